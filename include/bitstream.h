@@ -0,0 +1,116 @@
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bit level writer and reader over a caller provided buffer. Values are
+ * packed least significant bit first with no padding between them, the last
+ * byte is zero padded. Going past the end of the buffer does not write or
+ * read anything out of it: the stream is flagged as overflowed instead and
+ * reads return 0 from then on, so callers only need to check once at the end.
+ *
+ * Floats are sent quantized. Everything here works on integers once a value
+ * has been quantized, and quantization itself is a fixed sequence of single
+ * precision operations, so both ends decode exactly the same values and
+ * encoding a decoded value gives back the same integer.
+ */
+
+// Bits of each group of a variable length integer, each group is followed by
+// a bit telling if another one comes after it
+#define BITSTREAM_VARUINT_GROUP_BITS 4
+
+struct bitWriter {
+        uint8_t *data;
+        size_t size;
+        size_t pos;
+        uint64_t scratch;
+        unsigned scratchBits;
+        bool overflow;
+};
+
+struct bitReader {
+        const uint8_t *data;
+        size_t size;
+        size_t pos;
+        uint64_t scratch;
+        unsigned scratchBits;
+        bool overflow;
+};
+
+// Fixed point encoding of a float in [min, max] with a given precision. There
+// is an odd number of values, the middle one being the center of the range
+// exactly, so that 0 survives the round trip in a range centered on it.
+struct quantization {
+        float min;
+        float max;
+        float center;
+        float step;
+        // even
+        uint32_t maxValue;
+        unsigned bits;
+};
+
+void bitWriter_init(struct bitWriter *writer, void *data, size_t size)
+        __attribute__((access (write_only, 1)))
+        __attribute__((nonnull));
+
+// Write the lowest bits of value, at most 32.
+void bitWriter_write(struct bitWriter *writer, uint32_t value, unsigned bits)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Write an integer using fewer bits the smaller it is.
+void bitWriter_writeVarUint(struct bitWriter *writer, uint32_t value)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Write out the last partial byte. Return the number of bytes written, or 0 if
+// the buffer was too small.
+size_t bitWriter_finish(struct bitWriter *writer)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+void bitReader_init(struct bitReader *reader, const void *data, size_t size)
+        __attribute__((access (write_only, 1)))
+        __attribute__((nonnull));
+
+// Read a value written with bitWriter_write, at most 32 bits.
+uint32_t bitReader_read(struct bitReader *reader, unsigned bits)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+uint32_t bitReader_readVarUint(struct bitReader *reader)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Whether everything read so far was in the buffer.
+bool bitReader_ok(const struct bitReader *reader)
+        __attribute__((access (read_only, 1)))
+        __attribute__((nonnull));
+
+// Use as many bits as needed for values in [min, max] to be encoded with an
+// error no larger than half of precision. At least 2 and at most 32 bits are
+// used.
+void quantization_init(struct quantization *quantization, float min, float max, float precision)
+        __attribute__((access (write_only, 1)))
+        __attribute__((nonnull));
+
+// Values out of range are clamped.
+uint32_t quantization_encode(const struct quantization *quantization, float value)
+        __attribute__((access (read_only, 1)))
+        __attribute__((nonnull));
+
+float quantization_decode(const struct quantization *quantization, uint32_t value)
+        __attribute__((access (read_only, 1)))
+        __attribute__((nonnull));
+
+// Encode an angle in radians as a fraction of a turn using the given number of
+// bits. Any angle is accepted, it is decoded in [0, 2*pi).
+uint32_t angle_encode(float angle, unsigned bits);
+
+float angle_decode(uint32_t value, unsigned bits);
+
+#endif /* BITSTREAM_H */
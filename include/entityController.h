@@ -22,9 +22,15 @@ struct networkEntity {
 
 struct entityController {
         struct game *game;
-        struct networkEntity entities[MAX_ENTITIES];
+        // One per entity index of the server, as many as it tells in the
+        // welcome
+        struct networkEntity *entities;
+        size_t capacity;
         size_t numEntities;
 
+        // Interpolation period, the server tells us its tick period
+        unsigned long tickPeriodNs;
+
         const char *playerName;
         size_t playerIdx;
 };
@@ -34,4 +40,8 @@ void entityController_setup(struct entityController *const controller, struct ga
         __attribute__((access (read_write, 2)))
         __attribute__((nonnull));
 
+void entityController_free(struct entityController *controller)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
 #endif /* ENTITY_CONTROLLER_H */
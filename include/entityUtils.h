@@ -2,22 +2,88 @@
 #define ENTITY_UTILS_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-#define MAX_ENTITIES 1024
+// Entity indices go on the wire as 16 bits. Servers are sized at startup to
+// anything up to this and tell clients, which size what they keep per entity
+// from that rather than from this.
+#define MAX_ENTITIES UINT16_MAX
 #define PLAYER_SPEED 10.0f
 #define JUMP_HEIGHT 5.0f
 #define JUMP_TIME 0.5f
-#define TICK_PERIOD_NS 100000000L
+#define TICK_RATE_DEFAULT 10
+#define TICK_PERIOD_NS_DEFAULT 100000000L
+// Players bump into the level as a sphere this far above their feet, so that
+// they walk over what is lower and are stopped by what is higher. Clients
+// predict it as the server does it.
+#define PLAYER_COLLISION_RADIUS 0.4f
+#define PLAYER_COLLISION_HEIGHT 1.0f
+
+// Bits of the jump/fall state of an entity
+#define JUMP_STATE_JUMPING 0x1U
+#define JUMP_STATE_FALLING 0x2U
+
+// Buttons held during a player input
+#define INPUT_FORWARD 0x01U
+#define INPUT_BACKWARD 0x02U
+#define INPUT_LEFT 0x04U
+#define INPUT_RIGHT 0x08U
+#define INPUT_JUMP 0x10U
+#define INPUT_BUTTON_BITS 5
+
+/*
+ * What a player does during one tick: the buttons it holds and where it faces.
+ * Clients that send inputs instead of positions move their player with
+ * apply_player_input, and the server runs the very same code on what it
+ * receives.
+ */
+struct playerInput {
+        uint32_t buttons;
+        float yaw;
+};
 
 // Utility function to clamp an angle between -2*pi and 2*pi radians.
 float normalize_yaw(float angle);
 
 /*
- * Return current height in a jump/fall animation.
+ * Return current height above the ground in a jump/fall animation.
  */
 float jump_fall_animation(bool *jumping, bool *falling, float airtime)
         __attribute__((access (read_write, 1)))
         __attribute__((access (read_write, 2)))
         __attribute__((nonnull));
 
+/*
+ * Advance the jump/fall animation of count entities by timeDelta seconds. The
+ * arrays hold one element per entity, and heights are above the ground.
+ * Entities with no bits set in their state are on it: their height is set to
+ * 0 and nothing else changes. For the rest, airtime is increased, state is
+ * updated as jump_fall_animation would and height is set to the new height.
+ *
+ * Uses SSE2 or AVX2 when available.
+ */
+void jump_fall_animation_batch(size_t count, float *airtime, uint32_t *state, float *height, float timeDelta)
+        __attribute__((access (read_write, 2, 1)))
+        __attribute__((access (read_write, 3, 1)))
+        __attribute__((access (write_only, 4, 1)))
+        __attribute__((nonnull));
+
+/*
+ * Move a player by an input held for timeDelta seconds. The player turns to
+ * the input's yaw and walks at PLAYER_SPEED in the direction of its buttons,
+ * relative to where it faces. Jumping only starts a jump if the player is on
+ * the ground, the height is then advanced by jump_fall_animation as for any
+ * other entity.
+ */
+void apply_player_input(const struct playerInput *input, float *x, float *y, float *rotation,
+                        uint32_t *jump_state, float *airtime, float timeDelta)
+        __attribute__((access (read_only, 1)))
+        __attribute__((access (read_write, 2)))
+        __attribute__((access (read_write, 3)))
+        __attribute__((access (write_only, 4)))
+        __attribute__((access (read_write, 5)))
+        __attribute__((access (read_write, 6)))
+        __attribute__((nonnull));
+
 #endif /* ENTITY_UTILS_H */
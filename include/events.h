@@ -1,6 +1,7 @@
 #ifndef EVENTS_H
 #define EVENTS_H
 
+#include <networkCodec.h>
 #include <cglm/struct.h>
 #include <thirty/eventBroker.h>
 
@@ -8,10 +9,14 @@ enum event {
         EVENT_PLAYER_POSITION_CHANGED = EVENT_BROKER_EVENTS_TOTAL,
         EVENT_PLAYER_ROTATION_CHANGED,
         EVENT_PLAYER_JUMPED,
+        EVENT_PLAYER_INPUT,
         EVENT_SERVER_CORRECTED_PLAYER_POSITION,
         EVENT_NETWORK_ENTITY_UPDATE,
         EVENT_NETWORK_ENTITY_NEW,
         EVENT_NETWORK_ENTITY_DEL,
+        EVENT_NETWORK_WELCOME,
+        EVENT_NETWORK_REDIRECT,
+        EVENT_NETWORK_JOIN_PROGRESS,
         EVENT_TOTAL,
 };
 
@@ -23,10 +28,17 @@ struct eventPlayerRotationChanged {
 };
 struct eventPlayerJumped {
 };
+struct eventPlayerInput {
+        uint32_t sequence;
+        struct playerInput input;
+};
 struct eventPlayerPositionCorrected {
         vec3s position;
         bool jumping;
         bool falling;
+        float airtime;
+        // last input the server applied, if it takes inputs
+        uint32_t sequence;
 };
 struct eventNetworkEntityUpdate {
         size_t idx;
@@ -41,5 +53,20 @@ struct eventNetworkEntityNew {
 struct eventNetworkEntityDel {
         size_t idx;
 };
+struct eventNetworkWelcome {
+        size_t idx;
+        // entity indices are all below it
+        size_t capacity;
+        unsigned long tickPeriodNs;
+        // Whether the player moves by sending inputs, encoded with the codec
+        bool inputs;
+        const struct networkCodec *codec;
+};
+struct eventNetworkRedirect {
+};
+struct eventNetworkJoinProgress {
+        size_t current;
+        size_t total;
+};
 
 #endif
@@ -0,0 +1,115 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <serverNetwork.h>
+#include <networkCodec.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Append only record of everything the simulation of a server gets from the
+ * network, to run it again later without sockets. The journal starts with the
+ * parameters the world was set up with, followed by a record at the start of
+ * every tick and one for every command applied during it, in order. Commands
+ * keep the time they were received at, relative to the start of the server,
+ * since validating movement depends on it.
+ *
+ * Replaying a journal goes through the same code the live server runs, so it
+ * ends up in the same state, and does it as fast as it can. Journals are meant
+ * to be replayed on the same kind of machine that wrote them, so values are
+ * written as they are in memory.
+ */
+
+#define JOURNAL_MAGIC 0x4c4e524aU
+#define JOURNAL_VERSION 7
+
+struct __attribute__((packed)) journalHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t tickPeriodNs;
+        float interestRadius;
+        uint32_t maxPlayers;
+        uint32_t capacity;
+        struct networkCodecParams codec;
+        // enum networkMovement
+        uint8_t movement;
+        // hashes of the level collided with and the terrain stood on, 0 if
+        // none
+        uint64_t levelHash;
+        uint64_t terrainHash;
+};
+
+enum journalRecordType {
+        JOURNAL_RECORD_TICK,
+        JOURNAL_RECORD_COMMAND,
+};
+
+struct journalRecord {
+        enum journalRecordType type;
+        // JOURNAL_RECORD_TICK
+        uint32_t tick;
+        // JOURNAL_RECORD_COMMAND, received is left unset
+        struct serverCommand command;
+        // nanoseconds since the server started when the command was received
+        uint64_t time;
+};
+
+struct journalWriter {
+        FILE *file;
+};
+
+struct journalReader {
+        // mapped read only
+        uint8_t *data;
+        size_t size;
+        size_t pos;
+        struct journalHeader header;
+};
+
+// Create the journal and write its header. Return false if the file could not
+// be written, with errno set.
+bool journalWriter_open(struct journalWriter *writer, const char *path,
+                        const struct journalHeader *header)
+        __attribute__((access (write_only, 1)))
+        __attribute__((access (read_only, 2)))
+        __attribute__((access (read_only, 3)))
+        __attribute__((nonnull));
+
+// Record the start of a tick. What was written so far is flushed, so a journal
+// is complete up to the last tick if the server dies.
+void journalWriter_tick(struct journalWriter *writer, uint32_t tick)
+        __attribute__((access (read_only, 1)))
+        __attribute__((nonnull));
+
+// Record a command. Link commands are not recorded.
+void journalWriter_command(struct journalWriter *writer, const struct serverCommand *command,
+                           uint64_t time)
+        __attribute__((access (read_only, 1)))
+        __attribute__((access (read_only, 2)))
+        __attribute__((nonnull));
+
+void journalWriter_close(struct journalWriter *writer)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Map a journal to read it. Return false if it cannot be read or is not a
+// journal.
+bool journalReader_open(struct journalReader *reader, const char *path)
+        __attribute__((access (write_only, 1)))
+        __attribute__((access (read_only, 2)))
+        __attribute__((nonnull));
+
+// Read the next record. Return false at the end of the journal, or if the
+// rest of it is truncated.
+bool journalReader_next(struct journalReader *reader, struct journalRecord *record)
+        __attribute__((access (read_write, 1)))
+        __attribute__((access (write_only, 2)))
+        __attribute__((nonnull));
+
+void journalReader_close(struct journalReader *reader)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+#endif /* JOURNAL_H */
@@ -0,0 +1,88 @@
+#ifndef LEVEL_COLLISION_H
+#define LEVEL_COLLISION_H
+
+#include <cglm/struct.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Static geometry of a level, as the triangles of a Wavefront OBJ file with Z
+ * up, which is what `make collision` exports from the scene. Faces are all
+ * that is read, anything else in the file is ignored.
+ *
+ * Triangles are kept in a bounding volume hierarchy flattened in depth first
+ * order, with the bounds of every node in arrays of their own so that
+ * traversal only touches what it tests. The triangles of a leaf are next to
+ * each other, in arrays per coordinate, and are tested several at a time.
+ *
+ * Queries move a sphere along a segment and report the first thing it touches.
+ * Geometry the sphere already overlaps at the start is ignored so that it can
+ * always move out of it.
+ */
+
+struct levelCollision {
+        // Fingerprint of the triangles, to tell whether two levels are the same
+        uint64_t hash;
+
+        // The first child of an inner node is right after it, the second one
+        // is at first. Leaves have count triangles from first, inner nodes
+        // have a count of 0.
+        size_t numNodes;
+        float *minX, *minY, *minZ;
+        float *maxX, *maxY, *maxZ;
+        uint32_t *first;
+        uint32_t *count;
+
+        // Vertices and unit normal of every triangle
+        size_t numTriangles;
+        float *ax, *ay, *az;
+        float *bx, *by, *bz;
+        float *cx, *cy, *cz;
+        float *nx, *ny, *nz;
+};
+
+struct levelCollisionHit {
+        // Part of the segment covered before touching, from 0 to 1
+        float fraction;
+        // Pointing from what was hit towards the sphere
+        vec3s normal;
+};
+
+// Load the level from an OBJ file. Return false if the file can not be read or
+// has no triangles.
+bool levelCollision_load(struct levelCollision *level, const char *path)
+        __attribute__((access (write_only, 1)))
+        __attribute__((access (read_only, 2)))
+        __attribute__((nonnull));
+
+void levelCollision_free(struct levelCollision *level)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Move a sphere of the given radius from one point to another. Return whether
+// it touches the level on the way, and if so where in hit, which may be NULL.
+// A radius of 0 traces a ray.
+bool levelCollision_sweepSphere(const struct levelCollision *level, vec3s from, vec3s to,
+                                float radius, struct levelCollisionHit *hit)
+        __attribute__((access (read_only, 1)))
+        __attribute__((access (write_only, 5)))
+        __attribute__((nonnull (1)));
+
+// Move a sphere towards a point, sliding along what it touches on the way, and
+// return where it ends up.
+vec3s levelCollision_moveSphere(const struct levelCollision *level, vec3s from, vec3s to,
+                                float radius)
+        __attribute__((access (read_only, 1)))
+        __attribute__((nonnull));
+
+// Same as levelCollision_moveSphere for count spheres of the same radius. Every
+// element of to is replaced by where the sphere moving to it ends up.
+void levelCollision_moveSpheres(const struct levelCollision *level, size_t count,
+                                const vec3s *from, vec3s *to, float radius)
+        __attribute__((access (read_only, 1)))
+        __attribute__((access (read_only, 3, 2)))
+        __attribute__((access (read_write, 4, 2)))
+        __attribute__((nonnull));
+
+#endif /* LEVEL_COLLISION_H */
@@ -0,0 +1,157 @@
+#ifndef NETWORK_CODEC_H
+#define NETWORK_CODEC_H
+
+#include <bitstream.h>
+#include <entityUtils.h>
+#include <cglm/struct.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Wire encoding of entity state, shared by the client and the server.
+ * Positions are fixed point within the world bounds, rotations are a fraction
+ * of a turn and entity indices are variable length. The server picks the
+ * parameters and sends them in the welcome packet, so both ends always use the
+ * same ones.
+ */
+
+#define NETWORK_WORLD_EXTENT_DEFAULT 4096.0f
+#define NETWORK_HEIGHT_MIN_DEFAULT -16.0f
+#define NETWORK_HEIGHT_MAX_DEFAULT 64.0f
+#define NETWORK_POSITION_PRECISION_DEFAULT (1.0f / 128.0f)
+#define NETWORK_ANGLE_BITS_DEFAULT 14
+#define NETWORK_ANGLE_BITS_MIN 12
+#define NETWORK_ANGLE_BITS_MAX 16
+
+// Horizontal velocities are sent with a fixed precision, up to the speed of a
+// player
+#define NETWORK_VELOCITY_PRECISION (1.0f / 32.0f)
+
+#define NETWORK_JUMP_STATE_BITS 2
+#define NETWORK_AIRTIME_BITS 11
+
+// Fields of an entity, in the order they are encoded
+enum snapshotField {
+        SNAPSHOT_FIELD_X = 0x1,
+        SNAPSHOT_FIELD_Y = 0x2,
+        SNAPSHOT_FIELD_Z = 0x4,
+        SNAPSHOT_FIELD_ROTATION = 0x8,
+        SNAPSHOT_FIELDS_ALL = 0xF,
+};
+#define SNAPSHOT_FIELDS_TOTAL 4
+
+struct networkSnapshotEntity {
+        vec3s position;
+        float rotation;
+};
+
+// Parameters of the encoding as sent by the server. Positions have X and Y in
+// [-extent, extent] and Z in [heightMin, heightMax].
+struct __attribute__((packed)) networkCodecParams {
+        float extent;
+        float heightMin;
+        float heightMax;
+        float precision;
+        uint8_t angleBits;
+};
+
+struct networkCodec {
+        struct networkCodecParams params;
+        struct quantization horizontal;
+        struct quantization height;
+        struct quantization velocity;
+        unsigned angleBits;
+};
+
+// Return false if the parameters make no sense, which can only happen if they
+// came from a broken or malicious server.
+bool networkCodec_init(struct networkCodec *codec, const struct networkCodecParams *params)
+        __attribute__((access (write_only, 1)))
+        __attribute__((access (read_only, 2)))
+        __attribute__((nonnull));
+
+// Default parameters
+struct networkCodecParams networkCodec_defaultParams(void);
+
+void networkCodec_writePosition(const struct networkCodec *codec, struct bitWriter *writer, vec3s position)
+        __attribute__((access (read_only, 1)))
+        __attribute__((access (read_write, 2)))
+        __attribute__((nonnull));
+
+vec3s networkCodec_readPosition(const struct networkCodec *codec, struct bitReader *reader)
+        __attribute__((access (read_only, 1)))
+        __attribute__((access (read_write, 2)))
+        __attribute__((nonnull));
+
+void networkCodec_writeVelocity(const struct networkCodec *codec, struct bitWriter *writer, vec2s velocity)
+        __attribute__((access (read_only, 1)))
+        __attribute__((access (read_write, 2)))
+        __attribute__((nonnull));
+
+vec2s networkCodec_readVelocity(const struct networkCodec *codec, struct bitReader *reader)
+        __attribute__((access (read_only, 1)))
+        __attribute__((access (read_write, 2)))
+        __attribute__((nonnull));
+
+void networkCodec_writeRotation(const struct networkCodec *codec, struct bitWriter *writer, float rotation)
+        __attribute__((access (read_only, 1)))
+        __attribute__((access (read_write, 2)))
+        __attribute__((nonnull));
+
+float networkCodec_readRotation(const struct networkCodec *codec, struct bitReader *reader)
+        __attribute__((access (read_only, 1)))
+        __attribute__((access (read_write, 2)))
+        __attribute__((nonnull));
+
+// Rotation as the other end reads it once written.
+float networkCodec_roundRotation(const struct networkCodec *codec, float rotation)
+        __attribute__((access (read_only, 1)))
+        __attribute__((nonnull));
+
+// INPUT_BUTTON_BITS of buttons, then the yaw as a rotation.
+void networkCodec_writeInput(const struct networkCodec *codec, struct bitWriter *writer,
+                             const struct playerInput *input)
+        __attribute__((access (read_only, 1)))
+        __attribute__((access (read_write, 2)))
+        __attribute__((access (read_only, 3)))
+        __attribute__((nonnull));
+
+void networkCodec_readInput(const struct networkCodec *codec, struct bitReader *reader,
+                            struct playerInput *input)
+        __attribute__((access (read_only, 1)))
+        __attribute__((access (read_write, 2)))
+        __attribute__((access (write_only, 3)))
+        __attribute__((nonnull));
+
+// Quantize every field of an entity, in the order of enum snapshotField. Two
+// entities look the same to the other end if and only if their fields do.
+void networkCodec_encodeEntity(const struct networkCodec *codec,
+                               const struct networkSnapshotEntity *entity,
+                               uint32_t fields[SNAPSHOT_FIELDS_TOTAL])
+        __attribute__((access (read_only, 1)))
+        __attribute__((access (read_only, 2)))
+        __attribute__((access (write_only, 3)))
+        __attribute__((nonnull));
+
+// Write the fields in the mask, quantized by networkCodec_encodeEntity.
+void networkCodec_writeFields(const struct networkCodec *codec, struct bitWriter *writer,
+                              const uint32_t fields[SNAPSHOT_FIELDS_TOTAL], unsigned mask)
+        __attribute__((access (read_only, 1)))
+        __attribute__((access (read_write, 2)))
+        __attribute__((access (read_only, 3)))
+        __attribute__((nonnull));
+
+// Bits networkCodec_writeFields writes for the fields in the mask.
+unsigned networkCodec_fieldsBits(const struct networkCodec *codec, unsigned mask)
+        __attribute__((access (read_only, 1)))
+        __attribute__((nonnull));
+
+// Read the fields in the mask into the entity, leaving the others untouched.
+void networkCodec_readFields(const struct networkCodec *codec, struct bitReader *reader,
+                             struct networkSnapshotEntity *entity, unsigned mask)
+        __attribute__((access (read_only, 1)))
+        __attribute__((access (read_write, 2)))
+        __attribute__((access (read_write, 3)))
+        __attribute__((nonnull));
+
+#endif /* NETWORK_CODEC_H */
@@ -2,6 +2,7 @@
 #define NETWORK_CONTROLLER_H
 
 #include <timeutil.h>
+#include <networkCodec.h>
 #include <entityController.h>
 #include <events.h>
 #include <thirty/game.h>
@@ -9,6 +10,22 @@
 #define PACKET_SEND_RATELIMIT_MS 50
 #define PACKET_SEND_RATELIMIT 0.05f
 
+/*
+ * Clients that move their player themselves send its position along with its
+ * velocity, and the server keeps moving it at that velocity until the next
+ * one comes (dead reckoning). Clients keep track of where the server has
+ * extrapolated the player to and only send again once it is off by more than
+ * an error, or at least every NETWORK_DEAD_RECKONING_MAX_MS. An idle player or
+ * one walking straight sends next to nothing. The server stops extrapolating
+ * a while after the longest a client goes without sending.
+ */
+#define NETWORK_DEAD_RECKONING_MAX_MS 1000
+#define NETWORK_DEAD_RECKONING_ERROR 0.25f
+#define NETWORK_DEAD_RECKONING_ROTATION_ERROR 0.05f
+
+// Number of past snapshots kept around to be used as delta baselines
+#define SNAPSHOT_HISTORY 32
+
 enum networkChannel {
         NETWORK_CHANNEL_CONTROL,
         NETWORK_CHANNEL_MOVEMENT,
@@ -16,89 +33,248 @@ enum networkChannel {
         NETWORK_CHANNELS_TOTAL,
 };
 
+/*
+ * A redirect moves the client to another server without leaving the scene. It
+ * shows up as a disconnection followed by a connection, which the controllers
+ * that react to those tell apart with this.
+ */
+enum redirectState {
+        REDIRECT_NONE,
+        REDIRECT_DISCONNECTING,
+        REDIRECT_CONNECTING,
+};
+
+// Whether a disconnection is part of a redirect. If the redirect failed to
+// connect it is not, and the redirect is over.
+static inline bool redirectState_disconnected(enum redirectState *const state) {
+        switch (*state) {
+        case REDIRECT_DISCONNECTING:
+                *state = REDIRECT_CONNECTING;
+                return true;
+        case REDIRECT_CONNECTING:
+        case REDIRECT_NONE:
+        default:
+                *state = REDIRECT_NONE;
+                return false;
+        }
+}
+
+// Whether a connection is part of a redirect, which it finishes.
+static inline bool redirectState_connected(enum redirectState *const state) {
+        const bool redirecting = *state == REDIRECT_CONNECTING;
+        *state = REDIRECT_NONE;
+        return redirecting;
+}
+
+struct networkSnapshot {
+        bool valid;
+        uint32_t tick;
+        // one per entity index of the server
+        struct networkSnapshotEntity *entities;
+};
+
 struct networkController {
         struct game *game;
         bool connected;
         unsigned id;
+        struct networkCodec codec;
+        // Whether the server takes inputs rather than positions
+        bool inputs;
+        // Entity indices of the server are below this, as it tells in the
+        // welcome. What is kept per entity is sized from it.
+        size_t capacity;
+
+        // Player as of the last frame, and its horizontal velocity then
+        vec3s playerPosition;
+        vec3s previousPlayerPosition;
+        vec2s playerVelocity;
+        float playerRotation;
+
+        // Jumped since the last movement packet
+        bool jumped;
+
+        // What was last sent of the player, which the server extrapolates
+        // from. Movement packets are numbered from 0 after every welcome.
+        bool sentMovement;
+        uint32_t nextMovementSequence;
+        struct timespec lastTimeSentMovement;
+        struct timespec lastTimeSentPosition;
+        vec3s sentPosition;
+        vec2s sentVelocity;
+        float sentRotation;
+
+        // Last snapshots received, to decode the deltas the server sends
+        // against them. Their entities are in one block.
+        struct networkSnapshot snapshots[SNAPSHOT_HISTORY];
+        struct networkSnapshotEntity *snapshotEntities;
+        bool receivedSnapshot;
+        uint32_t lastSnapshot;
+        // Entities in the snapshot being read, updated once its events are
+        // applied
+        uint16_t *updated;
+
+        // Sequence number of the next spawn or despawn event to apply
+        uint32_t nextEvent;
 
-        bool sentPosPacket;
-        struct timespec lastTimeSentPosPacket;
+        // Entities spawned since the welcome, until the server has sent
+        // every one around the player
+        bool joining;
+        size_t joinReceived;
 
-        bool sentRotPacket;
-        struct timespec lastTimeSentRotPacket;
+        // Server to reconnect to once disconnected from this one
+        enum redirectState redirect;
+        char redirectHost[64];
+        unsigned short redirectPort;
+        uint32_t redirectToken;
 };
 
 enum packetType {
-        PACKET_TYPE_POSITION_UPDATE,
-        PACKET_TYPE_ROTATION_UPDATE,
-        PACKET_TYPE_JUMP_UPDATE,
+        PACKET_TYPE_MOVEMENT_UPDATE,
         PACKET_TYPE_POSITION_CORRECTION,
         PACKET_TYPE_WELCOME,
-        PACKET_TYPE_ENTITY_CHANGES_UPDATE,
-        PACKET_TYPE_NEW_ENTITY,
-        PACKET_TYPE_DEL_ENTITY,
+        PACKET_TYPE_SNAPSHOT,
+        PACKET_TYPE_SNAPSHOT_ACK,
+        PACKET_TYPE_REDIRECT,
+        PACKET_TYPE_INPUT,
+};
+
+/*
+ * How clients tell the server where their player goes. Either they move it
+ * themselves and send its position, rotation and jumps, which the server
+ * checks, or they send what the player does every tick and the server moves
+ * it with the same code the client does.
+ */
+enum networkMovement {
+        NETWORK_MOVEMENT_POSITIONS,
+        NETWORK_MOVEMENT_INPUTS,
 };
 
 struct __attribute__((packed)) networkPacket {
         uint8_t type;
 };
 
-struct __attribute__((packed)) networkPacketEntityChange {
-        uint16_t idx;
-        vec3s position;
-        float rotation;
-};
+/*
+ * Apart from their fixed headers, packets are bitstreams encoded with the
+ * codec described in the welcome packet. What each one carries is described
+ * next to it.
+ */
 
+// Entity count as a varuint, then for each entity its index as a varuint, its
+// position and its rotation. Every entity index the server uses is below
+// capacity.
 struct __attribute__((packed)) networkPacketWelcome {
         struct networkPacket base;
         uint16_t id;
-        uint16_t count;
-        struct networkPacketEntityChange currentEntities[];
+        uint16_t capacity;
+        uint32_t tickPeriodNs;
+        struct networkCodecParams codec;
+        uint8_t movement;
+        uint8_t data[];
 };
 
+// Position, NETWORK_JUMP_STATE_BITS of jump state, NETWORK_AIRTIME_BITS of
+// milliseconds in the air and the sequence number of the last input the server
+// applied as 32 bits, UINT32_MAX before the first one.
 struct __attribute__((packed)) networkPacketPositionCorrection {
         struct networkPacket base;
-        vec3s position;
-        uint8_t jumpFall;
+        uint8_t data[];
 };
 
-struct __attribute__((packed)) networkPacketPosition {
-        struct networkPacket base;
-        vec3s position;
+// What a movement packet carries
+enum movementField {
+        MOVEMENT_FIELD_POSITION = 0x1,
+        MOVEMENT_FIELD_ROTATION = 0x2,
+        MOVEMENT_FIELD_JUMP = 0x4,
 };
+#define MOVEMENT_FIELDS_TOTAL 3
+
+// Everything about the player due to be sent, at most once per send interval.
+// MOVEMENT_FIELDS_TOTAL bits of fields, then if there the position and
+// horizontal velocity and then the rotation. Movement packets are unreliable
+// and numbered from 0 after every welcome, so that the server can drop the
+// ones overtaken by a later one.
 
-struct __attribute__((packed)) networkPacketRotation {
+struct __attribute__((packed)) networkPacketMovement {
         struct networkPacket base;
-        float rotation;
+        uint32_t sequence;
+        uint8_t data[];
 };
 
-struct __attribute__((packed)) networkPacketJump {
+// One tick of input, as written by networkCodec_writeInput. Inputs are
+// numbered from 0 after every welcome.
+struct __attribute__((packed)) networkPacketInput {
         struct networkPacket base;
+        uint32_t sequence;
+        uint8_t data[];
 };
 
-struct __attribute__((packed)) networkPacketNewEntity {
+/*
+ * State of the entities around a client at a given tick, encoded as a delta
+ * against an earlier snapshot the client acknowledged (the baseline). Only
+ * entities that differ from the baseline are present and only with the fields
+ * that differ. A baseline equal to the snapshot means there is none and every
+ * record has all of its fields.
+ *
+ * Records are in increasing index order and each one starts with the gap to
+ * the previous one as a varuint, idx - prev - 1 with prev starting at -1, so
+ * that neighbouring entities take a single byte. Then come
+ * SNAPSHOT_FIELDS_TOTAL bits with the mask of fields present and the fields
+ * themselves, in the order of enum snapshotField.
+ *
+ * After the records come the entities spawning and despawning on the client,
+ * which are sequenced apart from snapshots: their count as a varuint and, if
+ * there are any, the sequence number of the first one as a varuint. Each one
+ * is a bit telling whether it is a spawn and the entity index as a varuint. A
+ * spawning entity takes its state from the snapshot. The server sends the
+ * events in every snapshot until the client acknowledges one that had them,
+ * so the client skips the ones it already applied.
+ *
+ * Pending is the count of entities around the client that are still to spawn.
+ * The first snapshot after a welcome with none pending ends the join.
+ */
+struct __attribute__((packed)) networkPacketSnapshot {
         struct networkPacket base;
-        uint16_t idx;
-        vec3s position;
-        float rotation;
+        uint32_t snapshot;
+        uint32_t baseline;
+        uint16_t count;
+        uint16_t pending;
+        uint8_t data[];
 };
 
-struct __attribute__((packed)) networkPacketDelEntity {
+// Upper bound of the encoded size of a snapshot record, in bytes
+#define NETWORK_SNAPSHOT_RECORD_MAX (sizeof(struct networkSnapshotEntity) + 8)
+// Upper bounds of the encoded size of a spawn or despawn event and of what
+// comes before them, in bytes
+#define NETWORK_SNAPSHOT_EVENT_MAX 3
+#define NETWORK_SNAPSHOT_EVENTS_HEADER_MAX 10
+
+struct __attribute__((packed)) networkPacketSnapshotAck {
         struct networkPacket base;
-        uint16_t idx;
+        uint32_t snapshot;
 };
 
-struct __attribute__((packed)) networkPacketEntityChangesUpdate {
+// The player walked into the part of the world another server owns. The
+// client reconnects to it, an IPv4 address and port in ENet's byte order, with
+// the token as connection data so that it takes the player over.
+struct __attribute__((packed)) networkPacketRedirect {
         struct networkPacket base;
-        uint16_t count;
-        struct networkPacketEntityChange entities[];
+        uint32_t token;
+        uint32_t host;
+        uint16_t port;
 };
 
+// Largest of the small packets, the ones that carry at most one entity
+#define NETWORK_SMALL_PACKET_MAX 64
+
 void networkController_setup(struct networkController *controller, struct game *game)
         __attribute__((access (write_only, 1)))
         __attribute__((access (read_write, 2)))
         __attribute__((nonnull));
 
+void networkController_free(struct networkController *controller)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
 void networkController_connect(const struct networkController *controller, const char *host, unsigned short port)
         __attribute__((access (read_only, 1)))
         __attribute__((access (read_only, 2)))
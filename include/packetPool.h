@@ -0,0 +1,65 @@
+#ifndef PACKET_POOL_H
+#define PACKET_POOL_H
+
+#include <spscQueue.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+ * Pool of packet buffers owned by one thread, which gets them to encode
+ * packets in place. Buffers are handed over to another thread that gives them
+ * back once sent, through a lock-free queue the owner drains when it runs out.
+ * Buffers come in power of two size classes and are never freed while the
+ * pool lives, so once traffic is steady getting a buffer does not allocate.
+ * Every time it has to anyway counts as a miss.
+ */
+
+#define PACKET_POOL_MIN_SIZE 64
+#define PACKET_POOL_CLASSES 12
+#define PACKET_POOL_RETURN_QUEUE_SIZE 65536
+
+struct packetBuffer;
+
+struct packetPool {
+        struct packetBuffer *free[PACKET_POOL_CLASSES];
+        struct spscQueue returned;
+
+        // Buffers allocated so far
+        size_t allocations;
+        // Buffers given back while the queue was full, which are freed and
+        // have to be allocated again
+        atomic_size_t lost;
+};
+
+void packetPool_init(struct packetPool *pool)
+        __attribute__((access (write_only, 1)))
+        __attribute__((nonnull));
+
+// Free every buffer, including those handed over and given back. Buffers still
+// out are lost.
+void packetPool_free(struct packetPool *pool)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Owner side. Get a buffer with room for at least size bytes.
+void *packetPool_get(struct packetPool *pool, size_t size)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Owner side. Put back a buffer that was not handed over.
+void packetPool_release(struct packetPool *pool, void *data)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Owner side. Buffers allocated or lost so far, which is 0 more per tick once
+// traffic is steady.
+size_t packetPool_misses(const struct packetPool *pool)
+        __attribute__((access (read_only, 1)))
+        __attribute__((nonnull));
+
+// Other side. Give back a buffer that was handed over.
+void packetPool_return(struct packetPool *pool, void *data)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+#endif /* PACKET_POOL_H */
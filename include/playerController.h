@@ -2,10 +2,28 @@
 #define PLAYER_CONTROLLER_H
 
 #include <curve.h>
+#include <levelCollision.h>
+#include <networkCodec.h>
+#include <terrain.h>
 #include <thirty/game.h>
 #include <cglm/struct.h>
 #include <stddef.h>
 
+// Inputs kept to be applied again after a correction, with sequence numbers
+// wrapping around it
+#define INPUT_HISTORY 64
+
+// Input sent to the server and the state of the player it was predicted to
+// lead to
+struct predictedInput {
+        bool valid;
+        uint32_t sequence;
+        struct playerInput input;
+        vec3s position;
+        uint32_t jump_state;
+        float airtime;
+};
+
 struct sphericalCoord {
         float distance;
         float yaw;
@@ -36,8 +54,35 @@ struct playerController {
         bool pc_jumping;
         bool pc_falling;
         float pc_airtime;
+        // above the ground
         float pc_height;
         bool player_height_needs_update;
+        // Ground the player stands on, flat at 0 if NULL. It must be the one
+        // the server has.
+        const struct terrain *terrain;
+        // What the player bumps into, nothing if NULL. It must also be the
+        // one the server has, or the server corrects every move into it.
+        const struct levelCollision *level;
+
+        // Set by the server's welcome. The player then moves in steps of a
+        // tick with the buttons held during each one, as the server does
+        // with the inputs it is sent, and is drawn between the last two
+        // steps.
+        bool inputs;
+        const struct networkCodec *codec;
+        float step_period;
+        float step_time;
+        uint32_t step_buttons;
+        vec3s step_from;
+        vec3s step_to;
+
+        // Inputs the server may not have applied yet. When it corrects the
+        // player, they are applied again from where it put it.
+        struct predictedInput history[INPUT_HISTORY];
+        uint32_t next_sequence;
+        // How far off the player is drawn from where it is after a
+        // correction, fading over a few frames
+        vec3s correction_error;
         
         enum {
                 CAMERA_MODE_CURSOR,  // Mouse movement does not control camera,
@@ -60,9 +105,11 @@ struct playerController {
         } camera_mode;
 };
 
-void playerController_setup(struct playerController *controller, struct game *game, const char *cameraName, const char *playerName)
+void playerController_setup(struct playerController *controller, struct game *game, const char *cameraName, const char *playerName, const struct terrain *terrain, const struct levelCollision *level)
         __attribute__((access (write_only, 1)))
         __attribute__((access (read_only, 2)))
-        __attribute__((nonnull));
+        __attribute__((access (read_only, 5)))
+        __attribute__((access (read_only, 6)))
+        __attribute__((nonnull (1, 2, 3, 4)));
 
 #endif /* PLAYER_CONTROLLER_H */
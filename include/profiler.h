@@ -0,0 +1,77 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Instrumentation of the server tick. Every phase keeps a count, the bytes it
+ * handled and a histogram of its durations. Histograms are log-linear: each
+ * power of two is split in PROFILER_SUB_BUCKETS linear buckets, so any
+ * duration is recorded with a relative error under 1/PROFILER_SUB_BUCKETS
+ * using a fixed amount of memory and constant time. A few events are counted
+ * on top of that. Only the simulation thread may record.
+ */
+
+#define PROFILER_SUB_BUCKET_BITS 4
+#define PROFILER_SUB_BUCKETS (1 << PROFILER_SUB_BUCKET_BITS)
+#define PROFILER_BUCKETS ((64 - PROFILER_SUB_BUCKET_BITS + 1) * PROFILER_SUB_BUCKETS)
+
+enum profilerPhase {
+        PROFILER_PHASE_TICK,
+        PROFILER_PHASE_PROCESS_COMMANDS,
+        PROFILER_PHASE_STEP_WORLD,
+        PROFILER_PHASE_SHARD,
+        PROFILER_PHASE_BROADCAST_CHANGES,
+        PROFILER_PHASE_ON_CONNECTION,
+        PROFILER_PHASE_ON_DISCONNECTION,
+        PROFILER_PHASE_ON_MOVEMENT,
+        PROFILER_PHASE_ON_INPUT,
+        PROFILER_PHASE_ON_SNAPSHOT_ACK,
+        PROFILER_PHASE_ON_LINK,
+        PROFILER_PHASES_TOTAL,
+};
+
+// Events counted rather than timed
+enum profilerCounter {
+        // Received by the network thread but dropped, see serverNetwork.h
+        PROFILER_COUNTER_COMMANDS_DROPPED,
+        // Packet buffers allocated, which only happens while warming up
+        PROFILER_COUNTER_PACKET_POOL_MISSES,
+        // Positions sent by clients that the server corrected
+        PROFILER_COUNTER_POSITIONS_REJECTED,
+        PROFILER_COUNTERS_TOTAL,
+};
+
+struct profilerHistogram {
+        uint64_t count;
+        uint64_t bytes;
+        uint64_t total;
+        uint64_t max;
+        uint64_t buckets[PROFILER_BUCKETS];
+};
+
+// Start timing a phase.
+struct timespec profiler_start(void);
+
+// Record a phase that started at the given time and handled the given number
+// of bytes.
+void profiler_record(enum profilerPhase phase, struct timespec start, size_t bytes);
+
+// Add to a counter.
+void profiler_count(enum profilerCounter counter, uint64_t count);
+
+// Value of a counter since the last reset.
+uint64_t profiler_counter(enum profilerCounter counter);
+
+// Write a table with every phase's statistics and the counters since the last
+// reset.
+void profiler_dump(FILE *file)
+        __attribute__((nonnull));
+
+void profiler_reset(void);
+
+#endif /* PROFILER_H */
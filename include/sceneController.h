@@ -1,11 +1,15 @@
 #ifndef SCENE_CONTROLLER_H
 #define SCENE_CONTROLLER_H
 
+#include <networkController.h>
 #include <thirty/game.h>
 
 struct sceneController {
         struct game *game;
         size_t testSceneIdx;
+
+        // The scene stays loaded while the client moves to another server
+        enum redirectState redirect;
 };
 
 void sceneController_setup(struct sceneController *const controller, struct game *game, size_t testSceneIdx)
@@ -0,0 +1,152 @@
+#ifndef SERVER_NETWORK_H
+#define SERVER_NETWORK_H
+
+#include <networkController.h>
+#include <shardLink.h>
+#include <transport.h>
+#include <enet/enet.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Network side of the server. A dedicated thread owns the host clients
+ * connect to, see transport.h: it decodes everything that arrives into
+ * commands and sends the packets the simulation produces. The two threads only
+ * talk through lock-free single producer single consumer queues, so the
+ * simulation never calls into the network and a burst of traffic does not eat
+ * into the tick. The network thread never waits on the simulation: when it
+ * falls behind, updates that a later one supersedes are dropped. Packets are
+ * encoded straight into pooled buffers that are sent without copying them.
+ *
+ * Peers are identified by their index in the host and by the connection id
+ * they were assigned, so that a packet meant for a peer that disconnected is
+ * never delivered to whoever reuses its slot.
+ *
+ * A sharded server also has a second host for the links with its neighbours.
+ * The network thread keeps a connection open to each of them, reconnecting
+ * when it drops, and sends link packets on it. What neighbours send arrives
+ * on the connections they opened to this server, as commands from link peers.
+ */
+
+enum serverCommandType {
+        SERVER_COMMAND_CONNECT,
+        SERVER_COMMAND_DISCONNECT,
+        SERVER_COMMAND_MOVEMENT,
+        SERVER_COMMAND_INPUT,
+        SERVER_COMMAND_SNAPSHOT_ACK,
+        // The connection to a neighbour went up or down
+        SERVER_COMMAND_NEIGHBOR_UP,
+        SERVER_COMMAND_NEIGHBOR_DOWN,
+        // A link peer sent a packet or closed its connection
+        SERVER_COMMAND_LINK_RECEIVE,
+        SERVER_COMMAND_LINK_CLOSED,
+};
+
+struct serverPeer {
+        size_t idx;
+        uint32_t connectID;
+};
+
+struct serverCommand {
+        enum serverCommandType type;
+        struct serverPeer peer;
+        // milliseconds, as estimated by the host
+        uint32_t roundTripTime;
+        uint32_t roundTripTimeVariance;
+        // when the network thread got it, by the monotonic clock
+        struct timespec received;
+        // bytes received, 0 for connections and disconnections
+        size_t size;
+        // as numbered by the client, SERVER_COMMAND_MOVEMENT and
+        // SERVER_COMMAND_INPUT
+        uint32_t sequence;
+        union {
+                struct {
+                        ENetAddress address;
+                        // connection data, the token of a handoff if not 0
+                        uint32_t token;
+                } connection;           // SERVER_COMMAND_CONNECT
+                struct {
+                        // enum movementField present
+                        unsigned fields;
+                        vec3s position;
+                        // horizontal, to extrapolate the position with
+                        vec2s velocity;
+                        float rotation;
+                };                      // SERVER_COMMAND_MOVEMENT
+                struct playerInput input;       // SERVER_COMMAND_INPUT
+                uint32_t snapshot;      // SERVER_COMMAND_SNAPSHOT_ACK
+                size_t neighbor;        // SERVER_COMMAND_NEIGHBOR_*
+                ENetPacket *packet;     // SERVER_COMMAND_LINK_RECEIVE
+        };
+};
+
+// Links of a sharded server
+struct serverNetworkLinks {
+        unsigned short port;
+        size_t count;
+        ENetAddress neighbors[SHARD_LINK_MAX_NEIGHBORS];
+};
+
+// Create the host with the given backend and start the network thread.
+// Received packets are decoded with the given codec, which must stay unchanged
+// while the thread runs. Links are only set up if given, always over ENet.
+void serverNetwork_init(enum transportBackend backend, unsigned short port, size_t maxPeers,
+                        const struct networkCodec *codec, const struct serverNetworkLinks *links)
+        __attribute__((access (read_only, 4)))
+        __attribute__((access (read_only, 5)))
+        __attribute__((nonnull (4)));
+
+// Set up to encode packets without sending them anywhere, for running the
+// simulation without a network. Nothing is ever received and everything sent
+// is dropped.
+void serverNetwork_initOffline(void);
+
+// Stop the network thread and destroy the host.
+void serverNetwork_deinit(void);
+
+// Get the next command received from the network thread. Return false if there
+// are none left.
+bool serverNetwork_poll(struct serverCommand *command)
+        __attribute__((access (write_only, 1)))
+        __attribute__((nonnull));
+
+// Get a buffer to encode a packet of at most size bytes into. Buffers are
+// pooled, so this does not allocate once the server is warmed up.
+void *serverNetwork_packet(size_t size);
+
+// Queue a packet encoded in a buffer from serverNetwork_packet to be sent to a
+// peer. The buffer is sent as is and must not be touched afterwards.
+void serverNetwork_send(struct serverPeer peer, enum networkChannel channel,
+                        void *data, size_t size, uint32_t flags)
+        __attribute__((nonnull));
+
+// Queue a packet encoded in a buffer from serverNetwork_packet to be sent to a
+// neighbour. It is dropped if the link with the neighbour is down.
+void serverNetwork_sendLink(size_t neighbor, enum linkChannel channel,
+                            void *data, size_t size, uint32_t flags)
+        __attribute__((nonnull));
+
+// Free the packet of a SERVER_COMMAND_LINK_RECEIVE command.
+void serverNetwork_release(ENetPacket *packet)
+        __attribute__((nonnull));
+
+// Give back a buffer from serverNetwork_packet without sending it.
+void serverNetwork_discard(void *data)
+        __attribute__((nonnull));
+
+// Total bytes queued to be sent so far.
+size_t serverNetwork_bytesQueued(void);
+
+// Packet buffers that had to be allocated so far, see packetPool.h.
+size_t serverNetwork_poolMisses(void);
+
+// Movement updates and snapshot acks received but dropped since the last call,
+// because the simulation was too far behind to take them.
+size_t serverNetwork_droppedCommands(void);
+
+// Wake the network thread up so that it sends everything queued so far right
+// away.
+void serverNetwork_flush(void);
+
+#endif /* SERVER_NETWORK_H */
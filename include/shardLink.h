@@ -0,0 +1,67 @@
+#ifndef SHARD_LINK_H
+#define SHARD_LINK_H
+
+#include <cglm/struct.h>
+#include <stdint.h>
+
+/*
+ * Protocol spoken between the servers of a sharded world. Each server owns a
+ * strip of the world along the x axis and links to the servers owning the
+ * strips next to it. Every tick a server sends its neighbours the entities
+ * close enough to their strip to be seen from it, which they show to their
+ * own players as ghosts. A player walking out of a server's strip is handed
+ * off: its state is sent to the neighbour, reliably, under a random token and
+ * the client is told to reconnect there with that token as connection data.
+ *
+ * Servers trust each other and run on the same kind of machine, so packets
+ * carry raw floats.
+ */
+
+// Most neighbours a server links to
+#define SHARD_LINK_MAX_NEIGHBORS 8
+
+enum linkChannel {
+        LINK_CHANNEL_BORDER,
+        LINK_CHANNEL_HANDOFF,
+        LINK_CHANNELS_TOTAL,
+};
+
+enum linkPacketType {
+        LINK_PACKET_TYPE_BORDER,
+        LINK_PACKET_TYPE_HANDOFF,
+};
+
+struct __attribute__((packed)) linkPacket {
+        uint8_t type;
+};
+
+struct __attribute__((packed)) linkBorderEntity {
+        uint16_t idx;
+        float x;
+        float y;
+        float z;
+        float rotation;
+};
+
+// Entities of the sender close to the receiver's strip. Entities in the
+// previous border packet and not in this one are gone. Sent unreliably every
+// tick, ENet drops the ones that arrive after a newer one.
+struct __attribute__((packed)) linkPacketBorder {
+        struct linkPacket base;
+        uint16_t count;
+        struct linkBorderEntity entities[];
+};
+
+// State of a player moving to the receiver's strip.
+struct __attribute__((packed)) linkPacketHandoff {
+        struct linkPacket base;
+        uint32_t token;
+        float x;
+        float y;
+        float z;
+        float rotation;
+        float airtime;
+        uint8_t jumpState;
+};
+
+#endif /* SHARD_LINK_H */
@@ -0,0 +1,63 @@
+#ifndef SLOT_ALLOCATOR_H
+#define SLOT_ALLOCATOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Allocator of the indices [0, capacity) that always hands out the lowest free
+ * one. Free indices are kept in a hierarchical bitmap: each bit of a level
+ * tells whether the 64 bits under it have any free index, so finding one is a
+ * find first set per level and taking or releasing one only updates the words
+ * on its path. Either is O(1) for any capacity this is used with.
+ *
+ * Every index has a generation that changes each time it is released, so that
+ * a handle kept around can be told stale once its index is reused.
+ */
+
+#define SLOT_ALLOCATOR_MAX_LEVELS 4
+
+struct slotHandle {
+        uint32_t idx;
+        uint32_t generation;
+};
+
+struct slotAllocator {
+        size_t capacity;
+        size_t count;
+        size_t levels;
+        // set bits are free indices at level 0, words with free indices above
+        uint64_t *bits[SLOT_ALLOCATOR_MAX_LEVELS];
+        uint32_t *generations;
+};
+
+void slotAllocator_init(struct slotAllocator *allocator, size_t capacity)
+        __attribute__((access (write_only, 1)))
+        __attribute__((nonnull));
+
+void slotAllocator_free(struct slotAllocator *allocator)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Take the lowest free index. Return the capacity if there is none.
+size_t slotAllocator_take(struct slotAllocator *allocator)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Give back a taken index.
+void slotAllocator_release(struct slotAllocator *allocator, size_t idx)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Handle to a taken index, valid until it is released.
+struct slotHandle slotAllocator_handle(const struct slotAllocator *allocator, size_t idx)
+        __attribute__((access (read_only, 1)))
+        __attribute__((nonnull));
+
+// Whether the index of a handle is still taken by whoever got the handle.
+bool slotAllocator_valid(const struct slotAllocator *allocator, struct slotHandle handle)
+        __attribute__((access (read_only, 1)))
+        __attribute__((nonnull));
+
+#endif /* SLOT_ALLOCATOR_H */
@@ -0,0 +1,63 @@
+#ifndef SPATIAL_HASH_H
+#define SPATIAL_HASH_H
+
+#include <cglm/struct.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Uniform grid over the XY plane. Cells are stored in a hash table keyed by
+ * their integer coordinates so that the world does not need to be bounded
+ * beforehand. Every element is identified by an index smaller than the
+ * capacity given at initialization and can only be in the structure once.
+ *
+ * The structure is meant to be rebuilt every tick: clear it, insert every
+ * element and then run as many radius queries as needed. Clearing only touches
+ * the buckets that were used.
+ */
+
+#define SPATIAL_HASH_BUCKETS 4096
+#define SPATIAL_HASH_NONE SIZE_MAX
+
+struct spatialHash {
+        float cellSize;
+        size_t capacity;
+
+        size_t buckets[SPATIAL_HASH_BUCKETS];
+        size_t *usedBuckets;
+        size_t numUsedBuckets;
+
+        size_t *next;
+        int32_t *cellX;
+        int32_t *cellY;
+        vec2s *positions;
+};
+
+// Initialize an empty hash. The cell size should be about the radius of the
+// queries that will be made, so that a query touches few cells.
+void spatialHash_init(struct spatialHash *hash, float cellSize, size_t capacity)
+        __attribute__((access (write_only, 1)))
+        __attribute__((nonnull));
+
+void spatialHash_free(struct spatialHash *hash)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Remove every element.
+void spatialHash_clear(struct spatialHash *hash)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Add an element at the given position. The index must not already be in the
+// hash.
+void spatialHash_insert(struct spatialHash *hash, size_t idx, vec2s position)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Call func for every element at a distance of at most radius from center.
+void spatialHash_query(const struct spatialHash *hash, vec2s center, float radius,
+                       void(*func)(size_t idx, void *args), void *args)
+        __attribute__((access (read_only, 1)))
+        __attribute__((nonnull (1, 4)));
+
+#endif /* SPATIAL_HASH_H */
@@ -0,0 +1,45 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Bounded lock-free queue of fixed size elements for exactly one producer
+ * thread and one consumer thread. Elements are copied in and out. The
+ * capacity is rounded up to a power of two.
+ */
+
+struct spscQueue {
+        size_t elementSize;
+        size_t mask;
+        unsigned char *data;
+
+        // Written by the consumer only, on its own cache line
+        _Alignas(64) atomic_size_t head;
+        // Written by the producer only, on its own cache line
+        _Alignas(64) atomic_size_t tail;
+};
+
+void spscQueue_init(struct spscQueue *queue, size_t elementSize, size_t capacity)
+        __attribute__((access (write_only, 1)))
+        __attribute__((nonnull));
+
+void spscQueue_free(struct spscQueue *queue)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Producer side. Return false without doing anything if the queue is full.
+bool spscQueue_push(struct spscQueue *queue, const void *element)
+        __attribute__((access (read_write, 1)))
+        __attribute__((access (read_only, 2)))
+        __attribute__((nonnull));
+
+// Consumer side. Return false without doing anything if the queue is empty.
+bool spscQueue_pop(struct spscQueue *queue, void *element)
+        __attribute__((access (read_write, 1)))
+        __attribute__((access (write_only, 2)))
+        __attribute__((nonnull));
+
+#endif /* SPSC_QUEUE_H */
@@ -0,0 +1,72 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Ground players stand on, as a grid of heights read from a binary PGM image
+ * seen from above: one sample every TERRAIN_CELL_SIZE meters, centered on the
+ * origin, with x to the right and y up the image. Black is at height 0 and
+ * white at TERRAIN_MAX_HEIGHT. Between samples the height is interpolated
+ * bilinearly, and beyond the edges it is that of the nearest edge.
+ *
+ * Samples are stored in square tiles, and tiles in Morton order, so that
+ * samples close on the ground are close in memory whichever way players walk.
+ * They can be kept quantized as in the image, which takes half the memory, or
+ * as floats. Both give the very same heights, so that a client and a server
+ * storing them differently still agree.
+ */
+
+#define TERRAIN_CELL_SIZE 1.0f
+#define TERRAIN_MAX_HEIGHT 16.0f
+// Samples along each side of a tile
+#define TERRAIN_TILE 8
+
+struct terrain {
+        // Fingerprint of the samples, to tell whether two terrains are the
+        // same
+        uint64_t hash;
+
+        // samples along x and y, at least 2 each
+        size_t width;
+        size_t height;
+        // position of the first sample
+        float originX;
+        float originY;
+
+        // height of a quantized sample q is q * step
+        float step;
+        // one of them is NULL
+        uint16_t *quantized;
+        float *heights;
+};
+
+// Load a terrain from a PGM file, keeping its samples quantized or not.
+// Return false if it can not be read or is not a heightfield.
+bool terrain_load(struct terrain *terrain, const char *path, bool quantized)
+        __attribute__((access (write_only, 1)))
+        __attribute__((access (read_only, 2)))
+        __attribute__((nonnull));
+
+void terrain_free(struct terrain *terrain)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Height of the ground at x, y.
+float terrain_height(const struct terrain *terrain, float x, float y)
+        __attribute__((access (read_only, 1)))
+        __attribute__((nonnull));
+
+// Height of the ground under count points, one element per point in each
+// array.
+void terrain_heights(const struct terrain *terrain, size_t count, const float *x,
+                     const float *y, float *height)
+        __attribute__((access (read_only, 1)))
+        __attribute__((access (read_only, 3, 2)))
+        __attribute__((access (read_only, 4, 2)))
+        __attribute__((access (write_only, 5, 2)))
+        __attribute__((nonnull));
+
+#endif /* TERRAIN_H */
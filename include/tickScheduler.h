@@ -0,0 +1,43 @@
+#ifndef TICK_SCHEDULER_H
+#define TICK_SCHEDULER_H
+
+#include <stdbool.h>
+#include <time.h>
+
+/*
+ * Fixed timestep scheduler. Tick n is due at start + n*period, so the error of
+ * one tick never carries over to the next one. When the simulation falls
+ * behind the policy decides what to do: catching up runs the missed ticks back
+ * to back, skipping drops them and realigns to the next due tick. Even when
+ * catching up, falling behind by more than TICK_SCHEDULER_MAX_CATCH_UP ticks
+ * drops them rather than spiraling.
+ */
+
+#define TICK_SCHEDULER_MAX_CATCH_UP 10
+
+enum tickPolicy {
+        TICK_POLICY_CATCH_UP,
+        TICK_POLICY_SKIP,
+};
+
+struct tickScheduler {
+        unsigned long period_ns;
+        enum tickPolicy policy;
+
+        struct timespec deadline;
+        unsigned long long tick;
+        unsigned long long skipped;
+};
+
+void tickScheduler_init(struct tickScheduler *scheduler, unsigned long period_ns,
+                        enum tickPolicy policy)
+        __attribute__((access (write_only, 1)))
+        __attribute__((nonnull));
+
+// Wait until the next tick is due. Return the number of ticks that were
+// dropped to get back on schedule, 0 if none.
+unsigned long tickScheduler_wait(struct tickScheduler *scheduler)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+#endif /* TICK_SCHEDULER_H */
@@ -1,6 +1,7 @@
 #ifndef TIMEUTIL_H
 #define TIMEUTIL_H
 
+#include <stdbool.h>
 #include <time.h>
 
 // Get current time according to a monotonic clock. This does not relate to the
@@ -10,4 +11,14 @@ struct timespec monotonic(void);
 // Get the difference in nanoseconds between two monotonic clock times.
 unsigned long monotonic_difference(struct timespec a, struct timespec b);
 
+// Add a number of nanoseconds to a time.
+struct timespec timespec_add(struct timespec t, unsigned long ns);
+
+// Whether time a comes before time b.
+bool timespec_before(struct timespec a, struct timespec b);
+
+// Sleep until the monotonic clock reaches the given time. Return immediately if
+// it already has.
+void monotonic_sleep_until(struct timespec t);
+
 #endif /* TIMEUTIL_H */
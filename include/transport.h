@@ -0,0 +1,126 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <enet/enet.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Connections over UDP with reliable and unreliable channels, behind which the
+ * server talks to its clients and the bots to the server. ENet is the default
+ * backend and the only one the game client speaks.
+ *
+ * The udp backend is a lighter protocol for Linux that moves datagrams in
+ * batches, with recvmmsg and sendmmsg, rather than one system call each: a
+ * broadcast to every client goes out in a handful of calls. On each channel
+ * reliable packets arrive once and in order and unreliable ones are dropped if
+ * older than the last one received, as with ENet. Unreliable packets that do
+ * not fit in a datagram are sent reliably.
+ */
+
+enum transportBackend {
+        TRANSPORT_BACKEND_ENET,
+        TRANSPORT_BACKEND_UDP,
+};
+
+enum transportEventType {
+        TRANSPORT_EVENT_NONE,
+        TRANSPORT_EVENT_CONNECT,
+        TRANSPORT_EVENT_DISCONNECT,
+        TRANSPORT_EVENT_RECEIVE,
+};
+
+// A connection of a host. Once it closes, its index may be taken by another
+// one with a different connectID.
+struct transportPeer {
+        size_t idx;
+        uint32_t connectID;
+};
+
+struct transportEvent {
+        enum transportEventType type;
+        struct transportPeer peer;
+        // milliseconds, as estimated by the backend
+        uint32_t roundTripTime;
+        uint32_t roundTripTimeVariance;
+        // TRANSPORT_EVENT_CONNECT, connection data is 0 for the host that
+        // connected
+        ENetAddress address;
+        uint32_t data;
+        // TRANSPORT_EVENT_RECEIVE, valid until the host is serviced again
+        uint8_t channel;
+        const uint8_t *payload;
+        size_t size;
+};
+
+struct transport;
+
+// Create a host listening at the address, or one that only connects if there
+// is none. Buffers handed over with transport_sendOwned are given back through
+// release, which may be NULL if nothing is sent that way. Return NULL if the
+// host could not be created.
+struct transport *transport_create(enum transportBackend backend, const ENetAddress *address,
+                                   size_t peerCount, size_t channels, void (*release)(void *data))
+        __attribute__((access (read_only, 2)));
+
+// Close every connection at once and destroy the host.
+void transport_destroy(struct transport *transport)
+        __attribute__((nonnull));
+
+// Socket to wait on for the host to have something to service.
+int transport_socket(const struct transport *transport)
+        __attribute__((access (read_only, 1)))
+        __attribute__((nonnull));
+
+// Send what is queued, receive what arrived and handle timeouts. Never blocks.
+// Return 1 with the next event, 0 if there are none left and a negative number
+// on error.
+int transport_service(struct transport *transport, struct transportEvent *event)
+        __attribute__((access (read_write, 1)))
+        __attribute__((access (write_only, 2)))
+        __attribute__((nonnull));
+
+// Send what is queued.
+void transport_flush(struct transport *transport)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Start connecting. Return false if the host has no room for another peer.
+bool transport_connect(struct transport *transport, const ENetAddress *address, size_t channels,
+                       uint32_t data, struct transportPeer *peer)
+        __attribute__((access (read_write, 1)))
+        __attribute__((access (read_only, 2)))
+        __attribute__((access (write_only, 5)))
+        __attribute__((nonnull));
+
+// Close a connection without waiting for the other side. No event is
+// generated for it.
+void transport_disconnect(struct transport *transport, struct transportPeer peer)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Queue a copy of a packet. ENet packet flags apply. Return false if the peer
+// is not connected anymore.
+bool transport_send(struct transport *transport, struct transportPeer peer, uint8_t channel,
+                    const void *data, size_t size, uint32_t flags)
+        __attribute__((access (read_write, 1)))
+        __attribute__((access (read_only, 4, 5)))
+        __attribute__((nonnull));
+
+// Queue a packet, handing the buffer over until it is given back through the
+// release function of the host. It is given back right away if the peer is not
+// connected anymore.
+bool transport_sendOwned(struct transport *transport, struct transportPeer peer, uint8_t channel,
+                         void *data, size_t size, uint32_t flags)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+// Bytes sent and received since the last call.
+void transport_traffic(struct transport *transport, size_t *sent, size_t *received)
+        __attribute__((access (read_write, 1)))
+        __attribute__((access (write_only, 2)))
+        __attribute__((access (write_only, 3)))
+        __attribute__((nonnull));
+
+#endif /* TRANSPORT_H */
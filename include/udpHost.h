@@ -0,0 +1,69 @@
+#ifndef UDP_HOST_H
+#define UDP_HOST_H
+
+#include <transport.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The udp backend of the transport, see transport.h. Every datagram carries
+ * one packet, or one fragment of it, behind a small header. Reliable datagrams
+ * are numbered per channel, acknowledged in batches and sent again after a
+ * timeout derived from the round trip time, up to a window of them in flight.
+ * The receiver keeps the ones that arrive ahead of a missing one until it
+ * shows up. Peers that go quiet are pinged, and dropped once they stay quiet
+ * for long enough.
+ */
+
+struct udpHost;
+
+struct udpHost *udpHost_create(const ENetAddress *address, size_t peerCount, size_t channels,
+                               void (*release)(void *data))
+        __attribute__((access (read_only, 1)));
+
+void udpHost_destroy(struct udpHost *host)
+        __attribute__((nonnull));
+
+int udpHost_socket(const struct udpHost *host)
+        __attribute__((access (read_only, 1)))
+        __attribute__((nonnull));
+
+int udpHost_service(struct udpHost *host, struct transportEvent *event)
+        __attribute__((access (read_write, 1)))
+        __attribute__((access (write_only, 2)))
+        __attribute__((nonnull));
+
+void udpHost_flush(struct udpHost *host)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+bool udpHost_connect(struct udpHost *host, const ENetAddress *address, uint32_t data,
+                     struct transportPeer *peer)
+        __attribute__((access (read_write, 1)))
+        __attribute__((access (read_only, 2)))
+        __attribute__((access (write_only, 4)))
+        __attribute__((nonnull));
+
+void udpHost_disconnect(struct udpHost *host, struct transportPeer peer)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+bool udpHost_send(struct udpHost *host, struct transportPeer peer, uint8_t channel,
+                  const void *data, size_t size, uint32_t flags)
+        __attribute__((access (read_write, 1)))
+        __attribute__((access (read_only, 4, 5)))
+        __attribute__((nonnull));
+
+bool udpHost_sendOwned(struct udpHost *host, struct transportPeer peer, uint8_t channel,
+                       void *data, size_t size, uint32_t flags)
+        __attribute__((access (read_write, 1)))
+        __attribute__((nonnull));
+
+void udpHost_traffic(struct udpHost *host, size_t *sent, size_t *received)
+        __attribute__((access (read_write, 1)))
+        __attribute__((access (write_only, 2)))
+        __attribute__((access (write_only, 3)))
+        __attribute__((nonnull));
+
+#endif /* UDP_HOST_H */
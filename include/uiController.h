@@ -23,6 +23,11 @@ struct uiControllerStatusData {
         
         float deltas;
         unsigned count;
+
+        // Entities of the area around the player received so far
+        bool joining;
+        size_t joinProgressCurrent;
+        size_t joinProgressTotal;
 };
 
 struct uiControllerServerSelectData {
@@ -50,6 +55,9 @@ struct uiController {
 
         struct uiControllerStatusData statusWidgetData;
         struct uiControllerServerSelectData serverSelectWidgetData;
+
+        // Moving to another server is not a disconnection to report
+        enum redirectState redirect;
 };
 
 void uiController_setup(struct uiController *controller, struct game *game, struct networkController *networkController)
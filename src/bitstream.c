@@ -0,0 +1,169 @@
+#include <bitstream.h>
+#include <math.h>
+
+#define TURN (2.0f * 3.14159265358979323846f)
+
+static inline uint64_t low_bits(const unsigned bits) {
+        return ((uint64_t)1 << bits) - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void bitWriter_init(struct bitWriter *const writer, void *const data, const size_t size) {
+        writer->data = data;
+        writer->size = size;
+        writer->pos = 0;
+        writer->scratch = 0;
+        writer->scratchBits = 0;
+        writer->overflow = false;
+}
+
+void bitWriter_write(struct bitWriter *const writer, const uint32_t value, const unsigned bits) {
+        writer->scratch |= (value & low_bits(bits)) << writer->scratchBits;
+        writer->scratchBits += bits;
+
+        while (writer->scratchBits >= 8) {
+                if (writer->pos >= writer->size) {
+                        writer->overflow = true;
+                        writer->scratch = 0;
+                        writer->scratchBits = 0;
+                        return;
+                }
+                writer->data[writer->pos++] = (uint8_t)writer->scratch;
+                writer->scratch >>= 8;
+                writer->scratchBits -= 8;
+        }
+}
+
+void bitWriter_writeVarUint(struct bitWriter *const writer, uint32_t value) {
+        for (;;) {
+                bitWriter_write(writer, value, BITSTREAM_VARUINT_GROUP_BITS);
+                value >>= BITSTREAM_VARUINT_GROUP_BITS;
+                bitWriter_write(writer, value != 0, 1);
+                if (value == 0) {
+                        break;
+                }
+        }
+}
+
+size_t bitWriter_finish(struct bitWriter *const writer) {
+        if (writer->scratchBits > 0) {
+                bitWriter_write(writer, 0, 8 - writer->scratchBits);
+        }
+        if (writer->overflow) {
+                return 0;
+        }
+        return writer->pos;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void bitReader_init(struct bitReader *const reader, const void *const data, const size_t size) {
+        reader->data = data;
+        reader->size = size;
+        reader->pos = 0;
+        reader->scratch = 0;
+        reader->scratchBits = 0;
+        reader->overflow = false;
+}
+
+uint32_t bitReader_read(struct bitReader *const reader, const unsigned bits) {
+        while (reader->scratchBits < bits) {
+                if (reader->pos >= reader->size) {
+                        reader->overflow = true;
+                }
+                if (reader->overflow) {
+                        return 0;
+                }
+                reader->scratch |= (uint64_t)reader->data[reader->pos++] << reader->scratchBits;
+                reader->scratchBits += 8;
+        }
+
+        const uint32_t value = (uint32_t)(reader->scratch & low_bits(bits));
+        reader->scratch >>= bits;
+        reader->scratchBits -= bits;
+        return value;
+}
+
+uint32_t bitReader_readVarUint(struct bitReader *const reader) {
+        uint32_t value = 0;
+        for (unsigned shift=0; shift<32; shift+=BITSTREAM_VARUINT_GROUP_BITS) {
+                value |= bitReader_read(reader, BITSTREAM_VARUINT_GROUP_BITS) << shift;
+                if (!bitReader_read(reader, 1)) {
+                        return value;
+                }
+        }
+
+        // longer than any value that can be written
+        reader->overflow = true;
+        return 0;
+}
+
+bool bitReader_ok(const struct bitReader *const reader) {
+        return !reader->overflow;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void quantization_init(struct quantization *const quantization, const float min,
+                       const float max, const float precision) {
+        const float levels = ceilf((max - min) / precision);
+
+        // all ones is left out to keep the number of values odd
+        unsigned bits = 2;
+        while (bits < 32 && (float)(low_bits(bits) - 1) < levels) {
+                bits++;
+        }
+
+        quantization->min = min;
+        quantization->max = max;
+        quantization->center = min + (max - min) / 2;
+        quantization->bits = bits;
+        quantization->maxValue = (uint32_t)low_bits(bits) - 1;
+        quantization->step = (max - min) / (float)quantization->maxValue;
+}
+
+// Values are counted from the center so that it is encoded and decoded
+// without rounding
+uint32_t quantization_encode(const struct quantization *const quantization, const float value) {
+        // also catches NaN
+        if (!(value > quantization->min)) {
+                return 0;
+        }
+        if (value >= quantization->max) {
+                return quantization->maxValue;
+        }
+
+        const uint32_t half = quantization->maxValue / 2;
+        const float q = floorf((value - quantization->center) / quantization->step + 0.5f);
+        if (q <= -(float)half) {
+                return 0;
+        }
+        if (q >= (float)half) {
+                return quantization->maxValue;
+        }
+        return (uint32_t)((int64_t)q + half);
+}
+
+float quantization_decode(const struct quantization *const quantization, const uint32_t value) {
+        // all ones is never written
+        const uint32_t clamped = value > quantization->maxValue ? quantization->maxValue : value;
+        const int64_t offset = (int64_t)clamped - (int64_t)(quantization->maxValue / 2);
+        return quantization->center + (float)offset * quantization->step;
+}
+
+uint32_t angle_encode(const float angle, const unsigned bits) {
+        if (isnan(angle) || isinf(angle)) {
+                return 0;
+        }
+
+        float turns = angle / TURN;
+        turns -= floorf(turns);
+
+        const float q = turns * (float)((uint64_t)1 << bits) + 0.5f;
+        return (uint32_t)((uint64_t)q & low_bits(bits));
+}
+
+float angle_decode(const uint32_t value, const unsigned bits) {
+        return (float)value * (TURN / (float)((uint64_t)1 << bits));
+}
@@ -0,0 +1,908 @@
+#define _POSIX_C_SOURCE 200809L
+
+/*
+ * Headless load generator. Connects a number of bots to a server from a
+ * single process, moves them around following simple scripted patterns while
+ * speaking the same protocol as the game client and reports every second
+ * what the server looks like from their side.
+ */
+
+#include <networkController.h>
+#include <networkCodec.h>
+#include <bitstream.h>
+#include <timeutil.h>
+#include <transport.h>
+#include <enet/enet.h>
+#include <cglm/struct.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BOTS_DEFAULT 100
+#define BOTS_PER_HOST 256
+// Room for the connections of redirected bots
+#define PEERS_PER_HOST (2 * BOTS_PER_HOST)
+#define BOT_CONNECT_RATE 200
+#define SPREAD_DEFAULT 256.0f
+
+// Bots move a bit slower than allowed so that the server never has a reason
+// to correct them
+#define BOT_SPEED (PLAYER_SPEED * 0.9f)
+#define BOT_ARRIVAL_DISTANCE 0.5f
+#define BOT_JUMPS_PER_SECOND 0.2f
+#define BOT_PATTERN_SIZE 16.0f
+#define BOT_CIRCLE_STEPS 12
+
+#define LOOP_PERIOD_NS 1000000L
+#define REPORT_PERIOD_NS 1000000000L
+
+#define TURN (2.0f * 3.14159265358979323846f)
+
+enum botPattern {
+        BOT_PATTERN_IDLE,
+        BOT_PATTERN_CIRCLE,
+        BOT_PATTERN_WANDER,
+        BOT_PATTERN_LINE,
+        BOT_PATTERNS_TOTAL,
+};
+
+struct bot {
+        // set while hasPeer, whether the connection is up yet or not
+        struct transportPeer peer;
+        bool hasPeer;
+        bool welcomed;
+        size_t idx;
+        struct networkCodec codec;
+        uint32_t random;
+
+        enum botPattern pattern;
+        vec2s home;
+        vec2s target;
+        bool reachedHome;
+        unsigned step;
+
+        vec3s position;
+        vec2s velocity;
+        float rotation;
+        float airtime;
+        bool airborne;
+
+        // If the server takes inputs, the bot moves in steps of a tick and
+        // sends the input of each one instead of its position
+        bool inputs;
+        float stepPeriod;
+        float stepTime;
+        uint32_t jumpState;
+        uint32_t nextSequence;
+
+        // Bots send their position like clients do, once the server's
+        // extrapolation of the last one sent is off
+        struct timespec lastMovementSent;
+        uint32_t nextMovementSequence;
+        bool jumped;
+        vec2s sentVelocity;
+        float sentRotation;
+
+        // Last position sent and when, to measure how long it takes to show
+        // up in the snapshots of the other bots
+        bool sentPosition;
+        vec3s lastPosition;
+        struct timespec lastPositionTime;
+
+        bool receivedSnapshot;
+        uint32_t lastSnapshot;
+        struct timespec lastSnapshotTime;
+};
+
+struct samples {
+        double *values;
+        size_t count;
+        size_t capacity;
+};
+
+struct stats {
+        unsigned long movements;
+        unsigned long positions;
+        unsigned long rotations;
+        unsigned long jumps;
+        unsigned long inputs;
+        unsigned long corrections;
+        unsigned long redirects;
+        unsigned long snapshots;
+        unsigned long records;
+        struct samples latency;
+        struct samples tickInterval;
+};
+
+static struct bot *bots;
+static size_t numBots;
+static struct transport **hosts;
+static size_t numHosts;
+// Bot of each peer of each host, PEERS_PER_HOST per host
+static struct bot **peerBots;
+
+// Bot controlling each entity, if any, for every entity index of the servers
+// as they tell in their welcome
+static struct bot **entityBots;
+static size_t numEntityBots;
+
+static struct stats stats;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static float random_float(uint32_t *const state) {
+        // xorshift32
+        uint32_t x = *state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        *state = x;
+        return (float)(x >> 8) / (float)(1U << 24);
+}
+
+static void samples_add(struct samples *const samples, const double value) {
+        if (samples->count == samples->capacity) {
+                samples->capacity = samples->capacity == 0 ? 1024 : samples->capacity * 2;
+                samples->values = realloc(samples->values, samples->capacity * sizeof(*samples->values));
+                if (samples->values == NULL) {
+                        fprintf(stderr, "could not allocate samples\n");
+                        exit(EXIT_FAILURE);
+                }
+        }
+        samples->values[samples->count++] = value;
+}
+
+static int compare_doubles(const void *const a, const void *const b) {
+        const double x = *(const double*)a;
+        const double y = *(const double*)b;
+        return (x > y) - (x < y);
+}
+
+// Only valid after sorting
+static double samples_percentile(const struct samples *const samples, const double percentile) {
+        if (samples->count == 0) {
+                return 0;
+        }
+        size_t i = (size_t)(percentile / 100.0 * (double)(samples->count - 1) + 0.5);
+        return samples->values[i];
+}
+
+static double ms(const unsigned long ns) {
+        return (double)ns / 1e6;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static size_t bot_host(const struct bot *const bot) {
+        return (size_t)(bot - bots) / BOTS_PER_HOST;
+}
+
+static void bot_send(const struct bot *const bot, const void *const data, const size_t size,
+                     const uint32_t flags) {
+        transport_send(hosts[bot_host(bot)], bot->peer, NETWORK_CHANNEL_MOVEMENT, data, size, flags);
+}
+
+static void send_packet(const struct bot *const bot, const void *const data,
+                        struct bitWriter *const writer, const size_t header) {
+        size_t size = header + bitWriter_finish(writer);
+        bot_send(bot, data, size, 0);
+}
+
+// Send what is due of the bot in one movement packet
+static void send_movement(struct bot *const bot, const unsigned fields, const struct timespec now) {
+        uint8_t buffer[NETWORK_SMALL_PACKET_MAX];
+        struct networkPacketMovement *data = (void*)buffer;
+        data->base.type = PACKET_TYPE_MOVEMENT_UPDATE;
+        data->sequence = bot->nextMovementSequence++;
+
+        struct bitWriter writer;
+        bitWriter_init(&writer, data->data, sizeof(buffer) - sizeof(*data));
+        bitWriter_write(&writer, fields, MOVEMENT_FIELDS_TOTAL);
+        if (fields & MOVEMENT_FIELD_POSITION) {
+                networkCodec_writePosition(&bot->codec, &writer, bot->position);
+                networkCodec_writeVelocity(&bot->codec, &writer, bot->velocity);
+                bot->sentPosition = true;
+                bot->sentVelocity = bot->velocity;
+                bot->lastPosition = bot->position;
+                bot->lastPositionTime = now;
+                stats.positions++;
+        }
+        if (fields & MOVEMENT_FIELD_ROTATION) {
+                networkCodec_writeRotation(&bot->codec, &writer, bot->rotation);
+                bot->sentRotation = bot->rotation;
+                stats.rotations++;
+        }
+        if (fields & MOVEMENT_FIELD_JUMP) {
+                bot->jumped = false;
+                stats.jumps++;
+        }
+        send_packet(bot, data, &writer, sizeof(*data));
+
+        bot->lastMovementSent = now;
+        stats.movements++;
+}
+
+static void send_input(struct bot *const bot, const struct playerInput *const input,
+                       const struct timespec now) {
+        uint8_t buffer[NETWORK_SMALL_PACKET_MAX];
+        struct networkPacketInput *data = (void*)buffer;
+        data->base.type = PACKET_TYPE_INPUT;
+        data->sequence = bot->nextSequence++;
+
+        struct bitWriter writer;
+        bitWriter_init(&writer, data->data, sizeof(buffer) - sizeof(*data));
+        networkCodec_writeInput(&bot->codec, &writer, input);
+        size_t size = sizeof(*data) + bitWriter_finish(&writer);
+        bot_send(bot, data, size, ENET_PACKET_FLAG_RELIABLE);
+
+        // where the server puts the bot once it applies the input
+        bot->sentPosition = true;
+        bot->lastPosition = bot->position;
+        bot->lastPositionTime = now;
+        stats.inputs++;
+}
+
+static void send_snapshot_ack(const struct bot *const bot, const uint32_t snapshot) {
+        struct networkPacketSnapshotAck data;
+        data.base.type = PACKET_TYPE_SNAPSHOT_ACK;
+        data.snapshot = snapshot;
+        bot_send(bot, &data, sizeof(data), 0);
+}
+
+static bool bot_connect(struct bot *const bot, const ENetAddress *const address,
+                        const uint32_t data) {
+        const size_t host = bot_host(bot);
+        if (!transport_connect(hosts[host], address, NETWORK_CHANNELS_TOTAL, data, &bot->peer)) {
+                return false;
+        }
+        bot->hasPeer = true;
+        peerBots[host * PEERS_PER_HOST + bot->peer.idx] = bot;
+        return true;
+}
+
+static void bot_disconnect(struct bot *const bot) {
+        const size_t host = bot_host(bot);
+        peerBots[host * PEERS_PER_HOST + bot->peer.idx] = NULL;
+        transport_disconnect(hosts[host], bot->peer);
+        bot->hasPeer = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void onWelcome(struct bot *const bot, const struct networkPacketWelcome *const packet,
+                      const size_t size) {
+        if (size < sizeof(*packet) || !networkCodec_init(&bot->codec, &packet->codec)) {
+                fprintf(stderr, "bad welcome packet\n");
+                return;
+        }
+        if (packet->id >= packet->capacity) {
+                return;
+        }
+        if (packet->capacity > numEntityBots) {
+                entityBots = realloc(entityBots, packet->capacity * sizeof(*entityBots));
+                if (entityBots == NULL) {
+                        fprintf(stderr, "could not allocate memory\n");
+                        exit(EXIT_FAILURE);
+                }
+                for (size_t i=numEntityBots; i<packet->capacity; i++) {
+                        entityBots[i] = NULL;
+                }
+                numEntityBots = packet->capacity;
+        }
+
+        bot->welcomed = true;
+        bot->idx = packet->id;
+        entityBots[bot->idx] = bot;
+        bot->inputs = packet->movement == NETWORK_MOVEMENT_INPUTS;
+        bot->stepPeriod = (float)packet->tickPeriodNs / 1e9f;
+        bot->stepTime = 0;
+        bot->jumpState = 0;
+        bot->nextSequence = 0;
+        bot->nextMovementSequence = 0;
+        bot->jumped = false;
+
+        struct bitReader reader;
+        bitReader_init(&reader, packet->data, size - sizeof(*packet));
+        uint32_t count = bitReader_readVarUint(&reader);
+        for (size_t i=0; i<count; i++) {
+                size_t idx = bitReader_readVarUint(&reader);
+                vec3s position = networkCodec_readPosition(&bot->codec, &reader);
+                float rotation = networkCodec_readRotation(&bot->codec, &reader);
+                if (!bitReader_ok(&reader)) {
+                        break;
+                }
+                if (idx == bot->idx) {
+                        bot->position = position;
+                        bot->rotation = rotation;
+                }
+        }
+}
+
+static void onPositionCorrection(struct bot *const bot,
+                                 const struct networkPacketPositionCorrection *const packet,
+                                 const size_t size) {
+        struct bitReader reader;
+        bitReader_init(&reader, packet->data, size - sizeof(*packet));
+        vec3s position = networkCodec_readPosition(&bot->codec, &reader);
+        uint32_t jumpFall = bitReader_read(&reader, NETWORK_JUMP_STATE_BITS);
+        if (!bitReader_ok(&reader)) {
+                return;
+        }
+
+        bot->position = position;
+        bot->airborne = jumpFall != 0;
+        bot->jumpState = jumpFall & (JUMP_STATE_JUMPING | JUMP_STATE_FALLING);
+        stats.corrections++;
+}
+
+// Follow the player to the server that owns where it walked to, keeping its
+// state, like the client does.
+static void onRedirect(struct bot *const bot, const struct networkPacketRedirect *const packet,
+                       const size_t size) {
+        if (size < sizeof(*packet)) {
+                return;
+        }
+
+        ENetAddress address;
+        address.host = packet->host;
+        address.port = packet->port;
+
+        entityBots[bot->idx] = NULL;
+        bot->welcomed = false;
+        bot->receivedSnapshot = false;
+        bot->sentPosition = false;
+        bot_disconnect(bot);
+
+        if (!bot_connect(bot, &address, packet->token)) {
+                fprintf(stderr, "could not follow redirect of bot %zu\n", (size_t)(bot - bots));
+                return;
+        }
+        stats.redirects++;
+}
+
+// If a record shows the last position sent by the bot moving the entity, take
+// how long it took to get here as a latency sample. The entity has the fields
+// missing from the record set to that position.
+static void measure_latency(const struct bot *const bot, const struct bot *const mover,
+                            const struct networkSnapshotEntity *const entity,
+                            const unsigned mask, const struct timespec now) {
+        if (!mover->sentPosition || !(mask & (SNAPSHOT_FIELD_X | SNAPSHOT_FIELD_Y))) {
+                return;
+        }
+
+        struct networkSnapshotEntity sent;
+        sent.position = mover->lastPosition;
+        sent.rotation = 0;
+        uint32_t expected[SNAPSHOT_FIELDS_TOTAL];
+        uint32_t received[SNAPSHOT_FIELDS_TOTAL];
+        networkCodec_encodeEntity(&bot->codec, &sent, expected);
+        networkCodec_encodeEntity(&bot->codec, entity, received);
+        if (expected[0] == received[0] && expected[1] == received[1]) {
+                samples_add(&stats.latency, ms(monotonic_difference(now, mover->lastPositionTime)));
+        }
+}
+
+static void onSnapshot(struct bot *const bot, const struct networkPacketSnapshot *const packet,
+                       const size_t size, const struct timespec now) {
+        if (size < sizeof(*packet)) {
+                return;
+        }
+        if (bot->receivedSnapshot && (int32_t)(packet->snapshot - bot->lastSnapshot) <= 0) {
+                return;
+        }
+
+        if (bot->receivedSnapshot) {
+                uint32_t ticks = packet->snapshot - bot->lastSnapshot;
+                unsigned long elapsed = monotonic_difference(now, bot->lastSnapshotTime);
+                samples_add(&stats.tickInterval, ms(elapsed) / ticks);
+        }
+        bot->receivedSnapshot = true;
+        bot->lastSnapshot = packet->snapshot;
+        bot->lastSnapshotTime = now;
+        stats.snapshots++;
+
+        struct bitReader reader;
+        bitReader_init(&reader, packet->data, size - sizeof(*packet));
+        size_t idx = 0;
+        for (size_t i=0; i<packet->count; i++, idx++) {
+                idx += bitReader_readVarUint(&reader);
+                unsigned mask = bitReader_read(&reader, SNAPSHOT_FIELDS_TOTAL);
+                if (!bitReader_ok(&reader) || idx >= numEntityBots) {
+                        return;
+                }
+
+                const struct bot *mover = entityBots[idx];
+                struct networkSnapshotEntity entity;
+                entity.position = mover != NULL ? mover->lastPosition : GLMS_VEC3_ZERO;
+                entity.rotation = 0;
+                networkCodec_readFields(&bot->codec, &reader, &entity, mask);
+                if (!bitReader_ok(&reader)) {
+                        return;
+                }
+
+                if (mover != NULL) {
+                        measure_latency(bot, mover, &entity, mask, now);
+                }
+                stats.records++;
+        }
+
+        send_snapshot_ack(bot, packet->snapshot);
+}
+
+static void onReceive(struct bot *const bot, const struct transportEvent *const event,
+                      const struct timespec now) {
+        if (event->size < sizeof(struct networkPacket)) {
+                return;
+        }
+
+        const struct networkPacket *base = (const void*)event->payload;
+        if (base->type == PACKET_TYPE_WELCOME) {
+                onWelcome(bot, (const void*)base, event->size);
+                return;
+        }
+        if (!bot->welcomed) {
+                return;
+        }
+
+        switch (base->type) {
+        case PACKET_TYPE_POSITION_CORRECTION:
+                onPositionCorrection(bot, (const void*)base, event->size);
+                break;
+        case PACKET_TYPE_SNAPSHOT:
+                onSnapshot(bot, (const void*)base, event->size, now);
+                break;
+        case PACKET_TYPE_REDIRECT:
+                onRedirect(bot, (const void*)base, event->size);
+                break;
+        default:
+                break;
+        }
+}
+
+static void service_host(const size_t host, const struct timespec now) {
+        struct transportEvent event;
+        while (transport_service(hosts[host], &event) > 0) {
+                struct bot *bot = peerBots[host * PEERS_PER_HOST + event.peer.idx];
+                if (bot == NULL || bot->peer.connectID != event.peer.connectID) {
+                        continue;
+                }
+                switch (event.type) {
+                case TRANSPORT_EVENT_RECEIVE:
+                        onReceive(bot, &event, now);
+                        break;
+                case TRANSPORT_EVENT_DISCONNECT:
+                        fprintf(stderr, "bot %zu disconnected\n", (size_t)(bot - bots));
+                        if (bot->welcomed) {
+                                entityBots[bot->idx] = NULL;
+                        }
+                        bot->welcomed = false;
+                        bot->hasPeer = false;
+                        peerBots[host * PEERS_PER_HOST + event.peer.idx] = NULL;
+                        break;
+                case TRANSPORT_EVENT_CONNECT:
+                case TRANSPORT_EVENT_NONE:
+                default:
+                        break;
+                }
+        }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static vec2s pattern_target(struct bot *const bot) {
+        vec2s target = bot->home;
+        switch (bot->pattern) {
+        case BOT_PATTERN_CIRCLE: {
+                float angle = TURN * (float)(bot->step % BOT_CIRCLE_STEPS) / BOT_CIRCLE_STEPS;
+                target.x += BOT_PATTERN_SIZE * cosf(angle);
+                target.y += BOT_PATTERN_SIZE * sinf(angle);
+                break;
+        }
+        case BOT_PATTERN_WANDER:
+                target.x += BOT_PATTERN_SIZE * (2 * random_float(&bot->random) - 1);
+                target.y += BOT_PATTERN_SIZE * (2 * random_float(&bot->random) - 1);
+                break;
+        case BOT_PATTERN_LINE:
+                target.x += bot->step % 2 == 0 ? BOT_PATTERN_SIZE : -BOT_PATTERN_SIZE;
+                break;
+        case BOT_PATTERN_IDLE:
+        case BOT_PATTERNS_TOTAL:
+        default:
+                break;
+        }
+        bot->step++;
+        return target;
+}
+
+// The bot got to its target, pick the next one
+static void bot_arrived(struct bot *const bot) {
+        if (!bot->reachedHome) {
+                bot->reachedHome = true;
+        } else if (bot->pattern == BOT_PATTERN_IDLE) {
+                return;
+        }
+        bot->target = pattern_target(bot);
+}
+
+static void bot_move(struct bot *const bot, const float timeDelta) {
+        vec2s position = glms_vec2(bot->position);
+        vec2s difference = glms_vec2_sub(bot->target, position);
+        float distance = glms_vec2_norm(difference);
+
+        if (distance < BOT_ARRIVAL_DISTANCE) {
+                bot->velocity = GLMS_VEC2_ZERO;
+                bot_arrived(bot);
+                return;
+        }
+
+        float advance = BOT_SPEED * timeDelta;
+        if (advance > distance) {
+                advance = distance;
+        }
+        position = glms_vec2_add(position, glms_vec2_scale(difference, advance / distance));
+        bot->position.x = position.x;
+        bot->position.y = position.y;
+        bot->velocity = glms_vec2_scale(difference, BOT_SPEED / distance);
+        bot->rotation = atan2f(difference.y, difference.x);
+}
+
+// Whether the server's extrapolation of the last position sent is off. Bots
+// walk in straight lines, so that is mostly when they turn or stop.
+static bool position_off(const struct bot *const bot, const struct timespec now) {
+        if (!bot->sentPosition) {
+                return true;
+        }
+        const unsigned long elapsed_ms = monotonic_difference(now, bot->lastPositionTime) / 1000000;
+        if (elapsed_ms >= NETWORK_DEAD_RECKONING_MAX_MS) {
+                return glms_vec2_norm(bot->velocity) > 0 ||
+                        glms_vec2_norm(bot->sentVelocity) > 0;
+        }
+        const vec2s extrapolated = glms_vec2_add(glms_vec2(bot->lastPosition),
+                                                 glms_vec2_scale(bot->sentVelocity,
+                                                                 (float)elapsed_ms / 1000.0f));
+        return glms_vec2_norm(glms_vec2_sub(glms_vec2(bot->position), extrapolated)) >
+                NETWORK_DEAD_RECKONING_ERROR;
+}
+
+// Walk to the target a tick at a time with the same code the server moves the
+// bot with, sending the input of every tick
+static void bot_step_inputs(struct bot *const bot, const float timeDelta,
+                            const struct timespec now) {
+        // a step may go past the target by up to its length
+        const float arrival = fmaxf(BOT_ARRIVAL_DISTANCE, PLAYER_SPEED * bot->stepPeriod);
+
+        bot->stepTime += timeDelta;
+        while (bot->stepTime >= bot->stepPeriod) {
+                bot->stepTime -= bot->stepPeriod;
+
+                struct playerInput input;
+                input.buttons = 0;
+                input.yaw = bot->rotation;
+
+                vec2s difference = glms_vec2_sub(bot->target, glms_vec2(bot->position));
+                if (glms_vec2_norm(difference) < arrival) {
+                        bot_arrived(bot);
+                } else {
+                        input.buttons |= INPUT_FORWARD;
+                        input.yaw = networkCodec_roundRotation(&bot->codec,
+                                                               atan2f(difference.y, difference.x));
+                }
+                if (bot->jumpState == 0 && bot->pattern != BOT_PATTERN_IDLE &&
+                    random_float(&bot->random) < BOT_JUMPS_PER_SECOND * bot->stepPeriod) {
+                        input.buttons |= INPUT_JUMP;
+                        stats.jumps++;
+                }
+
+                apply_player_input(&input, &bot->position.x, &bot->position.y, &bot->rotation,
+                                   &bot->jumpState, &bot->airtime, bot->stepPeriod);
+                jump_fall_animation_batch(1, &bot->airtime, &bot->jumpState, &bot->position.z,
+                                          bot->stepPeriod);
+                send_input(bot, &input, now);
+        }
+}
+
+static void bot_update(struct bot *const bot, const float timeDelta, const struct timespec now) {
+        if (bot->inputs) {
+                bot_step_inputs(bot, timeDelta, now);
+                return;
+        }
+
+        bot_move(bot, timeDelta);
+
+        if (bot->airborne) {
+                bot->airtime += timeDelta;
+                if (bot->airtime > 2 * JUMP_TIME) {
+                        bot->airborne = false;
+                }
+        } else if (bot->pattern != BOT_PATTERN_IDLE &&
+                   random_float(&bot->random) < BOT_JUMPS_PER_SECOND * timeDelta) {
+                bot->airborne = true;
+                bot->airtime = 0;
+                bot->jumped = true;
+        }
+
+        // as clients do, jumps go right away and the rest at most once per
+        // send interval
+        unsigned fields = bot->jumped ? MOVEMENT_FIELD_JUMP : 0;
+        if (fields == 0 && bot->sentPosition &&
+            monotonic_difference(now, bot->lastMovementSent) / 1000000 < PACKET_SEND_RATELIMIT_MS) {
+                return;
+        }
+        if (position_off(bot, now)) {
+                fields |= MOVEMENT_FIELD_POSITION;
+        }
+        const float turned = fabsf(remainderf(bot->rotation - bot->sentRotation, TURN));
+        if (turned > NETWORK_DEAD_RECKONING_ROTATION_ERROR || (turned > 0 && fields != 0)) {
+                fields |= MOVEMENT_FIELD_ROTATION;
+        }
+        if (fields != 0) {
+                send_movement(bot, fields, now);
+        }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void report(const unsigned long elapsed) {
+        const double seconds = (double)elapsed / 1e9;
+
+        size_t welcomed = 0;
+        for (size_t i=0; i<numBots; i++) {
+                welcomed += bots[i].welcomed;
+        }
+
+        // from the point of view of the server
+        unsigned long inbound = 0;
+        unsigned long outbound = 0;
+        for (size_t i=0; i<numHosts; i++) {
+                size_t sent, received;
+                transport_traffic(hosts[i], &sent, &received);
+                inbound += sent;
+                outbound += received;
+        }
+
+        qsort(stats.latency.values, stats.latency.count, sizeof(double), compare_doubles);
+        qsort(stats.tickInterval.values, stats.tickInterval.count, sizeof(double), compare_doubles);
+
+        double corrections = 0;
+        const unsigned long movements = stats.movements + stats.inputs;
+        if (movements > 0) {
+                corrections = 100.0 * (double)stats.corrections / (double)movements;
+        }
+
+        printf("bots %zu/%zu | in %.1f KiB/s out %.1f KiB/s | "
+               "sent %.0f movement/s (%.0f pos/s %.0f rot/s %.0f jump/s) %.0f input/s | "
+               "corrections %.2f%% redirects %lu | "
+               "snapshots %.0f/s records %.0f/s | "
+               "tick p50 %.1f p99 %.1f max %.1f ms | "
+               "latency p50 %.1f p90 %.1f p99 %.1f max %.1f ms\n",
+               welcomed, numBots,
+               (double)inbound / 1024 / seconds, (double)outbound / 1024 / seconds,
+               (double)stats.movements / seconds,
+               (double)stats.positions / seconds, (double)stats.rotations / seconds,
+               (double)stats.jumps / seconds, (double)stats.inputs / seconds,
+               corrections, stats.redirects,
+               (double)stats.snapshots / seconds, (double)stats.records / seconds,
+               samples_percentile(&stats.tickInterval, 50),
+               samples_percentile(&stats.tickInterval, 99),
+               samples_percentile(&stats.tickInterval, 100),
+               samples_percentile(&stats.latency, 50),
+               samples_percentile(&stats.latency, 90),
+               samples_percentile(&stats.latency, 99),
+               samples_percentile(&stats.latency, 100));
+        fflush(stdout);
+
+        stats.movements = 0;
+        stats.positions = 0;
+        stats.rotations = 0;
+        stats.jumps = 0;
+        stats.inputs = 0;
+        stats.corrections = 0;
+        stats.redirects = 0;
+        stats.snapshots = 0;
+        stats.records = 0;
+        stats.latency.count = 0;
+        stats.tickInterval.count = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void bots_init(const enum transportBackend backend, const enum botPattern pattern,
+                      const bool mixed, const float spread) {
+        bots = malloc(numBots * sizeof(*bots));
+        numHosts = (numBots + BOTS_PER_HOST - 1) / BOTS_PER_HOST;
+        hosts = malloc(numHosts * sizeof(*hosts));
+        peerBots = calloc(numHosts * PEERS_PER_HOST, sizeof(*peerBots));
+        if (bots == NULL || hosts == NULL || peerBots == NULL) {
+                fprintf(stderr, "could not allocate bots\n");
+                exit(EXIT_FAILURE);
+        }
+
+        for (size_t i=0; i<numHosts; i++) {
+                size_t peers = numBots - i * BOTS_PER_HOST;
+                if (peers > BOTS_PER_HOST) {
+                        peers = BOTS_PER_HOST;
+                }
+                // Nothing is sent with transport_sendOwned
+                hosts[i] = transport_create(backend, NULL, 2 * peers, NETWORK_CHANNELS_TOTAL, NULL);
+                if (hosts[i] == NULL) {
+                        fprintf(stderr, "could not create host\n");
+                        exit(EXIT_FAILURE);
+                }
+        }
+
+        for (size_t i=0; i<numBots; i++) {
+                struct bot *bot = &bots[i];
+                memset(bot, 0, sizeof(*bot));
+                bot->random = (uint32_t)(i * 2654435761U) | 1;
+
+                bot->pattern = mixed ? (enum botPattern)(i % BOT_PATTERNS_TOTAL) : pattern;
+
+                // uniform over a disc
+                float r = spread * sqrtf(random_float(&bot->random));
+                float angle = TURN * random_float(&bot->random);
+                bot->home.x = r * cosf(angle);
+                bot->home.y = r * sinf(angle);
+                bot->target = bot->home;
+        }
+}
+
+static void bots_connect(const ENetAddress *const address, size_t *const connected,
+                         const size_t count) {
+        for (size_t n=0; n<count && *connected<numBots; n++, (*connected)++) {
+                if (!bot_connect(&bots[*connected], address, 0)) {
+                        fprintf(stderr, "could not connect bot %zu\n", *connected);
+                }
+        }
+}
+
+static void bots_deinit(void) {
+        for (size_t i=0; i<numBots; i++) {
+                if (bots[i].hasPeer) {
+                        bot_disconnect(&bots[i]);
+                }
+        }
+        for (size_t i=0; i<numHosts; i++) {
+                transport_destroy(hosts[i]);
+        }
+        free(hosts);
+        free(peerBots);
+        free(bots);
+        free(entityBots);
+        free(stats.latency.values);
+        free(stats.tickInterval.values);
+        enet_deinitialize();
+}
+
+static void usage(const char *const name) {
+        fprintf(stderr, "usage:\n\t%s [-n bots] [-m idle|circle|wander|line|mixed] [-s spread] "
+                "[-d duration_seconds] [-T enet|udp] host port\n", name);
+}
+
+int main(int argc, char *argv[]) {
+        numBots = BOTS_DEFAULT;
+        enum botPattern pattern = BOT_PATTERN_WANDER;
+        bool mixed = false;
+        float spread = SPREAD_DEFAULT;
+        double duration = 0;
+        enum transportBackend backend = TRANSPORT_BACKEND_ENET;
+
+        static const char *const patterns[] = {
+                [BOT_PATTERN_IDLE] = "idle",
+                [BOT_PATTERN_CIRCLE] = "circle",
+                [BOT_PATTERN_WANDER] = "wander",
+                [BOT_PATTERN_LINE] = "line",
+        };
+
+        int opt;
+        while ((opt = getopt(argc, argv, "n:m:s:d:T:")) != -1) {
+                switch (opt) {
+                case 'n':
+                        numBots = strtoul(optarg, NULL, 10);
+                        if (numBots == 0) {
+                                fprintf(stderr, "need at least one bot\n");
+                                return 1;
+                        }
+                        break;
+                case 'm': {
+                        mixed = strcmp(optarg, "mixed") == 0;
+                        bool found = mixed;
+                        for (size_t i=0; i<BOT_PATTERNS_TOTAL && !found; i++) {
+                                if (strcmp(optarg, patterns[i]) == 0) {
+                                        pattern = (enum botPattern)i;
+                                        found = true;
+                                }
+                        }
+                        if (!found) {
+                                usage(argv[0]);
+                                return 1;
+                        }
+                        break;
+                }
+                case 's':
+                        spread = strtof(optarg, NULL);
+                        break;
+                case 'd':
+                        duration = strtod(optarg, NULL);
+                        break;
+                case 'T':
+                        if (strcmp(optarg, "enet") == 0) {
+                                backend = TRANSPORT_BACKEND_ENET;
+                        } else if (strcmp(optarg, "udp") == 0) {
+                                backend = TRANSPORT_BACKEND_UDP;
+                        } else {
+                                usage(argv[0]);
+                                return 1;
+                        }
+                        break;
+                default:
+                        usage(argv[0]);
+                        return 1;
+                }
+        }
+        if (optind != argc - 2) {
+                usage(argv[0]);
+                return 1;
+        }
+
+        if (enet_initialize() != 0) {
+                fprintf(stderr, "could not initialize enet\n");
+                return 1;
+        }
+
+        ENetAddress address;
+        if (enet_address_set_host(&address, argv[optind]) != 0) {
+                fprintf(stderr, "could not resolve %s\n", argv[optind]);
+                return 1;
+        }
+        address.port = (enet_uint16)atoi(argv[optind + 1]);
+
+        bots_init(backend, pattern, mixed, spread);
+        atexit(bots_deinit);
+
+        const struct timespec start = monotonic();
+        struct timespec last = start;
+        struct timespec lastReport = start;
+        size_t connected = 0;
+
+        for (;;) {
+                const struct timespec now = monotonic();
+                const unsigned long elapsed = monotonic_difference(now, start);
+                if (duration > 0 && (double)elapsed / 1e9 >= duration) {
+                        break;
+                }
+
+                // Connect gradually rather than flood the server with
+                // handshakes
+                size_t due = (size_t)((double)elapsed / 1e9 * BOT_CONNECT_RATE) + 1;
+                if (due > connected) {
+                        bots_connect(&address, &connected, due - connected);
+                }
+
+                for (size_t i=0; i<numHosts; i++) {
+                        service_host(i, now);
+                }
+
+                const float timeDelta = (float)monotonic_difference(now, last) / 1e9f;
+                last = now;
+                for (size_t i=0; i<numBots; i++) {
+                        if (bots[i].welcomed) {
+                                bot_update(&bots[i], timeDelta, now);
+                        }
+                }
+                for (size_t i=0; i<numHosts; i++) {
+                        transport_flush(hosts[i]);
+                }
+
+                const unsigned long sinceReport = monotonic_difference(now, lastReport);
+                if (sinceReport >= REPORT_PERIOD_NS) {
+                        report(sinceReport);
+                        lastReport = now;
+                }
+
+                monotonic_sleep_until(timespec_add(now, LOOP_PERIOD_NS));
+        }
+
+        return 0;
+}
@@ -2,6 +2,7 @@
 #include <entityUtils.h>
 #include <curve.h>
 #include <events.h>
+#include <thirty/util.h>
 
 static size_t createEntity(struct game *const game, struct component *const geometry, struct component *const material, const char *const name, vec3s position, float rotation) {
         struct scene *const scene = game_getCurrentScene(game);
@@ -18,10 +19,25 @@ static size_t createEntity(struct game *const game, struct component *const geom
         return object->idx;
 }
 
+static void removeEntity(struct entityController *const controller,
+                         struct networkEntity *const entity) {
+        struct scene *scene = game_getCurrentScene(controller->game);
+        if (scene != NULL) {
+                struct object *object = scene_getObjectFromIdx(scene, entity->localIdx);
+                scene_removeObject(scene, object);
+        }
+        
+        entity->init = false;
+        controller->numEntities--;
+}
+
 static void onNetworkEntityNew(void *registerArgs, void *fireArgs) {
         struct entityController *controller = registerArgs;
         struct eventNetworkEntityNew *args = fireArgs;
 
+        if (args->idx >= controller->capacity) {
+                return;
+        }
         struct networkEntity *entity = &controller->entities[args->idx];
         if (entity->init) {
                 fprintf(stderr, "NETWORK NEW ENTITY ALREADY EXISTS\n");
@@ -54,11 +70,37 @@ static void onNetworkEntityNew(void *registerArgs, void *fireArgs) {
         controller->numEntities++;
 }
 
+static void removeEntities(struct entityController *const controller) {
+        for (size_t i=0; i<controller->capacity && controller->numEntities>0; i++) {
+                if (controller->entities[i].init) {
+                        removeEntity(controller, &controller->entities[i]);
+                }
+        }
+}
+
+static void onNetworkWelcome(void *registerArgs, void *fireArgs) {
+        struct entityController *controller = registerArgs;
+        struct eventNetworkWelcome *args = fireArgs;
+
+        controller->tickPeriodNs = args->tickPeriodNs;
+
+        // The server has other entity indices
+        if (args->capacity != controller->capacity) {
+                removeEntities(controller);
+                controller->capacity = args->capacity;
+                controller->entities = srealloc(controller->entities,
+                                                args->capacity * sizeof(*controller->entities));
+                for (size_t i=0; i<controller->capacity; i++) {
+                        controller->entities[i].init = false;
+                }
+        }
+}
+
 static void onNetworkEntityDel(void *registerArgs, void *fireArgs) {
         struct entityController *controller = registerArgs;
         struct eventNetworkEntityDel *args = fireArgs;
 
-        if (!controller->game->inScene) {
+        if (!controller->game->inScene || args->idx >= controller->capacity) {
                 return;
         }
 
@@ -68,21 +110,22 @@ static void onNetworkEntityDel(void *registerArgs, void *fireArgs) {
                 return;
         }
 
-        struct scene *scene = game_getCurrentScene(controller->game);
-        if (scene != NULL) {
-                struct object *object = scene_getObjectFromIdx(scene, entity->localIdx);
-                scene_removeObject(scene, object);
-        }
-        
-        entity->init = false;
-        controller->numEntities--;
+        removeEntity(controller, entity);
+}
+
+// Entity indices belong to the server, the new one sends its own entities
+static void onNetworkRedirect(void *registerArgs, void *fireArgs) {
+        struct entityController *controller = registerArgs;
+        (void)fireArgs;
+
+        removeEntities(controller);
 }
 
 static void onNetworkEntityUpdate(void *registerArgs, void *fireArgs) {
         struct entityController *controller = registerArgs;
         struct eventNetworkEntityUpdate *args = fireArgs;
 
-        if (!controller->game->inScene) {
+        if (!controller->game->inScene || args->idx >= controller->capacity) {
                 return;
         }
 
@@ -139,11 +182,11 @@ static void onUpdate(void *registerArgs, void *fireArgs) {
         struct timespec now = monotonic();
 
         size_t count = 0;
-        for (size_t i=0; i<MAX_ENTITIES && count<controller->numEntities; i++) {
+        for (size_t i=0; i<controller->capacity && count<controller->numEntities; i++) {
                 struct networkEntity *entity = &controller->entities[i];
                 if (entity->init) {
                         unsigned long elapsed_ns = monotonic_difference(now, entity->lastUpdate);
-                        float t = (float)elapsed_ns/(float)TICK_PERIOD_NS;
+                        float t = (float)elapsed_ns/(float)controller->tickPeriodNs;
                         if (t > 2 || t < 0) {
                                 continue;
                         }
@@ -183,7 +226,7 @@ static void onSceneChange(void *registerArgs, void *fireArgs) {
         controller->playerIdx = scene_idxByName(scene, controller->playerName);
 
         size_t count = 0;
-        for (size_t i=0; i<MAX_ENTITIES && count<controller->numEntities; i++) {
+        for (size_t i=0; i<controller->capacity && count<controller->numEntities; i++) {
                 struct networkEntity *entity = &controller->entities[i];
                 if (entity->init) {
                         static char name[256];
@@ -200,15 +243,22 @@ void entityController_setup(struct entityController *const controller, struct ga
         controller->game = game;
         controller->numEntities = 0;
         controller->playerName = playerName;
-
-        for (size_t i=0; i<MAX_ENTITIES; i++) {
-                controller->entities[i].init = false;
-        }
+        controller->tickPeriodNs = TICK_PERIOD_NS_DEFAULT;
+        controller->entities = NULL;
+        controller->capacity = 0;
 
         eventBroker_register(onNetworkEntityNew, EVENT_BROKER_PRIORITY_HIGH, (enum eventBrokerEvent)EVENT_NETWORK_ENTITY_NEW, controller);
+        eventBroker_register(onNetworkWelcome, EVENT_BROKER_PRIORITY_HIGH, (enum eventBrokerEvent)EVENT_NETWORK_WELCOME, controller);
         eventBroker_register(onNetworkEntityDel, EVENT_BROKER_PRIORITY_HIGH, (enum eventBrokerEvent)EVENT_NETWORK_ENTITY_DEL, controller);
+        eventBroker_register(onNetworkRedirect, EVENT_BROKER_PRIORITY_HIGH, (enum eventBrokerEvent)EVENT_NETWORK_REDIRECT, controller);
         eventBroker_register(onNetworkEntityUpdate, EVENT_BROKER_PRIORITY_HIGH, (enum eventBrokerEvent)EVENT_NETWORK_ENTITY_UPDATE, controller);
         eventBroker_register(onSceneChange, EVENT_BROKER_PRIORITY_HIGH, EVENT_BROKER_SCENE_CHANGED, controller);
 
         eventBroker_register(onUpdate, EVENT_BROKER_PRIORITY_HIGH, EVENT_BROKER_UPDATE, controller);
 }
+
+void entityController_free(struct entityController *const controller) {
+        free(controller->entities);
+        controller->entities = NULL;
+        controller->capacity = 0;
+}
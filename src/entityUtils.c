@@ -2,6 +2,12 @@
 #include <curve.h>
 #include <cglm/cglm.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 static const struct curve jump_curve = {
         .p0 = 0.0f,
         .c0 = 0.5f,
@@ -48,3 +54,176 @@ float jump_fall_animation(bool *const jumping, bool *const falling, const float
 
         return v;
 }
+
+void apply_player_input(const struct playerInput *const input, float *const x, float *const y,
+                        float *const rotation, uint32_t *const jump_state, float *const airtime,
+                        const float timeDelta) {
+        *rotation = input->yaw;
+
+        // x is forward and y is left, as the player faces
+        int forward = 0;
+        int left = 0;
+        if (input->buttons & INPUT_FORWARD) {
+                forward += 1;
+        }
+        if (input->buttons & INPUT_BACKWARD) {
+                forward -= 1;
+        }
+        if (input->buttons & INPUT_LEFT) {
+                left += 1;
+        }
+        if (input->buttons & INPUT_RIGHT) {
+                left -= 1;
+        }
+        if (forward != 0 || left != 0) {
+                const float scale = PLAYER_SPEED * timeDelta / sqrtf((float)(forward*forward + left*left));
+                const float c = cosf(input->yaw);
+                const float s = sinf(input->yaw);
+                *x += (c*(float)forward - s*(float)left) * scale;
+                *y += (s*(float)forward + c*(float)left) * scale;
+        }
+
+        if ((input->buttons & INPUT_JUMP) && *jump_state == 0) {
+                *jump_state = JUMP_STATE_JUMPING;
+                *airtime = 0;
+        }
+}
+
+static void jump_fall_animation_single(float *const airtime, uint32_t *const state,
+                                       float *const height, const float timeDelta) {
+        bool jumping = *state & JUMP_STATE_JUMPING;
+        bool falling = *state & JUMP_STATE_FALLING;
+        if (!jumping && !falling) {
+                *height = 0;
+                return;
+        }
+
+        *airtime += timeDelta;
+        *height = jump_fall_animation(&jumping, &falling, *airtime);
+        *state = (jumping ? JUMP_STATE_JUMPING : 0) | (falling ? JUMP_STATE_FALLING : 0);
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+#if defined(__AVX2__)
+#define LANES 8
+typedef __m256 vfloat;
+typedef __m256i vint;
+#define vf_set1 _mm256_set1_ps
+#define vf_load _mm256_loadu_ps
+#define vf_store _mm256_storeu_ps
+#define vf_add _mm256_add_ps
+#define vf_sub _mm256_sub_ps
+#define vf_mul _mm256_mul_ps
+#define vf_and _mm256_and_ps
+#define vf_andnot _mm256_andnot_ps
+#define vf_or _mm256_or_ps
+#define vf_gt(a, b) _mm256_cmp_ps((a), (b), _CMP_GT_OQ)
+#define vf_le(a, b) _mm256_cmp_ps((a), (b), _CMP_LE_OQ)
+#define vf_blend(a, b, mask) _mm256_blendv_ps((a), (b), (mask))
+#define vi_set1 _mm256_set1_epi32
+#define vi_load(p) _mm256_loadu_si256((const __m256i*)(p))
+#define vi_store(p, v) _mm256_storeu_si256((__m256i*)(p), (v))
+#define vi_and _mm256_and_si256
+#define vi_or _mm256_or_si256
+#define vi_eq _mm256_cmpeq_epi32
+#define vi_to_mask _mm256_castsi256_ps
+#define vf_to_int _mm256_castps_si256
+#else
+#define LANES 4
+typedef __m128 vfloat;
+typedef __m128i vint;
+#define vf_set1 _mm_set1_ps
+#define vf_load _mm_loadu_ps
+#define vf_store _mm_storeu_ps
+#define vf_add _mm_add_ps
+#define vf_sub _mm_sub_ps
+#define vf_mul _mm_mul_ps
+#define vf_and _mm_and_ps
+#define vf_andnot _mm_andnot_ps
+#define vf_or _mm_or_ps
+#define vf_gt _mm_cmpgt_ps
+#define vf_le _mm_cmple_ps
+#define vf_blend(a, b, mask) _mm_or_ps(_mm_andnot_ps((mask), (a)), _mm_and_ps((mask), (b)))
+#define vi_set1 _mm_set1_epi32
+#define vi_load(p) _mm_loadu_si128((const __m128i*)(p))
+#define vi_store(p, v) _mm_storeu_si128((__m128i*)(p), (v))
+#define vi_and _mm_and_si128
+#define vi_or _mm_or_si128
+#define vi_eq _mm_cmpeq_epi32
+#define vi_to_mask _mm_castsi128_ps
+#define vf_to_int _mm_castps_si128
+#endif
+
+// Same as glm_bezier
+static inline vfloat bezier_lanes(const vfloat s, const struct curve *const curve) {
+        const vfloat x = vf_sub(vf_set1(1.0f), s);
+        const vfloat xx = vf_mul(x, x);
+        const vfloat ss = vf_mul(s, s);
+        const vfloat p0 = vf_mul(vf_mul(vf_set1(curve->p0), xx), x);
+        const vfloat c0 = vf_mul(vf_mul(vf_set1(curve->c0), s), xx);
+        const vfloat c1 = vf_mul(vf_mul(vf_set1(curve->c1), ss), x);
+        const vfloat p1 = vf_mul(vf_mul(vf_set1(curve->p1), ss), s);
+        return vf_add(vf_add(p0, vf_mul(vf_set1(3.0f), vf_add(c0, c1))), p1);
+}
+
+static size_t jump_fall_animation_lanes(const size_t count, float *const airtime,
+                                        uint32_t *const state, float *const height,
+                                        const float timeDelta) {
+        const vint jumpBit = vi_set1((int)JUMP_STATE_JUMPING);
+        const vint fallBit = vi_set1((int)JUMP_STATE_FALLING);
+        const vfloat one = vf_set1(1.0f);
+        const vfloat two = vf_set1(2.0f);
+
+        size_t i = 0;
+        for (; i + LANES <= count; i += LANES) {
+                const vint st = vi_load(&state[i]);
+                const vfloat jumping = vi_to_mask(vi_eq(vi_and(st, jumpBit), jumpBit));
+                const vfloat falling = vi_to_mask(vi_eq(vi_and(st, fallBit), fallBit));
+                const vfloat airborne = vf_or(jumping, falling);
+
+                const vfloat air = vf_add(vf_load(&airtime[i]),
+                                          vf_and(airborne, vf_set1(timeDelta)));
+                const vfloat s = vf_mul(air, vf_set1(1.0f / JUMP_TIME));
+
+                // see jump_fall_animation
+                const vfloat newJumping = vf_and(jumping, vf_le(s, one));
+                const vfloat newFalling = vf_or(vf_andnot(newJumping, jumping),
+                                                vf_andnot(jumping, vf_and(falling, vf_le(s, two))));
+
+                const vfloat jumpHeight = bezier_lanes(s, &jump_curve);
+                const vfloat fallHeight = bezier_lanes(vf_sub(s, one), &fall_curve);
+                vfloat v = vf_and(newFalling, fallHeight);
+                v = vf_blend(v, jumpHeight, newJumping);
+                v = vf_mul(v, vf_set1(JUMP_HEIGHT));
+
+                vf_store(&airtime[i], air);
+                vf_store(&height[i], v);
+                vi_store(&state[i], vi_or(vi_and(vf_to_int(newJumping), jumpBit),
+                                          vi_and(vf_to_int(newFalling), fallBit)));
+        }
+        return i;
+}
+
+#else
+
+static size_t jump_fall_animation_lanes(const size_t count, float *const airtime,
+                                        uint32_t *const state, float *const height,
+                                        const float timeDelta) {
+        (void)count;
+        (void)airtime;
+        (void)state;
+        (void)height;
+        (void)timeDelta;
+        return 0;
+}
+
+#endif
+
+void jump_fall_animation_batch(const size_t count, float *const airtime, uint32_t *const state,
+                               float *const height, const float timeDelta) {
+        size_t i = jump_fall_animation_lanes(count, airtime, state, height, timeDelta);
+        for (; i<count; i++) {
+                jump_fall_animation_single(&airtime[i], &state[i], &height[i], timeDelta);
+        }
+}
@@ -0,0 +1,296 @@
+#define _GNU_SOURCE
+
+#include <journal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Buffer of the journal file, flushed every tick
+#define JOURNAL_BUFFER_SIZE (1 << 16)
+
+struct __attribute__((packed)) journalTick {
+        uint8_t type;
+        uint32_t tick;
+};
+
+struct __attribute__((packed)) journalCommand {
+        uint8_t type;
+        uint8_t command;
+        uint16_t peer;
+        uint32_t connectID;
+        uint32_t roundTripTime;
+        uint32_t roundTripTimeVariance;
+        uint64_t time;
+        uint32_t size;
+};
+
+// What follows a command, depending on its type
+struct __attribute__((packed)) journalConnection {
+        uint32_t host;
+        uint16_t port;
+        uint32_t token;
+};
+
+struct __attribute__((packed)) journalMovement {
+        uint32_t sequence;
+        uint8_t fields;
+        vec3s position;
+        vec2s velocity;
+        float rotation;
+};
+
+struct __attribute__((packed)) journalInput {
+        struct playerInput input;
+        uint32_t sequence;
+};
+
+union journalPayload {
+        struct journalConnection connection;
+        struct journalMovement movement;
+        struct journalInput input;
+        uint32_t snapshot;
+};
+
+static size_t payload_size(const enum serverCommandType type) {
+        switch (type) {
+        case SERVER_COMMAND_CONNECT:
+                return sizeof(struct journalConnection);
+        case SERVER_COMMAND_MOVEMENT:
+                return sizeof(struct journalMovement);
+        case SERVER_COMMAND_INPUT:
+                return sizeof(struct journalInput);
+        case SERVER_COMMAND_SNAPSHOT_ACK:
+                return sizeof(uint32_t);
+        case SERVER_COMMAND_DISCONNECT:
+        case SERVER_COMMAND_NEIGHBOR_UP:
+        case SERVER_COMMAND_NEIGHBOR_DOWN:
+        case SERVER_COMMAND_LINK_RECEIVE:
+        case SERVER_COMMAND_LINK_CLOSED:
+        default:
+                return 0;
+        }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool journalWriter_open(struct journalWriter *const writer, const char *const path,
+                        const struct journalHeader *const header) {
+        writer->file = fopen(path, "wb");
+        if (writer->file == NULL) {
+                return false;
+        }
+        setvbuf(writer->file, NULL, _IOFBF, JOURNAL_BUFFER_SIZE);
+        if (fwrite(header, sizeof(*header), 1, writer->file) != 1) {
+                const int error = errno;
+                fclose(writer->file);
+                errno = error;
+                return false;
+        }
+        return true;
+}
+
+void journalWriter_tick(struct journalWriter *const writer, const uint32_t tick) {
+        fflush(writer->file);
+
+        struct journalTick record;
+        record.type = JOURNAL_RECORD_TICK;
+        record.tick = tick;
+        fwrite(&record, sizeof(record), 1, writer->file);
+}
+
+void journalWriter_command(struct journalWriter *const writer,
+                           const struct serverCommand *const command, const uint64_t time) {
+        uint8_t payload[sizeof(union journalPayload)];
+        switch (command->type) {
+        case SERVER_COMMAND_CONNECT: {
+                struct journalConnection connection;
+                connection.host = command->connection.address.host;
+                connection.port = command->connection.address.port;
+                connection.token = command->connection.token;
+                memcpy(payload, &connection, sizeof(connection));
+                break;
+        }
+        case SERVER_COMMAND_MOVEMENT: {
+                struct journalMovement movement;
+                movement.sequence = command->sequence;
+                movement.fields = (uint8_t)command->fields;
+                movement.position = command->position;
+                movement.velocity = command->velocity;
+                movement.rotation = command->rotation;
+                memcpy(payload, &movement, sizeof(movement));
+                break;
+        }
+        case SERVER_COMMAND_INPUT: {
+                struct journalInput input;
+                input.input = command->input;
+                input.sequence = command->sequence;
+                memcpy(payload, &input, sizeof(input));
+                break;
+        }
+        case SERVER_COMMAND_SNAPSHOT_ACK:
+                memcpy(payload, &command->snapshot, sizeof(command->snapshot));
+                break;
+        case SERVER_COMMAND_DISCONNECT:
+                break;
+        case SERVER_COMMAND_NEIGHBOR_UP:
+        case SERVER_COMMAND_NEIGHBOR_DOWN:
+        case SERVER_COMMAND_LINK_RECEIVE:
+        case SERVER_COMMAND_LINK_CLOSED:
+        default:
+                return;
+        }
+
+        struct journalCommand record;
+        record.type = JOURNAL_RECORD_COMMAND;
+        record.command = (uint8_t)command->type;
+        record.peer = (uint16_t)command->peer.idx;
+        record.connectID = command->peer.connectID;
+        record.roundTripTime = command->roundTripTime;
+        record.roundTripTimeVariance = command->roundTripTimeVariance;
+        record.time = time;
+        record.size = (uint32_t)command->size;
+        fwrite(&record, sizeof(record), 1, writer->file);
+        fwrite(payload, payload_size(command->type), 1, writer->file);
+}
+
+void journalWriter_close(struct journalWriter *const writer) {
+        fclose(writer->file);
+        writer->file = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool journalReader_open(struct journalReader *const reader, const char *const path) {
+        const int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+                perror("open");
+                return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+                perror("fstat");
+                close(fd);
+                return false;
+        }
+        reader->size = (size_t)st.st_size;
+        if (reader->size < sizeof(reader->header)) {
+                fprintf(stderr, "%s is not a journal\n", path);
+                close(fd);
+                return false;
+        }
+
+        void *data = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+                perror("mmap");
+                return false;
+        }
+        // read once, front to back
+        madvise(data, reader->size, MADV_SEQUENTIAL);
+        reader->data = data;
+
+        memcpy(&reader->header, reader->data, sizeof(reader->header));
+        if (reader->header.magic != JOURNAL_MAGIC || reader->header.version != JOURNAL_VERSION) {
+                fprintf(stderr, "%s is not a journal of this version\n", path);
+                journalReader_close(reader);
+                return false;
+        }
+        reader->pos = sizeof(reader->header);
+        return true;
+}
+
+bool journalReader_next(struct journalReader *const reader, struct journalRecord *const record) {
+        const size_t left = reader->size - reader->pos;
+        const uint8_t *data = reader->data + reader->pos;
+        if (left == 0) {
+                return false;
+        }
+
+        if (data[0] == JOURNAL_RECORD_TICK) {
+                struct journalTick tick;
+                if (left < sizeof(tick)) {
+                        return false;
+                }
+                memcpy(&tick, data, sizeof(tick));
+                record->type = JOURNAL_RECORD_TICK;
+                record->tick = tick.tick;
+                reader->pos += sizeof(tick);
+                return true;
+        }
+        if (data[0] != JOURNAL_RECORD_COMMAND) {
+                fprintf(stderr, "corrupt journal record at %zu\n", reader->pos);
+                return false;
+        }
+
+        struct journalCommand command;
+        if (left < sizeof(command)) {
+                return false;
+        }
+        memcpy(&command, data, sizeof(command));
+        const enum serverCommandType type = command.command;
+        const size_t size = payload_size(type);
+        if (left < sizeof(command) + size) {
+                return false;
+        }
+        const uint8_t *payload = data + sizeof(command);
+
+        record->type = JOURNAL_RECORD_COMMAND;
+        record->time = command.time;
+        memset(&record->command, 0, sizeof(record->command));
+        record->command.type = type;
+        record->command.peer.idx = command.peer;
+        record->command.peer.connectID = command.connectID;
+        record->command.roundTripTime = command.roundTripTime;
+        record->command.roundTripTimeVariance = command.roundTripTimeVariance;
+        record->command.size = command.size;
+        switch (type) {
+        case SERVER_COMMAND_CONNECT: {
+                struct journalConnection connection;
+                memcpy(&connection, payload, sizeof(connection));
+                record->command.connection.address.host = connection.host;
+                record->command.connection.address.port = connection.port;
+                record->command.connection.token = connection.token;
+                break;
+        }
+        case SERVER_COMMAND_MOVEMENT: {
+                struct journalMovement movement;
+                memcpy(&movement, payload, sizeof(movement));
+                record->command.sequence = movement.sequence;
+                record->command.fields = movement.fields;
+                record->command.position = movement.position;
+                record->command.velocity = movement.velocity;
+                record->command.rotation = movement.rotation;
+                break;
+        }
+        case SERVER_COMMAND_INPUT: {
+                struct journalInput input;
+                memcpy(&input, payload, sizeof(input));
+                record->command.input = input.input;
+                record->command.sequence = input.sequence;
+                break;
+        }
+        case SERVER_COMMAND_SNAPSHOT_ACK:
+                memcpy(&record->command.snapshot, payload, sizeof(record->command.snapshot));
+                break;
+        case SERVER_COMMAND_DISCONNECT:
+                break;
+        case SERVER_COMMAND_NEIGHBOR_UP:
+        case SERVER_COMMAND_NEIGHBOR_DOWN:
+        case SERVER_COMMAND_LINK_RECEIVE:
+        case SERVER_COMMAND_LINK_CLOSED:
+        default:
+                fprintf(stderr, "corrupt journal command at %zu\n", reader->pos);
+                return false;
+        }
+
+        reader->pos += sizeof(command) + size;
+        return true;
+}
+
+void journalReader_close(struct journalReader *const reader) {
+        munmap(reader->data, reader->size);
+        reader->data = NULL;
+}
@@ -0,0 +1,890 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <levelCollision.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Most triangles in a leaf, before padding
+#define LEAF_TRIANGLES 8
+// Deeper than a hierarchy split in halves can get
+#define MAX_DEPTH 64
+// How far from what it touches a moving sphere stops, so that its next move
+// does not start touching it
+#define SKIN 0.01f
+// Times a moving sphere slides along what it touches before it stops
+#define MAX_SLIDES 3
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+#if defined(__AVX2__)
+#define LANES 8
+typedef __m256 vfloat;
+#define vf_set1 _mm256_set1_ps
+#define vf_load _mm256_loadu_ps
+#define vf_store _mm256_storeu_ps
+#define vf_add _mm256_add_ps
+#define vf_sub _mm256_sub_ps
+#define vf_mul _mm256_mul_ps
+#define vf_div _mm256_div_ps
+#define vf_sqrt _mm256_sqrt_ps
+#define vf_and _mm256_and_ps
+#define vf_or _mm256_or_ps
+#define vf_ge(a, b) _mm256_cmp_ps((a), (b), _CMP_GE_OQ)
+#define vf_gt(a, b) _mm256_cmp_ps((a), (b), _CMP_GT_OQ)
+#define vf_lt(a, b) _mm256_cmp_ps((a), (b), _CMP_LT_OQ)
+#define vf_le(a, b) _mm256_cmp_ps((a), (b), _CMP_LE_OQ)
+#define vf_blend(a, b, mask) _mm256_blendv_ps((a), (b), (mask))
+#else
+#define LANES 4
+typedef __m128 vfloat;
+#define vf_set1 _mm_set1_ps
+#define vf_load _mm_loadu_ps
+#define vf_store _mm_storeu_ps
+#define vf_add _mm_add_ps
+#define vf_sub _mm_sub_ps
+#define vf_mul _mm_mul_ps
+#define vf_div _mm_div_ps
+#define vf_sqrt _mm_sqrt_ps
+#define vf_and _mm_and_ps
+#define vf_or _mm_or_ps
+#define vf_ge _mm_cmpge_ps
+#define vf_gt _mm_cmpgt_ps
+#define vf_lt _mm_cmplt_ps
+#define vf_le _mm_cmple_ps
+#define vf_blend(a, b, mask) _mm_or_ps(_mm_andnot_ps((mask), (a)), _mm_and_ps((mask), (b)))
+#endif
+
+#else
+
+// Triangles tested at once
+#define LANES 1
+
+#endif
+
+struct sweep {
+        vec3s from;
+        vec3s delta;
+        // 1/delta, kept finite
+        vec3s inverse;
+        float radius;
+
+        // closest hit so far
+        bool found;
+        float fraction;
+        size_t triangle;
+};
+
+struct buildTriangle {
+        vec3s a, b, c;
+        vec3s centroid;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Make room for one more element at the end of an array
+static void *reserve(void *const array, const size_t count, size_t *const capacity,
+                     const size_t size) {
+        if (count < *capacity) {
+                return array;
+        }
+        *capacity = *capacity == 0 ? 1024 : *capacity * 2;
+        void *grown = realloc(array, *capacity * size);
+        if (grown == NULL) {
+                fprintf(stderr, "could not allocate memory\n");
+                exit(EXIT_FAILURE);
+        }
+        return grown;
+}
+
+static uint64_t hash_vec3(uint64_t hash, const vec3s v) {
+        // FNV-1a
+        unsigned char bytes[sizeof(v.raw)];
+        memcpy(bytes, v.raw, sizeof(bytes));
+        for (size_t i=0; i<sizeof(bytes); i++) {
+                hash ^= bytes[i];
+                hash *= 0x100000001b3ULL;
+        }
+        return hash;
+}
+
+static bool add_triangle(struct buildTriangle **const triangles, size_t *const count,
+                         size_t *const capacity, const vec3s a, const vec3s b, const vec3s c) {
+        // nothing can touch a triangle with no area
+        const vec3s normal = glms_vec3_cross(glms_vec3_sub(b, a), glms_vec3_sub(c, a));
+        if (glms_vec3_dot(normal, normal) <= 1e-12f) {
+                return false;
+        }
+
+        *triangles = reserve(*triangles, *count, capacity, sizeof(**triangles));
+        struct buildTriangle *triangle = &(*triangles)[(*count)++];
+        triangle->a = a;
+        triangle->b = b;
+        triangle->c = c;
+        triangle->centroid = glms_vec3_scale(glms_vec3_add(glms_vec3_add(a, b), c), 1.0f / 3.0f);
+        return true;
+}
+
+// Read the vertices and faces of an OBJ file, faces with more than three
+// corners are split into triangles around their first corner.
+static bool read_obj(FILE *const file, const char *const path,
+                     struct buildTriangle **const triangles, size_t *const numTriangles,
+                     uint64_t *const hash) {
+        vec3s *vertices = NULL;
+        size_t numVertices = 0;
+        size_t verticesCapacity = 0;
+        size_t trianglesCapacity = 0;
+        *triangles = NULL;
+        *numTriangles = 0;
+        *hash = 0xcbf29ce484222325ULL;
+
+        char *line = NULL;
+        size_t lineSize = 0;
+        size_t lineNumber = 0;
+        bool ok = true;
+        while (ok && getline(&line, &lineSize, file) != -1) {
+                lineNumber++;
+                if (line[0] == 'v' && line[1] == ' ') {
+                        vec3s v;
+                        if (sscanf(line + 2, "%f %f %f", &v.x, &v.y, &v.z) != 3) {
+                                ok = false;
+                                break;
+                        }
+                        vertices = reserve(vertices, numVertices, &verticesCapacity,
+                                           sizeof(*vertices));
+                        vertices[numVertices++] = v;
+                } else if (line[0] == 'f' && line[1] == ' ') {
+                        char *s = line + 2;
+                        size_t corners = 0;
+                        size_t first = 0;
+                        size_t previous = 0;
+                        while (true) {
+                                char *end;
+                                const long idx = strtol(s, &end, 10);
+                                if (end == s) {
+                                        break;
+                                }
+                                // skip texture coordinates and normals
+                                s = end;
+                                while (*s != '\0' && !isspace((unsigned char)*s)) {
+                                        s++;
+                                }
+
+                                // indices start at 1, negative ones count
+                                // back from the last vertex read
+                                const long vertex = idx < 0 ? (long)numVertices + idx : idx - 1;
+                                if (vertex < 0 || (size_t)vertex >= numVertices) {
+                                        ok = false;
+                                        break;
+                                }
+                                if (corners == 0) {
+                                        first = (size_t)vertex;
+                                } else if (corners >= 2 &&
+                                           add_triangle(triangles, numTriangles, &trianglesCapacity,
+                                                        vertices[first], vertices[previous],
+                                                        vertices[vertex])) {
+                                        const struct buildTriangle *t = &(*triangles)[*numTriangles - 1];
+                                        *hash = hash_vec3(hash_vec3(hash_vec3(*hash, t->a), t->b), t->c);
+                                }
+                                previous = (size_t)vertex;
+                                corners++;
+                        }
+                }
+        }
+        if (!ok) {
+                fprintf(stderr, "%s:%zu: malformed line\n", path, lineNumber);
+                free(*triangles);
+                *triangles = NULL;
+        }
+
+        free(line);
+        free(vertices);
+        return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Axis build_compare orders triangles on, qsort has no way to pass it
+static int split_axis;
+
+static int build_compare(const void *const a, const void *const b) {
+        const float ca = ((const struct buildTriangle*)a)->centroid.raw[split_axis];
+        const float cb = ((const struct buildTriangle*)b)->centroid.raw[split_axis];
+        return (ca > cb) - (ca < cb);
+}
+
+static void build_triangle(struct levelCollision *const level,
+                           const struct buildTriangle *const triangle) {
+        const size_t i = level->numTriangles++;
+        level->ax[i] = triangle->a.x;
+        level->ay[i] = triangle->a.y;
+        level->az[i] = triangle->a.z;
+        level->bx[i] = triangle->b.x;
+        level->by[i] = triangle->b.y;
+        level->bz[i] = triangle->b.z;
+        level->cx[i] = triangle->c.x;
+        level->cy[i] = triangle->c.y;
+        level->cz[i] = triangle->c.z;
+
+        const vec3s normal = glms_vec3_normalize(
+                glms_vec3_cross(glms_vec3_sub(triangle->b, triangle->a),
+                                glms_vec3_sub(triangle->c, triangle->a)));
+        level->nx[i] = normal.x;
+        level->ny[i] = normal.y;
+        level->nz[i] = normal.z;
+}
+
+// Add the node holding triangles [begin, end) and everything below it. Nodes
+// are split in two halves along the axis their triangles spread the most on.
+static void build_node(struct levelCollision *const level, struct buildTriangle *const triangles,
+                       const size_t begin, const size_t end) {
+        const size_t node = level->numNodes++;
+
+        vec3s min = triangles[begin].a;
+        vec3s max = min;
+        vec3s centroidMin = triangles[begin].centroid;
+        vec3s centroidMax = centroidMin;
+        for (size_t i=begin; i<end; i++) {
+                const struct buildTriangle *t = &triangles[i];
+                min = glms_vec3_minv(min, glms_vec3_minv(t->a, glms_vec3_minv(t->b, t->c)));
+                max = glms_vec3_maxv(max, glms_vec3_maxv(t->a, glms_vec3_maxv(t->b, t->c)));
+                centroidMin = glms_vec3_minv(centroidMin, t->centroid);
+                centroidMax = glms_vec3_maxv(centroidMax, t->centroid);
+        }
+        level->minX[node] = min.x;
+        level->minY[node] = min.y;
+        level->minZ[node] = min.z;
+        level->maxX[node] = max.x;
+        level->maxY[node] = max.y;
+        level->maxZ[node] = max.z;
+
+        if (end - begin <= LEAF_TRIANGLES) {
+                level->first[node] = (uint32_t)level->numTriangles;
+                for (size_t i=begin; i<end; i++) {
+                        build_triangle(level, &triangles[i]);
+                }
+                // Repeat the last triangle up to a whole number of lanes,
+                // testing it twice does no harm
+                while ((level->numTriangles - level->first[node]) % LANES != 0) {
+                        build_triangle(level, &triangles[end - 1]);
+                }
+                level->count[node] = (uint32_t)(level->numTriangles - level->first[node]);
+                return;
+        }
+
+        const vec3s extent = glms_vec3_sub(centroidMax, centroidMin);
+        split_axis = 0;
+        if (extent.y > extent.raw[split_axis]) {
+                split_axis = 1;
+        }
+        if (extent.z > extent.raw[split_axis]) {
+                split_axis = 2;
+        }
+        qsort(&triangles[begin], end - begin, sizeof(*triangles), build_compare);
+
+        const size_t middle = begin + (end - begin) / 2;
+        build_node(level, triangles, begin, middle);
+        level->first[node] = (uint32_t)level->numNodes;
+        level->count[node] = 0;
+        build_node(level, triangles, middle, end);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static vec3s triangle_vertex(const float *const x, const float *const y, const float *const z,
+                             const size_t i) {
+        vec3s v;
+        v.x = x[i];
+        v.y = y[i];
+        v.z = z[i];
+        return v;
+}
+
+// Whether p, in the plane of a triangle, is inside it
+static bool inside_triangle(const vec3s p, const vec3s a, const vec3s b, const vec3s c,
+                            const vec3s normal) {
+        return glms_vec3_dot(glms_vec3_cross(glms_vec3_sub(b, a), glms_vec3_sub(p, a)), normal) >= 0 &&
+                glms_vec3_dot(glms_vec3_cross(glms_vec3_sub(c, b), glms_vec3_sub(p, b)), normal) >= 0 &&
+                glms_vec3_dot(glms_vec3_cross(glms_vec3_sub(a, c), glms_vec3_sub(p, c)), normal) >= 0;
+}
+
+// Where along from + t*delta, t in [0, best), a sphere first touches the
+// inside of a triangle's face, or best if it does not. Only the side the
+// sphere starts on counts. Sets overlap if it touches it at the start.
+static float sweep_face(const vec3s from, const vec3s delta, const float radius,
+                        const vec3s a, const vec3s b, const vec3s c, const vec3s normal,
+                        const float best, bool *const overlap) {
+        const float distance = glms_vec3_dot(glms_vec3_sub(from, a), normal);
+        const float side = distance < 0 ? -1.0f : 1.0f;
+        if (side * distance < radius &&
+            inside_triangle(glms_vec3_sub(from, glms_vec3_scale(normal, distance)), a, b, c, normal)) {
+                *overlap = true;
+                return best;
+        }
+        const float approach = -side * glms_vec3_dot(delta, normal);
+        if (approach <= 0) {
+                return best;
+        }
+        const float t = (side * distance - radius) / approach;
+        if (t < 0 || t >= best) {
+                return best;
+        }
+
+        const vec3s p = glms_vec3_sub(glms_vec3_add(from, glms_vec3_scale(delta, t)),
+                                      glms_vec3_scale(normal, side * radius));
+        if (!inside_triangle(p, a, b, c, normal)) {
+                return best;
+        }
+        return t;
+}
+
+// Same as sweep_face for the segment from a to b, which the moving sphere
+// touches when its center gets within radius of it.
+static float sweep_edge(const vec3s from, const vec3s delta, const float radius,
+                        const vec3s a, const vec3s b, const float best, bool *const overlap) {
+        const vec3s ba = glms_vec3_sub(b, a);
+        const vec3s fa = glms_vec3_sub(from, a);
+        const float baba = glms_vec3_dot(ba, ba);
+        const float bad = glms_vec3_dot(ba, delta);
+        const float bafa = glms_vec3_dot(ba, fa);
+
+        // where the center is at radius from the line through the segment
+        const float qa = baba * glms_vec3_dot(delta, delta) - bad * bad;
+        const float qb = baba * glms_vec3_dot(delta, fa) - bafa * bad;
+        const float qc = baba * glms_vec3_dot(fa, fa) - bafa * bafa - radius * radius * baba;
+        if (qc < 0 && bafa >= 0 && bafa <= baba) {
+                *overlap = true;
+                return best;
+        }
+        const float h = qb * qb - qa * qc;
+        if (qa <= 0 || h < 0) {
+                return best;
+        }
+        const float t = (-qb - sqrtf(h)) / qa;
+        const float along = bafa + t * bad;
+        if (t < 0 || t >= best || along < 0 || along > baba) {
+                return best;
+        }
+        return t;
+}
+
+// Same as sweep_face for a single point.
+static float sweep_vertex(const vec3s from, const vec3s delta, const float radius,
+                          const vec3s v, const float best, bool *const overlap) {
+        const vec3s fv = glms_vec3_sub(from, v);
+        const float qa = glms_vec3_dot(delta, delta);
+        const float qb = glms_vec3_dot(fv, delta);
+        const float qc = glms_vec3_dot(fv, fv) - radius * radius;
+        if (qc < 0) {
+                *overlap = true;
+                return best;
+        }
+        const float h = qb * qb - qa * qc;
+        if (h < 0) {
+                return best;
+        }
+        const float t = (-qb - sqrtf(h)) / qa;
+        if (t < 0 || t >= best) {
+                return best;
+        }
+        return t;
+}
+
+static void sweep_triangle(const struct levelCollision *const level, const size_t i,
+                           struct sweep *const sweep) {
+        const vec3s a = triangle_vertex(level->ax, level->ay, level->az, i);
+        const vec3s b = triangle_vertex(level->bx, level->by, level->bz, i);
+        const vec3s c = triangle_vertex(level->cx, level->cy, level->cz, i);
+        const vec3s normal = triangle_vertex(level->nx, level->ny, level->nz, i);
+
+        // a triangle the sphere starts in is ignored whole, not only the
+        // parts of it it touches at the start
+        bool overlap = false;
+        float t = sweep->fraction;
+        t = sweep_face(sweep->from, sweep->delta, sweep->radius, a, b, c, normal, t, &overlap);
+        t = sweep_edge(sweep->from, sweep->delta, sweep->radius, a, b, t, &overlap);
+        t = sweep_edge(sweep->from, sweep->delta, sweep->radius, b, c, t, &overlap);
+        t = sweep_edge(sweep->from, sweep->delta, sweep->radius, c, a, t, &overlap);
+        t = sweep_vertex(sweep->from, sweep->delta, sweep->radius, a, t, &overlap);
+        t = sweep_vertex(sweep->from, sweep->delta, sweep->radius, b, t, &overlap);
+        t = sweep_vertex(sweep->from, sweep->delta, sweep->radius, c, t, &overlap);
+        if (!overlap && t < sweep->fraction) {
+                sweep->found = true;
+                sweep->fraction = t;
+                sweep->triangle = i;
+        }
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+struct vec3Lanes {
+        vfloat x, y, z;
+};
+
+static inline struct vec3Lanes vec3_lanes(const vec3s v) {
+        struct vec3Lanes r;
+        r.x = vf_set1(v.x);
+        r.y = vf_set1(v.y);
+        r.z = vf_set1(v.z);
+        return r;
+}
+
+static inline struct vec3Lanes load_lanes(const float *const x, const float *const y,
+                                          const float *const z, const size_t i) {
+        struct vec3Lanes r;
+        r.x = vf_load(&x[i]);
+        r.y = vf_load(&y[i]);
+        r.z = vf_load(&z[i]);
+        return r;
+}
+
+static inline struct vec3Lanes sub_lanes(const struct vec3Lanes a, const struct vec3Lanes b) {
+        struct vec3Lanes r;
+        r.x = vf_sub(a.x, b.x);
+        r.y = vf_sub(a.y, b.y);
+        r.z = vf_sub(a.z, b.z);
+        return r;
+}
+
+static inline struct vec3Lanes scale_lanes(const struct vec3Lanes a, const vfloat s) {
+        struct vec3Lanes r;
+        r.x = vf_mul(a.x, s);
+        r.y = vf_mul(a.y, s);
+        r.z = vf_mul(a.z, s);
+        return r;
+}
+
+static inline vfloat dot_lanes(const struct vec3Lanes a, const struct vec3Lanes b) {
+        return vf_add(vf_add(vf_mul(a.x, b.x), vf_mul(a.y, b.y)), vf_mul(a.z, b.z));
+}
+
+static inline struct vec3Lanes cross_lanes(const struct vec3Lanes a, const struct vec3Lanes b) {
+        struct vec3Lanes r;
+        r.x = vf_sub(vf_mul(a.y, b.z), vf_mul(a.z, b.y));
+        r.y = vf_sub(vf_mul(a.z, b.x), vf_mul(a.x, b.z));
+        r.z = vf_sub(vf_mul(a.x, b.y), vf_mul(a.y, b.x));
+        return r;
+}
+
+// Whether p is on the inner side of the edge from a to b
+static inline vfloat inside_lanes(const struct vec3Lanes a, const struct vec3Lanes b,
+                                  const struct vec3Lanes p, const struct vec3Lanes normal) {
+        return vf_ge(dot_lanes(cross_lanes(sub_lanes(b, a), sub_lanes(p, a)), normal),
+                     vf_set1(0.0f));
+}
+
+// see sweep_face, overlap is a mask
+static inline vfloat sweep_face_lanes(const struct vec3Lanes from, const struct vec3Lanes delta,
+                                      const vfloat radius, const struct vec3Lanes a,
+                                      const struct vec3Lanes b, const struct vec3Lanes c,
+                                      const struct vec3Lanes normal, const vfloat best,
+                                      vfloat *const overlap) {
+        const vfloat zero = vf_set1(0.0f);
+        const vfloat distance = dot_lanes(sub_lanes(from, a), normal);
+        const vfloat side = vf_blend(vf_set1(1.0f), vf_set1(-1.0f), vf_lt(distance, zero));
+
+        const struct vec3Lanes projected = sub_lanes(from, scale_lanes(normal, distance));
+        vfloat start = vf_lt(vf_mul(side, distance), radius);
+        start = vf_and(start, inside_lanes(a, b, projected, normal));
+        start = vf_and(start, inside_lanes(b, c, projected, normal));
+        start = vf_and(start, inside_lanes(c, a, projected, normal));
+        *overlap = vf_or(*overlap, start);
+
+        const vfloat approach = vf_mul(vf_sub(zero, side), dot_lanes(delta, normal));
+        const vfloat t = vf_div(vf_sub(vf_mul(side, distance), radius), approach);
+
+        struct vec3Lanes p = sub_lanes(from, scale_lanes(normal, vf_mul(side, radius)));
+        p.x = vf_add(p.x, vf_mul(delta.x, t));
+        p.y = vf_add(p.y, vf_mul(delta.y, t));
+        p.z = vf_add(p.z, vf_mul(delta.z, t));
+
+        vfloat hit = vf_and(vf_gt(approach, zero), vf_and(vf_ge(t, zero), vf_lt(t, best)));
+        hit = vf_and(hit, inside_lanes(a, b, p, normal));
+        hit = vf_and(hit, inside_lanes(b, c, p, normal));
+        hit = vf_and(hit, inside_lanes(c, a, p, normal));
+        return vf_blend(best, t, hit);
+}
+
+// see sweep_edge
+static inline vfloat sweep_edge_lanes(const struct vec3Lanes from, const struct vec3Lanes delta,
+                                      const vfloat radius, const struct vec3Lanes a,
+                                      const struct vec3Lanes b, const vfloat best,
+                                      vfloat *const overlap) {
+        const vfloat zero = vf_set1(0.0f);
+        const struct vec3Lanes ba = sub_lanes(b, a);
+        const struct vec3Lanes fa = sub_lanes(from, a);
+        const vfloat baba = dot_lanes(ba, ba);
+        const vfloat bad = dot_lanes(ba, delta);
+        const vfloat bafa = dot_lanes(ba, fa);
+
+        const vfloat qa = vf_sub(vf_mul(baba, dot_lanes(delta, delta)), vf_mul(bad, bad));
+        const vfloat qb = vf_sub(vf_mul(baba, dot_lanes(delta, fa)), vf_mul(bafa, bad));
+        const vfloat qc = vf_sub(vf_sub(vf_mul(baba, dot_lanes(fa, fa)), vf_mul(bafa, bafa)),
+                                 vf_mul(vf_mul(radius, radius), baba));
+        const vfloat start = vf_and(vf_lt(qc, zero), vf_and(vf_ge(bafa, zero), vf_le(bafa, baba)));
+        *overlap = vf_or(*overlap, start);
+        const vfloat h = vf_sub(vf_mul(qb, qb), vf_mul(qa, qc));
+        const vfloat t = vf_div(vf_sub(vf_sub(zero, qb), vf_sqrt(h)), qa);
+        const vfloat along = vf_add(bafa, vf_mul(t, bad));
+
+        vfloat hit = vf_and(vf_gt(qa, zero), vf_ge(h, zero));
+        hit = vf_and(hit, vf_and(vf_ge(t, zero), vf_lt(t, best)));
+        hit = vf_and(hit, vf_and(vf_ge(along, zero), vf_le(along, baba)));
+        return vf_blend(best, t, hit);
+}
+
+// see sweep_vertex
+static inline vfloat sweep_vertex_lanes(const struct vec3Lanes from, const struct vec3Lanes delta,
+                                        const vfloat radius, const struct vec3Lanes v,
+                                        const vfloat best, vfloat *const overlap) {
+        const vfloat zero = vf_set1(0.0f);
+        const struct vec3Lanes fv = sub_lanes(from, v);
+        const vfloat qa = dot_lanes(delta, delta);
+        const vfloat qb = dot_lanes(fv, delta);
+        const vfloat qc = vf_sub(dot_lanes(fv, fv), vf_mul(radius, radius));
+        *overlap = vf_or(*overlap, vf_lt(qc, zero));
+        const vfloat h = vf_sub(vf_mul(qb, qb), vf_mul(qa, qc));
+        const vfloat t = vf_div(vf_sub(vf_sub(zero, qb), vf_sqrt(h)), qa);
+
+        const vfloat hit = vf_and(vf_ge(h, zero), vf_and(vf_ge(t, zero), vf_lt(t, best)));
+        return vf_blend(best, t, hit);
+}
+
+static size_t sweep_triangles_lanes(const struct levelCollision *const level, const size_t begin,
+                                    const size_t end, struct sweep *const sweep) {
+        const struct vec3Lanes from = vec3_lanes(sweep->from);
+        const struct vec3Lanes delta = vec3_lanes(sweep->delta);
+        const vfloat radius = vf_set1(sweep->radius);
+
+        size_t i = begin;
+        for (; i + LANES <= end; i += LANES) {
+                const struct vec3Lanes a = load_lanes(level->ax, level->ay, level->az, i);
+                const struct vec3Lanes b = load_lanes(level->bx, level->by, level->bz, i);
+                const struct vec3Lanes c = load_lanes(level->cx, level->cy, level->cz, i);
+                const struct vec3Lanes normal = load_lanes(level->nx, level->ny, level->nz, i);
+
+                const vfloat best = vf_set1(sweep->fraction);
+                vfloat overlap = vf_set1(0.0f);
+                vfloat t = best;
+                t = sweep_face_lanes(from, delta, radius, a, b, c, normal, t, &overlap);
+                t = sweep_edge_lanes(from, delta, radius, a, b, t, &overlap);
+                t = sweep_edge_lanes(from, delta, radius, b, c, t, &overlap);
+                t = sweep_edge_lanes(from, delta, radius, c, a, t, &overlap);
+                t = sweep_vertex_lanes(from, delta, radius, a, t, &overlap);
+                t = sweep_vertex_lanes(from, delta, radius, b, t, &overlap);
+                t = sweep_vertex_lanes(from, delta, radius, c, t, &overlap);
+                // see sweep_triangle
+                t = vf_blend(t, best, overlap);
+
+                float lanes[LANES];
+                vf_store(lanes, t);
+                for (size_t j=0; j<LANES; j++) {
+                        if (lanes[j] < sweep->fraction) {
+                                sweep->found = true;
+                                sweep->fraction = lanes[j];
+                                sweep->triangle = i + j;
+                        }
+                }
+        }
+        return i;
+}
+
+#else
+
+static size_t sweep_triangles_lanes(const struct levelCollision *const level, const size_t begin,
+                                    const size_t end, struct sweep *const sweep) {
+        (void)level;
+        (void)end;
+        (void)sweep;
+        return begin;
+}
+
+#endif
+
+// Whether the segment gets within radius of a node's bounds before the closest
+// hit so far, and if so where it does first
+static bool sweep_bounds(const struct levelCollision *const level, const size_t node,
+                         const struct sweep *const sweep, float *const enter) {
+        const float minimum[3] = {level->minX[node], level->minY[node], level->minZ[node]};
+        const float maximum[3] = {level->maxX[node], level->maxY[node], level->maxZ[node]};
+        float near = 0;
+        float far = sweep->fraction;
+        for (size_t axis=0; axis<3; axis++) {
+                const float t0 = (minimum[axis] - sweep->radius - sweep->from.raw[axis]) *
+                        sweep->inverse.raw[axis];
+                const float t1 = (maximum[axis] + sweep->radius - sweep->from.raw[axis]) *
+                        sweep->inverse.raw[axis];
+                near = fmaxf(near, fminf(t0, t1));
+                far = fminf(far, fmaxf(t0, t1));
+        }
+        *enter = near;
+        return near <= far;
+}
+
+// Visit the nodes the sphere gets to, nearest first so that what it hits
+// early on rules out the rest
+static void sweep_level(const struct levelCollision *const level, struct sweep *const sweep) {
+        uint32_t stack[MAX_DEPTH];
+        float stackEnter[MAX_DEPTH];
+        size_t depth = 0;
+
+        float enter;
+        if (!sweep_bounds(level, 0, sweep, &enter)) {
+                return;
+        }
+        stack[depth] = 0;
+        stackEnter[depth++] = enter;
+        while (depth > 0) {
+                depth--;
+                const uint32_t node = stack[depth];
+                if (stackEnter[depth] >= sweep->fraction) {
+                        continue;
+                }
+
+                if (level->count[node] == 0) {
+                        uint32_t near = node + 1;
+                        uint32_t far = level->first[node];
+                        float nearEnter, farEnter;
+                        bool nearHit = sweep_bounds(level, near, sweep, &nearEnter);
+                        bool farHit = sweep_bounds(level, far, sweep, &farEnter);
+                        if (nearHit && farHit && farEnter < nearEnter) {
+                                near = level->first[node];
+                                far = node + 1;
+                                const float swap = nearEnter;
+                                nearEnter = farEnter;
+                                farEnter = swap;
+                        }
+                        if (farHit) {
+                                stack[depth] = far;
+                                stackEnter[depth++] = farEnter;
+                        }
+                        if (nearHit) {
+                                stack[depth] = near;
+                                stackEnter[depth++] = nearEnter;
+                        }
+                        continue;
+                }
+
+                const size_t end = (size_t)level->first[node] + level->count[node];
+                size_t i = sweep_triangles_lanes(level, level->first[node], end, sweep);
+                for (; i<end; i++) {
+                        sweep_triangle(level, i, sweep);
+                }
+        }
+}
+
+// Closest point of a triangle to p
+static vec3s closest_point(const vec3s p, const vec3s a, const vec3s b, const vec3s c) {
+        const vec3s ab = glms_vec3_sub(b, a);
+        const vec3s ac = glms_vec3_sub(c, a);
+        const vec3s ap = glms_vec3_sub(p, a);
+        const float d1 = glms_vec3_dot(ab, ap);
+        const float d2 = glms_vec3_dot(ac, ap);
+        if (d1 <= 0 && d2 <= 0) {
+                return a;
+        }
+
+        const vec3s bp = glms_vec3_sub(p, b);
+        const float d3 = glms_vec3_dot(ab, bp);
+        const float d4 = glms_vec3_dot(ac, bp);
+        if (d3 >= 0 && d4 <= d3) {
+                return b;
+        }
+
+        const float vc = d1 * d4 - d3 * d2;
+        if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+                return glms_vec3_add(a, glms_vec3_scale(ab, d1 / (d1 - d3)));
+        }
+
+        const vec3s cp = glms_vec3_sub(p, c);
+        const float d5 = glms_vec3_dot(ab, cp);
+        const float d6 = glms_vec3_dot(ac, cp);
+        if (d6 >= 0 && d5 <= d6) {
+                return c;
+        }
+
+        const float vb = d5 * d2 - d1 * d6;
+        if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+                return glms_vec3_add(a, glms_vec3_scale(ac, d2 / (d2 - d6)));
+        }
+
+        const float va = d3 * d6 - d5 * d4;
+        if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+                return glms_vec3_add(b, glms_vec3_scale(glms_vec3_sub(c, b),
+                                                        (d4 - d3) / ((d4 - d3) + (d5 - d6))));
+        }
+
+        const float denominator = 1.0f / (va + vb + vc);
+        return glms_vec3_add(a, glms_vec3_add(glms_vec3_scale(ab, vb * denominator),
+                                              glms_vec3_scale(ac, vc * denominator)));
+}
+
+static vec3s hit_normal(const struct levelCollision *const level, const struct sweep *const sweep) {
+        const size_t i = sweep->triangle;
+        const vec3s center = glms_vec3_add(sweep->from, glms_vec3_scale(sweep->delta, sweep->fraction));
+        const vec3s closest = closest_point(center,
+                                            triangle_vertex(level->ax, level->ay, level->az, i),
+                                            triangle_vertex(level->bx, level->by, level->bz, i),
+                                            triangle_vertex(level->cx, level->cy, level->cz, i));
+        const vec3s away = glms_vec3_sub(center, closest);
+        const float distance = glms_vec3_norm(away);
+        if (distance > 1e-4f) {
+                return glms_vec3_scale(away, 1.0f / distance);
+        }
+
+        // rays touch the face itself, whose normal may point either way
+        const vec3s normal = triangle_vertex(level->nx, level->ny, level->nz, i);
+        if (glms_vec3_dot(normal, sweep->delta) > 0) {
+                return glms_vec3_scale(normal, -1.0f);
+        }
+        return normal;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool levelCollision_load(struct levelCollision *const level, const char *const path) {
+        FILE *file = fopen(path, "r");
+        if (file == NULL) {
+                perror(path);
+                return false;
+        }
+        struct buildTriangle *triangles;
+        size_t numTriangles;
+        const bool read = read_obj(file, path, &triangles, &numTriangles, &level->hash);
+        fclose(file);
+        if (!read) {
+                return false;
+        }
+        if (numTriangles == 0) {
+                fprintf(stderr, "%s: no triangles\n", path);
+                free(triangles);
+                return false;
+        }
+        if (numTriangles > UINT32_MAX / LANES) {
+                fprintf(stderr, "%s: too many triangles\n", path);
+                free(triangles);
+                return false;
+        }
+
+        // Every leaf has at least one triangle and is padded by less than a
+        // whole number of lanes
+        const size_t maxNodes = 2 * numTriangles;
+        const size_t maxTriangles = numTriangles * LANES;
+        float **nodeArrays[] = {&level->minX, &level->minY, &level->minZ,
+                                &level->maxX, &level->maxY, &level->maxZ};
+        float **triangleArrays[] = {&level->ax, &level->ay, &level->az,
+                                    &level->bx, &level->by, &level->bz,
+                                    &level->cx, &level->cy, &level->cz,
+                                    &level->nx, &level->ny, &level->nz};
+        bool allocated = true;
+        for (size_t i=0; i<sizeof(nodeArrays)/sizeof(*nodeArrays); i++) {
+                *nodeArrays[i] = malloc(maxNodes * sizeof(float));
+                allocated = allocated && *nodeArrays[i] != NULL;
+        }
+        for (size_t i=0; i<sizeof(triangleArrays)/sizeof(*triangleArrays); i++) {
+                *triangleArrays[i] = malloc(maxTriangles * sizeof(float));
+                allocated = allocated && *triangleArrays[i] != NULL;
+        }
+        level->first = malloc(maxNodes * sizeof(*level->first));
+        level->count = malloc(maxNodes * sizeof(*level->count));
+        if (!allocated || level->first == NULL || level->count == NULL) {
+                fprintf(stderr, "could not allocate memory\n");
+                exit(EXIT_FAILURE);
+        }
+
+        level->numNodes = 0;
+        level->numTriangles = 0;
+        build_node(level, triangles, 0, numTriangles);
+        free(triangles);
+        return true;
+}
+
+void levelCollision_free(struct levelCollision *const level) {
+        free(level->minX);
+        free(level->minY);
+        free(level->minZ);
+        free(level->maxX);
+        free(level->maxY);
+        free(level->maxZ);
+        free(level->first);
+        free(level->count);
+        free(level->ax);
+        free(level->ay);
+        free(level->az);
+        free(level->bx);
+        free(level->by);
+        free(level->bz);
+        free(level->cx);
+        free(level->cy);
+        free(level->cz);
+        free(level->nx);
+        free(level->ny);
+        free(level->nz);
+}
+
+bool levelCollision_sweepSphere(const struct levelCollision *const level, const vec3s from,
+                                const vec3s to, const float radius,
+                                struct levelCollisionHit *const hit) {
+        struct sweep sweep;
+        sweep.from = from;
+        sweep.delta = glms_vec3_sub(to, from);
+        sweep.radius = radius;
+        sweep.found = false;
+        sweep.fraction = 1;
+        sweep.triangle = 0;
+        if (glms_vec3_dot(sweep.delta, sweep.delta) <= 0) {
+                return false;
+        }
+        for (size_t axis=0; axis<3; axis++) {
+                const float d = sweep.delta.raw[axis];
+                sweep.inverse.raw[axis] = fabsf(d) > 1e-20f ? 1.0f / d : 1e30f;
+        }
+
+        sweep_level(level, &sweep);
+        if (!sweep.found) {
+                return false;
+        }
+        if (hit != NULL) {
+                hit->fraction = sweep.fraction;
+                hit->normal = hit_normal(level, &sweep);
+        }
+        return true;
+}
+
+vec3s levelCollision_moveSphere(const struct levelCollision *const level, const vec3s from,
+                                const vec3s to, const float radius) {
+        vec3s position = from;
+        vec3s target = to;
+        for (size_t i=0; i<MAX_SLIDES; i++) {
+                struct levelCollisionHit hit;
+                if (!levelCollision_sweepSphere(level, position, target, radius, &hit)) {
+                        return target;
+                }
+
+                const vec3s delta = glms_vec3_sub(target, position);
+                const float fraction = fmaxf(0, hit.fraction - SKIN / glms_vec3_norm(delta));
+                position = glms_vec3_add(position, glms_vec3_scale(delta, fraction));
+
+                // go on with what is left of the move, without the part of it
+                // into what was hit
+                vec3s rest = glms_vec3_sub(target, position);
+                rest = glms_vec3_sub(rest, glms_vec3_scale(hit.normal, glms_vec3_dot(rest, hit.normal)));
+                target = glms_vec3_add(position, rest);
+        }
+        return position;
+}
+
+void levelCollision_moveSpheres(const struct levelCollision *const level, const size_t count,
+                                const vec3s *const from, vec3s *const to, const float radius) {
+        for (size_t i=0; i<count; i++) {
+                to[i] = levelCollision_moveSphere(level, from[i], to[i], radius);
+        }
+}
@@ -16,10 +16,15 @@
 #include <pthread.h>
 #include <signal.h>
 #include <errno.h>
+#include <unistd.h>
 
 #define SCREEN_WIDTH 800
 #define SCREEN_HEIGHT 600
 #define TITLE_BUFFER_SIZE 256
+// The scene is flat without it, and so must be the server's
+#define TERRAIN_FILE "scenes/terrain.pgm"
+// What `make collision` exports, the server must collide players with it too
+#define LEVEL_FILE "scenes/scene.obj"
 
 static void processKeyboardEvent(void *registerArgs, void *fireArgs) {
         static bool playingQ = false;
@@ -86,9 +91,27 @@ int main(void) {
         }
         game_unsetCurrentScene(game);
 
+        // Read terrain from file, if there is one
+        struct terrain *terrain = NULL;
+        if (access(TERRAIN_FILE, F_OK) == 0) {
+                terrain = smalloc(sizeof(struct terrain));
+                if (!terrain_load(terrain, TERRAIN_FILE, false)) {
+                        return EXIT_FAILURE;
+                }
+        }
+
+        // Read level collision from file, if there is one
+        struct levelCollision *level = NULL;
+        if (access(LEVEL_FILE, F_OK) == 0) {
+                level = smalloc(sizeof(struct levelCollision));
+                if (!levelCollision_load(level, LEVEL_FILE)) {
+                        return EXIT_FAILURE;
+                }
+        }
+
         // Setup player controller
         struct playerController *playerController = smalloc(sizeof(struct playerController));
-        playerController_setup(playerController, game, "Camera", "PlayerCharacter");
+        playerController_setup(playerController, game, "Camera", "PlayerCharacter", terrain, level);
 
         // Setup network controller
         struct networkController *networkController = smalloc(sizeof(struct networkController));
@@ -115,12 +138,22 @@ int main(void) {
 
         game_free(game);
 
+        networkController_free(networkController);
+        entityController_free(entityController);
         free(playerController);
         free(networkController);
         free(entityController);
         free(sceneController);
         free(uiController);
         free(game);
+        if (terrain != NULL) {
+                terrain_free(terrain);
+                free(terrain);
+        }
+        if (level != NULL) {
+                levelCollision_free(level);
+                free(level);
+        }
         
         return EXIT_SUCCESS;
 }
@@ -0,0 +1,153 @@
+#include <networkCodec.h>
+#include <math.h>
+
+bool networkCodec_init(struct networkCodec *const codec, const struct networkCodecParams *const params) {
+        if (!isfinite(params->extent) || !isfinite(params->heightMin) ||
+            !isfinite(params->heightMax) || !isfinite(params->precision)) {
+                return false;
+        }
+        if (params->extent <= 0 || params->heightMax <= params->heightMin ||
+            params->precision <= 0) {
+                return false;
+        }
+        if (params->angleBits < NETWORK_ANGLE_BITS_MIN ||
+            params->angleBits > NETWORK_ANGLE_BITS_MAX) {
+                return false;
+        }
+
+        codec->params = *params;
+        quantization_init(&codec->horizontal, -params->extent, params->extent, params->precision);
+        quantization_init(&codec->height, params->heightMin, params->heightMax, params->precision);
+        quantization_init(&codec->velocity, -PLAYER_SPEED, PLAYER_SPEED, NETWORK_VELOCITY_PRECISION);
+        codec->angleBits = params->angleBits;
+        return true;
+}
+
+struct networkCodecParams networkCodec_defaultParams(void) {
+        struct networkCodecParams params;
+        params.extent = NETWORK_WORLD_EXTENT_DEFAULT;
+        params.heightMin = NETWORK_HEIGHT_MIN_DEFAULT;
+        params.heightMax = NETWORK_HEIGHT_MAX_DEFAULT;
+        params.precision = NETWORK_POSITION_PRECISION_DEFAULT;
+        params.angleBits = NETWORK_ANGLE_BITS_DEFAULT;
+        return params;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const struct quantization *field_quantization(const struct networkCodec *const codec,
+                                                     const size_t field) {
+        if (field == 2) {
+                return &codec->height;
+        }
+        return &codec->horizontal;
+}
+
+static unsigned field_bits(const struct networkCodec *const codec, const size_t field) {
+        if (field == 3) {
+                return codec->angleBits;
+        }
+        return field_quantization(codec, field)->bits;
+}
+
+void networkCodec_writePosition(const struct networkCodec *const codec,
+                                struct bitWriter *const writer, const vec3s position) {
+        bitWriter_write(writer, quantization_encode(&codec->horizontal, position.x), codec->horizontal.bits);
+        bitWriter_write(writer, quantization_encode(&codec->horizontal, position.y), codec->horizontal.bits);
+        bitWriter_write(writer, quantization_encode(&codec->height, position.z), codec->height.bits);
+}
+
+vec3s networkCodec_readPosition(const struct networkCodec *const codec,
+                                struct bitReader *const reader) {
+        vec3s position;
+        position.x = quantization_decode(&codec->horizontal, bitReader_read(reader, codec->horizontal.bits));
+        position.y = quantization_decode(&codec->horizontal, bitReader_read(reader, codec->horizontal.bits));
+        position.z = quantization_decode(&codec->height, bitReader_read(reader, codec->height.bits));
+        return position;
+}
+
+void networkCodec_writeVelocity(const struct networkCodec *const codec,
+                                struct bitWriter *const writer, const vec2s velocity) {
+        bitWriter_write(writer, quantization_encode(&codec->velocity, velocity.x), codec->velocity.bits);
+        bitWriter_write(writer, quantization_encode(&codec->velocity, velocity.y), codec->velocity.bits);
+}
+
+vec2s networkCodec_readVelocity(const struct networkCodec *const codec,
+                                struct bitReader *const reader) {
+        vec2s velocity;
+        velocity.x = quantization_decode(&codec->velocity, bitReader_read(reader, codec->velocity.bits));
+        velocity.y = quantization_decode(&codec->velocity, bitReader_read(reader, codec->velocity.bits));
+        return velocity;
+}
+
+void networkCodec_writeRotation(const struct networkCodec *const codec,
+                                struct bitWriter *const writer, const float rotation) {
+        bitWriter_write(writer, angle_encode(rotation, codec->angleBits), codec->angleBits);
+}
+
+float networkCodec_readRotation(const struct networkCodec *const codec,
+                                struct bitReader *const reader) {
+        return angle_decode(bitReader_read(reader, codec->angleBits), codec->angleBits);
+}
+
+float networkCodec_roundRotation(const struct networkCodec *const codec, const float rotation) {
+        return angle_decode(angle_encode(rotation, codec->angleBits), codec->angleBits);
+}
+
+void networkCodec_writeInput(const struct networkCodec *const codec, struct bitWriter *const writer,
+                             const struct playerInput *const input) {
+        bitWriter_write(writer, input->buttons, INPUT_BUTTON_BITS);
+        networkCodec_writeRotation(codec, writer, input->yaw);
+}
+
+void networkCodec_readInput(const struct networkCodec *const codec, struct bitReader *const reader,
+                            struct playerInput *const input) {
+        input->buttons = bitReader_read(reader, INPUT_BUTTON_BITS);
+        input->yaw = networkCodec_readRotation(codec, reader);
+}
+
+void networkCodec_encodeEntity(const struct networkCodec *const codec,
+                               const struct networkSnapshotEntity *const entity,
+                               uint32_t fields[SNAPSHOT_FIELDS_TOTAL]) {
+        fields[0] = quantization_encode(&codec->horizontal, entity->position.x);
+        fields[1] = quantization_encode(&codec->horizontal, entity->position.y);
+        fields[2] = quantization_encode(&codec->height, entity->position.z);
+        fields[3] = angle_encode(entity->rotation, codec->angleBits);
+}
+
+void networkCodec_writeFields(const struct networkCodec *const codec, struct bitWriter *const writer,
+                              const uint32_t fields[SNAPSHOT_FIELDS_TOTAL], const unsigned mask) {
+        for (size_t i=0; i<SNAPSHOT_FIELDS_TOTAL; i++) {
+                if (mask & (1U << i)) {
+                        bitWriter_write(writer, fields[i], field_bits(codec, i));
+                }
+        }
+}
+
+unsigned networkCodec_fieldsBits(const struct networkCodec *const codec, const unsigned mask) {
+        unsigned bits = 0;
+        for (size_t i=0; i<SNAPSHOT_FIELDS_TOTAL; i++) {
+                if (mask & (1U << i)) {
+                        bits += field_bits(codec, i);
+                }
+        }
+        return bits;
+}
+
+void networkCodec_readFields(const struct networkCodec *const codec, struct bitReader *const reader,
+                             struct networkSnapshotEntity *const entity, const unsigned mask) {
+        float *const values[] = {
+                &entity->position.x, &entity->position.y, &entity->position.z, &entity->rotation,
+        };
+        for (size_t i=0; i<SNAPSHOT_FIELDS_TOTAL; i++) {
+                if (!(mask & (1U << i))) {
+                        continue;
+                }
+                const uint32_t value = bitReader_read(reader, field_bits(codec, i));
+                if (i == 3) {
+                        *values[i] = angle_decode(value, codec->angleBits);
+                } else {
+                        *values[i] = quantization_decode(field_quantization(codec, i), value);
+                }
+        }
+}
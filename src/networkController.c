@@ -2,109 +2,367 @@
 #include <timeutil.h>
 #include <events.h>
 #include <thirty/util.h>
+#include <string.h>
+
+// Updates are spread further apart on slow connections, where the server is a
+// trip behind anyway, and come at least more often on lossy ones, where a lost
+// update is only made up for by the next one.
+static unsigned long minSendInterval(const ENetPeer *const peer) {
+        unsigned long interval = peer->roundTripTime / 4;
+        if (interval < PACKET_SEND_RATELIMIT_MS / 2) {
+                interval = PACKET_SEND_RATELIMIT_MS / 2;
+        } else if (interval > 2 * PACKET_SEND_RATELIMIT_MS) {
+                interval = 2 * PACKET_SEND_RATELIMIT_MS;
+        }
+        return interval;
+}
 
-static bool shouldSendPacket(bool *const sentMovementPacket, struct timespec *const lastMovementPacket) {
-        if (!*sentMovementPacket) {
-                *lastMovementPacket = monotonic();
-                *sentMovementPacket = true;
-                return true;
-        } else {
-                struct timespec t = monotonic();
-                unsigned long diff_ns = monotonic_difference(t, *lastMovementPacket);
-                unsigned long diff_ms = diff_ns / 1000000;
-                if (diff_ms >= PACKET_SEND_RATELIMIT_MS) {
-                        *lastMovementPacket = t;
-                        return true;
-                }
-                return false;
+static unsigned long maxSendInterval(const ENetPeer *const peer) {
+        const float loss = (float)peer->packetLoss / (float)ENET_PEER_PACKET_LOSS_SCALE;
+        const float interval = (float)NETWORK_DEAD_RECKONING_MAX_MS * (1.0f - 2.0f * loss);
+        if (interval < 4.0f * PACKET_SEND_RATELIMIT_MS) {
+                return 4 * PACKET_SEND_RATELIMIT_MS;
+        }
+        return (unsigned long)interval;
+}
+
+// Where the server has extrapolated the player to by now
+static vec2s extrapolatedPosition(const struct networkController *const controller,
+                                  const unsigned long elapsed_ms) {
+        unsigned long ms = elapsed_ms;
+        if (ms > NETWORK_DEAD_RECKONING_MAX_MS) {
+                ms = NETWORK_DEAD_RECKONING_MAX_MS;
+        }
+        return glms_vec2_add(glms_vec2(controller->sentPosition),
+                             glms_vec2_scale(controller->sentVelocity, (float)ms / 1000.0f));
+}
+
+// Fields of the player due to be sent in a movement packet, if any. Positions
+// go once the server's extrapolation is off or it is too long since the last,
+// jumps go right away, and a rotation goes once it is off or along with
+// anything else. Nothing goes more often than the send interval but jumps.
+static unsigned dueMovementFields(const struct networkController *const controller,
+                                  const struct timespec now) {
+        const unsigned jump = controller->jumped ? MOVEMENT_FIELD_JUMP : 0;
+        if (!controller->sentMovement) {
+                return MOVEMENT_FIELD_POSITION | MOVEMENT_FIELD_ROTATION | jump;
+        }
+        const ENetPeer *peer = controller->game->server;
+        const unsigned long elapsed_ms = monotonic_difference(now, controller->lastTimeSentMovement) / 1000000;
+        if (elapsed_ms < minSendInterval(peer) && jump == 0) {
+                return 0;
         }
+
+        unsigned fields = jump;
+        const unsigned long position_ms = monotonic_difference(now, controller->lastTimeSentPosition) / 1000000;
+        const vec2s error = glms_vec2_sub(glms_vec2(controller->playerPosition),
+                                          extrapolatedPosition(controller, position_ms));
+        if (position_ms >= maxSendInterval(peer) ||
+            glms_vec2_norm(error) > NETWORK_DEAD_RECKONING_ERROR) {
+                fields |= MOVEMENT_FIELD_POSITION;
+        }
+
+        const float turned = fabsf(remainderf(controller->playerRotation - controller->sentRotation,
+                                              2*GLM_PIf));
+        if (turned > NETWORK_DEAD_RECKONING_ROTATION_ERROR || (turned > 0 && fields != 0)) {
+                fields |= MOVEMENT_FIELD_ROTATION;
+        }
+        return fields;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void sendPacket(const struct networkController *const controller,
+                       const void *const data, struct bitWriter *const writer,
+                       const size_t header, const enum networkChannel channel) {
+        size_t size = header + bitWriter_finish(writer);
+        ENetPacket *packet = enet_packet_create(data, size, 0);
+        enet_peer_send(controller->game->server, channel, packet);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 static void onPositionCorrectionPacket(struct networkController *const controller,
-                                 const struct networkPacketPositionCorrection *const packet) {
-        (void)controller;
+                                       const struct networkPacketPositionCorrection *const packet,
+                                       const size_t size) {
+        struct bitReader reader;
+        bitReader_init(&reader, packet->data, size - sizeof(*packet));
+
         struct eventPlayerPositionCorrected args;
-        args.position = packet->position;
-        args.jumping = packet->jumpFall & 0x1;
-        args.falling = packet->jumpFall & 0x2;
+        args.position = networkCodec_readPosition(&controller->codec, &reader);
+        uint32_t jumpFall = bitReader_read(&reader, NETWORK_JUMP_STATE_BITS);
+        args.jumping = jumpFall & JUMP_STATE_JUMPING;
+        args.falling = jumpFall & JUMP_STATE_FALLING;
+        args.airtime = (float)bitReader_read(&reader, NETWORK_AIRTIME_BITS) / 1000.0f;
+        args.sequence = bitReader_read(&reader, 32);
+        if (!bitReader_ok(&reader)) {
+                fprintf(stderr, "truncated position correction\n");
+                return;
+        }
         eventBroker_fire((enum eventBrokerEvent)EVENT_SERVER_CORRECTED_PLAYER_POSITION, &args);
 }
+// Size what is kept per entity for a server with the given capacity
+static void resizeEntities(struct networkController *const controller, const size_t capacity) {
+        if (capacity == controller->capacity) {
+                return;
+        }
+        controller->capacity = capacity;
+        controller->snapshotEntities = srealloc(controller->snapshotEntities,
+                                                SNAPSHOT_HISTORY * capacity *
+                                                sizeof(*controller->snapshotEntities));
+        memset(controller->snapshotEntities, 0,
+               SNAPSHOT_HISTORY * capacity * sizeof(*controller->snapshotEntities));
+        for (size_t i=0; i<SNAPSHOT_HISTORY; i++) {
+                controller->snapshots[i].entities = controller->snapshotEntities + i * capacity;
+        }
+        controller->updated = srealloc(controller->updated, capacity * sizeof(*controller->updated));
+}
+
 static void onWelcomePacket(struct networkController *const controller,
-                            const struct networkPacketWelcome *const packet) {
+                            const struct networkPacketWelcome *const packet,
+                            const size_t size) {
+        if (size < sizeof(*packet)) {
+                return;
+        }
+        if (!networkCodec_init(&controller->codec, &packet->codec)) {
+                fprintf(stderr, "server sent invalid codec parameters\n");
+                return;
+        }
+        if (packet->capacity == 0 || packet->id >= packet->capacity) {
+                fprintf(stderr, "server sent invalid entity capacity\n");
+                return;
+        }
+        resizeEntities(controller, packet->capacity);
+
         controller->connected = true;
         controller->id = packet->id;
-        for (size_t i=0; i<packet->count; i++) {
-                size_t idx = packet->currentEntities[i].idx;
+        controller->sentMovement = false;
+        controller->nextMovementSequence = 0;
+        controller->jumped = false;
+        controller->inputs = packet->movement == NETWORK_MOVEMENT_INPUTS;
+
+        controller->receivedSnapshot = false;
+        for (size_t i=0; i<SNAPSHOT_HISTORY; i++) {
+                controller->snapshots[i].valid = false;
+        }
+        controller->nextEvent = 0;
+        controller->joining = true;
+        controller->joinReceived = 0;
+
+        struct eventNetworkWelcome welcome;
+        welcome.idx = packet->id;
+        welcome.capacity = controller->capacity;
+        welcome.tickPeriodNs = packet->tickPeriodNs;
+        welcome.inputs = controller->inputs;
+        welcome.codec = &controller->codec;
+        eventBroker_fire((enum eventBrokerEvent)EVENT_NETWORK_WELCOME, &welcome);
+
+        struct bitReader reader;
+        bitReader_init(&reader, packet->data, size - sizeof(*packet));
+        uint32_t count = bitReader_readVarUint(&reader);
+        for (size_t i=0; i<count; i++) {
+                size_t idx = bitReader_readVarUint(&reader);
+                vec3s position = networkCodec_readPosition(&controller->codec, &reader);
+                float rotation = networkCodec_readRotation(&controller->codec, &reader);
+                if (!bitReader_ok(&reader) || idx >= controller->capacity) {
+                        fprintf(stderr, "truncated welcome\n");
+                        return;
+                }
+
                 if (idx == packet->id) {
                         struct eventPlayerPositionCorrected args;
                         args.falling = false;
                         args.jumping = false;
-                        args.position = packet->currentEntities[i].position;
+                        args.airtime = 0;
+                        args.sequence = UINT32_MAX;
+                        args.position = position;
                         eventBroker_fire((enum eventBrokerEvent)EVENT_SERVER_CORRECTED_PLAYER_POSITION, &args);
                 } else {
                         struct eventNetworkEntityNew args;
                         args.idx = idx;
-                        args.position = packet->currentEntities[i].position;
-                        args.rotation = packet->currentEntities[i].rotation;
+                        args.position = position;
+                        args.rotation = rotation;
                         eventBroker_fire((enum eventBrokerEvent)EVENT_NETWORK_ENTITY_NEW, &args);
                 }
         }
 }
-static void onEntityChangesUpdate(struct networkController *const controller,
-                                  const struct networkPacketEntityChangesUpdate *const packet) {
-        (void)controller;
-        
-        if (packet->count == 0) {
-                fprintf(stderr, "WARNING: SPURIOUS PACKET RECEIVED!!\n");
+static void sendSnapshotAck(const struct networkController *const controller,
+                            const uint32_t snapshot) {
+        struct networkPacketSnapshotAck data;
+        data.base.type = PACKET_TYPE_SNAPSHOT_ACK;
+        data.snapshot = snapshot;
+
+        ENetPacket *packet = enet_packet_create(&data, sizeof(data), 0);
+        enet_peer_send(controller->game->server, NETWORK_CHANNEL_MOVEMENT, packet);
+}
+
+// Read one record into the snapshot. Return false if the packet is truncated.
+static bool readSnapshotRecord(const struct networkController *const controller,
+                               struct bitReader *const reader,
+                               struct networkSnapshot *const snapshot,
+                               size_t *const idx) {
+        *idx += bitReader_readVarUint(reader);
+        unsigned mask = bitReader_read(reader, SNAPSHOT_FIELDS_TOTAL);
+        if (!bitReader_ok(reader) || *idx >= controller->capacity) {
+                return false;
+        }
+
+        networkCodec_readFields(&controller->codec, reader, &snapshot->entities[*idx], mask);
+        return bitReader_ok(reader);
+}
+
+// Spawn and despawn the entities the snapshot tells to, skipping the events
+// already applied from an earlier one. Return false if the packet is
+// truncated.
+static bool applySnapshotEvents(struct networkController *const controller,
+                                struct bitReader *const reader,
+                                const struct networkSnapshot *const snapshot) {
+        uint32_t count = bitReader_readVarUint(reader);
+        if (count == 0) {
+                return bitReader_ok(reader);
+        }
+        uint32_t sequence = bitReader_readVarUint(reader);
+
+        for (uint32_t i=0; i<count; i++, sequence++) {
+                bool spawn = bitReader_read(reader, 1);
+                size_t idx = bitReader_readVarUint(reader);
+                if (!bitReader_ok(reader) || idx >= controller->capacity) {
+                        return false;
+                }
+                if ((int32_t)(sequence - controller->nextEvent) < 0) {
+                        continue;
+                }
+                controller->nextEvent = sequence + 1;
+                if (idx == controller->id) {
+                        continue;
+                }
+
+                if (spawn) {
+                        struct eventNetworkEntityNew args;
+                        args.idx = idx;
+                        args.position = snapshot->entities[idx].position;
+                        args.rotation = snapshot->entities[idx].rotation;
+                        eventBroker_fire((enum eventBrokerEvent)EVENT_NETWORK_ENTITY_NEW, &args);
+                        controller->joinReceived++;
+                } else {
+                        struct eventNetworkEntityDel args;
+                        args.idx = idx;
+                        eventBroker_fire((enum eventBrokerEvent)EVENT_NETWORK_ENTITY_DEL, &args);
+                }
+        }
+        return true;
+}
+
+static void onSnapshot(struct networkController *const controller,
+                       const struct networkPacketSnapshot *const packet,
+                       const size_t size) {
+        // entities are only sized once welcomed
+        if (size < sizeof(*packet) || !controller->connected ||
+            packet->count > controller->capacity) {
                 return;
         }
-        
+
+        // unreliable packets may arrive late
+        if (controller->receivedSnapshot &&
+            (int32_t)(packet->snapshot - controller->lastSnapshot) <= 0) {
+                return;
+        }
+
+        struct networkSnapshot *snapshot = &controller->snapshots[packet->snapshot % SNAPSHOT_HISTORY];
+        if (packet->baseline != packet->snapshot) {
+                const struct networkSnapshot *baseline = &controller->snapshots[packet->baseline % SNAPSHOT_HISTORY];
+                if (!baseline->valid || baseline->tick != packet->baseline || baseline == snapshot) {
+                        fprintf(stderr, "missing snapshot baseline %u\n", packet->baseline);
+                        return;
+                }
+                memcpy(snapshot->entities, baseline->entities,
+                       controller->capacity * sizeof(*snapshot->entities));
+        }
+        snapshot->tick = packet->snapshot;
+        snapshot->valid = true;
+
+        struct bitReader reader;
+        bitReader_init(&reader, packet->data, size - sizeof(*packet));
+        size_t idx = 0;
+        for (size_t i=0; i<packet->count; i++, idx++) {
+                if (!readSnapshotRecord(controller, &reader, snapshot, &idx)) {
+                        fprintf(stderr, "truncated snapshot %u\n", packet->snapshot);
+                        snapshot->valid = false;
+                        return;
+                }
+                controller->updated[i] = (uint16_t)idx;
+        }
+
+        if (!applySnapshotEvents(controller, &reader, snapshot)) {
+                fprintf(stderr, "truncated snapshot %u\n", packet->snapshot);
+                snapshot->valid = false;
+                return;
+        }
+
         for (size_t i=0; i<packet->count; i++) {
-                const struct networkPacketEntityChange *entity = &packet->entities[i];
-                if (entity->idx == controller->id) {
+                idx = controller->updated[i];
+                if (idx == controller->id) {
                         continue;
                 }
                 struct eventNetworkEntityUpdate args;
-                args.idx = entity->idx;
-                args.position = entity->position;
-                args.rotation = entity->rotation;
+                args.idx = idx;
+                args.position = snapshot->entities[idx].position;
+                args.rotation = snapshot->entities[idx].rotation;
                 eventBroker_fire((enum eventBrokerEvent)EVENT_NETWORK_ENTITY_UPDATE, &args);
         }
-}
 
-static void onEntityNew(struct networkController *const controller,
-                        const struct networkPacketNewEntity *const packet) {
-        if (packet->idx == controller->id) {
-                return;
+        if (controller->joining) {
+                controller->joining = packet->pending > 0;
+
+                struct eventNetworkJoinProgress progress;
+                progress.current = controller->joinReceived;
+                progress.total = controller->joinReceived + packet->pending;
+                eventBroker_fire((enum eventBrokerEvent)EVENT_NETWORK_JOIN_PROGRESS, &progress);
         }
 
-        struct eventNetworkEntityNew args;
-        args.idx = packet->idx;
-        args.position = packet->position;
-        args.rotation = packet->rotation;
-        eventBroker_fire((enum eventBrokerEvent)EVENT_NETWORK_ENTITY_NEW, &args);
+        controller->receivedSnapshot = true;
+        controller->lastSnapshot = packet->snapshot;
+        sendSnapshotAck(controller, packet->snapshot);
 }
 
-static void onEntityDel(struct networkController *const controller,
-                        const struct networkPacketDelEntity *const packet) {
-        if (packet->idx == controller->id) {
+// Move over to the server the player walked into. The connection to it is
+// opened once this one is closed.
+static void onRedirectPacket(struct networkController *const controller,
+                             const struct networkPacketRedirect *const packet,
+                             const size_t size) {
+        if (size < sizeof(*packet)) {
                 return;
         }
-        
-        struct eventNetworkEntityDel args;
-        args.idx = packet->idx;
-        eventBroker_fire((enum eventBrokerEvent)EVENT_NETWORK_ENTITY_DEL, &args);
+
+        ENetAddress address;
+        address.host = packet->host;
+        address.port = packet->port;
+        if (enet_address_get_host_ip(&address, controller->redirectHost,
+                                     sizeof(controller->redirectHost)) != 0) {
+                fprintf(stderr, "invalid redirect address\n");
+                return;
+        }
+        controller->redirectPort = packet->port;
+        controller->redirectToken = packet->token;
+        controller->redirect = REDIRECT_DISCONNECTING;
+        controller->connected = false;
+
+        struct eventNetworkRedirect args;
+        eventBroker_fire((enum eventBrokerEvent)EVENT_NETWORK_REDIRECT, &args);
+        game_disconnect(controller->game, 0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 static void onControlPacket(struct networkController *const controller,
-                            const struct networkPacket *const packet) {
+                            const struct networkPacket *const packet,
+                            const size_t size) {
         switch (packet->type) {
         case PACKET_TYPE_WELCOME:
-                onWelcomePacket(controller, (const void*)packet);
+                onWelcomePacket(controller, (const void*)packet, size);
+                break;
+        case PACKET_TYPE_REDIRECT:
+                onRedirectPacket(controller, (const void*)packet, size);
                 break;
         default:
                 fprintf(stderr, "unexpected control packet type %u\n", packet->type);
@@ -112,14 +370,15 @@ static void onControlPacket(struct networkController *const controller,
         }
 }
 static void onMovementPacket(struct networkController *const controller,
-                             const struct networkPacket *const packet) {
+                             const struct networkPacket *const packet,
+                             const size_t size) {
         if (!controller->game->inScene) {
                 return;
         }
         
         switch (packet->type) {
         case PACKET_TYPE_POSITION_CORRECTION:
-                onPositionCorrectionPacket(controller, (const void*)packet);
+                onPositionCorrectionPacket(controller, (const void*)packet, size);
                 break;
         default:
                 fprintf(stderr, "unexpected control packet type %u\n", packet->type);
@@ -127,20 +386,15 @@ static void onMovementPacket(struct networkController *const controller,
         }
 }
 static void onServerUpdatePacket(struct networkController *const controller,
-                                 const struct networkPacket *const packet) {
+                                 const struct networkPacket *const packet,
+                                 const size_t size) {
         if (!controller->game->inScene) {
                 return;
         }
         
         switch (packet->type) {
-        case PACKET_TYPE_ENTITY_CHANGES_UPDATE:
-                onEntityChangesUpdate(controller, (const void*)packet);
-                break;
-        case PACKET_TYPE_NEW_ENTITY:
-                onEntityNew(controller, (const void*)packet);
-                break;
-        case PACKET_TYPE_DEL_ENTITY:
-                onEntityDel(controller, (const void*)packet);
+        case PACKET_TYPE_SNAPSHOT:
+                onSnapshot(controller, (const void*)packet, size);
                 break;
         default:
                 fprintf(stderr, "unexpected server update packet type %u\n", packet->type);
@@ -154,15 +408,23 @@ static void onReceived(void *registerArgs, void *fireArgs) {
         struct networkController *controller = registerArgs;
         ENetEvent *event = ((ENetEvent*)fireArgs);
 
+        if (event->packet->dataLength < sizeof(struct networkPacket)) {
+                enet_packet_destroy(event->packet);
+                return;
+        }
+
         switch (event->channelID) {
         case NETWORK_CHANNEL_CONTROL:
-                onControlPacket(controller, (void*)event->packet->data);
+                onControlPacket(controller, (void*)event->packet->data,
+                                event->packet->dataLength);
                 break;
         case NETWORK_CHANNEL_MOVEMENT:
-                onMovementPacket(controller, (void*)event->packet->data);
+                onMovementPacket(controller, (void*)event->packet->data,
+                                 event->packet->dataLength);
                 break;
         case NETWORK_CHANNEL_SERVER_UPDATES:
-                onServerUpdatePacket(controller, (void*)event->packet->data);
+                onServerUpdatePacket(controller, (void*)event->packet->data,
+                                     event->packet->dataLength);
                 break;
         default:
                 fprintf(stderr, "PACKET RECEIVED ON UNEXPECTED CHANNEL %u\n",
@@ -173,73 +435,127 @@ static void onReceived(void *registerArgs, void *fireArgs) {
         enet_packet_destroy(event->packet);
 }
 
-////////////////////////////////////////////////////////////////////////////////
+static void onConnected(void *registerArgs, void *fireArgs) {
+        struct networkController *controller = registerArgs;
+        (void)fireArgs;
 
-static void onPlayerJumped(void *registerArgs, void *fireArgs) {
+        redirectState_connected(&controller->redirect);
+}
+
+static void onDisconnected(void *registerArgs, void *fireArgs) {
         struct networkController *controller = registerArgs;
-        struct eventPlayerJumped *jumped = fireArgs;
+        (void)fireArgs;
 
-        if (!controller->game->inScene) {
-                return;
+        controller->connected = false;
+        controller->joining = false;
+        if (redirectState_disconnected(&controller->redirect)) {
+                game_connect(controller->game, NETWORK_CHANNELS_TOTAL, 0, 0,
+                             controller->redirectHost, controller->redirectPort,
+                             controller->redirectToken);
         }
+}
 
-        if (!controller->connected) {
-                return;
-        }
+////////////////////////////////////////////////////////////////////////////////
 
-        (void)jumped;
-        struct networkPacketJump data;
-        data.base.type = PACKET_TYPE_JUMP_UPDATE;
+static void onPlayerJumped(void *registerArgs, void *fireArgs) {
+        struct networkController *controller = registerArgs;
+        struct eventPlayerJumped *jumped = fireArgs;
 
-        ENetPacket *packet = enet_packet_create(&data, sizeof(data), 0);
-        enet_peer_send(controller->game->server, NETWORK_CHANNEL_MOVEMENT, packet);
+        (void)jumped;
+        controller->jumped = true;
 }
 static void onPlayerPositionChanged(void *registerArgs, void *fireArgs) {
         struct networkController *controller = registerArgs;
         struct eventPlayerPositionChanged *pos = fireArgs;
 
-        if (!controller->game->inScene) {
-                return;
+        controller->playerPosition = pos->position;
+}
+static void onPlayerRotationChanged(void *registerArgs, void *fireArgs) {
+        struct networkController *controller = registerArgs;
+        struct eventPlayerRotationChanged *rot = fireArgs;
+
+        controller->playerRotation = rot->rotation;
+}
+static void sendMovement(struct networkController *const controller, const unsigned fields,
+                         const struct timespec now) {
+        uint8_t buffer[NETWORK_SMALL_PACKET_MAX];
+        struct networkPacketMovement *data = (void*)buffer;
+        data->base.type = PACKET_TYPE_MOVEMENT_UPDATE;
+        data->sequence = controller->nextMovementSequence++;
+
+        struct bitWriter writer;
+        bitWriter_init(&writer, data->data, sizeof(buffer) - sizeof(*data));
+        bitWriter_write(&writer, fields, MOVEMENT_FIELDS_TOTAL);
+        if (fields & MOVEMENT_FIELD_POSITION) {
+                networkCodec_writePosition(&controller->codec, &writer, controller->playerPosition);
+                networkCodec_writeVelocity(&controller->codec, &writer, controller->playerVelocity);
+                controller->lastTimeSentPosition = now;
+                controller->sentPosition = controller->playerPosition;
+                controller->sentVelocity = controller->playerVelocity;
+        }
+        if (fields & MOVEMENT_FIELD_ROTATION) {
+                networkCodec_writeRotation(&controller->codec, &writer, controller->playerRotation);
+                controller->sentRotation = controller->playerRotation;
         }
+        sendPacket(controller, data, &writer, sizeof(*data), NETWORK_CHANNEL_MOVEMENT);
 
-        if (!controller->connected) {
-                return;
+        controller->sentMovement = true;
+        controller->lastTimeSentMovement = now;
+        controller->jumped = false;
+}
+// Send what the server's extrapolation of the player would be too far off
+// about
+static void onUpdate(void *registerArgs, void *fireArgs) {
+        struct networkController *controller = registerArgs;
+        struct eventBrokerUpdate *args = fireArgs;
+
+        const vec3s previous = controller->previousPlayerPosition;
+        controller->previousPlayerPosition = controller->playerPosition;
+        if (args->timeDelta > 0) {
+                controller->playerVelocity = glms_vec2_scale(
+                        glms_vec2(glms_vec3_sub(controller->playerPosition, previous)),
+                        1.0f / args->timeDelta);
         }
 
-        if (!shouldSendPacket(&controller->sentPosPacket,
-                              &controller->lastTimeSentPosPacket)) {
+        if (!controller->game->inScene) {
                 return;
         }
 
-        struct networkPacketPosition data;
-        data.base.type = PACKET_TYPE_POSITION_UPDATE;
-        data.position = pos->position;
+        if (!controller->connected || controller->inputs) {
+                controller->jumped = false;
+                return;
+        }
 
-        ENetPacket *packet = enet_packet_create(&data, sizeof(data), 0);
-        enet_peer_send(controller->game->server, NETWORK_CHANNEL_MOVEMENT, packet);
+        const struct timespec now = monotonic();
+        const unsigned fields = dueMovementFields(controller, now);
+        if (fields != 0) {
+                sendMovement(controller, fields, now);
+        }
 }
-static void onPlayerRotationChanged(void *registerArgs, void *fireArgs) {
+// Inputs are sent reliably, the server has to apply every one of them to end
+// up where the client did.
+static void onPlayerInput(void *registerArgs, void *fireArgs) {
         struct networkController *controller = registerArgs;
-        struct eventPlayerRotationChanged *rot = fireArgs;
+        struct eventPlayerInput *args = fireArgs;
 
         if (!controller->game->inScene) {
                 return;
         }
 
-        if (!controller->connected) {
+        if (!controller->connected || !controller->inputs) {
                 return;
         }
 
-        if (!shouldSendPacket(&controller->sentRotPacket,
-                              &controller->lastTimeSentRotPacket)) {
-                return;
-        }
-
-        struct networkPacketRotation data;
-        data.base.type = PACKET_TYPE_ROTATION_UPDATE;
-        data.rotation = rot->rotation;
+        uint8_t buffer[NETWORK_SMALL_PACKET_MAX];
+        struct networkPacketInput *data = (void*)buffer;
+        data->base.type = PACKET_TYPE_INPUT;
+        data->sequence = args->sequence;
 
-        ENetPacket *packet = enet_packet_create(&data, sizeof(data), 0);
+        struct bitWriter writer;
+        bitWriter_init(&writer, data->data, sizeof(buffer) - sizeof(*data));
+        networkCodec_writeInput(&controller->codec, &writer, &args->input);
+        size_t size = sizeof(*data) + bitWriter_finish(&writer);
+        ENetPacket *packet = enet_packet_create(data, size, ENET_PACKET_FLAG_RELIABLE);
         enet_peer_send(controller->game->server, NETWORK_CHANNEL_MOVEMENT, packet);
 }
 
@@ -248,19 +564,54 @@ static void onPlayerRotationChanged(void *registerArgs, void *fireArgs) {
 void networkController_setup(struct networkController *controller, struct game *game) {
         controller->game = game;
         controller->connected = false;
-        
-        controller->sentPosPacket = false;
-        controller->sentRotPacket = false;
+        controller->inputs = false;
+        controller->capacity = 0;
+        controller->snapshotEntities = NULL;
+        controller->updated = NULL;
+
+        controller->playerPosition = GLMS_VEC3_ZERO;
+        controller->previousPlayerPosition = GLMS_VEC3_ZERO;
+        controller->playerVelocity = GLMS_VEC2_ZERO;
+        controller->playerRotation = 0;
+        controller->jumped = false;
+        controller->sentMovement = false;
+        controller->nextMovementSequence = 0;
+
+        controller->receivedSnapshot = false;
+        for (size_t i=0; i<SNAPSHOT_HISTORY; i++) {
+                controller->snapshots[i].valid = false;
+        }
+        controller->nextEvent = 0;
+        controller->joining = false;
+        controller->joinReceived = 0;
+
+        controller->redirect = REDIRECT_NONE;
 
         eventBroker_register(onReceived, EVENT_BROKER_PRIORITY_HIGH,
                              EVENT_BROKER_NETWORK_RECV, controller);
+        eventBroker_register(onConnected, EVENT_BROKER_PRIORITY_HIGH,
+                             EVENT_BROKER_NETWORK_CONNECTED, controller);
+        eventBroker_register(onDisconnected, EVENT_BROKER_PRIORITY_HIGH,
+                             EVENT_BROKER_NETWORK_DISCONNECTED, controller);
 
+        eventBroker_register(onUpdate, EVENT_BROKER_PRIORITY_HIGH,
+                             EVENT_BROKER_UPDATE, controller);
         eventBroker_register(onPlayerJumped, EVENT_BROKER_PRIORITY_HIGH,
                              (enum eventBrokerEvent)EVENT_PLAYER_JUMPED, controller);
         eventBroker_register(onPlayerPositionChanged, EVENT_BROKER_PRIORITY_HIGH,
                              (enum eventBrokerEvent)EVENT_PLAYER_POSITION_CHANGED, controller);
         eventBroker_register(onPlayerRotationChanged, EVENT_BROKER_PRIORITY_HIGH,
                              (enum eventBrokerEvent)EVENT_PLAYER_ROTATION_CHANGED, controller);
+        eventBroker_register(onPlayerInput, EVENT_BROKER_PRIORITY_HIGH,
+                             (enum eventBrokerEvent)EVENT_PLAYER_INPUT, controller);
+}
+
+void networkController_free(struct networkController *controller) {
+        free(controller->snapshotEntities);
+        free(controller->updated);
+        controller->snapshotEntities = NULL;
+        controller->updated = NULL;
+        controller->capacity = 0;
 }
 
 void networkController_connect(const struct networkController *controller, const char *host, unsigned short port) {
@@ -0,0 +1,105 @@
+#include <packetPool.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct packetBuffer {
+        struct packetBuffer *next;
+        size_t sizeClass;
+        alignas(max_align_t) unsigned char data[];
+};
+
+static struct packetBuffer *buffer_of(void *const data) {
+        return (void*)((unsigned char*)data - offsetof(struct packetBuffer, data));
+}
+
+static size_t class_size(const size_t sizeClass) {
+        return (size_t)PACKET_POOL_MIN_SIZE << sizeClass;
+}
+
+static void push_free(struct packetPool *const pool, struct packetBuffer *const buffer) {
+        buffer->next = pool->free[buffer->sizeClass];
+        pool->free[buffer->sizeClass] = buffer;
+}
+
+// Move everything the other side gave back to the free lists
+static void drain_returned(struct packetPool *const pool) {
+        void *data;
+        while (spscQueue_pop(&pool->returned, &data)) {
+                push_free(pool, buffer_of(data));
+        }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void packetPool_init(struct packetPool *const pool) {
+        for (size_t i=0; i<PACKET_POOL_CLASSES; i++) {
+                pool->free[i] = NULL;
+        }
+        spscQueue_init(&pool->returned, sizeof(void*), PACKET_POOL_RETURN_QUEUE_SIZE);
+        pool->allocations = 0;
+        atomic_init(&pool->lost, 0);
+}
+
+void packetPool_free(struct packetPool *const pool) {
+        drain_returned(pool);
+        for (size_t i=0; i<PACKET_POOL_CLASSES; i++) {
+                struct packetBuffer *buffer = pool->free[i];
+                while (buffer != NULL) {
+                        struct packetBuffer *next = buffer->next;
+                        free(buffer);
+                        buffer = next;
+                }
+                pool->free[i] = NULL;
+        }
+        spscQueue_free(&pool->returned);
+}
+
+void *packetPool_get(struct packetPool *const pool, const size_t size) {
+        size_t sizeClass = 0;
+        while (class_size(sizeClass) < size) {
+                sizeClass++;
+                if (sizeClass >= PACKET_POOL_CLASSES) {
+                        fprintf(stderr, "packet of %zu bytes is too large for the pool\n", size);
+                        exit(EXIT_FAILURE);
+                }
+        }
+
+        if (pool->free[sizeClass] == NULL) {
+                drain_returned(pool);
+        }
+
+        struct packetBuffer *buffer = pool->free[sizeClass];
+        if (buffer != NULL) {
+                pool->free[sizeClass] = buffer->next;
+        } else {
+                buffer = malloc(sizeof(*buffer) + class_size(sizeClass));
+                if (buffer == NULL) {
+                        fprintf(stderr, "could not allocate packet buffer\n");
+                        exit(EXIT_FAILURE);
+                }
+                buffer->sizeClass = sizeClass;
+                pool->allocations++;
+        }
+
+        return buffer->data;
+}
+
+void packetPool_release(struct packetPool *const pool, void *const data) {
+        push_free(pool, buffer_of(data));
+}
+
+size_t packetPool_misses(const struct packetPool *const pool) {
+        return pool->allocations + atomic_load_explicit(&pool->lost, memory_order_relaxed);
+}
+
+void packetPool_return(struct packetPool *const pool, void *const data) {
+        // The owner drains the queue whenever it runs out of buffers, so it
+        // only fills up if far more are out than it ever needed at once.
+        // Better to lose the buffer than to wait on the owner.
+        if (!spscQueue_push(&pool->returned, &data)) {
+                free(buffer_of(data));
+                atomic_fetch_add_explicit(&pool->lost, 1, memory_order_relaxed);
+        }
+}
@@ -16,6 +16,9 @@ static const float camera_pos_yaw_animation_rate = 8.0F;
 static const float camera_pos_pitch_initial = 1.25f;
 static const float movement_vector_zero = 1e-9f;
 static const float spin_speed = 2.0F;
+static const float correction_smoothing_rate = 10.0F;
+static const float correction_snap_distance = 4.0F;
+static const float correction_agree_distance = 1e-3f;
 
 static inline void update_cursor_visibility(struct playerController *controller, bool visible) {
         if (visible) {
@@ -37,6 +40,58 @@ static inline mat4s getCameraModel(struct sphericalCoord coord) {
         return glms_rotate_z(glms_rotate_y(glms_rotate_z(glms_translate(GLMS_MAT4_IDENTITY, pos), coord.yaw), coord.pitch), GLM_PI_2f);
 }
 
+static inline float getPlayerYaw(const struct transform *trans) {
+        mat4s r;
+        vec3s s;
+        glms_decompose_rs(trans->model, &r, &s);
+        vec3s rot = glms_euler_angles(r);
+        return rot.z;
+}
+
+static inline void setPlayerPosition(struct transform *trans, vec3s position) {
+        trans->model.col[3].x = position.x;
+        trans->model.col[3].y = position.y;
+        trans->model.col[3].z = position.z;
+}
+
+static inline float getGroundHeight(const struct playerController *controller, float x, float y) {
+        if (controller->terrain == NULL) {
+                return 0;
+        }
+        return terrain_height(controller->terrain, x, y);
+}
+
+// Where a player walking from one position gets to on its way to x, y, sliding
+// along the level with the sphere the server moves it as
+static inline void collidePlayer(const struct playerController *controller, vec3s from,
+                                 float *x, float *y) {
+        if (controller->level == NULL) {
+                return;
+        }
+        from.z += PLAYER_COLLISION_HEIGHT;
+        const vec3s to = {.x = *x, .y = *y, .z = from.z};
+        const vec3s moved = levelCollision_moveSphere(controller->level, from, to,
+                                                      PLAYER_COLLISION_RADIUS);
+        *x = moved.x;
+        *y = moved.y;
+}
+
+// Buttons that move the player in the given direction, x forward and y left
+static inline uint32_t getMovementButtons(vec2s direction) {
+        uint32_t buttons = 0;
+        if (direction.x > movement_vector_zero) {
+                buttons |= INPUT_FORWARD;
+        } else if (direction.x < -movement_vector_zero) {
+                buttons |= INPUT_BACKWARD;
+        }
+        if (direction.y > movement_vector_zero) {
+                buttons |= INPUT_LEFT;
+        } else if (direction.y < -movement_vector_zero) {
+                buttons |= INPUT_RIGHT;
+        }
+        return buttons;
+}
+
 static inline void onMousePositionCursor(struct playerController *controller,
                               struct eventBrokerMousePosition *args) {
         int width, height;
@@ -125,6 +180,10 @@ static inline void onAnimateCameraYaw(struct playerController *controller, struc
 }
 
 static inline void onAnimatePlayerJumpFall(struct playerController *controller, struct eventBrokerUpdate *args) {
+        if (controller->inputs) {
+                // done in steps
+                return;
+        }
         if (!controller->pc_jumping && !controller->pc_falling) {
                 controller->pc_height = 0;
                 return;
@@ -134,6 +193,131 @@ static inline void onAnimatePlayerJumpFall(struct playerController *controller,
         controller->pc_height = jump_fall_animation(&controller->pc_jumping, &controller->pc_falling, controller->pc_airtime);
 }
 
+// Apply an input to the state of the player, exactly as the server does
+static void simulateInput(const struct playerController *controller,
+                          const struct playerInput *input, vec3s *position,
+                          uint32_t *jump_state, float *airtime) {
+        const vec3s from = *position;
+        float rotation;
+        apply_player_input(input, &position->x, &position->y, &rotation,
+                           jump_state, airtime, controller->step_period);
+        collidePlayer(controller, from, &position->x, &position->y);
+        jump_fall_animation_batch(1, airtime, jump_state, &position->z, controller->step_period);
+        position->z += getGroundHeight(controller, position->x, position->y);
+}
+
+static inline uint32_t getJumpState(const struct playerController *controller) {
+        return (controller->pc_jumping ? JUMP_STATE_JUMPING : 0) |
+                (controller->pc_falling ? JUMP_STATE_FALLING : 0);
+}
+
+static inline void setJumpState(struct playerController *controller, uint32_t jump_state) {
+        controller->pc_jumping = jump_state & JUMP_STATE_JUMPING;
+        controller->pc_falling = jump_state & JUMP_STATE_FALLING;
+}
+
+// Where the player is between the last two steps
+static inline vec3s getStepPosition(const struct playerController *controller) {
+        return glms_vec3_lerp(controller->step_from, controller->step_to,
+                              controller->step_time / controller->step_period);
+}
+
+// Move the player one step with the input held during it, keep what it was
+// predicted to lead to and send it
+static void stepPlayerInput(struct playerController *controller, const struct transform *pc_trans) {
+        const uint32_t sequence = controller->next_sequence++;
+        struct predictedInput *step = &controller->history[sequence % INPUT_HISTORY];
+        step->valid = true;
+        step->sequence = sequence;
+        step->input.buttons = controller->step_buttons;
+        step->input.yaw = networkCodec_roundRotation(controller->codec, getPlayerYaw(pc_trans));
+        controller->step_buttons = 0;
+
+        step->position = controller->step_to;
+        step->jump_state = getJumpState(controller);
+        step->airtime = controller->pc_airtime;
+        simulateInput(controller, &step->input, &step->position, &step->jump_state, &step->airtime);
+        setJumpState(controller, step->jump_state);
+        controller->pc_airtime = step->airtime;
+
+        controller->step_from = controller->step_to;
+        controller->step_to = step->position;
+
+        struct eventPlayerInput data;
+        data.sequence = sequence;
+        data.input = step->input;
+        eventBroker_fire((enum eventBrokerEvent)EVENT_PLAYER_INPUT, &data);
+}
+
+// Start over from the state the server put the player in, applying again the
+// inputs it had not applied yet. The player is drawn where it was and the
+// difference fades over a few frames, unless it is too large for anything but
+// a jump to the new position.
+static void reconcilePlayer(struct playerController *controller,
+                            const struct eventPlayerPositionCorrected *args) {
+        const struct predictedInput *acked = &controller->history[args->sequence % INPUT_HISTORY];
+        if (acked->valid && acked->sequence == args->sequence &&
+            glms_vec3_distance(acked->position, args->position) <= correction_agree_distance &&
+            acked->jump_state == ((args->jumping ? JUMP_STATE_JUMPING : 0) |
+                                  (args->falling ? JUMP_STATE_FALLING : 0))) {
+                // the prediction was right
+                return;
+        }
+
+        const vec3s drawn = glms_vec3_add(getStepPosition(controller), controller->correction_error);
+
+        vec3s position = args->position;
+        uint32_t jump_state = (args->jumping ? JUMP_STATE_JUMPING : 0) |
+                (args->falling ? JUMP_STATE_FALLING : 0);
+        float airtime = args->airtime;
+        vec3s previous = position;
+        for (uint32_t sequence = args->sequence + 1; sequence != controller->next_sequence; sequence++) {
+                struct predictedInput *step = &controller->history[sequence % INPUT_HISTORY];
+                if (!step->valid || step->sequence != sequence) {
+                        // fell out of the history
+                        continue;
+                }
+                previous = position;
+                simulateInput(controller, &step->input, &position, &jump_state, &airtime);
+                step->position = position;
+                step->jump_state = jump_state;
+                step->airtime = airtime;
+        }
+
+        controller->step_from = previous;
+        controller->step_to = position;
+        setJumpState(controller, jump_state);
+        controller->pc_airtime = airtime;
+
+        // before the server applied any input the player is only being put
+        // where it starts
+        controller->correction_error = glms_vec3_sub(drawn, getStepPosition(controller));
+        if (args->sequence == UINT32_MAX ||
+            glms_vec3_norm(controller->correction_error) > correction_snap_distance) {
+                controller->correction_error = GLMS_VEC3_ZERO;
+        }
+}
+
+static void onUpdateInputs(struct playerController *controller, struct transform *pc_trans,
+                           float timeDelta) {
+        controller->step_buttons |= getMovementButtons(controller->pc_movement_direction);
+        controller->pc_movement_direction = GLMS_VEC2_ZERO;
+
+        controller->step_time += timeDelta;
+        while (controller->step_time >= controller->step_period) {
+                controller->step_time -= controller->step_period;
+                stepPlayerInput(controller, pc_trans);
+        }
+
+        controller->correction_error = glms_vec3_scale(controller->correction_error,
+                                                       expf(-correction_smoothing_rate * timeDelta));
+
+        struct eventPlayerPositionChanged data;
+        data.position = glms_vec3_add(getStepPosition(controller), controller->correction_error);
+        setPlayerPosition(pc_trans, data.position);
+        eventBroker_fire((enum eventBrokerEvent)EVENT_PLAYER_POSITION_CHANGED, &data);
+}
+
 static void onUpdate(void *registerArgs, void *fireArgs) {
         struct playerController *controller = registerArgs;
         struct eventBrokerUpdate *args = fireArgs;
@@ -164,22 +348,24 @@ static void onUpdate(void *registerArgs, void *fireArgs) {
                 transform_rotateZ(pc_trans, normalize_yaw(controller->pc_rotation));
 
                 // fire event                
-                mat4s r;
-                vec3s s;
-                glms_decompose_rs(pc_trans->model, &r, &s);
-                vec3s rot = glms_euler_angles(r);
                 struct eventPlayerRotationChanged data;
-                data.rotation = rot.z;
+                data.rotation = getPlayerYaw(pc_trans);
                 eventBroker_fire((enum eventBrokerEvent)EVENT_PLAYER_ROTATION_CHANGED, &data);
         }
         controller->pc_rotation = 0;
 
+        if (controller->inputs) {
+                onUpdateInputs(controller, pc_trans, args->timeDelta);
+                return;
+        }
+
         bool positionUpdated = false;
 
         // update player position if needed
         if (ABS(controller->pc_movement_direction.x) > movement_vector_zero ||
             ABS(controller->pc_movement_direction.y) > movement_vector_zero) {
                 positionUpdated = true;
+                const vec3s from = glms_vec3(pc_trans->model.col[3]);
                 vec2s movement_direction = glms_vec2_scale(
                         glms_vec2_normalize(controller->pc_movement_direction),
                         game_timeDelta(controller->game)*PLAYER_SPEED);
@@ -190,14 +376,20 @@ static void onUpdate(void *registerArgs, void *fireArgs) {
                 if (ABS(movement_direction.y) > movement_vector_zero) {
                         transform_translateY(pc_trans, movement_direction.y);
                 }
+                collidePlayer(controller, from, &pc_trans->model.col[3].x,
+                              &pc_trans->model.col[3].y);
         }
         controller->pc_movement_direction = GLMS_VEC2_ZERO;
 
-        // update player height if needed
-        if (controller->player_height_needs_update) {
+        // update player height if needed, walking on uneven ground
+        // changes it too
+        if (controller->player_height_needs_update ||
+            (positionUpdated && controller->terrain != NULL)) {
                 positionUpdated = true;
                 scene = game_getCurrentScene(controller->game);
-                transform_setZ(pc_trans, controller->pc_height);
+                const float ground = getGroundHeight(controller, pc_trans->model.col[3].x,
+                                                     pc_trans->model.col[3].y);
+                transform_setZ(pc_trans, ground + controller->pc_height);
         }
         controller->player_height_needs_update = false;
 
@@ -478,7 +670,10 @@ static void onKeyboardEvent(void *registerArgs, void *fireArgs) {
 
         if (action == GLFW_PRESS) {
                 if (key == GLFW_KEY_SPACE) {
-                        if (!controller->pc_jumping && !controller->pc_falling) {
+                        if (controller->inputs) {
+                                // the next step jumps if it can
+                                controller->step_buttons |= INPUT_JUMP;
+                        } else if (!controller->pc_jumping && !controller->pc_falling) {
                                 controller->pc_jumping = true;
                                 controller->pc_airtime = 0;
 
@@ -498,6 +693,11 @@ static void onPositionCorrection(void *registerArgs, void *fireArgs) {
                 return;
         }
         
+        if (controller->inputs) {
+                reconcilePlayer(controller, args);
+                return;
+        }
+
         struct scene *scene = game_getCurrentScene(controller->game);
         struct object *player = scene_getObjectFromIdx(scene, controller->playerCharacter_idx);
         struct transform *player_trans = object_getComponent(player, COMPONENT_TRANSFORM);
@@ -517,6 +717,24 @@ static void onPositionCorrection(void *registerArgs, void *fireArgs) {
 #endif
 }
 
+static void onNetworkWelcome(void *registerArgs, void *fireArgs) {
+        struct playerController *controller = registerArgs;
+        struct eventNetworkWelcome *args = fireArgs;
+
+        controller->inputs = args->inputs;
+        controller->codec = args->codec;
+        controller->step_period = (float)args->tickPeriodNs / 1e9f;
+        controller->step_time = 0;
+        controller->step_buttons = 0;
+
+        // the welcome is followed by where the player starts
+        for (size_t i=0; i<INPUT_HISTORY; i++) {
+                controller->history[i].valid = false;
+        }
+        controller->next_sequence = 0;
+        controller->correction_error = GLMS_VEC3_ZERO;
+}
+
 static void onSceneChange(void *registerArgs, void *fireArgs) {
         struct playerController *controller = registerArgs;
         struct eventBrokerSceneChanged *args = fireArgs;
@@ -538,7 +756,7 @@ static void onSceneChange(void *registerArgs, void *fireArgs) {
 }
 
 
-void playerController_setup(struct playerController *controller, struct game *const game, const char *const cameraName, const char *const playerName) {
+void playerController_setup(struct playerController *controller, struct game *const game, const char *const cameraName, const char *const playerName, const struct terrain *const terrain, const struct levelCollision *const level) {
         controller->game = game;
 
         controller->camera_name = cameraName;
@@ -566,6 +784,18 @@ void playerController_setup(struct playerController *controller, struct game *co
         controller->pc_airtime = 0;
         controller->pc_height = 0;
         controller->player_height_needs_update = false;
+        controller->terrain = terrain;
+        controller->level = level;
+
+        controller->inputs = false;
+        controller->codec = NULL;
+        controller->step_from = GLMS_VEC3_ZERO;
+        controller->step_to = GLMS_VEC3_ZERO;
+        for (size_t i=0; i<INPUT_HISTORY; i++) {
+                controller->history[i].valid = false;
+        }
+        controller->next_sequence = 0;
+        controller->correction_error = GLMS_VEC3_ZERO;
         
         controller->camera_mode = CAMERA_MODE_CURSOR;
 
@@ -577,6 +807,7 @@ void playerController_setup(struct playerController *controller, struct game *co
         eventBroker_register(onMousePoll, EVENT_BROKER_PRIORITY_HIGH, EVENT_BROKER_MOUSE_POLL, controller);
         eventBroker_register(onKeyboardPoll, EVENT_BROKER_PRIORITY_HIGH, EVENT_BROKER_MOUSE_POLL, controller);
         eventBroker_register(onPositionCorrection, EVENT_BROKER_PRIORITY_HIGH, (enum eventBrokerEvent)EVENT_SERVER_CORRECTED_PLAYER_POSITION, controller);
+        eventBroker_register(onNetworkWelcome, EVENT_BROKER_PRIORITY_HIGH, (enum eventBrokerEvent)EVENT_NETWORK_WELCOME, controller);
         eventBroker_register(onSceneChange, EVENT_BROKER_PRIORITY_HIGH, EVENT_BROKER_SCENE_CHANGED, controller);
 
         onSceneChange(controller, NULL);
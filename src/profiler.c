@@ -0,0 +1,139 @@
+#include <profiler.h>
+#include <timeutil.h>
+#include <string.h>
+
+static const char *const phaseNames[PROFILER_PHASES_TOTAL] = {
+        [PROFILER_PHASE_TICK] = "tick",
+        [PROFILER_PHASE_PROCESS_COMMANDS] = "process_commands",
+        [PROFILER_PHASE_STEP_WORLD] = "step_world",
+        [PROFILER_PHASE_SHARD] = "shard_step",
+        [PROFILER_PHASE_BROADCAST_CHANGES] = "broadcast_changes",
+        [PROFILER_PHASE_ON_CONNECTION] = "onNewConnection",
+        [PROFILER_PHASE_ON_DISCONNECTION] = "onDisconnection",
+        [PROFILER_PHASE_ON_MOVEMENT] = "onMovementPacket",
+        [PROFILER_PHASE_ON_INPUT] = "onInputPacket",
+        [PROFILER_PHASE_ON_SNAPSHOT_ACK] = "onSnapshotAck",
+        [PROFILER_PHASE_ON_LINK] = "onLinkPacket",
+};
+
+static const char *const counterNames[PROFILER_COUNTERS_TOTAL] = {
+        [PROFILER_COUNTER_COMMANDS_DROPPED] = "commands_dropped",
+        [PROFILER_COUNTER_PACKET_POOL_MISSES] = "packet_pool_misses",
+        [PROFILER_COUNTER_POSITIONS_REJECTED] = "positions_rejected",
+};
+
+static struct profilerHistogram histograms[PROFILER_PHASES_TOTAL];
+static uint64_t counters[PROFILER_COUNTERS_TOTAL];
+static struct timespec windowStart;
+static bool started;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static size_t bucket_of(const uint64_t value) {
+        if (value < PROFILER_SUB_BUCKETS) {
+                return (size_t)value;
+        }
+        const unsigned msb = 63 - (unsigned)__builtin_clzll(value);
+        const unsigned shift = msb - PROFILER_SUB_BUCKET_BITS;
+        const uint64_t sub = (value >> shift) - PROFILER_SUB_BUCKETS;
+        return (size_t)(shift + 1) * PROFILER_SUB_BUCKETS + (size_t)sub;
+}
+
+// Highest value that falls in a bucket
+static uint64_t bucket_max(const size_t bucket) {
+        if (bucket < PROFILER_SUB_BUCKETS) {
+                return bucket;
+        }
+        const unsigned shift = (unsigned)(bucket / PROFILER_SUB_BUCKETS) - 1;
+        const uint64_t sub = bucket % PROFILER_SUB_BUCKETS;
+        return ((PROFILER_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+static uint64_t percentile(const struct profilerHistogram *const histogram, const double p) {
+        if (histogram->count == 0) {
+                return 0;
+        }
+
+        uint64_t rank = (uint64_t)(p / 100.0 * (double)histogram->count);
+        if (rank >= histogram->count) {
+                rank = histogram->count - 1;
+        }
+
+        uint64_t seen = 0;
+        for (size_t i=0; i<PROFILER_BUCKETS; i++) {
+                seen += histogram->buckets[i];
+                if (seen > rank) {
+                        const uint64_t value = bucket_max(i);
+                        return value < histogram->max ? value : histogram->max;
+                }
+        }
+        return histogram->max;
+}
+
+static double us(const uint64_t ns) {
+        return (double)ns / 1e3;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct timespec profiler_start(void) {
+        return monotonic();
+}
+
+void profiler_record(const enum profilerPhase phase, const struct timespec start, const size_t bytes) {
+        if (!started) {
+                windowStart = start;
+                started = true;
+        }
+
+        const uint64_t duration = monotonic_difference(monotonic(), start);
+        struct profilerHistogram *histogram = &histograms[phase];
+        histogram->count++;
+        histogram->bytes += bytes;
+        histogram->total += duration;
+        if (duration > histogram->max) {
+                histogram->max = duration;
+        }
+        histogram->buckets[bucket_of(duration)]++;
+}
+
+void profiler_count(const enum profilerCounter counter, const uint64_t count) {
+        counters[counter] += count;
+}
+
+uint64_t profiler_counter(const enum profilerCounter counter) {
+        return counters[counter];
+}
+
+void profiler_dump(FILE *const file) {
+        const double seconds = started ? (double)monotonic_difference(monotonic(), windowStart) / 1e9 : 0;
+
+        fprintf(file, "# server profile over the last %.1f s, times in microseconds\n", seconds);
+        fprintf(file, "%-18s %10s %10s %10s %10s %10s %10s %12s\n",
+                "phase", "count", "mean", "p50", "p90", "p99", "max", "bytes");
+        for (size_t i=0; i<PROFILER_PHASES_TOTAL; i++) {
+                const struct profilerHistogram *histogram = &histograms[i];
+                double mean = 0;
+                if (histogram->count > 0) {
+                        mean = (double)histogram->total / (double)histogram->count;
+                }
+                fprintf(file, "%-18s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %12llu\n",
+                        phaseNames[i], (unsigned long long)histogram->count, mean / 1e3,
+                        us(percentile(histogram, 50)), us(percentile(histogram, 90)),
+                        us(percentile(histogram, 99)), us(histogram->max),
+                        (unsigned long long)histogram->bytes);
+        }
+        fprintf(file, "\n%-18s %10s\n", "counter", "count");
+        for (size_t i=0; i<PROFILER_COUNTERS_TOTAL; i++) {
+                fprintf(file, "%-18s %10llu\n", counterNames[i],
+                        (unsigned long long)counters[i]);
+        }
+        fprintf(file, "\n");
+        fflush(file);
+}
+
+void profiler_reset(void) {
+        memset(histograms, 0, sizeof(histograms));
+        memset(counters, 0, sizeof(counters));
+        started = false;
+}
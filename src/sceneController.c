@@ -8,6 +8,9 @@ static void onConnected(void *registerArgs, void *fireArgs) {
         struct eventServerConnectionSuccess *args = fireArgs;
         (void)args;
 
+        if (redirectState_connected(&controller->redirect)) {
+                return;
+        }
         game_setCurrentScene(controller->game, controller->testSceneIdx);
 }
 
@@ -16,13 +19,25 @@ static void onDisconnected(void *registerArgs, void *fireArgs) {
         struct eventBrokerNetworkDisconnected *args = fireArgs;
         (void)args;
 
+        if (redirectState_disconnected(&controller->redirect)) {
+                return;
+        }
         game_unsetCurrentScene(controller->game);
 }
 
+static void onRedirect(void *registerArgs, void *fireArgs) {
+        struct sceneController *controller = registerArgs;
+        (void)fireArgs;
+
+        controller->redirect = REDIRECT_DISCONNECTING;
+}
+
 void sceneController_setup(struct sceneController *const controller, struct game *game, size_t testSceneIdx) {
         controller->game = game;
         controller->testSceneIdx = testSceneIdx;
+        controller->redirect = REDIRECT_NONE;
 
         eventBroker_register(onConnected, EVENT_BROKER_PRIORITY_HIGH, EVENT_BROKER_NETWORK_CONNECTED, controller);
         eventBroker_register(onDisconnected, EVENT_BROKER_PRIORITY_HIGH, EVENT_BROKER_NETWORK_DISCONNECTED, controller);
+        eventBroker_register(onRedirect, EVENT_BROKER_PRIORITY_HIGH, (enum eventBrokerEvent)EVENT_NETWORK_REDIRECT, controller);
 }
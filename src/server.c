@@ -1,484 +1,2419 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <timeutil.h>
 #include <entityUtils.h>
+#include <spatialHash.h>
+#include <serverNetwork.h>
+#include <tickScheduler.h>
+#include <profiler.h>
+#include <slotAllocator.h>
+#include <journal.h>
+#include <levelCollision.h>
+#include <terrain.h>
 #include <networkController.h>
 #include <curve.h>
 #include <enet/enet.h>
 #include <cglm/struct.h>
 #include <errno.h>
-
-#define TICK_PERIOD 0.1f
-#define MAX_PLAYERS 512
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+
+#define MAX_PLAYERS_DEFAULT 512
+#define INTEREST_RADIUS_DEFAULT 64.0f
+#define PROFILE_PERIOD_DEFAULT 10.0
+
+// Send a snapshot at least this often, even if empty, so that clients keep
+// acknowledging and their baseline does not fall out of the history
+#define SNAPSHOT_KEEPALIVE 8
+
+// Players handed off to this server and not reconnected yet, at most
+#define MAX_HANDOFFS 256
+// Time a player handed off to this server has to reconnect
+#define HANDOFF_TIMEOUT_NS 10000000000UL
+// Distance a player walks past the edge of the strip before it is handed off,
+// so that it does not bounce between servers walking along the edge
+#define HANDOFF_MARGIN 2.0f
+// Link peers there can be, both ways with every neighbour
+#define LINK_PEERS (2 * SHARD_LINK_MAX_NEIGHBORS)
+#define NO_GHOST UINT32_MAX
+
+// Authoritative positions kept per player to validate the ones it sends
+// against. Clients send at most one every PACKET_SEND_RATELIMIT / 2 and
+// usually far fewer, so this covers well over a second.
+#define POSITION_HISTORY 32
+
+// Entities entering an area of interest spawn on the client at most this many
+// per tick, nearest first. A client joining a crowded area gets it over
+// several ticks instead of all at once.
+#define ENTER_PER_TICK 64
+// Spawn and despawn events carried by a snapshot, at most
+#define SNAPSHOT_EVENTS_MAX 256
+
+// Bytes of a snapshot a client is sent per tick. Every SNAPSHOT_BUDGET_WINDOW
+// ticks the budget backs off if the client acknowledged less than
+// SNAPSHOT_BUDGET_DELIVERED of what it was sent, and grows if it was all
+// needed and got through.
+#define SNAPSHOT_BUDGET_MIN 256.0f
+#define SNAPSHOT_BUDGET_START 2048.0f
+#define SNAPSHOT_BUDGET_MAX 8192.0f
+#define SNAPSHOT_BUDGET_WINDOW 16
+#define SNAPSHOT_BUDGET_DELIVERED 0.8f
+#define SNAPSHOT_BUDGET_GROWTH 1.25f
+#define SNAPSHOT_BUDGET_BACKOFF 0.7f
+
+// Inputs a client may send ahead of the server's ticks, one tick's worth
+// each. This absorbs the jitter of the connection, anything beyond is moving
+// faster than the server and is dropped.
+#define INPUT_CREDIT_MAX 8
+
+#define BITSET_WORD_BITS 64
 
 #ifndef ABS
 #define ABS(x) ((x)<0?-(x):(x))
 #endif
 
+// Horizontal position of a player as its client had it at a given time, in
+// nanoseconds of server time, and how high above the ground it was
+struct positionSample {
+        unsigned long time;
+        vec2s position;
+        float height;
+};
+
+// Entity sent whole to a player since a given tick. It entered the area of
+// interest then, or it was left out of the snapshot before that for lack of
+// budget. Spawning ones are never left out, their spawn takes its state from
+// the snapshot. The others pile up priority every time they are left out.
+struct enteringEntity {
+        uint32_t idx;
+        uint32_t since;
+        bool spawning;
+        float priority;
+};
+
+// Spawn or despawn of an entity on a client
+struct entityEvent {
+        uint32_t idx;
+        bool spawn;
+};
+
+// Snapshot sent to a player, its size and the end of the events it carried
+struct sentSnapshot {
+        bool valid;
+        bool acked;
+        uint32_t tick;
+        uint32_t events_end;
+        size_t size;
+};
+
+// Entity that could go in a snapshot, with the bits its record takes at most
+struct snapshotCandidate {
+        size_t idx;
+        float priority;
+        unsigned bits;
+};
+
+// Entity that entered a player's area of interest and is yet to be sent, with
+// its squared distance to the player
+struct enteredEntity {
+        size_t idx;
+        float distance;
+};
+
+// Per connection data of a player. Its simulation state lives in the world
+// state arrays, at the given slot.
 struct player {
         bool init;
         size_t idx;
+        size_t slot;
         
         ENetAddress address;
-
-        vec3s position;        
-        float rotation;
-
-        bool jumping;
-        bool falling;
-        float airtime;
+        struct serverPeer peer;
+
+        // Entities this player's client currently knows about, or is told
+        // about by the events
+        uint64_t *visible;
+
+        // Last snapshot the client acknowledged
+        bool acked;
+        uint32_t baseline;
+
+        // Entities that entered the area of interest and are sent whole until
+        // the client acknowledges a snapshot from after they did. The list
+        // has exactly the entities in the set, which is for lookups.
+        uint64_t *entering;
+        struct enteringEntity *entering_list;
+        size_t entering_count;
+        size_t entering_capacity;
+
+        // Spawns and despawns the client has not acknowledged yet, in order.
+        // Every snapshot carries them until a snapshot that did is
+        // acknowledged. The first one has sequence number events_first.
+        struct entityEvent *events;
+        size_t events_count;
+        size_t events_capacity;
+        uint32_t events_first;
+        struct sentSnapshot sent[SNAPSHOT_HISTORY];
+
+        // Bytes of snapshot to send per tick, adjusted once per window from
+        // how much of what was sent in it got acknowledged
+        float budget;
+        uint32_t window_start;
+        size_t window_sent;
+        size_t window_acked;
+        bool window_saturated;
+
+        // Inputs the client may still send, see INPUT_CREDIT_MAX
+        unsigned input_credit;
+        // Sequence number of the last input applied or dropped, sent with
+        // corrections so that the client applies again the ones after it
+        uint32_t input_sequence;
+        // Sequence number of the last movement packet applied
+        uint32_t movement_sequence;
+
+        // Ring of the last positions accepted or imposed, oldest first from
+        // history_next
+        struct positionSample history[POSITION_HISTORY];
+        size_t history_count;
+        size_t history_next;
+        // Tick the client last sent a position in, which is not extrapolated
+        // from until the next one
+        uint32_t position_tick;
 };
 
-struct changedEntity {
-        bool init;
-        struct player *entity;
+// Simulation state of the active entities as a structure of arrays. Only the
+// first count elements of each array are in use and they are kept packed:
+// removing an entity moves the last one into its slot.
+struct worldState {
+        size_t count;
+        float *x;
+        float *y;
+        float *z;
+        float *rotation;
+        // horizontal velocity the position is extrapolated with, for the
+        // seconds left in extrapolate
+        float *vx;
+        float *vy;
+        float *extrapolate;
+        float *airtime;
+        uint32_t *jump_state;
+        size_t *idx;
 };
 
+// Set of entities that changed during the current tick. The bitset answers
+// membership and gives ordered iteration by scanning its words, the dense list
+// of indices is only there so that clearing touches just what was added.
 struct changedEntitySet {
         size_t count;
-        size_t end;
-        struct changedEntity entities[MAX_ENTITIES];
+        uint64_t *bits;
+        size_t *entities;
+};
+
+// State of the world at the end of a tick
+struct worldSnapshot {
+        uint32_t tick;
+        // entities that changed during this tick
+        uint64_t *changed;
+        struct networkSnapshotEntity *entities;
+        // entities as quantized for the network, once for every client that
+        // gets this snapshot or has it as its baseline
+        uint32_t (*fields)[SNAPSHOT_FIELDS_TOTAL];
 };
 
 struct world {
+        // Entities there is room for, and players among them. The rest is
+        // left for ghosts.
+        size_t capacity;
+        size_t max_players;
+        // words of a bitset of entities
+        size_t bitset_words;
+
         struct player *entities;
+        struct slotAllocator slots;
+        struct worldState state;
+
+        // Player of each connected peer, by peer index, if the handle is
+        // valid
+        struct slotHandle *peers;
         size_t num_players;
-        size_t lowest_free_player_slot;
 
         struct changedEntitySet changed_entities;
+
+        uint32_t tick;
+        struct worldSnapshot *snapshots;
+
+        // Bitsets send_client_snapshot works on
+        uint64_t *scratch;
+        struct enteredEntity *entered;
+        struct snapshotCandidate *candidates;
+        // entering_list entry of each entity, while selecting records
+        uint32_t *entering_entry;
+        // fields each selected record carries
+        uint8_t *record_mask;
+
+        unsigned long tick_period_ns;
+        float tick_period;
+
+        // Whether clients send positions or inputs
+        enum networkMovement movement;
+
+        struct spatialHash grid;
+        float interest_radius;
+
+        struct networkCodec codec;
+
+        // Static geometry players collide with, if the server was given any
+        bool has_level;
+        struct levelCollision level;
+        // Players extrapolated this tick and where they move from, while
+        // colliding them with the level
+        size_t *moving_slots;
+        vec3s *moving_from;
+        vec3s *moving_to;
+
+        // Ground players stand on, flat at 0 if the server was given none
+        bool has_terrain;
+        struct terrain terrain;
+        // height of the ground under each entity, while grounding them
+        float *ground;
+
+        // Origin of server time
+        struct timespec epoch;
+};
+
+// Server owning the strip of the world next to this one
+struct neighbor {
+        float min_x;
+        float max_x;
+        // where its clients connect
+        ENetAddress address;
+        bool up;
+};
+
+// Entity of a neighbour shown to the players of this server
+struct ghost {
+        size_t link;
+        size_t remote;
+        // border packet it was last in
+        uint32_t seen;
+        // position in the list of ghosts
+        size_t pos;
+        struct networkSnapshotEntity state;
+};
+
+// Connection a neighbour opened to send its border entities
+struct borderLink {
+        uint32_t connectID;
+        uint32_t received;
+        // ghost of each of the neighbour's entities, NO_GHOST if none
+        uint32_t *ghosts;
+};
+
+// Player handed off to this server, waiting for its client to reconnect
+struct handoff {
+        bool pending;
+        uint32_t token;
+        struct timespec expires;
+        vec3s position;
+        float rotation;
+        float airtime;
+        uint32_t jump_state;
+};
+
+// The world is split along x in strips, this server owns [min_x, max_x)
+struct shard {
+        bool enabled;
+        float min_x;
+        float max_x;
+
+        size_t num_neighbors;
+        struct neighbor neighbors[SHARD_LINK_MAX_NEIGHBORS];
+
+        struct borderLink *links;
+        // Ghosts are limited to the entities left after players
+        struct ghost *ghosts;
+        size_t max_ghosts;
+        size_t num_ghosts;
+        size_t *ghost_list;
+
+        struct handoff handoffs[MAX_HANDOFFS];
+        uint64_t token_state;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 
 static struct world world;
-static ENetHost *server = NULL;
+static struct shard shard;
+// Where the commands are recorded, if anywhere
+static struct journalWriter journal;
+
+// Set by SIGUSR1 to get a profile dump after the current tick
+static volatile sig_atomic_t profile_requested = 0;
+// Packet buffers allocated as of the end of the last tick
+static size_t pool_misses = 0;
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static void player_init(struct player *const player, ENetAddress addr) {
+// Allocate memory, which the server cannot do without
+static void *allocate(const size_t count, const size_t size) {
+        void *data = calloc(count, size);
+        if (data == NULL) {
+                fprintf(stderr, "could not allocate memory\n");
+                exit(EXIT_FAILURE);
+        }
+        return data;
+}
+
+static void player_init(struct player *const player, const struct serverPeer peer,
+                        const ENetAddress address) {
         player->init = true;
         
-        player->address = addr;
-
-        player->position = GLMS_VEC3_ZERO;
-        player->rotation = 0;
-
-        player->jumping = false;
-        player->falling = false;
-        player->airtime = 0;
+        player->address = address;
+        player->peer = peer;
+        // Kept for whoever reuses the index, a player at a time
+        if (player->visible == NULL) {
+                player->visible = allocate(world.bitset_words, sizeof(*player->visible));
+                player->entering = allocate(world.bitset_words, sizeof(*player->entering));
+        }
+        for (size_t i=0; i<world.bitset_words; i++) {
+                player->visible[i] = 0;
+                player->entering[i] = 0;
+        }
+        player->entering_count = 0;
+        player->events_count = 0;
+        player->events_first = 0;
+        for (size_t i=0; i<SNAPSHOT_HISTORY; i++) {
+                player->sent[i].valid = false;
+        }
+        player->budget = SNAPSHOT_BUDGET_START;
+        player->window_start = world.tick;
+        player->window_sent = 0;
+        player->window_acked = 0;
+        player->window_saturated = false;
+        player->acked = false;
+        player->baseline = 0;
+        player->input_credit = INPUT_CREDIT_MAX;
+        player->input_sequence = UINT32_MAX;
+        player->movement_sequence = UINT32_MAX;
+        player->history_count = 0;
+        player->history_next = 0;
+        player->position_tick = world.tick - 1;
+
+        struct worldState *state = &world.state;
+        const size_t slot = state->count++;
+        player->slot = slot;
+        state->idx[slot] = player->idx;
+
+        state->x[slot] = 0;
+        state->y[slot] = 0;
+        state->z[slot] = 0;
+        state->rotation[slot] = 0;
+        state->vx[slot] = 0;
+        state->vy[slot] = 0;
+        state->extrapolate[slot] = 0;
+
+        state->jump_state[slot] = 0;
+        state->airtime[slot] = 0;
 }
 
 static void player_deinit(struct player *const player) {
         player->init = false;
-}
-
-////////////////////////////////////////////////////////////////////////////////
 
-static void changedEntitySet_init(struct changedEntitySet *const set) {
-        set->count = 0;
-        set->end = 0;
+        struct worldState *state = &world.state;
+        const size_t slot = player->slot;
+        const size_t last = --state->count;
+        if (slot != last) {
+                state->x[slot] = state->x[last];
+                state->y[slot] = state->y[last];
+                state->z[slot] = state->z[last];
+                state->rotation[slot] = state->rotation[last];
+                state->vx[slot] = state->vx[last];
+                state->vy[slot] = state->vy[last];
+                state->extrapolate[slot] = state->extrapolate[last];
+                state->jump_state[slot] = state->jump_state[last];
+                state->airtime[slot] = state->airtime[last];
+                state->idx[slot] = state->idx[last];
+                world.entities[state->idx[slot]].slot = slot;
+        }
 }
 
-static void changedEntitySet_add(struct changedEntitySet *const set,
-                                 struct player *const entity) {
-        size_t idx = 0;
-        while (idx < MAX_ENTITIES && set->entities[idx].init) {
-                if (entity->idx < set->entities[idx].entity->idx) {
-                        idx = idx*2 + 1;
-                } else if (entity->idx > set->entities[idx].entity->idx) {
-                        idx = idx*2 + 2;
-                } else {
-                        return; // already added
+// Queue the spawn or despawn of an entity on a player's client
+static void player_event_push(struct player *const player, const size_t idx, const bool spawn) {
+        if (player->events_count == player->events_capacity) {
+                player->events_capacity = player->events_capacity == 0 ? 64 : player->events_capacity * 2;
+                player->events = realloc(player->events, player->events_capacity * sizeof(*player->events));
+                if (player->events == NULL) {
+                        fprintf(stderr, "could not allocate memory\n");
+                        exit(EXIT_FAILURE);
                 }
         }
-        if (idx >= MAX_ENTITIES) {
+        player->events[player->events_count].idx = (uint32_t)idx;
+        player->events[player->events_count].spawn = spawn;
+        player->events_count++;
+}
+
+// Forget the events before end, which the client has
+static void player_events_acked(struct player *const player, const uint32_t end) {
+        const int32_t acked = (int32_t)(end - player->events_first);
+        if (acked <= 0) {
                 return;
         }
-        set->entities[idx].entity = entity;
-        set->entities[idx].init = true;
-        set->count++;
-        if (idx > set->end) {
-                set->end = idx;
-        }
+        const size_t count = (size_t)acked < player->events_count ? (size_t)acked : player->events_count;
+        memmove(player->events, player->events + count,
+                (player->events_count - count) * sizeof(*player->events));
+        player->events_count -= count;
+        player->events_first += (uint32_t)count;
 }
 
-static inline size_t changedEntitySet_count(const struct changedEntitySet *const set) {
-        return set->count;
+static inline vec3s player_position(const struct player *const player) {
+        const struct worldState *state = &world.state;
+        return (vec3s){
+                .x = state->x[player->slot],
+                .y = state->y[player->slot],
+                .z = state->z[player->slot],
+        };
 }
 
-static void changedEntity_iter(const struct changedEntity *array,
-                               const size_t start, const size_t end,
-                               void(*const func)(const struct player *entity, void *args),
-                               void *const args) {
-        if (start > end) {
-                return;
+static inline void player_set_position(const struct player *const player, const vec3s position) {
+        struct worldState *state = &world.state;
+        state->x[player->slot] = position.x;
+        state->y[player->slot] = position.y;
+        state->z[player->slot] = position.z;
+}
+
+static inline float player_rotation(const struct player *const player) {
+        return world.state.rotation[player->slot];
+}
+
+static inline uint32_t player_jump_state(const struct player *const player) {
+        return world.state.jump_state[player->slot];
+}
+
+static inline float ground_height(const float x, const float y) {
+        return world.has_terrain ? terrain_height(&world.terrain, x, y) : 0;
+}
+
+// Center of the sphere a player with its feet at x, y, z collides with the
+// level as
+static inline vec3s collision_center(const float x, const float y, const float z) {
+        return (vec3s){
+                .x = x,
+                .y = y,
+                .z = z + PLAYER_COLLISION_HEIGHT,
+        };
+}
+
+static inline unsigned long server_time(const struct timespec t) {
+        return monotonic_difference(t, world.epoch);
+}
+
+// Remember where a player was at a given time. Samples are kept in order, one
+// from before the latest is taken as being from the same time.
+static void history_push(struct player *const player, unsigned long time) {
+        if (player->history_count > 0) {
+                const size_t last = (player->history_next + POSITION_HISTORY - 1) % POSITION_HISTORY;
+                if (time < player->history[last].time) {
+                        time = player->history[last].time;
+                }
+        }
+
+        const vec3s position = player_position(player);
+        struct positionSample *sample = &player->history[player->history_next];
+        sample->time = time;
+        sample->position = glms_vec2(position);
+        // as the client had it, which can not be below the ground or above
+        // a jump
+        sample->height = fminf(fmaxf(position.z - ground_height(position.x, position.y), 0),
+                               JUMP_HEIGHT);
+
+        player->history_next = (player->history_next + 1) % POSITION_HISTORY;
+        if (player->history_count < POSITION_HISTORY) {
+                player->history_count++;
         }
-        
-        changedEntity_iter(array, start*2+1, end, func, args);
-        func(array[start].entity, args);
-        changedEntity_iter(array, start*2+2, end, func, args);
 }
 
-static void changedEntitySet_iter(const struct changedEntitySet *const set,
-                                  void(*const func)(const struct player *entity, void *args),
-                                  void *const args) {
-        if (set->count == 0) {
-                return;
+// Latest sample from no later than the given time, or the oldest one if they
+// are all later. There must be at least one.
+static const struct positionSample *history_at(const struct player *const player,
+                                               const unsigned long time) {
+        const struct positionSample *found = NULL;
+        for (size_t i=1; i<=player->history_count; i++) {
+                found = &player->history[(player->history_next + POSITION_HISTORY - i) % POSITION_HISTORY];
+                if (found->time <= time) {
+                        break;
+                }
         }
-        
-        changedEntity_iter(set->entities, 0, set->end, func, args);
+        return found;
 }
 
-static void changedEntitySet_clear(struct changedEntitySet *const set) {
-        if (set->count == 0) {
+// Take the lowest free entity index, which keeps them packed at the start of
+// the bitsets. There always is one, since players and ghosts are limited to
+// their share of them.
+static size_t entity_take(void) {
+        const size_t idx = slotAllocator_take(&world.slots);
+        world.entities[idx].init = true;
+        return idx;
+}
+
+static void entity_give_back(const size_t idx) {
+        world.entities[idx].init = false;
+        slotAllocator_release(&world.slots, idx);
+}
+
+// Player owning the given slot of the world state
+static inline struct player *slot_player(const size_t slot) {
+        return &world.entities[world.state.idx[slot]];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void bitset_set(uint64_t *const set, const size_t idx) {
+        set[idx / BITSET_WORD_BITS] |= (uint64_t)1 << (idx % BITSET_WORD_BITS);
+}
+
+static inline void bitset_unset(uint64_t *const set, const size_t idx) {
+        set[idx / BITSET_WORD_BITS] &= ~((uint64_t)1 << (idx % BITSET_WORD_BITS));
+}
+
+static inline bool bitset_test(const uint64_t *const set, const size_t idx) {
+        return (set[idx / BITSET_WORD_BITS] >> (idx % BITSET_WORD_BITS)) & 1;
+}
+
+// Remove the lowest set bit of a word and return its position.
+static inline size_t bitset_word_pop(uint64_t *const word) {
+        const size_t bit = (size_t)__builtin_ctzll(*word);
+        *word &= *word - 1;
+        return bit;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void changedEntitySet_init(struct changedEntitySet *const set) {
+        set->count = 0;
+        set->bits = allocate(world.bitset_words, sizeof(*set->bits));
+        set->entities = allocate(world.capacity, sizeof(*set->entities));
+}
+
+static void changedEntitySet_free(struct changedEntitySet *const set) {
+        free(set->bits);
+        free(set->entities);
+}
+
+static inline void changedEntitySet_add(struct changedEntitySet *const set,
+                                        const struct player *const entity) {
+        if (bitset_test(set->bits, entity->idx)) {
                 return;
         }
+        bitset_set(set->bits, entity->idx);
+        set->entities[set->count++] = entity->idx;
+}
 
-        for (size_t i=0; i<=set->end; i++) {
-                set->entities[i].init = false;
-                set->entities[i].entity = NULL;
-        }
+static inline size_t changedEntitySet_count(const struct changedEntitySet *const set) {
+        return set->count;
+}
 
-        set->end = 0;
+// Changed entities among the ones whose index is in
+// [w*BITSET_WORD_BITS, (w+1)*BITSET_WORD_BITS)
+static inline uint64_t changedEntitySet_word(const struct changedEntitySet *const set,
+                                             const size_t w) {
+        return set->bits[w];
+}
+
+static void changedEntitySet_clear(struct changedEntitySet *const set) {
+        for (size_t i=0; i<set->count; i++) {
+                bitset_unset(set->bits, set->entities[i]);
+        }
         set->count = 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static void world_init(void) {
-        world.entities = malloc(MAX_ENTITIES * sizeof(*world.entities));
-        for (size_t i=0; i<MAX_ENTITIES; i++) {
+static void world_init(const size_t max_players, const size_t capacity,
+                       const unsigned long tick_period_ns, const float interest_radius,
+                       const struct networkCodec *const codec,
+                       const enum networkMovement movement) {
+        world.capacity = capacity;
+        world.max_players = max_players;
+        world.bitset_words = (capacity + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS;
+
+        world.entities = allocate(capacity, sizeof(*world.entities));
+        for (size_t i=0; i<capacity; i++) {
                 world.entities[i].init = false;
                 world.entities[i].idx = i;
+                world.entities[i].visible = NULL;
+                world.entities[i].entering = NULL;
+                world.entities[i].entering_list = NULL;
+                world.entities[i].entering_capacity = 0;
+                world.entities[i].events = NULL;
+                world.entities[i].events_capacity = 0;
+        }
+        slotAllocator_init(&world.slots, capacity);
+        world.peers = allocate(max_players, sizeof(*world.peers));
+        for (size_t i=0; i<max_players; i++) {
+                world.peers[i].idx = UINT32_MAX;
         }
+
+        struct worldState *state = &world.state;
+        state->count = 0;
+        state->x = allocate(capacity, sizeof(*state->x));
+        state->y = allocate(capacity, sizeof(*state->y));
+        state->z = allocate(capacity, sizeof(*state->z));
+        state->rotation = allocate(capacity, sizeof(*state->rotation));
+        state->vx = allocate(capacity, sizeof(*state->vx));
+        state->vy = allocate(capacity, sizeof(*state->vy));
+        state->extrapolate = allocate(capacity, sizeof(*state->extrapolate));
+        state->airtime = allocate(capacity, sizeof(*state->airtime));
+        state->jump_state = allocate(capacity, sizeof(*state->jump_state));
+        state->idx = allocate(capacity, sizeof(*state->idx));
         
-        world.lowest_free_player_slot = 0;
         world.num_players = 0;
         changedEntitySet_init(&world.changed_entities);
+
+        world.tick_period_ns = tick_period_ns;
+        world.tick_period = (float)tick_period_ns / 1e9f;
+        world.movement = movement;
+
+        world.interest_radius = interest_radius;
+        spatialHash_init(&world.grid, interest_radius, capacity);
+
+        world.tick = 0;
+        world.snapshots = allocate(SNAPSHOT_HISTORY, sizeof(*world.snapshots));
+        for (size_t i=0; i<SNAPSHOT_HISTORY; i++) {
+                world.snapshots[i].tick = 0;
+                world.snapshots[i].changed = allocate(world.bitset_words, sizeof(*world.snapshots[i].changed));
+                world.snapshots[i].entities = allocate(capacity, sizeof(*world.snapshots[i].entities));
+                world.snapshots[i].fields = allocate(capacity, sizeof(*world.snapshots[i].fields));
+        }
+        world.scratch = allocate(3 * world.bitset_words, sizeof(*world.scratch));
+        world.entered = allocate(capacity, sizeof(*world.entered));
+        world.candidates = allocate(capacity, sizeof(*world.candidates));
+        world.entering_entry = allocate(capacity, sizeof(*world.entering_entry));
+        world.record_mask = allocate(capacity, sizeof(*world.record_mask));
+
+        world.codec = *codec;
+        world.has_level = false;
+        world.has_terrain = false;
+        world.epoch = monotonic();
+}
+
+static bool world_load_level(const char *const path) {
+        if (!levelCollision_load(&world.level, path)) {
+                return false;
+        }
+        world.has_level = true;
+        world.moving_slots = allocate(world.capacity, sizeof(*world.moving_slots));
+        world.moving_from = allocate(world.capacity, sizeof(*world.moving_from));
+        world.moving_to = allocate(world.capacity, sizeof(*world.moving_to));
+        return true;
+}
+
+// Samples are kept quantized, the whole world is grounded every tick
+static bool world_load_terrain(const char *const path) {
+        if (!terrain_load(&world.terrain, path, true)) {
+                return false;
+        }
+        world.has_terrain = true;
+        world.ground = allocate(world.capacity, sizeof(*world.ground));
+        return true;
 }
 
 static void world_deinit(void) {
+        for (size_t i=0; i<world.capacity; i++) {
+                free(world.entities[i].visible);
+                free(world.entities[i].entering);
+                free(world.entities[i].entering_list);
+                free(world.entities[i].events);
+        }
         free(world.entities);
+        slotAllocator_free(&world.slots);
+        free(world.peers);
+        changedEntitySet_free(&world.changed_entities);
+        free(world.state.x);
+        free(world.state.y);
+        free(world.state.z);
+        free(world.state.rotation);
+        free(world.state.vx);
+        free(world.state.vy);
+        free(world.state.extrapolate);
+        free(world.state.airtime);
+        free(world.state.jump_state);
+        free(world.state.idx);
+        spatialHash_free(&world.grid);
+        for (size_t i=0; i<SNAPSHOT_HISTORY; i++) {
+                free(world.snapshots[i].changed);
+                free(world.snapshots[i].entities);
+                free(world.snapshots[i].fields);
+        }
+        free(world.snapshots);
+        free(world.scratch);
+        free(world.entered);
+        free(world.candidates);
+        free(world.entering_entry);
+        free(world.record_mask);
+        if (world.has_level) {
+                levelCollision_free(&world.level);
+                free(world.moving_slots);
+                free(world.moving_from);
+                free(world.moving_to);
+        }
+        if (world.has_terrain) {
+                terrain_free(&world.terrain);
+                free(world.ground);
+        }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static void networking_deinit(void);
-static void networking_init(unsigned short port) {
-        enet_initialize();
-        atexit(networking_deinit);
+static uint64_t splitmix64(uint64_t *const state) {
+        uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+}
 
-        ENetAddress address;
-        address.host = ENET_HOST_ANY;
-        address.port = port;
+static void shard_init(void) {
+        // Neighbours may have room for more entities than this server, link
+        // maps cover any index
+        shard.links = allocate(LINK_PEERS, sizeof(*shard.links));
+        for (size_t i=0; i<LINK_PEERS; i++) {
+                shard.links[i].connectID = 0;
+                shard.links[i].received = 0;
+                shard.links[i].ghosts = allocate(MAX_ENTITIES, sizeof(*shard.links[i].ghosts));
+                for (size_t j=0; j<MAX_ENTITIES; j++) {
+                        shard.links[i].ghosts[j] = NO_GHOST;
+                }
+        }
+        shard.max_ghosts = world.capacity - world.max_players;
+        shard.ghosts = allocate(world.capacity, sizeof(*shard.ghosts));
+        shard.ghost_list = allocate(shard.max_ghosts, sizeof(*shard.ghost_list));
+        shard.num_ghosts = 0;
 
-        server = enet_host_create(&address, MAX_PLAYERS, NETWORK_CHANNELS_TOTAL, 0, 0);
-        if (server == NULL) {
-                fprintf(stderr, "could not create server\n");
-                exit(EXIT_FAILURE);
+        for (size_t i=0; i<MAX_HANDOFFS; i++) {
+                shard.handoffs[i].pending = false;
+        }
+
+        // Tokens are what a client shows to claim a handoff, so they should
+        // not be guessable
+        const struct timespec now = monotonic();
+        shard.token_state = (uint64_t)now.tv_nsec ^ ((uint64_t)getpid() << 32);
+        FILE *urandom = fopen("/dev/urandom", "rb");
+        if (urandom != NULL) {
+                uint64_t seed;
+                if (fread(&seed, sizeof(seed), 1, urandom) == 1) {
+                        shard.token_state ^= seed;
+                }
+                fclose(urandom);
+        }
+}
+
+static void shard_deinit(void) {
+        for (size_t i=0; i<LINK_PEERS; i++) {
+                free(shard.links[i].ghosts);
         }
+        free(shard.links);
+        free(shard.ghosts);
+        free(shard.ghost_list);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void networking_deinit(void);
+static void networking_init(const enum transportBackend backend, const unsigned short port,
+                            const struct serverNetworkLinks *const links) {
+        serverNetwork_init(backend, port, world.max_players, &world.codec, links);
+        atexit(networking_deinit);
 }
 
 static void networking_deinit(void) {
+        serverNetwork_deinit();
         world_deinit();
-        if (server != NULL) {
-                enet_host_destroy(server);
+        if (shard.enabled) {
+                shard_deinit();
         }
-        enet_deinitialize();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static void sendCorrectionPacket(ENetPeer *const client,
-                                 const struct player *const player) {
-        struct networkPacketPositionCorrection data;
-        data.base.type = PACKET_TYPE_POSITION_CORRECTION;
-        data.position = player->position;
-        data.jumpFall = (uint8_t)player->jumping;
-        data.jumpFall |= (uint8_t)((uint8_t)player->falling << 1);
+// The client snaps to the position sent, so later samples are checked against
+// it from the given server time on, that of the command that caused it so
+// that replays do the same. A client sending inputs applies again the ones
+// the server has not yet.
+static void sendCorrectionPacket(struct player *const player, const unsigned long time) {
+        history_push(player, time);
+
+        struct networkPacketPositionCorrection *data = serverNetwork_packet(NETWORK_SMALL_PACKET_MAX);
+        data->base.type = PACKET_TYPE_POSITION_CORRECTION;
+
+        struct bitWriter writer;
+        bitWriter_init(&writer, data->data, NETWORK_SMALL_PACKET_MAX - sizeof(*data));
+        networkCodec_writePosition(&world.codec, &writer, player_position(player));
+        bitWriter_write(&writer, player_jump_state(player), NETWORK_JUMP_STATE_BITS);
+        const float airtime = fminf(world.state.airtime[player->slot] * 1000.0f,
+                                    (float)((1U << NETWORK_AIRTIME_BITS) - 1));
+        bitWriter_write(&writer, (uint32_t)airtime, NETWORK_AIRTIME_BITS);
+        bitWriter_write(&writer, player->input_sequence, 32);
+        size_t size = sizeof(*data) + bitWriter_finish(&writer);
+
+        serverNetwork_send(player->peer, NETWORK_CHANNEL_MOVEMENT, data, size, 0);
+}
+
+static void sendRedirectPacket(const struct player *const client,
+                               const ENetAddress address, const uint32_t token) {
+        struct networkPacketRedirect *data = serverNetwork_packet(sizeof(*data));
+        data->base.type = PACKET_TYPE_REDIRECT;
+        data->token = token;
+        data->host = address.host;
+        data->port = address.port;
 
-        ENetPacket *packet = enet_packet_create(&data, sizeof(data), 0);
-        enet_peer_send(client, NETWORK_CHANNEL_MOVEMENT, packet);
+        serverNetwork_send(client->peer, NETWORK_CHANNEL_CONTROL,
+                           data, sizeof(*data), ENET_PACKET_FLAG_RELIABLE);
 }
 
+// Time at which the client took a sample it sent, estimated as one way trip
+// before it arrived
+static unsigned long client_sample_time(const struct serverCommand *const command) {
+        const unsigned long received = server_time(command->received);
+        const unsigned long trip = (unsigned long)command->roundTripTime * 1000000UL / 2;
+        return received > trip ? received - trip : 0;
+}
+
+// Whether the client could have walked to a position. The server rewinds to
+// the last position it knows the client had before taking this sample, and
+// allows the distance that can be walked in the time between both samples.
+// Only the jitter of the connection and the tick's granularity are given as
+// slack, rather than the whole round trip. Nor can the client have gone
+// through the level on the way, with the sphere the simulation moves players
+// as, so that it can not stand closer to walls or fit through narrower gaps
+// than simulated players.
 static bool validateNewPlayerPosition(struct player *const player,
-                                      const vec3s clientPosition, unsigned ping) {
-        if (player->position.z > JUMP_HEIGHT) {
+                                      const vec3s clientPosition,
+                                      const struct serverCommand *const command) {
+        vec3s serverPosition = player_position(player);
+        const float height = serverPosition.z - ground_height(serverPosition.x, serverPosition.y);
+        if (height > JUMP_HEIGHT) {
                 return false;
         }
 
-        vec2s serverPosition2 = glms_vec2(player->position);
+        const unsigned long time = client_sample_time(command);
+        const struct positionSample *from = history_at(player, time);
+
         vec2s clientPosition2 = glms_vec2(clientPosition);
-        
-        vec2s difference = glms_vec2_sub(clientPosition2, serverPosition2);
+        vec2s difference = glms_vec2_sub(clientPosition2, from->position);
         float magnitude = glms_vec2_norm(difference);
 
-        double maxTime = ping/1000.0 + PACKET_SEND_RATELIMIT + TICK_PERIOD;
-        double tolerance = maxTime * PLAYER_SPEED;
-        
-        if (magnitude <= tolerance) {
-                return true;
-        } else {
-                fprintf(stderr, "magnitude: %f\ntolerance: %f\n\n", magnitude, tolerance);
+        unsigned long elapsed = time > from->time ? time - from->time : 0;
+        elapsed += (unsigned long)command->roundTripTimeVariance * 1000000UL + world.tick_period_ns;
+        double tolerance = (double)elapsed / 1e9 * PLAYER_SPEED;
+        if (magnitude > tolerance) {
                 return false;
         }
+
+        // on the ground under each end, which may be far above or below
+        // where the player is now on slopes
+        if (world.has_level) {
+                const vec3s start = collision_center(
+                        from->position.x, from->position.y,
+                        ground_height(from->position.x, from->position.y) + from->height);
+                const vec3s end = collision_center(
+                        clientPosition.x, clientPosition.y,
+                        ground_height(clientPosition.x, clientPosition.y) + height);
+                if (levelCollision_sweepSphere(&world.level, start, end,
+                                               PLAYER_COLLISION_RADIUS, NULL)) {
+                        return false;
+                }
+        }
+        return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static void onPositionPacket(ENetPeer *const client, struct player *const player,
-                             const struct networkPacketPosition *const packet) {
-        if (!validateNewPlayerPosition(player, packet->position, client->roundTripTime)) {
-                sendCorrectionPacket(client, player);
+// Clients only send positions once the server's extrapolation of the last one
+// is off, so the player keeps moving with the velocity sent until then. For
+// a while longer than clients go between positions, in case one is lost.
+static void movement_position(struct player *const player, const struct serverCommand *const command) {
+        struct worldState *state = &world.state;
+        const size_t slot = player->slot;
+        if (!validateNewPlayerPosition(player, command->position, command)) {
+                profiler_count(PROFILER_COUNTER_POSITIONS_REJECTED, 1);
+                state->vx[slot] = 0;
+                state->vy[slot] = 0;
+                state->extrapolate[slot] = 0;
+                sendCorrectionPacket(player, server_time(command->received));
         } else {
-                player->position = packet->position;
+                player_set_position(player, command->position);
+                history_push(player, client_sample_time(command));
+                player->position_tick = world.tick;
+
+                vec2s velocity = command->velocity;
+                const float speed = glms_vec2_norm(velocity);
+                if (speed > PLAYER_SPEED) {
+                        velocity = glms_vec2_scale(velocity, PLAYER_SPEED / speed);
+                }
+                state->vx[slot] = velocity.x;
+                state->vy[slot] = velocity.y;
+                state->extrapolate[slot] = (float)NETWORK_DEAD_RECKONING_MAX_MS * 1.5f / 1000.0f;
                 changedEntitySet_add(&world.changed_entities, player);
         }
 }
-static void onRotationPacket(struct player *const player,
-                             const struct networkPacketRotation *const packet) {
-        player->rotation = packet->rotation;
+static void movement_rotation(struct player *const player, const struct serverCommand *const command) {
+        world.state.rotation[player->slot] = command->rotation;
         changedEntitySet_add(&world.changed_entities, player);
 }
-static void onJumpPacket(ENetPeer *const client, struct player *const player) {
-        if (player->jumping || player->falling) {
-                sendCorrectionPacket(client, player);
+static void movement_jump(struct player *const player, const struct serverCommand *const command) {
+        if (player_jump_state(player) != 0) {
+                sendCorrectionPacket(player, server_time(command->received));
         } else {
-                player->jumping = true;
-                player->falling = false;
-                player->airtime = 0;
+                world.state.jump_state[player->slot] = JUMP_STATE_JUMPING;
+                world.state.airtime[player->slot] = 0;
                 changedEntitySet_add(&world.changed_entities, player);
         }
 }
-
-////////////////////////////////////////////////////////////////////////////////
-
-static void onControlPacket(ENetPeer *client, struct player *const player,
-                            const void *const data) {
-        (void)client;
-        (void)player;
-        (void)data;
-}
-static void onMovementPacket(ENetPeer *const client, struct player *const player,
-                             const struct networkPacket *const packet) {
-        switch (packet->type) {
-        case PACKET_TYPE_POSITION_UPDATE:
-                onPositionPacket(client, player, (const void*)packet);
-                break;
-        case PACKET_TYPE_ROTATION_UPDATE:
-                onRotationPacket(player, (const void*)packet);
-                break;
-        case PACKET_TYPE_JUMP_UPDATE:
-                onJumpPacket(client, player);
-                break;
-        default:
-                break;
+// Everything a client sent about its player since its last movement packet,
+// in one go. Packets overtaken by a later one on the way are dropped, the
+// later one has a more recent position anyway.
+static void onMovementPacket(struct player *const player, const struct serverCommand *const command) {
+        if ((int32_t)(command->sequence - player->movement_sequence) <= 0) {
+                return;
         }
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-static void onNewConnection(const ENetEvent *const event) {
-        size_t idx = world.lowest_free_player_slot;
-        struct player *player = &world.entities[idx];
-        player_init(player, event->peer->address);
-        event->peer->data = player;
+        player->movement_sequence = command->sequence;
 
-        do {
-                world.lowest_free_player_slot++;
-        } while (world.entities[world.lowest_free_player_slot].init);
-        world.num_players++;
-
-        size_t size = sizeof(struct networkPacketWelcome) + sizeof(struct networkPacketEntityChange) * world.num_players;
-        struct networkPacketWelcome *data = malloc(size);
-        
-        data->base.type = PACKET_TYPE_WELCOME;
-        data->id = (uint16_t)idx;
-        data->count = 0;
-        for (size_t i=0; i<MAX_PLAYERS; i++) {
-                data->currentEntities[data->count].idx = (uint16_t)i;
-                data->currentEntities[data->count].position = world.entities[i].position;
-                data->currentEntities[data->count].rotation = world.entities[i].rotation;
-                data->count++;
-                if (data->count >= world.num_players-1) {
-                        break;
-                }
+        if (command->fields & MOVEMENT_FIELD_POSITION) {
+                movement_position(player, command);
+        }
+        if (command->fields & MOVEMENT_FIELD_ROTATION) {
+                movement_rotation(player, command);
+        }
+        if (command->fields & MOVEMENT_FIELD_JUMP) {
+                movement_jump(player, command);
         }
-        ENetPacket *packet = enet_packet_create(data, size, ENET_PACKET_FLAG_RELIABLE);
-        enet_peer_send(event->peer, NETWORK_CHANNEL_CONTROL, packet);
-
-        struct networkPacketNewEntity data2;
-        data2.base.type = PACKET_TYPE_NEW_ENTITY;
-        data2.idx = (uint16_t)idx;
-        data2.position = player->position;
-        data2.rotation = player->rotation;
-        ENetPacket *packet2 = enet_packet_create(&data2, sizeof(data2), ENET_PACKET_FLAG_RELIABLE);
-        enet_host_broadcast(server, NETWORK_CHANNEL_SERVER_UPDATES, packet2);
 }
-static void onDisconnection(const ENetEvent *const event) {
-        struct player *player = event->peer->data;
-        size_t idx = player->idx;
-        if (player == NULL) {
+static void onSnapshotAck(struct player *const player, const struct serverCommand *const command) {
+        // acknowledgements arrive unordered and may be forged
+        if ((int32_t)(world.tick - command->snapshot) < 0) {
                 return;
         }
 
-        if (idx < world.lowest_free_player_slot) {
-                world.lowest_free_player_slot = player->idx;
+        // Only a snapshot this client was actually sent can be its baseline,
+        // deltas against anything else would not decode to what the server
+        // has
+        struct sentSnapshot *sent = &player->sent[command->snapshot % SNAPSHOT_HISTORY];
+        if (!sent->valid || sent->tick != command->snapshot) {
+                return;
+        }
+        if (!sent->acked) {
+                sent->acked = true;
+                player->window_acked += sent->size;
+                player_events_acked(player, sent->events_end);
         }
-        world.num_players--;
-        
-        player_deinit(player);
-        event->peer->data = NULL;
 
-        struct networkPacketDelEntity data;
-        data.base.type = PACKET_TYPE_DEL_ENTITY;
-        data.idx = (uint16_t)idx;
-        ENetPacket *packet = enet_packet_create(&data, sizeof(data), ENET_PACKET_FLAG_RELIABLE);
-        enet_host_broadcast(server, NETWORK_CHANNEL_SERVER_UPDATES, packet);
+        if (player->acked && (int32_t)(command->snapshot - player->baseline) <= 0) {
+                return;
+        }
+        player->acked = true;
+        player->baseline = command->snapshot;
 }
-static void onReceived(const ENetEvent *const event) {
-        struct player *player = event->peer->data;
-        if (player == NULL) {
+
+// Move the player as its client did. Nothing needs validating, only inputs
+// sent faster than ticks go by are dropped, after which the client is set
+// back to where the server has it. So is a client that jumped while the
+// server still has it in the air, or walked into the level.
+static void onInputPacket(struct player *const player, const struct serverCommand *const command) {
+        player->input_sequence = command->sequence;
+        if (player->input_credit == 0) {
+                sendCorrectionPacket(player, server_time(command->received));
                 return;
         }
+        player->input_credit--;
+
+        struct worldState *state = &world.state;
+        const size_t slot = player->slot;
+        const bool airborne = state->jump_state[slot] != 0;
+        const vec3s from = collision_center(state->x[slot], state->y[slot], state->z[slot]);
+        apply_player_input(&command->input, &state->x[slot], &state->y[slot],
+                           &state->rotation[slot], &state->jump_state[slot],
+                           &state->airtime[slot], world.tick_period);
+        changedEntitySet_add(&world.changed_entities, player);
 
-        switch (event->channelID) {
-        case NETWORK_CHANNEL_CONTROL:
-                onControlPacket(event->peer, player, (void*)event->packet->data);
-                break;
-        case NETWORK_CHANNEL_MOVEMENT:
-                onMovementPacket(event->peer, player, (void*)event->packet->data);
-                break;
-        case NETWORK_CHANNEL_SERVER_UPDATES:
-        default:
-                fprintf(stderr, "ignoring packet received on channel %u\n", event->channelID);
-                break;
+        bool blocked = false;
+        if (world.has_level) {
+                const vec3s to = collision_center(state->x[slot], state->y[slot], state->z[slot]);
+                const vec3s moved = levelCollision_moveSphere(&world.level, from, to,
+                                                              PLAYER_COLLISION_RADIUS);
+                blocked = glms_vec3_distance(moved, to) > 0;
+                state->x[slot] = moved.x;
+                state->y[slot] = moved.y;
         }
 
-        enet_packet_destroy(event->packet);
+        if (blocked || (airborne && (command->input.buttons & INPUT_JUMP))) {
+                sendCorrectionPacket(player, server_time(command->received));
+        }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static void poll_events(unsigned time_passed) {
-        unsigned long period_ns;
-        if (time_passed > TICK_PERIOD_NS) {
-                period_ns = 0;
+// Handoff a reconnecting client claims with its token at a given time, if
+// there is one
+static struct handoff *claim_handoff(const uint32_t token, const struct timespec now) {
+        if (token == 0) {
+                return NULL;
         }
-        period_ns = TICK_PERIOD_NS - time_passed;
-        unsigned period = (unsigned)(period_ns/1000000UL);
-        
-        struct timespec t1 = monotonic();
-        
-        ENetEvent event;
-        while (enet_host_service(server, &event, period) > 0) {
-                switch (event.type) {
-                case ENET_EVENT_TYPE_CONNECT:
-                        onNewConnection(&event);
-                        break;
-                case ENET_EVENT_TYPE_DISCONNECT:
-                        onDisconnection(&event);
-                        break;
-                case ENET_EVENT_TYPE_RECEIVE:
-                        onReceived(&event);
-                        break;
-                case ENET_EVENT_TYPE_NONE:
-                default:
-                        break;
-                }
-
-                struct timespec t2 = monotonic();
-                unsigned long t = monotonic_difference(t2, t1)/1000000UL;
-                if (t >= period) {
-                        period = 0;
-                } else {
-                        period -= (unsigned)t;
+        for (size_t i=0; i<MAX_HANDOFFS; i++) {
+                struct handoff *handoff = &shard.handoffs[i];
+                if (handoff->pending && handoff->token == token &&
+                    timespec_before(now, handoff->expires)) {
+                        handoff->pending = false;
+                        return handoff;
                 }
-                t1 = t2;
         }
+        return NULL;
 }
 
-////////////////////////////////////////////////////////////////////////////////
+static void onNewConnection(const struct serverCommand *const command) {
+        size_t idx = entity_take();
+        struct player *player = &world.entities[idx];
+        player_init(player, command->peer, command->connection.address);
+        world.peers[command->peer.idx] = slotAllocator_handle(&world.slots, idx);
+        world.num_players++;
 
-static void step_player_jump(struct player *const player) {
-        if (!player->jumping && !player->falling) {
-                player->position.z = 0;
-                return;
+        // A player handed off by a neighbour carries on where it was
+        const struct handoff *handoff = claim_handoff(command->connection.token, command->received);
+        if (handoff != NULL) {
+                player_set_position(player, handoff->position);
+                world.state.rotation[player->slot] = handoff->rotation;
+                world.state.airtime[player->slot] = handoff->airtime;
+                world.state.jump_state[player->slot] = handoff->jump_state;
         }
+        history_push(player, server_time(command->received));
+
+        // Other entities are sent as they enter this player's area of
+        // interest, the welcome only carries the player itself.
+        struct networkPacketWelcome *data = serverNetwork_packet(sizeof(*data) + NETWORK_SMALL_PACKET_MAX);
         
-        player->airtime += TICK_PERIOD;
-        player->position.z = jump_fall_animation(&player->jumping,
-                                                 &player->falling,
-                                                 player->airtime);
+        data->base.type = PACKET_TYPE_WELCOME;
+        data->id = (uint16_t)idx;
+        data->capacity = (uint16_t)world.capacity;
+        data->tickPeriodNs = (uint32_t)world.tick_period_ns;
+        data->codec = world.codec.params;
+        data->movement = (uint8_t)world.movement;
+
+        struct bitWriter writer;
+        bitWriter_init(&writer, data->data, NETWORK_SMALL_PACKET_MAX);
+        bitWriter_writeVarUint(&writer, 1);
+        bitWriter_writeVarUint(&writer, (uint32_t)idx);
+        networkCodec_writePosition(&world.codec, &writer, player_position(player));
+        networkCodec_writeRotation(&world.codec, &writer, player_rotation(player));
+        size_t size = sizeof(*data) + bitWriter_finish(&writer);
+
+        serverNetwork_send(player->peer, NETWORK_CHANNEL_CONTROL, data, size, ENET_PACKET_FLAG_RELIABLE);
+
+        // The welcome does not tell the client it is in the air
+        if (handoff != NULL && handoff->jump_state != 0) {
+                sendCorrectionPacket(player, server_time(command->received));
+        }
 
+        // Make the new player show up for everyone around it
         changedEntitySet_add(&world.changed_entities, player);
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-static void step_player(struct player *const player) {
-        step_player_jump(player);
-        //fprintf(stderr, "player %lu - pos:%f,%f,%f - rot:%f\n", player->idx, player->position.x, player->position.y, player->position.z, player->orientation);
+// Tell every client that knows about an entity that it is gone
+static void entity_forget(const size_t idx) {
+        for (size_t slot=0; slot<world.state.count; slot++) {
+                struct player *other = slot_player(slot);
+                if (bitset_test(other->visible, idx)) {
+                        bitset_unset(other->visible, idx);
+                        bitset_unset(other->entering, idx);
+                        player_event_push(other, idx, false);
+                }
+        }
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-static void add_entity_change(const struct player *const entity, void *args) {
-        struct networkPacketEntityChangesUpdate *data = args;
-        size_t i = data->count;
-        struct networkPacketEntityChange *nwEntity = &data->entities[i];
-        nwEntity->idx = (uint16_t)entity->idx;
-        nwEntity->position = entity->position;
-        nwEntity->rotation = entity->rotation;
-        data->count += 1;
-}
+static void player_remove(struct player *const player) {
+        size_t idx = player->idx;
 
-static void broadcast_changes(void) {
-        struct networkPacketEntityChangesUpdate *data;
-        size_t count = changedEntitySet_count(&world.changed_entities);
-        if (count == 0) {
-                return;
-        }
-        
-        size_t size = sizeof(*data) + count * sizeof(struct networkPacketEntityChange);
-        data = malloc(size);
+        world.num_players--;
+        world.peers[player->peer.idx].idx = UINT32_MAX;
+        player_deinit(player);
+        entity_give_back(idx);
 
-        data->base.type = PACKET_TYPE_ENTITY_CHANGES_UPDATE;
-        data->count = 0;
-        changedEntitySet_iter(&world.changed_entities, add_entity_change, data);
+        entity_forget(idx);
+}
 
-        ENetPacket *packet = enet_packet_create(data, size, 0);
-        enet_host_broadcast(server, NETWORK_CHANNEL_SERVER_UPDATES, packet);
-        
-        changedEntitySet_clear(&world.changed_entities);
+static void onDisconnection(struct player *const player) {
+        player_remove(player);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static void step_world(void) {
-        for (size_t i=0; i<MAX_PLAYERS; i++) {
-                if (world.entities[i].init) {
-                        step_player(&world.entities[i]);
+static void ghost_remove(const size_t idx) {
+        struct ghost *ghost = &shard.ghosts[idx];
+        shard.links[ghost->link].ghosts[ghost->remote] = NO_GHOST;
+
+        const size_t last = shard.ghost_list[--shard.num_ghosts];
+        shard.ghost_list[ghost->pos] = last;
+        shard.ghosts[last].pos = ghost->pos;
+
+        entity_give_back(idx);
+        entity_forget(idx);
+}
+
+// Remove every ghost shown for a link. Removing moves the last ghost of the
+// list in place of the removed one, so the list is walked backwards.
+static void ghosts_forget(const size_t link) {
+        for (size_t i=shard.num_ghosts; i-->0;) {
+                const size_t idx = shard.ghost_list[i];
+                if (shard.ghosts[idx].link == link) {
+                        ghost_remove(idx);
                 }
         }
 }
 
-int main(int argc, char *argv[]) {
-        if (argc != 2) {
-                fprintf(stderr, "usage:\n\t%s port\n", argv[0]);
-                return 1;
+static void onLinkBorder(const struct serverCommand *const command) {
+        const ENetPacket *packet = command->packet;
+        const struct linkPacketBorder *data = (const void*)packet->data;
+        if (packet->dataLength < sizeof(*data) ||
+            packet->dataLength < sizeof(*data) + data->count * sizeof(*data->entities)) {
+                return;
         }
-        const unsigned short port = (unsigned short)atoi(argv[1]);
-        
-        world_init();
-        networking_init(port);
+
+        // A link peer may now be another neighbour, or the same one again
+        struct borderLink *link = &shard.links[command->peer.idx];
+        if (link->connectID != command->peer.connectID) {
+                ghosts_forget(command->peer.idx);
+                link->connectID = command->peer.connectID;
+        }
+        const uint32_t received = ++link->received;
+
+        for (size_t i=0; i<data->count; i++) {
+                const struct linkBorderEntity *entity = &data->entities[i];
+                if (entity->idx >= MAX_ENTITIES) {
+                        continue;
+                }
+
+                size_t idx = link->ghosts[entity->idx];
+                if (idx == NO_GHOST) {
+                        if (shard.num_ghosts >= shard.max_ghosts) {
+                                continue;
+                        }
+                        idx = entity_take();
+                        link->ghosts[entity->idx] = (uint32_t)idx;
+
+                        struct ghost *ghost = &shard.ghosts[idx];
+                        ghost->link = command->peer.idx;
+                        ghost->remote = entity->idx;
+                        ghost->pos = shard.num_ghosts;
+                        shard.ghost_list[shard.num_ghosts++] = idx;
+                }
+
+                struct ghost *ghost = &shard.ghosts[idx];
+                struct networkSnapshotEntity state = {
+                        .position = { .x = entity->x, .y = entity->y, .z = entity->z },
+                        .rotation = entity->rotation,
+                };
+                ghost->seen = received;
+                if (memcmp(&ghost->state, &state, sizeof(state)) != 0) {
+                        ghost->state = state;
+                        changedEntitySet_add(&world.changed_entities, &world.entities[idx]);
+                }
+        }
+
+        for (size_t i=shard.num_ghosts; i-->0;) {
+                const size_t idx = shard.ghost_list[i];
+                if (shard.ghosts[idx].link == command->peer.idx &&
+                    shard.ghosts[idx].seen != received) {
+                        ghost_remove(idx);
+                }
+        }
+}
+
+// Keep the state of a player on its way here until its client reconnects. The
+// link is faster than the client's reconnection, so it gets here first.
+static void onLinkHandoff(const struct serverCommand *const command) {
+        const ENetPacket *packet = command->packet;
+        const struct linkPacketHandoff *data = (const void*)packet->data;
+        if (packet->dataLength < sizeof(*data) || data->token == 0) {
+                return;
+        }
+
+        const struct timespec now = command->received;
+        struct handoff *handoff = NULL;
+        for (size_t i=0; i<MAX_HANDOFFS; i++) {
+                if (!shard.handoffs[i].pending ||
+                    !timespec_before(now, shard.handoffs[i].expires)) {
+                        handoff = &shard.handoffs[i];
+                        break;
+                }
+        }
+        if (handoff == NULL) {
+                fprintf(stderr, "too many handoffs pending, dropping one\n");
+                return;
+        }
+
+        handoff->pending = true;
+        handoff->token = data->token;
+        handoff->expires = timespec_add(now, HANDOFF_TIMEOUT_NS);
+        handoff->position = (vec3s){ .x = data->x, .y = data->y, .z = data->z };
+        handoff->rotation = data->rotation;
+        handoff->airtime = data->airtime;
+        handoff->jump_state = data->jumpState & (JUMP_STATE_JUMPING | JUMP_STATE_FALLING);
+}
+
+static void onLinkPacket(const struct serverCommand *const command) {
+        const struct linkPacket *base = (const void*)command->packet->data;
+        switch (base->type) {
+        case LINK_PACKET_TYPE_BORDER:
+                onLinkBorder(command);
+                break;
+        case LINK_PACKET_TYPE_HANDOFF:
+                onLinkHandoff(command);
+                break;
+        default:
+                fprintf(stderr, "unexpected link packet type %u\n", base->type);
+                break;
+        }
+        serverNetwork_release(command->packet);
+}
+
+static void onLinkClosed(const struct serverCommand *const command) {
+        if (shard.links[command->peer.idx].connectID == command->peer.connectID) {
+                ghosts_forget(command->peer.idx);
+                shard.links[command->peer.idx].connectID = 0;
+        }
+}
+
+static void onNeighborChanged(const struct serverCommand *const command) {
+        shard.neighbors[command->neighbor].up = command->type == SERVER_COMMAND_NEIGHBOR_UP;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Player a command came from, if it is still connected
+static struct player *command_player(const struct serverCommand *const command) {
+        const struct slotHandle handle = world.peers[command->peer.idx];
+        if (!slotAllocator_valid(&world.slots, handle)) {
+                return NULL;
+        }
+        struct player *player = &world.entities[handle.idx];
+        if (player->peer.connectID != command->peer.connectID) {
+                return NULL;
+        }
+        return player;
+}
+
+static enum profilerPhase command_phase(const enum serverCommandType type) {
+        switch (type) {
+        case SERVER_COMMAND_CONNECT:
+                return PROFILER_PHASE_ON_CONNECTION;
+        case SERVER_COMMAND_DISCONNECT:
+                return PROFILER_PHASE_ON_DISCONNECTION;
+        case SERVER_COMMAND_MOVEMENT:
+                return PROFILER_PHASE_ON_MOVEMENT;
+        case SERVER_COMMAND_INPUT:
+                return PROFILER_PHASE_ON_INPUT;
+        case SERVER_COMMAND_SNAPSHOT_ACK:
+                return PROFILER_PHASE_ON_SNAPSHOT_ACK;
+        case SERVER_COMMAND_NEIGHBOR_UP:
+        case SERVER_COMMAND_NEIGHBOR_DOWN:
+        case SERVER_COMMAND_LINK_RECEIVE:
+        case SERVER_COMMAND_LINK_CLOSED:
+        default:
+                return PROFILER_PHASE_ON_LINK;
+        }
+}
+
+static void process_command(const struct serverCommand *const command) {
+        const struct timespec start = profiler_start();
+        switch (command->type) {
+        case SERVER_COMMAND_CONNECT:
+                onNewConnection(command);
+                profiler_record(PROFILER_PHASE_ON_CONNECTION, start, command->size);
+                return;
+        case SERVER_COMMAND_NEIGHBOR_UP:
+        case SERVER_COMMAND_NEIGHBOR_DOWN:
+                onNeighborChanged(command);
+                profiler_record(PROFILER_PHASE_ON_LINK, start, command->size);
+                return;
+        case SERVER_COMMAND_LINK_RECEIVE:
+                onLinkPacket(command);
+                profiler_record(PROFILER_PHASE_ON_LINK, start, command->size);
+                return;
+        case SERVER_COMMAND_LINK_CLOSED:
+                onLinkClosed(command);
+                profiler_record(PROFILER_PHASE_ON_LINK, start, command->size);
+                return;
+        case SERVER_COMMAND_DISCONNECT:
+        case SERVER_COMMAND_MOVEMENT:
+        case SERVER_COMMAND_INPUT:
+        case SERVER_COMMAND_SNAPSHOT_ACK:
+        default:
+                break;
+        }
+
+        struct player *player = command_player(command);
+        if (player == NULL) {
+                return;
+        }
+
+        switch (command->type) {
+        case SERVER_COMMAND_DISCONNECT:
+                onDisconnection(player);
+                break;
+        // Clients only move their player the way the server told them to
+        case SERVER_COMMAND_MOVEMENT:
+                if (world.movement == NETWORK_MOVEMENT_POSITIONS) {
+                        onMovementPacket(player, command);
+                }
+                break;
+        case SERVER_COMMAND_INPUT:
+                if (world.movement == NETWORK_MOVEMENT_INPUTS) {
+                        onInputPacket(player, command);
+                }
+                break;
+        case SERVER_COMMAND_SNAPSHOT_ACK:
+                onSnapshotAck(player, command);
+                break;
+        case SERVER_COMMAND_CONNECT:
+        case SERVER_COMMAND_NEIGHBOR_UP:
+        case SERVER_COMMAND_NEIGHBOR_DOWN:
+        case SERVER_COMMAND_LINK_RECEIVE:
+        case SERVER_COMMAND_LINK_CLOSED:
+        default:
+                break;
+        }
+        profiler_record(command_phase(command->type), start, command->size);
+}
+
+// Apply everything the network thread received since the last tick
+static void process_commands(void) {
+        struct serverCommand command;
+        while (serverNetwork_poll(&command)) {
+                if (journal.file != NULL) {
+                        journalWriter_command(&journal, &command, server_time(command.received));
+                }
+                process_command(&command);
+        }
+        profiler_count(PROFILER_COUNTER_COMMANDS_DROPPED, serverNetwork_droppedCommands());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Fields of an entity that differ from the baseline, or all of them if there
+// is none. Fields are compared once quantized, since changes smaller than that
+// would not make it through.
+static unsigned record_fields(const uint32_t fields[SNAPSHOT_FIELDS_TOTAL],
+                              const uint32_t *const base) {
+        if (base == NULL) {
+                return SNAPSHOT_FIELDS_ALL;
+        }
+        unsigned mask = 0;
+        for (size_t i=0; i<SNAPSHOT_FIELDS_TOTAL; i++) {
+                if (fields[i] != base[i]) {
+                        mask |= 1U << i;
+                }
+        }
+        return mask;
+}
+
+// Append a snapshot record for an entity with the fields in the mask. next_idx
+// is the index following the previous record's.
+static void write_snapshot_record(struct bitWriter *const writer, uint16_t *const count,
+                                  size_t *const next_idx, const size_t idx,
+                                  const uint32_t fields[SNAPSHOT_FIELDS_TOTAL],
+                                  const unsigned mask) {
+        bitWriter_writeVarUint(writer, (uint32_t)(idx - *next_idx));
+        bitWriter_write(writer, mask, SNAPSHOT_FIELDS_TOTAL);
+        networkCodec_writeFields(&world.codec, writer, fields, mask);
+
+        *next_idx = idx + 1;
+        *count += 1;
+}
+
+struct interestQuery {
+        const struct player *viewer;
+        uint64_t *visible;
+};
+
+static void interest_add(const size_t idx, void *const args) {
+        struct interestQuery *query = args;
+        if (idx != query->viewer->idx) {
+                bitset_set(query->visible, idx);
+        }
+}
+
+static int entered_compare(const void *const a, const void *const b) {
+        const struct enteredEntity *entered_a = a;
+        const struct enteredEntity *entered_b = b;
+        return (entered_a->distance > entered_b->distance) - (entered_a->distance < entered_b->distance);
+}
+
+// Remember that an entity is sent whole to a player from a given tick
+static struct enteringEntity *player_entering_add(struct player *const player, const size_t idx,
+                                                 const uint32_t since, const bool spawning) {
+        if (player->entering_count == player->entering_capacity) {
+                player->entering_capacity = player->entering_capacity == 0 ? 64 : player->entering_capacity * 2;
+                player->entering_list = realloc(player->entering_list,
+                                                player->entering_capacity * sizeof(*player->entering_list));
+                if (player->entering_list == NULL) {
+                        fprintf(stderr, "could not allocate memory\n");
+                        exit(EXIT_FAILURE);
+                }
+        }
+        struct enteringEntity *entry = &player->entering_list[player->entering_count++];
+        entry->idx = (uint32_t)idx;
+        entry->since = since;
+        entry->spawning = spawning;
+        entry->priority = 0;
+        bitset_set(player->entering, idx);
+        return entry;
+}
+
+// Snapshot the client acknowledged, if it is still in the history
+static const struct worldSnapshot *client_baseline(const struct player *const player) {
+        if (!player->acked) {
+                return NULL;
+        }
+        if (world.tick - player->baseline >= SNAPSHOT_HISTORY) {
+                return NULL;
+        }
+
+        const struct worldSnapshot *snapshot = &world.snapshots[player->baseline % SNAPSHOT_HISTORY];
+        if (snapshot->tick != player->baseline) {
+                return NULL;
+        }
+        return snapshot;
+}
+
+// Bits of an integer written as a varuint
+static unsigned varuint_bits(uint32_t value) {
+        unsigned bits = 0;
+        do {
+                bits += BITSTREAM_VARUINT_GROUP_BITS + 1;
+                value >>= BITSTREAM_VARUINT_GROUP_BITS;
+        } while (value != 0);
+        return bits;
+}
+
+static int candidate_compare(const void *const a, const void *const b) {
+        const struct snapshotCandidate *candidate_a = a;
+        const struct snapshotCandidate *candidate_b = b;
+        return (candidate_a->priority < candidate_b->priority) - (candidate_a->priority > candidate_b->priority);
+}
+
+// Once per window, adjust a player's budget to what its link delivers. It
+// only grows if the budget was what kept something from being sent.
+static void player_update_budget(struct player *const player) {
+        if (world.tick - player->window_start < SNAPSHOT_BUDGET_WINDOW) {
+                return;
+        }
+
+        if (player->window_sent > 0) {
+                const float delivered = (float)player->window_acked / (float)player->window_sent;
+                if (delivered < SNAPSHOT_BUDGET_DELIVERED) {
+                        player->budget *= SNAPSHOT_BUDGET_BACKOFF;
+                } else if (player->window_saturated) {
+                        player->budget *= SNAPSHOT_BUDGET_GROWTH;
+                }
+                player->budget = glm_clamp(player->budget, SNAPSHOT_BUDGET_MIN, SNAPSHOT_BUDGET_MAX);
+        }
+
+        player->window_start = world.tick;
+        player->window_sent = 0;
+        player->window_acked = 0;
+        player->window_saturated = false;
+}
+
+// How much sending an entity now matters to a player: more the closer it is
+// and the more it changed since the client's baseline.
+static float record_priority(const vec2s position, const struct networkSnapshotEntity *const entity,
+                             const struct networkSnapshotEntity *const base) {
+        const float radius2 = world.interest_radius * world.interest_radius;
+        const vec2s offset = glms_vec2_sub(glms_vec2(entity->position), position);
+        const float proximity = 1.0f - 0.9f * fminf(glms_vec2_norm2(offset) / radius2, 1.0f);
+
+        float change = 1.0f;
+        if (base != NULL) {
+                const float step = PLAYER_SPEED * (float)world.tick_period_ns / 1e9f;
+                const float moved = glms_vec3_distance(entity->position, base->position) / step;
+                change += fminf(moved, 4.0f) + fabsf(entity->rotation - base->rotation) / GLM_PIf;
+        }
+        return proximity * change;
+}
+
+// Narrow the entities to send a player down to the ones that fit its budget,
+// by priority. Spawning entities always go. The others left out are sent
+// whole from the next tick they go on, since the client misses the changes
+// of this one, and they carry their priority over so that they do go at some
+// point. The fields each one carries are left in world.record_mask. Return how
+// many are left to send.
+static size_t select_records(struct player *const player, uint64_t *const send,
+                             const struct worldSnapshot *const baseline, const size_t reserved_bits) {
+        player_update_budget(player);
+
+        const struct worldSnapshot *current = &world.snapshots[world.tick % SNAPSHOT_HISTORY];
+        const vec2s position = glms_vec2(player_position(player));
+        for (size_t i=0; i<player->entering_count; i++) {
+                world.entering_entry[player->entering_list[i].idx] = (uint32_t)i;
+        }
+
+        size_t num_candidates = 0;
+        for (size_t w=0; w<world.bitset_words; w++) {
+                uint64_t word = send[w];
+                while (word != 0) {
+                        const size_t idx = w*BITSET_WORD_BITS + bitset_word_pop(&word);
+                        const struct networkSnapshotEntity *entity = &current->entities[idx];
+                        const bool whole = baseline == NULL || bitset_test(player->entering, idx);
+                        const struct networkSnapshotEntity *base = whole ? NULL : &baseline->entities[idx];
+
+                        const unsigned mask = record_fields(current->fields[idx],
+                                                            whole ? NULL : baseline->fields[idx]);
+                        // changes too small to make it through
+                        if (mask == 0) {
+                                bitset_unset(send, idx);
+                                continue;
+                        }
+                        world.record_mask[idx] = (uint8_t)mask;
+
+                        struct snapshotCandidate *candidate = &world.candidates[num_candidates++];
+                        candidate->idx = idx;
+                        candidate->bits = varuint_bits((uint32_t)idx) + SNAPSHOT_FIELDS_TOTAL +
+                                networkCodec_fieldsBits(&world.codec, mask);
+                        candidate->priority = record_priority(position, entity, base);
+                        if (bitset_test(player->entering, idx)) {
+                                const struct enteringEntity *entry =
+                                        &player->entering_list[world.entering_entry[idx]];
+                                candidate->priority = entry->spawning ? INFINITY :
+                                        candidate->priority + entry->priority;
+                        }
+                }
+        }
+
+        const size_t budget_bits = (size_t)(player->budget * 8);
+        size_t used_bits = reserved_bits;
+        size_t total_bits = reserved_bits;
+        for (size_t i=0; i<num_candidates; i++) {
+                total_bits += world.candidates[i].bits;
+        }
+        if (total_bits <= budget_bits) {
+                for (size_t i=0; i<player->entering_count; i++) {
+                        player->entering_list[i].priority = 0;
+                }
+                return num_candidates;
+        }
+        player->window_saturated = true;
+
+        qsort(world.candidates, num_candidates, sizeof(*world.candidates), candidate_compare);
+        size_t selected = 0;
+        for (size_t i=0; i<num_candidates; i++) {
+                const struct snapshotCandidate *candidate = &world.candidates[i];
+                if (isinf(candidate->priority) || used_bits + candidate->bits <= budget_bits) {
+                        used_bits += candidate->bits;
+                        selected++;
+                        if (bitset_test(player->entering, candidate->idx)) {
+                                player->entering_list[world.entering_entry[candidate->idx]].priority = 0;
+                        }
+                        continue;
+                }
+
+                bitset_unset(send, candidate->idx);
+                if (bitset_test(player->entering, candidate->idx)) {
+                        struct enteringEntity *entry = &player->entering_list[world.entering_entry[candidate->idx]];
+                        entry->since = world.tick + 1;
+                        entry->priority = candidate->priority;
+                } else {
+                        struct enteringEntity *entry =
+                                player_entering_add(player, candidate->idx, world.tick + 1, false);
+                        entry->priority = candidate->priority;
+                }
+        }
+        return selected;
+}
+
+// Send to a single client the state of its area of interest. Entities that
+// entered the area are sent as new entities, entities that left it as deleted
+// ones. The snapshot is a delta against the last one the client acknowledged,
+// so only what changed since then is sent. Without a usable baseline
+// everything is sent whole.
+static void send_client_snapshot(struct player *const player) {
+        const size_t words = world.bitset_words;
+        uint64_t *const visible = world.scratch;
+        uint64_t *const changed = world.scratch + words;
+        uint64_t *const send = world.scratch + 2*words;
+
+        for (size_t w=0; w<words; w++) {
+                visible[w] = 0;
+        }
+        struct interestQuery query = {
+                .viewer = player,
+                .visible = visible,
+        };
+        spatialHash_query(&world.grid, glms_vec2(player_position(player)),
+                          world.interest_radius, interest_add, &query);
+
+        const struct worldSnapshot *current = &world.snapshots[world.tick % SNAPSHOT_HISTORY];
+        const struct worldSnapshot *baseline = client_baseline(player);
+
+        for (size_t w=0; w<words; w++) {
+                changed[w] = baseline == NULL ? ~(uint64_t)0 : 0;
+        }
+        if (baseline != NULL) {
+                for (uint32_t tick=baseline->tick+1; tick!=world.tick+1; tick++) {
+                        const struct worldSnapshot *snapshot = &world.snapshots[tick % SNAPSHOT_HISTORY];
+                        for (size_t w=0; w<words; w++) {
+                                changed[w] |= snapshot->changed[w];
+                        }
+                }
+        }
+
+        // Entities that entered are only known to the client once sent
+        const vec2s position = glms_vec2(player_position(player));
+        size_t num_entered = 0;
+        for (size_t w=0; w<words; w++) {
+                uint64_t left = player->visible[w] & ~visible[w];
+                uint64_t entered = visible[w] & ~player->visible[w];
+                player->visible[w] &= visible[w];
+                player->entering[w] &= visible[w];
+
+                while (left != 0) {
+                        size_t idx = w*BITSET_WORD_BITS + bitset_word_pop(&left);
+                        player_event_push(player, idx, false);
+                }
+                while (entered != 0) {
+                        size_t idx = w*BITSET_WORD_BITS + bitset_word_pop(&entered);
+                        const vec2s offset = glms_vec2_sub(glms_vec2(current->entities[idx].position), position);
+                        world.entered[num_entered].idx = idx;
+                        world.entered[num_entered].distance = glms_vec2_norm2(offset);
+                        num_entered++;
+                }
+        }
+
+        // Entities stop entering once they left or the client has them
+        for (size_t i=player->entering_count; i-->0;) {
+                const struct enteringEntity *entry = &player->entering_list[i];
+                if (!bitset_test(player->entering, entry->idx) ||
+                    (baseline != NULL && (int32_t)(baseline->tick - entry->since) >= 0)) {
+                        bitset_unset(player->entering, entry->idx);
+                        player->entering_list[i] = player->entering_list[--player->entering_count];
+                }
+        }
+
+        // The nearest ones go first, the rest enter again on later ticks
+        if (num_entered > ENTER_PER_TICK) {
+                qsort(world.entered, num_entered, sizeof(*world.entered), entered_compare);
+        }
+        const size_t num_sent = num_entered > ENTER_PER_TICK ? ENTER_PER_TICK : num_entered;
+        for (size_t i=0; i<num_sent; i++) {
+                const size_t idx = world.entered[i].idx;
+                bitset_set(player->visible, idx);
+                player_entering_add(player, idx, world.tick, true);
+                player_event_push(player, idx, true);
+        }
+
+        const size_t events = player->events_count < SNAPSHOT_EVENTS_MAX ?
+                player->events_count : SNAPSHOT_EVENTS_MAX;
+        size_t pending = num_entered - num_sent;
+        for (size_t i=events; i<player->events_count; i++) {
+                pending += player->events[i].spawn;
+        }
+
+        for (size_t w=0; w<words; w++) {
+                send[w] = player->visible[w] & (changed[w] | player->entering[w]);
+        }
+        const size_t events_bits = 8 * (NETWORK_SNAPSHOT_EVENTS_HEADER_MAX + events * NETWORK_SNAPSHOT_EVENT_MAX);
+        const size_t records = select_records(player, send, baseline, events_bits);
+
+        const bool keepalive = baseline == NULL ||
+                world.tick - baseline->tick >= SNAPSHOT_KEEPALIVE;
+        if (records == 0 && events == 0 && !keepalive) {
+                return;
+        }
+
+        const size_t capacity = records * NETWORK_SNAPSHOT_RECORD_MAX +
+                events * NETWORK_SNAPSHOT_EVENT_MAX + NETWORK_SNAPSHOT_EVENTS_HEADER_MAX;
+        struct networkPacketSnapshot *data = serverNetwork_packet(sizeof(*data) + capacity);
+        data->base.type = PACKET_TYPE_SNAPSHOT;
+        data->snapshot = world.tick;
+        data->baseline = baseline == NULL ? world.tick : baseline->tick;
+        uint16_t count = 0;
+        size_t next_idx = 0;
+        struct bitWriter writer;
+        bitWriter_init(&writer, data->data, capacity);
+
+        for (size_t w=0; w<words; w++) {
+                while (send[w] != 0) {
+                        size_t idx = w*BITSET_WORD_BITS + bitset_word_pop(&send[w]);
+                        write_snapshot_record(&writer, &count, &next_idx, idx,
+                                              current->fields[idx], world.record_mask[idx]);
+                }
+        }
+        data->count = count;
+        data->pending = (uint16_t)(pending < UINT16_MAX ? pending : UINT16_MAX);
+
+        bitWriter_writeVarUint(&writer, (uint32_t)events);
+        if (events > 0) {
+                bitWriter_writeVarUint(&writer, player->events_first);
+                for (size_t i=0; i<events; i++) {
+                        bitWriter_write(&writer, player->events[i].spawn, 1);
+                        bitWriter_writeVarUint(&writer, player->events[i].idx);
+                }
+        }
+        size_t size = sizeof(*data) + bitWriter_finish(&writer);
+        serverNetwork_send(player->peer, NETWORK_CHANNEL_SERVER_UPDATES, data, size, 0);
+
+        struct sentSnapshot *sent = &player->sent[world.tick % SNAPSHOT_HISTORY];
+        sent->valid = true;
+        sent->acked = false;
+        sent->tick = world.tick;
+        sent->events_end = player->events_first + (uint32_t)events;
+        sent->size = size;
+        player->window_sent += size;
+}
+
+// Record the state of the world at the end of this tick, quantized once for
+// every client
+static void take_snapshot(void) {
+        world.tick++;
+
+        struct worldSnapshot *snapshot = &world.snapshots[world.tick % SNAPSHOT_HISTORY];
+        snapshot->tick = world.tick;
+        memcpy(snapshot->changed, world.changed_entities.bits,
+               world.bitset_words * sizeof(*snapshot->changed));
+
+        const struct worldState *state = &world.state;
+        for (size_t slot=0; slot<state->count; slot++) {
+                struct networkSnapshotEntity *entity = &snapshot->entities[state->idx[slot]];
+                entity->position.x = state->x[slot];
+                entity->position.y = state->y[slot];
+                entity->position.z = state->z[slot];
+                entity->rotation = state->rotation[slot];
+                networkCodec_encodeEntity(&world.codec, entity, snapshot->fields[state->idx[slot]]);
+        }
+
+        for (size_t i=0; i<shard.num_ghosts; i++) {
+                const size_t idx = shard.ghost_list[i];
+                snapshot->entities[idx] = shard.ghosts[idx].state;
+                networkCodec_encodeEntity(&world.codec, &snapshot->entities[idx], snapshot->fields[idx]);
+        }
+}
+
+static void broadcast_changes(void) {
+        take_snapshot();
+
+        const struct worldState *state = &world.state;
+
+        spatialHash_clear(&world.grid);
+        for (size_t slot=0; slot<state->count; slot++) {
+                vec2s position = { .x = state->x[slot], .y = state->y[slot] };
+                spatialHash_insert(&world.grid, state->idx[slot], position);
+        }
+        for (size_t i=0; i<shard.num_ghosts; i++) {
+                const size_t idx = shard.ghost_list[i];
+                spatialHash_insert(&world.grid, idx, glms_vec2(shard.ghosts[idx].state.position));
+        }
+
+        for (size_t slot=0; slot<state->count; slot++) {
+                send_client_snapshot(slot_player(slot));
+        }
+        
+        changedEntitySet_clear(&world.changed_entities);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void step_world(void) {
+        struct worldState *state = &world.state;
+
+        // everyone in the air or still being extrapolated moves this tick,
+        // and clients may send one more input
+        size_t moving = 0;
+        for (size_t slot=0; slot<state->count; slot++) {
+                struct player *player = slot_player(slot);
+                if (state->extrapolate[slot] > 0 && player->position_tick != world.tick) {
+                        const float dt = fminf(world.tick_period, state->extrapolate[slot]);
+                        if (world.has_level) {
+                                world.moving_slots[moving] = slot;
+                                world.moving_from[moving] = collision_center(
+                                        state->x[slot], state->y[slot], state->z[slot]);
+                                moving++;
+                        }
+                        state->x[slot] += state->vx[slot] * dt;
+                        state->y[slot] += state->vy[slot] * dt;
+                        state->extrapolate[slot] -= dt;
+                        if (state->extrapolate[slot] <= 0) {
+                                state->extrapolate[slot] = 0;
+                                state->vx[slot] = 0;
+                                state->vy[slot] = 0;
+                        }
+                        changedEntitySet_add(&world.changed_entities, player);
+                }
+                if (state->jump_state[slot] != 0) {
+                        changedEntitySet_add(&world.changed_entities, player);
+                }
+                if (player->input_credit < INPUT_CREDIT_MAX) {
+                        player->input_credit++;
+                }
+        }
+
+        // extrapolated players slide along the level rather than go through
+        // it, all in one go
+        if (moving > 0) {
+                for (size_t i=0; i<moving; i++) {
+                        const size_t slot = world.moving_slots[i];
+                        world.moving_to[i] = collision_center(state->x[slot], state->y[slot],
+                                                              state->z[slot]);
+                }
+                levelCollision_moveSpheres(&world.level, moving, world.moving_from,
+                                           world.moving_to, PLAYER_COLLISION_RADIUS);
+                for (size_t i=0; i<moving; i++) {
+                        const size_t slot = world.moving_slots[i];
+                        state->x[slot] = world.moving_to[i].x;
+                        state->y[slot] = world.moving_to[i].y;
+                }
+        }
+
+        jump_fall_animation_batch(state->count, state->airtime, state->jump_state,
+                                  state->z, world.tick_period);
+
+        // heights so far are above the ground, wherever everyone ended up
+        if (world.has_terrain) {
+                terrain_heights(&world.terrain, state->count, state->x, state->y, world.ground);
+                for (size_t slot=0; slot<state->count; slot++) {
+                        state->z[slot] += world.ground[slot];
+                }
+        }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Distance along x from a point to a neighbour's strip
+static float neighbor_distance(const struct neighbor *const neighbor, const float x) {
+        if (x < neighbor->min_x) {
+                return neighbor->min_x - x;
+        }
+        if (x > neighbor->max_x) {
+                return x - neighbor->max_x;
+        }
+        return 0;
+}
+
+// Neighbour owning the strip a point is in, if its link is up
+static const struct neighbor *neighbor_at(const float x, size_t *const n) {
+        for (size_t i=0; i<shard.num_neighbors; i++) {
+                const struct neighbor *neighbor = &shard.neighbors[i];
+                if (neighbor->up && x >= neighbor->min_x && x < neighbor->max_x) {
+                        *n = i;
+                        return neighbor;
+                }
+        }
+        return NULL;
+}
+
+// Move a player that walked out of this server's strip to the neighbour that
+// owns where it is now. Its state goes over the link and the client is told to
+// reconnect there. Without a neighbour to take it, it stays.
+static void handoff_player(struct player *const player) {
+        const float x = world.state.x[player->slot];
+        if (x >= shard.min_x - HANDOFF_MARGIN && x < shard.max_x + HANDOFF_MARGIN) {
+                return;
+        }
+        size_t n;
+        const struct neighbor *neighbor = neighbor_at(x, &n);
+        if (neighbor == NULL) {
+                return;
+        }
+
+        uint32_t token;
+        do {
+                token = (uint32_t)splitmix64(&shard.token_state);
+        } while (token == 0);
+
+        const struct worldState *state = &world.state;
+        struct linkPacketHandoff *data = serverNetwork_packet(sizeof(*data));
+        data->base.type = LINK_PACKET_TYPE_HANDOFF;
+        data->token = token;
+        data->x = state->x[player->slot];
+        data->y = state->y[player->slot];
+        data->z = state->z[player->slot];
+        data->rotation = state->rotation[player->slot];
+        data->airtime = state->airtime[player->slot];
+        data->jumpState = (uint8_t)state->jump_state[player->slot];
+        serverNetwork_sendLink(n, LINK_CHANNEL_HANDOFF, data, sizeof(*data), ENET_PACKET_FLAG_RELIABLE);
+
+        sendRedirectPacket(player, neighbor->address, token);
+        player_remove(player);
+}
+
+// Send a neighbour the players close enough to its strip to be seen from it
+static void send_border(const size_t n) {
+        const struct neighbor *neighbor = &shard.neighbors[n];
+        const struct worldState *state = &world.state;
+
+        size_t count = 0;
+        for (size_t slot=0; slot<state->count; slot++) {
+                if (neighbor_distance(neighbor, state->x[slot]) <= world.interest_radius) {
+                        count++;
+                }
+        }
+
+        struct linkPacketBorder *data = serverNetwork_packet(sizeof(*data) + count * sizeof(*data->entities));
+        data->base.type = LINK_PACKET_TYPE_BORDER;
+        data->count = (uint16_t)count;
+        count = 0;
+        for (size_t slot=0; slot<state->count; slot++) {
+                if (neighbor_distance(neighbor, state->x[slot]) <= world.interest_radius) {
+                        struct linkBorderEntity *entity = &data->entities[count++];
+                        entity->idx = (uint16_t)state->idx[slot];
+                        entity->x = state->x[slot];
+                        entity->y = state->y[slot];
+                        entity->z = state->z[slot];
+                        entity->rotation = state->rotation[slot];
+                }
+        }
+
+        const size_t size = sizeof(*data) + count * sizeof(*data->entities);
+        serverNetwork_sendLink(n, LINK_CHANNEL_BORDER, data, size, 0);
+}
+
+static void shard_step(void) {
+        // Removing a player moves the last one into its slot
+        for (size_t slot=world.state.count; slot-->0;) {
+                handoff_player(slot_player(slot));
+        }
+
+        for (size_t n=0; n<shard.num_neighbors; n++) {
+                if (shard.neighbors[n].up) {
+                        send_border(n);
+                }
+        }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void onProfileSignal(int signal) {
+        (void)signal;
+        profile_requested = 1;
+}
+
+// Count the packet buffers the tick had to allocate, none once warmed up
+static void count_pool_misses(void) {
+        const size_t misses = serverNetwork_poolMisses();
+        profiler_count(PROFILER_COUNTER_PACKET_POOL_MISSES, misses - pool_misses);
+        pool_misses = misses;
+}
+
+// Time a phase of the tick, with the bytes it queued to be sent
+#define PROFILE(phase, call) do {                                       \
+                const struct timespec start_ = profiler_start();        \
+                const size_t queued_ = serverNetwork_bytesQueued();     \
+                call;                                                   \
+                profiler_record(phase, start_,                          \
+                                serverNetwork_bytesQueued() - queued_); \
+        } while (0)
+
+// Step the world once the commands of a replayed tick were processed
+static void replay_tick(const struct timespec tick_start, const size_t tick_queued) {
+        profiler_record(PROFILER_PHASE_PROCESS_COMMANDS, tick_start, 0);
+        PROFILE(PROFILER_PHASE_STEP_WORLD, step_world());
+        PROFILE(PROFILER_PHASE_BROADCAST_CHANGES, broadcast_changes());
+        count_pool_misses();
+        profiler_record(PROFILER_PHASE_TICK, tick_start,
+                        serverNetwork_bytesQueued() - tick_queued);
+}
+
+// Run the ticks of a journal again as fast as possible, without a network,
+// and report how long they took
+static void replay(struct journalReader *const reader, FILE *const profile_file) {
+        const struct timespec replay_start = monotonic();
+        struct timespec tick_start = replay_start;
+        size_t tick_queued = 0;
+        bool in_tick = false;
+        bool diverged = false;
+        unsigned long ticks = 0;
+
+        struct journalRecord record;
+        while (journalReader_next(reader, &record)) {
+                if (record.type == JOURNAL_RECORD_COMMAND) {
+                        record.command.received = timespec_add(world.epoch, record.time);
+                        process_command(&record.command);
+                        continue;
+                }
+
+                if (in_tick) {
+                        replay_tick(tick_start, tick_queued);
+                        ticks++;
+                }
+                if (record.tick != world.tick && !diverged) {
+                        fprintf(stderr, "journal expected tick %u, replay is at %u\n",
+                                record.tick, world.tick);
+                        diverged = true;
+                }
+                in_tick = true;
+                tick_start = profiler_start();
+                tick_queued = serverNetwork_bytesQueued();
+        }
+        // the last tick has no marker after it
+        if (in_tick) {
+                replay_tick(tick_start, tick_queued);
+                ticks++;
+        }
+
+        const double elapsed = (double)monotonic_difference(monotonic(), replay_start) / 1e9;
+        printf("Replayed %lu ticks in %.3f s, %.1f ticks/s, %zu bytes sent.\n",
+               ticks, elapsed, (double)ticks / elapsed, serverNetwork_bytesQueued());
+        profiler_dump(profile_file);
+}
+
+// Set up a world like the one that wrote a journal and replay it
+static int run_replay(const char *const path, const char *const level_path,
+                      const char *const terrain_path, const char *const profile_path) {
+        struct journalReader reader;
+        if (!journalReader_open(&reader, path)) {
+                return 1;
+        }
+        const struct journalHeader *header = &reader.header;
+
+        struct networkCodec codec;
+        if (!networkCodec_init(&codec, &header->codec) ||
+            header->maxPlayers == 0 || header->capacity < header->maxPlayers ||
+            header->capacity > MAX_ENTITIES || header->tickPeriodNs == 0 ||
+            !(header->interestRadius > 0) || header->movement > NETWORK_MOVEMENT_INPUTS) {
+                fprintf(stderr, "journal has invalid world parameters\n");
+                return 1;
+        }
+
+        FILE *profile_file = stderr;
+        if (profile_path != NULL) {
+                profile_file = fopen(profile_path, "a");
+                if (profile_file == NULL) {
+                        perror("fopen");
+                        return 1;
+                }
+        }
+
+        world_init(header->maxPlayers, header->capacity, (unsigned long)header->tickPeriodNs,
+                   header->interestRadius, &codec, (enum networkMovement)header->movement);
+        if (level_path != NULL && !world_load_level(level_path)) {
+                world_deinit();
+                journalReader_close(&reader);
+                return 1;
+        }
+        if ((world.has_level ? world.level.hash : 0) != header->levelHash) {
+                fprintf(stderr, "journal was recorded with another level\n");
+                world_deinit();
+                journalReader_close(&reader);
+                return 1;
+        }
+        if (terrain_path != NULL && !world_load_terrain(terrain_path)) {
+                world_deinit();
+                journalReader_close(&reader);
+                return 1;
+        }
+        if ((world.has_terrain ? world.terrain.hash : 0) != header->terrainHash) {
+                fprintf(stderr, "journal was recorded with another terrain\n");
+                world_deinit();
+                journalReader_close(&reader);
+                return 1;
+        }
+        serverNetwork_initOffline();
+        replay(&reader, profile_file);
+        serverNetwork_deinit();
+        world_deinit();
+        journalReader_close(&reader);
+        return 0;
+}
+
+static void usage(const char *const name) {
+        fprintf(stderr, "usage:\n\t%s [-r interest_radius] [-t tick_rate] [-p catchup|skip] "
+                "[-b world_extent] [-q position_precision] [-a angle_bits] "
+                "[-o profile_file] [-i profile_interval] [-c max_players] [-j journal_file] [-I] "
+                "[-T enet|udp] [-g level_file] [-H terrain_file] "
+                "[-z min_x:max_x -l link_port [-n min_x:max_x:host:port:link_port]...] "
+                "port\n"
+                "\t%s [-o profile_file] [-g level_file] [-H terrain_file] -R journal_file\n",
+                name, name);
+}
+
+// Parse a neighbour given as min_x:max_x:host:port:link_port
+static bool parse_neighbor(const char *const arg, struct neighbor *const neighbor,
+                           ENetAddress *const link) {
+        char host[256];
+        unsigned short port, link_port;
+        if (sscanf(arg, "%f:%f:%255[^:]:%hu:%hu", &neighbor->min_x, &neighbor->max_x,
+                   host, &port, &link_port) != 5 || neighbor->min_x >= neighbor->max_x) {
+                return false;
+        }
+        if (enet_address_set_host(&neighbor->address, host) != 0) {
+                fprintf(stderr, "could not resolve %s\n", host);
+                return false;
+        }
+        neighbor->address.port = port;
+        neighbor->up = false;
+        *link = neighbor->address;
+        link->port = link_port;
+        return true;
+}
+
+int main(int argc, char *argv[]) {
+        float interest_radius = INTEREST_RADIUS_DEFAULT;
+        double tick_rate = TICK_RATE_DEFAULT;
+        enum tickPolicy tick_policy = TICK_POLICY_CATCH_UP;
+        struct networkCodecParams codec_params = networkCodec_defaultParams();
+        const char *profile_path = NULL;
+        double profile_period = PROFILE_PERIOD_DEFAULT;
+        struct serverNetworkLinks links = { .port = 0, .count = 0 };
+        long max_players = MAX_PLAYERS_DEFAULT;
+        const char *journal_path = NULL;
+        const char *replay_path = NULL;
+        const char *level_path = NULL;
+        const char *terrain_path = NULL;
+        enum networkMovement movement = NETWORK_MOVEMENT_POSITIONS;
+        enum transportBackend backend = TRANSPORT_BACKEND_ENET;
+
+        shard.enabled = false;
+        shard.min_x = -INFINITY;
+        shard.max_x = INFINITY;
+        shard.num_neighbors = 0;
+
+        int opt;
+        while ((opt = getopt(argc, argv, "r:t:p:b:q:a:o:i:c:j:R:Iz:l:n:T:g:H:")) != -1) {
+                switch (opt) {
+                case 'c':
+                        // ENet numbers its peers with 12 bits
+                        max_players = strtol(optarg, NULL, 10);
+                        if (max_players <= 0 || max_players > ENET_PROTOCOL_MAXIMUM_PEER_ID) {
+                                fprintf(stderr, "max players must be between 1 and %d\n",
+                                        ENET_PROTOCOL_MAXIMUM_PEER_ID);
+                                return 1;
+                        }
+                        break;
+                case 'j':
+                        journal_path = optarg;
+                        break;
+                case 'R':
+                        replay_path = optarg;
+                        break;
+                case 'g':
+                        level_path = optarg;
+                        break;
+                case 'H':
+                        terrain_path = optarg;
+                        break;
+                case 'I':
+                        movement = NETWORK_MOVEMENT_INPUTS;
+                        break;
+                case 'T':
+                        // the game client only speaks enet
+                        if (strcmp(optarg, "enet") == 0) {
+                                backend = TRANSPORT_BACKEND_ENET;
+                        } else if (strcmp(optarg, "udp") == 0) {
+                                backend = TRANSPORT_BACKEND_UDP;
+                        } else {
+                                usage(argv[0]);
+                                return 1;
+                        }
+                        break;
+                case 'z':
+                        if (sscanf(optarg, "%f:%f", &shard.min_x, &shard.max_x) != 2 ||
+                            shard.min_x >= shard.max_x) {
+                                fprintf(stderr, "zone must be min_x:max_x with min_x < max_x\n");
+                                return 1;
+                        }
+                        shard.enabled = true;
+                        break;
+                case 'l':
+                        links.port = (unsigned short)atoi(optarg);
+                        break;
+                case 'n':
+                        if (shard.num_neighbors >= SHARD_LINK_MAX_NEIGHBORS) {
+                                fprintf(stderr, "at most %d neighbours\n", SHARD_LINK_MAX_NEIGHBORS);
+                                return 1;
+                        }
+                        if (!parse_neighbor(optarg, &shard.neighbors[shard.num_neighbors],
+                                            &links.neighbors[shard.num_neighbors])) {
+                                fprintf(stderr, "neighbour must be min_x:max_x:host:port:link_port\n");
+                                return 1;
+                        }
+                        shard.num_neighbors++;
+                        links.count++;
+                        break;
+                case 'b':
+                        codec_params.extent = strtof(optarg, NULL);
+                        break;
+                case 'q':
+                        codec_params.precision = strtof(optarg, NULL);
+                        break;
+                case 'a': {
+                        codec_params.angleBits = 0;
+                        int angle_bits = atoi(optarg);
+                        if (angle_bits > 0 && angle_bits <= UINT8_MAX) {
+                                codec_params.angleBits = (uint8_t)angle_bits;
+                        }
+                        break;
+                }
+                case 't':
+                        tick_rate = strtod(optarg, NULL);
+                        if (tick_rate <= 0) {
+                                fprintf(stderr, "tick rate must be positive\n");
+                                return 1;
+                        }
+                        break;
+                case 'p':
+                        if (strcmp(optarg, "catchup") == 0) {
+                                tick_policy = TICK_POLICY_CATCH_UP;
+                        } else if (strcmp(optarg, "skip") == 0) {
+                                tick_policy = TICK_POLICY_SKIP;
+                        } else {
+                                usage(argv[0]);
+                                return 1;
+                        }
+                        break;
+                case 'o':
+                        profile_path = optarg;
+                        break;
+                case 'i':
+                        profile_period = strtod(optarg, NULL);
+                        if (profile_period <= 0) {
+                                fprintf(stderr, "profile interval must be positive\n");
+                                return 1;
+                        }
+                        break;
+                case 'r':
+                        interest_radius = strtof(optarg, NULL);
+                        if (interest_radius <= 0) {
+                                fprintf(stderr, "interest radius must be positive\n");
+                                return 1;
+                        }
+                        break;
+                default:
+                        usage(argv[0]);
+                        return 1;
+                }
+        }
+        if (replay_path != NULL) {
+                if (optind != argc) {
+                        usage(argv[0]);
+                        return 1;
+                }
+                return run_replay(replay_path, level_path, terrain_path, profile_path);
+        }
+        if (optind != argc - 1) {
+                usage(argv[0]);
+                return 1;
+        }
+        if (journal_path != NULL && shard.enabled) {
+                fprintf(stderr, "the journal of a sharded server could not be replayed on its own\n");
+                return 1;
+        }
+        const unsigned short port = (unsigned short)atoi(argv[optind]);
+        if (shard.enabled != (links.port != 0) || (links.count > 0 && !shard.enabled)) {
+                fprintf(stderr, "a sharded server needs both its zone and its link port\n");
+                return 1;
+        }
+        
+        struct networkCodec codec;
+        if (!networkCodec_init(&codec, &codec_params)) {
+                fprintf(stderr, "world extent and position precision must be positive "
+                        "and angle bits between %d and %d\n",
+                        NETWORK_ANGLE_BITS_MIN, NETWORK_ANGLE_BITS_MAX);
+                return 1;
+        }
+
+        // A sharded server leaves as many entities for ghosts as for its
+        // own players
+        size_t capacity = (size_t)max_players;
+        if (shard.enabled) {
+                capacity *= 2;
+        }
+        if (capacity > MAX_ENTITIES) {
+                capacity = MAX_ENTITIES;
+        }
+
+        const unsigned long tick_period_ns = (unsigned long)(1e9 / tick_rate);
+        world_init((size_t)max_players, capacity, tick_period_ns, interest_radius, &codec,
+                   movement);
+        if (level_path != NULL && !world_load_level(level_path)) {
+                return 1;
+        }
+        if (terrain_path != NULL && !world_load_terrain(terrain_path)) {
+                return 1;
+        }
+        if (shard.enabled) {
+                shard_init();
+        }
+        networking_init(backend, port, shard.enabled ? &links : NULL);
+
+        if (journal_path != NULL) {
+                struct journalHeader header;
+                header.magic = JOURNAL_MAGIC;
+                header.version = JOURNAL_VERSION;
+                header.tickPeriodNs = tick_period_ns;
+                header.interestRadius = interest_radius;
+                header.maxPlayers = (uint32_t)max_players;
+                header.capacity = (uint32_t)capacity;
+                header.codec = codec_params;
+                header.movement = (uint8_t)movement;
+                header.levelHash = world.has_level ? world.level.hash : 0;
+                header.terrainHash = world.has_terrain ? world.terrain.hash : 0;
+                if (!journalWriter_open(&journal, journal_path, &header)) {
+                        perror("fopen");
+                        return 1;
+                }
+        }
+
+        // Periodic profiles go to a file, the ones asked for with SIGUSR1
+        // too if there is one
+        FILE *profile_file = stderr;
+        if (profile_path != NULL) {
+                profile_file = fopen(profile_path, "a");
+                if (profile_file == NULL) {
+                        perror("fopen");
+                        return 1;
+                }
+        }
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = onProfileSignal;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGUSR1, &action, NULL);
+
+        struct tickScheduler scheduler;
+        tickScheduler_init(&scheduler, tick_period_ns, tick_policy);
+        struct timespec last_profile = monotonic();
 
         printf("Server start.\n");
         for (;;) {
-                struct timespec t1 = monotonic();
-                step_world();
-                broadcast_changes();
-                struct timespec t2 = monotonic();
-                
-                poll_events((unsigned)monotonic_difference(t2, t1)/1000000);
+                unsigned long dropped = tickScheduler_wait(&scheduler);
+                if (dropped > 0) {
+                        fprintf(stderr, "server running behind, dropped %lu ticks\n", dropped);
+                }
+
+                const struct timespec tick_start = profiler_start();
+                const size_t tick_queued = serverNetwork_bytesQueued();
+                if (journal.file != NULL) {
+                        journalWriter_tick(&journal, world.tick);
+                }
+                PROFILE(PROFILER_PHASE_PROCESS_COMMANDS, process_commands());
+                PROFILE(PROFILER_PHASE_STEP_WORLD, step_world());
+                if (shard.enabled) {
+                        PROFILE(PROFILER_PHASE_SHARD, shard_step());
+                }
+                PROFILE(PROFILER_PHASE_BROADCAST_CHANGES, broadcast_changes());
+                serverNetwork_flush();
+                count_pool_misses();
+                profiler_record(PROFILER_PHASE_TICK, tick_start,
+                                serverNetwork_bytesQueued() - tick_queued);
+
+                const struct timespec now = monotonic();
+                if (profile_requested ||
+                    (profile_path != NULL &&
+                     (double)monotonic_difference(now, last_profile) / 1e9 >= profile_period)) {
+                        profile_requested = 0;
+                        profiler_dump(profile_file);
+                        profiler_reset();
+                        last_profile = now;
+                }
         }
 
 }
@@ -0,0 +1,614 @@
+#define _GNU_SOURCE
+
+#include <serverNetwork.h>
+#include <transport.h>
+#include <spscQueue.h>
+#include <packetPool.h>
+#include <timeutil.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COMMAND_QUEUE_SIZE 65536
+#define MESSAGE_QUEUE_SIZE 65536
+
+// Longest the network thread sleeps without servicing the hosts, which keeps
+// their own timers (resends, pings) running even with no traffic. Those count
+// milliseconds, ENet's one at a time and the udp backend's UDP_TIMER_MS, so
+// waking up more often than once a millisecond finds nothing due.
+#define SERVICE_TIMEOUT_NS 1000000L
+
+// Time between attempts at connecting to a neighbour
+#define LINK_RETRY_NS 1000000000UL
+
+struct serverMessage {
+        // to the neighbour at peer.idx rather than to a peer
+        bool link;
+        struct serverPeer peer;
+        unsigned channel;
+        void *data;
+        size_t size;
+        uint32_t flags;
+};
+
+static struct transport *host = NULL;
+static ENetHost *linkHost = NULL;
+static struct serverNetworkLinks links;
+// Connection to each neighbour, NULL while there is none
+static ENetPeer *neighbors[SHARD_LINK_MAX_NEIGHBORS];
+static struct timespec neighborRetry[SHARD_LINK_MAX_NEIGHBORS];
+static const struct networkCodec *codec;
+static pthread_t thread;
+static atomic_bool running;
+
+// Written by the simulation to wake the network thread up when it has queued
+// packets
+static int wakefd = -1;
+
+// network thread -> simulation
+static struct spscQueue commands;
+// Commands that found the queue full and can not be dropped, in the order they
+// came in. Only touched by the network thread.
+static struct serverCommand *backlog;
+static size_t backlogCount;
+static size_t backlogCapacity;
+static atomic_size_t commandsDropped;
+// simulation -> network thread
+static struct spscQueue messages;
+
+// Buffers packets are encoded into, owned by the simulation and given back by
+// the network thread once the hosts are done with them
+static struct packetPool packets;
+// Set up without a host, everything sent is dropped
+static bool offline;
+static size_t bytesQueued;
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Give the network thread a chance to run right away
+static void wake(void) {
+        uint64_t one = 1;
+        if (write(wakefd, &one, sizeof(one)) < 0) {
+                perror("write");
+        }
+}
+
+// Simulation side. The network thread never waits on the simulation, so room
+// is bound to come up soon.
+static void push_message(const struct serverMessage *const message) {
+        while (!spscQueue_push(&messages, message)) {
+                wake();
+                sched_yield();
+        }
+}
+
+// Move as much of the backlog as fits to the queue
+static void push_backlog(void) {
+        size_t pushed = 0;
+        while (pushed < backlogCount && spscQueue_push(&commands, &backlog[pushed])) {
+                pushed++;
+        }
+        backlogCount -= pushed;
+        memmove(backlog, backlog + pushed, backlogCount * sizeof(*backlog));
+}
+
+// Network thread side. Waiting here for the simulation could deadlock, as it
+// may be waiting for room to send, so when it falls behind commands that a
+// later one makes up for are dropped and the others are kept for later.
+static void push_command(const struct serverCommand *const command, const bool droppable) {
+        push_backlog();
+        if (backlogCount == 0 && spscQueue_push(&commands, command)) {
+                return;
+        }
+        if (droppable) {
+                atomic_fetch_add_explicit(&commandsDropped, 1, memory_order_relaxed);
+                return;
+        }
+
+        if (backlogCount == backlogCapacity) {
+                backlogCapacity = backlogCapacity == 0 ? 256 : backlogCapacity * 2;
+                backlog = realloc(backlog, backlogCapacity * sizeof(*backlog));
+                if (backlog == NULL) {
+                        fprintf(stderr, "could not allocate memory\n");
+                        exit(EXIT_FAILURE);
+                }
+        }
+        backlog[backlogCount++] = *command;
+}
+
+// Fill in what every command from a peer carries
+static void command_from(struct serverCommand *const command,
+                         const struct transportEvent *const event, const size_t size) {
+        command->peer.idx = event->peer.idx;
+        command->peer.connectID = event->peer.connectID;
+        command->roundTripTime = event->roundTripTime;
+        command->roundTripTimeVariance = event->roundTripTimeVariance;
+        command->received = monotonic();
+        command->size = size;
+}
+
+static void command_fromLink(struct serverCommand *const command, const ENetPeer *const peer,
+                             const size_t size) {
+        command->peer.idx = (size_t)(peer - linkHost->peers);
+        command->peer.connectID = peer->connectID;
+        command->roundTripTime = peer->roundTripTime;
+        command->roundTripTimeVariance = peer->roundTripTimeVariance;
+        command->received = monotonic();
+        command->size = size;
+}
+
+// Neighbour a link peer is the connection to, or links.count if the neighbour
+// opened it
+static size_t peer_neighbor(const ENetPeer *const peer) {
+        size_t i;
+        for (i=0; i<links.count; i++) {
+                if (neighbors[i] == peer) {
+                        break;
+                }
+        }
+        return i;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void onMovementPacket(struct serverCommand *const command,
+                             const uint8_t *const payload, const size_t size) {
+        const struct networkPacket *base = (const void*)payload;
+        switch (base->type) {
+        case PACKET_TYPE_MOVEMENT_UPDATE: {
+                if (size < sizeof(struct networkPacketMovement)) {
+                        return;
+                }
+                const struct networkPacketMovement *data = (const void*)base;
+                struct bitReader reader;
+                bitReader_init(&reader, data->data, size - sizeof(*data));
+                command->type = SERVER_COMMAND_MOVEMENT;
+                command->sequence = data->sequence;
+                command->fields = bitReader_read(&reader, MOVEMENT_FIELDS_TOTAL);
+                if (command->fields & MOVEMENT_FIELD_POSITION) {
+                        command->position = networkCodec_readPosition(codec, &reader);
+                        command->velocity = networkCodec_readVelocity(codec, &reader);
+                }
+                if (command->fields & MOVEMENT_FIELD_ROTATION) {
+                        command->rotation = networkCodec_readRotation(codec, &reader);
+                }
+                if (!bitReader_ok(&reader)) {
+                        return;
+                }
+                break;
+        }
+        case PACKET_TYPE_INPUT: {
+                if (size < sizeof(struct networkPacketInput)) {
+                        return;
+                }
+                const struct networkPacketInput *data = (const void*)base;
+                struct bitReader reader;
+                bitReader_init(&reader, data->data, size - sizeof(*data));
+                command->type = SERVER_COMMAND_INPUT;
+                command->sequence = data->sequence;
+                networkCodec_readInput(codec, &reader, &command->input);
+                if (!bitReader_ok(&reader)) {
+                        return;
+                }
+                break;
+        }
+        case PACKET_TYPE_SNAPSHOT_ACK: {
+                if (size < sizeof(struct networkPacketSnapshotAck)) {
+                        return;
+                }
+                const struct networkPacketSnapshotAck *data = (const void*)base;
+                command->type = SERVER_COMMAND_SNAPSHOT_ACK;
+                command->snapshot = data->snapshot;
+                break;
+        }
+        default:
+                return;
+        }
+
+        // Positions and rotations are superseded by the next update and acks
+        // by the next ack. A jump is sent once and never again, and inputs are
+        // sent reliably and have to be applied in order, so those are kept.
+        const bool jump = command->type == SERVER_COMMAND_MOVEMENT &&
+                          (command->fields & MOVEMENT_FIELD_JUMP);
+        push_command(command, command->type != SERVER_COMMAND_INPUT && !jump);
+}
+
+static void onReceived(const struct transportEvent *const event) {
+        if (event->size < sizeof(struct networkPacket)) {
+                return;
+        }
+
+        struct serverCommand command;
+        command_from(&command, event, event->size);
+
+        switch (event->channel) {
+        case NETWORK_CHANNEL_CONTROL:
+                break;
+        case NETWORK_CHANNEL_MOVEMENT:
+                onMovementPacket(&command, event->payload, event->size);
+                break;
+        case NETWORK_CHANNEL_SERVER_UPDATES:
+        default:
+                fprintf(stderr, "ignoring packet received on channel %u\n", event->channel);
+                break;
+        }
+}
+
+static void onEvent(const struct transportEvent *const event) {
+        struct serverCommand command;
+
+        switch (event->type) {
+        case TRANSPORT_EVENT_CONNECT:
+                command.type = SERVER_COMMAND_CONNECT;
+                command_from(&command, event, 0);
+                command.connection.address = event->address;
+                command.connection.token = event->data;
+                push_command(&command, false);
+                break;
+        case TRANSPORT_EVENT_DISCONNECT:
+                command.type = SERVER_COMMAND_DISCONNECT;
+                command_from(&command, event, 0);
+                push_command(&command, false);
+                break;
+        case TRANSPORT_EVENT_RECEIVE:
+                onReceived(event);
+                break;
+        case TRANSPORT_EVENT_NONE:
+        default:
+                break;
+        }
+}
+
+static void onLinkEvent(const ENetEvent *const event) {
+        struct serverCommand command;
+        command_fromLink(&command, event->peer, 0);
+
+        const size_t neighbor = peer_neighbor(event->peer);
+        switch (event->type) {
+        case ENET_EVENT_TYPE_CONNECT:
+                if (neighbor < links.count) {
+                        command.type = SERVER_COMMAND_NEIGHBOR_UP;
+                        command.neighbor = neighbor;
+                        push_command(&command, false);
+                }
+                break;
+        case ENET_EVENT_TYPE_DISCONNECT:
+                if (neighbor < links.count) {
+                        neighbors[neighbor] = NULL;
+                        command.type = SERVER_COMMAND_NEIGHBOR_DOWN;
+                        command.neighbor = neighbor;
+                } else {
+                        command.type = SERVER_COMMAND_LINK_CLOSED;
+                }
+                push_command(&command, false);
+                break;
+        case ENET_EVENT_TYPE_RECEIVE:
+                // Neighbours only send on the connections they opened
+                if (neighbor < links.count ||
+                    event->packet->dataLength < sizeof(struct linkPacket)) {
+                        enet_packet_destroy(event->packet);
+                        break;
+                }
+                command.type = SERVER_COMMAND_LINK_RECEIVE;
+                command.size = event->packet->dataLength;
+                command.packet = event->packet;
+                push_command(&command, false);
+                break;
+        case ENET_EVENT_TYPE_NONE:
+        default:
+                break;
+        }
+}
+
+static void connect_neighbors(void) {
+        const struct timespec now = monotonic();
+        for (size_t i=0; i<links.count; i++) {
+                if (neighbors[i] != NULL || timespec_before(now, neighborRetry[i])) {
+                        continue;
+                }
+                neighbors[i] = enet_host_connect(linkHost, &links.neighbors[i], LINK_CHANNELS_TOTAL, 0);
+                neighborRetry[i] = timespec_add(now, LINK_RETRY_NS);
+        }
+}
+
+static void packet_release(void *const data) {
+        packetPool_return(&packets, data);
+}
+
+static void packet_sent(ENetPacket *const packet) {
+        packet_release(packet->userData);
+}
+
+static void send_messages(void) {
+        struct serverMessage message;
+        while (spscQueue_pop(&messages, &message)) {
+                if (!message.link) {
+                        struct transportPeer peer;
+                        peer.idx = message.peer.idx;
+                        peer.connectID = message.peer.connectID;
+                        transport_sendOwned(host, peer, (uint8_t)message.channel, message.data,
+                                            message.size, message.flags);
+                        continue;
+                }
+
+                // Send the buffer itself rather than a copy of it
+                ENetPacket *packet = enet_packet_create(message.data, message.size,
+                                                        message.flags | ENET_PACKET_FLAG_NO_ALLOCATE);
+                if (packet == NULL) {
+                        fprintf(stderr, "could not create packet\n");
+                        packetPool_return(&packets, message.data);
+                        continue;
+                }
+                packet->freeCallback = packet_sent;
+                packet->userData = message.data;
+
+                ENetPeer *peer = neighbors[message.peer.idx];
+                if (peer == NULL ||
+                    peer->state != ENET_PEER_STATE_CONNECTED ||
+                    enet_peer_send(peer, (enet_uint8)message.channel, packet) < 0) {
+                        enet_packet_destroy(packet);
+                }
+        }
+}
+
+static void *network_thread(void *args) {
+        (void)args;
+
+        struct pollfd fds[3];
+        nfds_t nfds = 2;
+        fds[0].fd = transport_socket(host);
+        fds[0].events = POLLIN;
+        fds[1].fd = wakefd;
+        fds[1].events = POLLIN;
+        if (linkHost != NULL) {
+                fds[2].fd = linkHost->socket;
+                fds[2].events = POLLIN;
+                nfds++;
+        }
+
+        struct timespec timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_nsec = SERVICE_TIMEOUT_NS;
+
+        while (atomic_load_explicit(&running, memory_order_relaxed)) {
+                send_messages();
+
+                // Never block inside the hosts: ENet's timeout has a
+                // granularity of milliseconds, waiting on the sockets here
+                // does not.
+                struct transportEvent event;
+                int r;
+                push_backlog();
+                while ((r = transport_service(host, &event)) > 0) {
+                        onEvent(&event);
+                }
+                if (r < 0) {
+                        fprintf(stderr, "error servicing host\n");
+                }
+
+                if (linkHost != NULL) {
+                        connect_neighbors();
+                        ENetEvent linkEvent;
+                        while ((r = enet_host_service(linkHost, &linkEvent, 0)) > 0) {
+                                onLinkEvent(&linkEvent);
+                        }
+                        if (r < 0) {
+                                fprintf(stderr, "error servicing link host\n");
+                        }
+                }
+
+                if (ppoll(fds, nfds, &timeout, NULL) < 0) {
+                        perror("ppoll");
+                        continue;
+                }
+                if (fds[1].revents & POLLIN) {
+                        uint64_t count;
+                        if (read(wakefd, &count, sizeof(count)) < 0) {
+                                perror("read");
+                        }
+                }
+        }
+
+        return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void serverNetwork_init(const enum transportBackend backend, const unsigned short port,
+                        const size_t maxPeers, const struct networkCodec *const networkCodec,
+                        const struct serverNetworkLinks *const networkLinks) {
+        codec = networkCodec;
+
+        if (enet_initialize() != 0) {
+                fprintf(stderr, "could not initialize enet\n");
+                exit(EXIT_FAILURE);
+        }
+
+        ENetAddress address;
+        address.host = ENET_HOST_ANY;
+        address.port = port;
+
+        host = transport_create(backend, &address, maxPeers, NETWORK_CHANNELS_TOTAL,
+                                packet_release);
+        if (host == NULL) {
+                fprintf(stderr, "could not create server\n");
+                exit(EXIT_FAILURE);
+        }
+
+        if (networkLinks != NULL) {
+                links = *networkLinks;
+                address.port = links.port;
+                // Room for the connections both ways with every neighbour
+                linkHost = enet_host_create(&address, 2 * SHARD_LINK_MAX_NEIGHBORS,
+                                            LINK_CHANNELS_TOTAL, 0, 0);
+                if (linkHost == NULL) {
+                        fprintf(stderr, "could not create link host\n");
+                        exit(EXIT_FAILURE);
+                }
+                const struct timespec now = monotonic();
+                for (size_t i=0; i<links.count; i++) {
+                        neighbors[i] = NULL;
+                        neighborRetry[i] = now;
+                }
+        }
+
+        spscQueue_init(&commands, sizeof(struct serverCommand), COMMAND_QUEUE_SIZE);
+        spscQueue_init(&messages, sizeof(struct serverMessage), MESSAGE_QUEUE_SIZE);
+        packetPool_init(&packets);
+
+        wakefd = eventfd(0, EFD_NONBLOCK);
+        if (wakefd < 0) {
+                perror("eventfd");
+                exit(EXIT_FAILURE);
+        }
+
+        // Signals are for the simulation thread to handle, the network
+        // thread inherits a mask that blocks all of them
+        sigset_t all, previous;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &previous);
+
+        atomic_store(&running, true);
+        int err = pthread_create(&thread, NULL, network_thread, NULL);
+        if (err != 0) {
+                fprintf(stderr, "could not create network thread: %d\n", err);
+                exit(EXIT_FAILURE);
+        }
+
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
+}
+
+void serverNetwork_initOffline(void) {
+        offline = true;
+        packetPool_init(&packets);
+}
+
+void serverNetwork_deinit(void) {
+        if (offline) {
+                packetPool_free(&packets);
+                offline = false;
+                return;
+        }
+        if (host == NULL) {
+                return;
+        }
+
+        atomic_store(&running, false);
+        pthread_join(thread, NULL);
+
+        // Destroying the host gives back the buffers of the packets still
+        // queued in it
+        transport_destroy(host);
+        host = NULL;
+        if (linkHost != NULL) {
+                enet_host_destroy(linkHost);
+                linkHost = NULL;
+        }
+
+        struct serverMessage message;
+        while (spscQueue_pop(&messages, &message)) {
+                packetPool_release(&packets, message.data);
+        }
+        struct serverCommand command;
+        while (spscQueue_pop(&commands, &command)) {
+                if (command.type == SERVER_COMMAND_LINK_RECEIVE) {
+                        enet_packet_destroy(command.packet);
+                }
+        }
+        for (size_t i=0; i<backlogCount; i++) {
+                if (backlog[i].type == SERVER_COMMAND_LINK_RECEIVE) {
+                        enet_packet_destroy(backlog[i].packet);
+                }
+        }
+        free(backlog);
+        backlog = NULL;
+        backlogCount = 0;
+        backlogCapacity = 0;
+        enet_deinitialize();
+        spscQueue_free(&commands);
+        spscQueue_free(&messages);
+        packetPool_free(&packets);
+        close(wakefd);
+}
+
+bool serverNetwork_poll(struct serverCommand *const command) {
+        if (offline) {
+                return false;
+        }
+        return spscQueue_pop(&commands, command);
+}
+
+void *serverNetwork_packet(const size_t size) {
+        return packetPool_get(&packets, size);
+}
+
+void serverNetwork_send(const struct serverPeer peer, const enum networkChannel channel,
+                        void *const data, const size_t size, const uint32_t flags) {
+        bytesQueued += size;
+        if (offline) {
+                packetPool_release(&packets, data);
+                return;
+        }
+
+        struct serverMessage message;
+        message.link = false;
+        message.peer = peer;
+        message.channel = channel;
+        message.data = data;
+        message.size = size;
+        message.flags = flags;
+        push_message(&message);
+}
+
+void serverNetwork_sendLink(const size_t neighbor, const enum linkChannel channel,
+                            void *const data, const size_t size, const uint32_t flags) {
+        bytesQueued += size;
+        if (offline) {
+                packetPool_release(&packets, data);
+                return;
+        }
+
+        struct serverMessage message;
+        message.link = true;
+        message.peer.idx = neighbor;
+        message.peer.connectID = 0;
+        message.channel = channel;
+        message.data = data;
+        message.size = size;
+        message.flags = flags;
+        push_message(&message);
+}
+
+void serverNetwork_release(ENetPacket *const packet) {
+        enet_packet_destroy(packet);
+}
+
+size_t serverNetwork_bytesQueued(void) {
+        return bytesQueued;
+}
+
+void serverNetwork_discard(void *const data) {
+        packetPool_release(&packets, data);
+}
+
+size_t serverNetwork_poolMisses(void) {
+        return packetPool_misses(&packets);
+}
+
+size_t serverNetwork_droppedCommands(void) {
+        return atomic_exchange_explicit(&commandsDropped, 0, memory_order_relaxed);
+}
+
+void serverNetwork_flush(void) {
+        if (offline) {
+                return;
+        }
+        wake();
+}
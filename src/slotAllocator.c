@@ -0,0 +1,120 @@
+#include <slotAllocator.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WORD_BITS 64
+
+static size_t words_for(const size_t bits) {
+        return (bits + WORD_BITS - 1) / WORD_BITS;
+}
+
+static inline bool bit_test(const uint64_t *const words, const size_t idx) {
+        return (words[idx / WORD_BITS] >> (idx % WORD_BITS)) & 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void slotAllocator_init(struct slotAllocator *const allocator, const size_t capacity) {
+        allocator->capacity = capacity;
+        allocator->count = 0;
+
+        // Levels go up until one word covers everything
+        size_t bits = capacity;
+        size_t levels = 0;
+        do {
+                if (levels >= SLOT_ALLOCATOR_MAX_LEVELS) {
+                        fprintf(stderr, "slot allocator capacity %zu is too large\n", capacity);
+                        exit(EXIT_FAILURE);
+                }
+                allocator->bits[levels] = malloc(words_for(bits) * sizeof(uint64_t));
+                if (allocator->bits[levels] == NULL) {
+                        fprintf(stderr, "could not allocate slot allocator\n");
+                        exit(EXIT_FAILURE);
+                }
+
+                // Everything is free, bits past the end are not
+                uint64_t *words = allocator->bits[levels];
+                for (size_t w=0; w<words_for(bits); w++) {
+                        const size_t remaining = bits - w * WORD_BITS;
+                        words[w] = remaining >= WORD_BITS ? ~(uint64_t)0 : ((uint64_t)1 << remaining) - 1;
+                }
+
+                levels++;
+                bits = words_for(bits);
+        } while (bits > 1);
+        allocator->levels = levels;
+
+        allocator->generations = calloc(capacity, sizeof(*allocator->generations));
+        if (allocator->generations == NULL) {
+                fprintf(stderr, "could not allocate slot allocator\n");
+                exit(EXIT_FAILURE);
+        }
+}
+
+void slotAllocator_free(struct slotAllocator *const allocator) {
+        for (size_t i=0; i<allocator->levels; i++) {
+                free(allocator->bits[i]);
+        }
+        free(allocator->generations);
+}
+
+size_t slotAllocator_take(struct slotAllocator *const allocator) {
+        const size_t top = allocator->levels - 1;
+        if (allocator->bits[top][0] == 0) {
+                return allocator->capacity;
+        }
+
+        size_t idx = 0;
+        for (size_t level=allocator->levels; level-->0;) {
+                idx = idx * WORD_BITS + (size_t)__builtin_ctzll(allocator->bits[level][idx]);
+        }
+
+        // Mark it taken and, for every word left with nothing free, the bit
+        // above it
+        size_t i = idx;
+        for (size_t level=0; level<allocator->levels; level++) {
+                uint64_t *word = &allocator->bits[level][i / WORD_BITS];
+                *word &= ~((uint64_t)1 << (i % WORD_BITS));
+                if (*word != 0) {
+                        break;
+                }
+                i /= WORD_BITS;
+        }
+
+        allocator->count++;
+        return idx;
+}
+
+void slotAllocator_release(struct slotAllocator *const allocator, const size_t idx) {
+        allocator->generations[idx]++;
+
+        // Mark it free and, for every word that had nothing free, the bit
+        // above it
+        size_t i = idx;
+        for (size_t level=0; level<allocator->levels; level++) {
+                uint64_t *word = &allocator->bits[level][i / WORD_BITS];
+                const bool had_free = *word != 0;
+                *word |= (uint64_t)1 << (i % WORD_BITS);
+                if (had_free) {
+                        break;
+                }
+                i /= WORD_BITS;
+        }
+
+        allocator->count--;
+}
+
+struct slotHandle slotAllocator_handle(const struct slotAllocator *const allocator,
+                                       const size_t idx) {
+        struct slotHandle handle;
+        handle.idx = (uint32_t)idx;
+        handle.generation = allocator->generations[idx];
+        return handle;
+}
+
+bool slotAllocator_valid(const struct slotAllocator *const allocator,
+                         const struct slotHandle handle) {
+        return handle.idx < allocator->capacity &&
+                !bit_test(allocator->bits[0], handle.idx) &&
+                allocator->generations[handle.idx] == handle.generation;
+}
@@ -0,0 +1,92 @@
+#include <spatialHash.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+static inline int32_t cell_coord(const float cellSize, const float v) {
+        return (int32_t)floorf(v / cellSize);
+}
+
+static inline size_t cell_bucket(const int32_t x, const int32_t y) {
+        uint32_t h = (uint32_t)x * 73856093U ^ (uint32_t)y * 19349663U;
+        return h & (SPATIAL_HASH_BUCKETS - 1);
+}
+
+void spatialHash_init(struct spatialHash *const hash, const float cellSize, const size_t capacity) {
+        hash->cellSize = cellSize;
+        hash->capacity = capacity;
+
+        for (size_t i=0; i<SPATIAL_HASH_BUCKETS; i++) {
+                hash->buckets[i] = SPATIAL_HASH_NONE;
+        }
+        hash->numUsedBuckets = 0;
+
+        hash->usedBuckets = malloc(capacity * sizeof(*hash->usedBuckets));
+        hash->next = malloc(capacity * sizeof(*hash->next));
+        hash->cellX = malloc(capacity * sizeof(*hash->cellX));
+        hash->cellY = malloc(capacity * sizeof(*hash->cellY));
+        hash->positions = malloc(capacity * sizeof(*hash->positions));
+        if (hash->usedBuckets == NULL || hash->next == NULL ||
+            hash->cellX == NULL || hash->cellY == NULL ||
+            hash->positions == NULL) {
+                fprintf(stderr, "could not allocate spatial hash\n");
+                exit(EXIT_FAILURE);
+        }
+}
+
+void spatialHash_free(struct spatialHash *const hash) {
+        free(hash->usedBuckets);
+        free(hash->next);
+        free(hash->cellX);
+        free(hash->cellY);
+        free(hash->positions);
+}
+
+void spatialHash_clear(struct spatialHash *const hash) {
+        for (size_t i=0; i<hash->numUsedBuckets; i++) {
+                hash->buckets[hash->usedBuckets[i]] = SPATIAL_HASH_NONE;
+        }
+        hash->numUsedBuckets = 0;
+}
+
+void spatialHash_insert(struct spatialHash *const hash, const size_t idx, const vec2s position) {
+        const int32_t x = cell_coord(hash->cellSize, position.x);
+        const int32_t y = cell_coord(hash->cellSize, position.y);
+        const size_t bucket = cell_bucket(x, y);
+
+        if (hash->buckets[bucket] == SPATIAL_HASH_NONE) {
+                hash->usedBuckets[hash->numUsedBuckets++] = bucket;
+        }
+
+        hash->cellX[idx] = x;
+        hash->cellY[idx] = y;
+        hash->positions[idx] = position;
+        hash->next[idx] = hash->buckets[bucket];
+        hash->buckets[bucket] = idx;
+}
+
+void spatialHash_query(const struct spatialHash *const hash, const vec2s center, const float radius,
+                       void(*const func)(size_t idx, void *args), void *const args) {
+        const int32_t minX = cell_coord(hash->cellSize, center.x - radius);
+        const int32_t maxX = cell_coord(hash->cellSize, center.x + radius);
+        const int32_t minY = cell_coord(hash->cellSize, center.y - radius);
+        const int32_t maxY = cell_coord(hash->cellSize, center.y + radius);
+        const float radius2 = radius * radius;
+
+        for (int32_t y=minY; y<=maxY; y++) {
+                for (int32_t x=minX; x<=maxX; x++) {
+                        size_t idx = hash->buckets[cell_bucket(x, y)];
+                        while (idx != SPATIAL_HASH_NONE) {
+                                // different cells may share a bucket
+                                if (hash->cellX[idx] == x && hash->cellY[idx] == y) {
+                                        const float dx = hash->positions[idx].x - center.x;
+                                        const float dy = hash->positions[idx].y - center.y;
+                                        if (dx*dx + dy*dy <= radius2) {
+                                                func(idx, args);
+                                        }
+                                }
+                                idx = hash->next[idx];
+                        }
+                }
+        }
+}
@@ -0,0 +1,52 @@
+#include <spscQueue.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+void spscQueue_init(struct spscQueue *const queue, const size_t elementSize, const size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+                size <<= 1;
+        }
+
+        queue->elementSize = elementSize;
+        queue->mask = size - 1;
+        queue->data = malloc(size * elementSize);
+        if (queue->data == NULL) {
+                fprintf(stderr, "could not allocate queue\n");
+                exit(EXIT_FAILURE);
+        }
+
+        atomic_init(&queue->head, 0);
+        atomic_init(&queue->tail, 0);
+}
+
+void spscQueue_free(struct spscQueue *const queue) {
+        free(queue->data);
+}
+
+bool spscQueue_push(struct spscQueue *const queue, const void *const element) {
+        const size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        const size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        if (tail - head > queue->mask) {
+                return false;
+        }
+
+        memcpy(queue->data + (tail & queue->mask) * queue->elementSize,
+               element, queue->elementSize);
+        atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+        return true;
+}
+
+bool spscQueue_pop(struct spscQueue *const queue, void *const element) {
+        const size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        const size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        if (head == tail) {
+                return false;
+        }
+
+        memcpy(element, queue->data + (head & queue->mask) * queue->elementSize,
+               queue->elementSize);
+        atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+        return true;
+}
@@ -0,0 +1,244 @@
+#include <terrain.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Largest side of a terrain, so that tile coordinates fit in 16 bits
+#define TERRAIN_MAX_SIDE 65536UL
+
+// Spread the low 16 bits of v to the even bits
+static size_t spread_bits(size_t v) {
+        v &= 0xffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+}
+
+// Where sample ix, iy is stored: the tile it is in, in Morton order, and
+// inside it row by row
+static inline size_t sample_index(const size_t ix, const size_t iy) {
+        const size_t tile = spread_bits(ix / TERRAIN_TILE) | (spread_bits(iy / TERRAIN_TILE) << 1);
+        return tile * TERRAIN_TILE * TERRAIN_TILE + (iy % TERRAIN_TILE) * TERRAIN_TILE +
+                ix % TERRAIN_TILE;
+}
+
+static inline float sample_height(const struct terrain *const terrain, const size_t index,
+                                  const bool quantized) {
+        if (quantized) {
+                return (float)terrain->quantized[index] * terrain->step;
+        }
+        return terrain->heights[index];
+}
+
+// Bilinear interpolation of the four samples around x, y. Inlined with
+// quantized known, so that batches do not check it for every point.
+static inline float height_at(const struct terrain *const terrain, const float x, const float y,
+                              const bool quantized) {
+        const float gx = fminf(fmaxf((x - terrain->originX) / TERRAIN_CELL_SIZE, 0),
+                               (float)(terrain->width - 1));
+        const float gy = fminf(fmaxf((y - terrain->originY) / TERRAIN_CELL_SIZE, 0),
+                               (float)(terrain->height - 1));
+
+        // cell the point is in, the last one for points on the far edges
+        size_t ix = (size_t)gx;
+        size_t iy = (size_t)gy;
+        if (ix > terrain->width - 2) {
+                ix = terrain->width - 2;
+        }
+        if (iy > terrain->height - 2) {
+                iy = terrain->height - 2;
+        }
+        const float fx = gx - (float)ix;
+        const float fy = gy - (float)iy;
+
+        const size_t i00 = sample_index(ix, iy);
+        size_t i10, i01, i11;
+        if (ix % TERRAIN_TILE != TERRAIN_TILE - 1 && iy % TERRAIN_TILE != TERRAIN_TILE - 1) {
+                // all in the same tile
+                i10 = i00 + 1;
+                i01 = i00 + TERRAIN_TILE;
+                i11 = i01 + 1;
+        } else {
+                i10 = sample_index(ix + 1, iy);
+                i01 = sample_index(ix, iy + 1);
+                i11 = sample_index(ix + 1, iy + 1);
+        }
+
+        const float h00 = sample_height(terrain, i00, quantized);
+        const float h10 = sample_height(terrain, i10, quantized);
+        const float h01 = sample_height(terrain, i01, quantized);
+        const float h11 = sample_height(terrain, i11, quantized);
+        const float bottom = h00 + (h10 - h00) * fx;
+        const float top = h01 + (h11 - h01) * fx;
+        return bottom + (top - bottom) * fy;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Read a number from the header of a PGM file, after any whitespace and
+// comments. The whitespace that ends it is read too.
+static bool read_header_number(FILE *const file, unsigned long *const value) {
+        int c = fgetc(file);
+        while (c == '#' || isspace(c)) {
+                if (c == '#') {
+                        while (c != '\n' && c != EOF) {
+                                c = fgetc(file);
+                        }
+                } else {
+                        c = fgetc(file);
+                }
+        }
+
+        if (!isdigit(c)) {
+                return false;
+        }
+        *value = 0;
+        while (isdigit(c)) {
+                *value = *value * 10 + (unsigned long)(c - '0');
+                if (*value > UINT32_MAX) {
+                        return false;
+                }
+                c = fgetc(file);
+        }
+        return isspace(c);
+}
+
+static uint64_t hash_bytes(uint64_t hash, const void *const data, const size_t size) {
+        // FNV-1a
+        const unsigned char *bytes = data;
+        for (size_t i=0; i<size; i++) {
+                hash ^= bytes[i];
+                hash *= 0x100000001b3ULL;
+        }
+        return hash;
+}
+
+// Read the samples of the image, its first row being the one furthest along y
+static bool read_samples(struct terrain *const terrain, FILE *const file,
+                         const unsigned long maxval) {
+        const size_t bytes = maxval > UINT8_MAX ? 2 : 1;
+        uint8_t *row = malloc(terrain->width * bytes);
+        if (row == NULL) {
+                fprintf(stderr, "could not allocate memory\n");
+                exit(EXIT_FAILURE);
+        }
+
+        bool ok = true;
+        for (size_t r=0; r<terrain->height && ok; r++) {
+                if (fread(row, bytes, terrain->width, file) != terrain->width) {
+                        ok = false;
+                        break;
+                }
+                const size_t iy = terrain->height - 1 - r;
+                for (size_t ix=0; ix<terrain->width; ix++) {
+                        uint16_t q = row[ix * bytes];
+                        if (bytes == 2) {
+                                q = (uint16_t)(q << 8 | row[ix * bytes + 1]);
+                        }
+                        if (q > maxval) {
+                                ok = false;
+                                break;
+                        }
+
+                        const size_t index = sample_index(ix, iy);
+                        if (terrain->quantized != NULL) {
+                                terrain->quantized[index] = q;
+                        } else {
+                                terrain->heights[index] = (float)q * terrain->step;
+                        }
+                }
+        }
+
+        free(row);
+        return ok;
+}
+
+bool terrain_load(struct terrain *const terrain, const char *const path, const bool quantized) {
+        FILE *file = fopen(path, "rb");
+        if (file == NULL) {
+                perror(path);
+                return false;
+        }
+
+        unsigned long width, height, maxval;
+        if (fgetc(file) != 'P' || fgetc(file) != '5' ||
+            !read_header_number(file, &width) || !read_header_number(file, &height) ||
+            !read_header_number(file, &maxval) ||
+            width < 2 || height < 2 || width > TERRAIN_MAX_SIDE || height > TERRAIN_MAX_SIDE ||
+            maxval == 0 || maxval > UINT16_MAX) {
+                fprintf(stderr, "%s: not a binary PGM image of at least 2x2 pixels\n", path);
+                fclose(file);
+                return false;
+        }
+
+        terrain->width = width;
+        terrain->height = height;
+        terrain->originX = -(float)(width - 1) * TERRAIN_CELL_SIZE / 2;
+        terrain->originY = -(float)(height - 1) * TERRAIN_CELL_SIZE / 2;
+        terrain->step = TERRAIN_MAX_HEIGHT / (float)maxval;
+
+        // Morton order grows along both axes, the last tile comes last.
+        // Samples of the tiles past the edges are never read.
+        const size_t samples = sample_index(width - 1, height - 1) /
+                (TERRAIN_TILE * TERRAIN_TILE) * TERRAIN_TILE * TERRAIN_TILE +
+                TERRAIN_TILE * TERRAIN_TILE;
+        terrain->quantized = NULL;
+        terrain->heights = NULL;
+        if (quantized) {
+                terrain->quantized = calloc(samples, sizeof(*terrain->quantized));
+        } else {
+                terrain->heights = calloc(samples, sizeof(*terrain->heights));
+        }
+        if (terrain->quantized == NULL && terrain->heights == NULL) {
+                fprintf(stderr, "could not allocate memory\n");
+                exit(EXIT_FAILURE);
+        }
+
+        const bool read = read_samples(terrain, file, maxval);
+        fclose(file);
+        if (!read) {
+                fprintf(stderr, "%s: truncated or invalid samples\n", path);
+                terrain_free(terrain);
+                return false;
+        }
+
+        // of the heights, so that quantized and not hash the same
+        terrain->hash = 0xcbf29ce484222325ULL;
+        terrain->hash = hash_bytes(terrain->hash, &terrain->width, sizeof(terrain->width));
+        terrain->hash = hash_bytes(terrain->hash, &terrain->height, sizeof(terrain->height));
+        for (size_t iy=0; iy<height; iy++) {
+                for (size_t ix=0; ix<width; ix++) {
+                        const float h = sample_height(terrain, sample_index(ix, iy), quantized);
+                        terrain->hash = hash_bytes(terrain->hash, &h, sizeof(h));
+                }
+        }
+        return true;
+}
+
+void terrain_free(struct terrain *const terrain) {
+        free(terrain->quantized);
+        free(terrain->heights);
+        terrain->quantized = NULL;
+        terrain->heights = NULL;
+}
+
+float terrain_height(const struct terrain *const terrain, const float x, const float y) {
+        return height_at(terrain, x, y, terrain->quantized != NULL);
+}
+
+void terrain_heights(const struct terrain *const terrain, const size_t count,
+                     const float *const x, const float *const y, float *const height) {
+        if (terrain->quantized != NULL) {
+                for (size_t i=0; i<count; i++) {
+                        height[i] = height_at(terrain, x[i], y[i], true);
+                }
+        } else {
+                for (size_t i=0; i<count; i++) {
+                        height[i] = height_at(terrain, x[i], y[i], false);
+                }
+        }
+}
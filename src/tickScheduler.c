@@ -0,0 +1,38 @@
+#include <tickScheduler.h>
+#include <timeutil.h>
+
+void tickScheduler_init(struct tickScheduler *const scheduler, const unsigned long period_ns,
+                        const enum tickPolicy policy) {
+        scheduler->period_ns = period_ns;
+        scheduler->policy = policy;
+        scheduler->deadline = monotonic();
+        scheduler->tick = 0;
+        scheduler->skipped = 0;
+}
+
+unsigned long tickScheduler_wait(struct tickScheduler *const scheduler) {
+        unsigned long dropped = 0;
+
+        struct timespec now = monotonic();
+        if (timespec_before(now, scheduler->deadline)) {
+                monotonic_sleep_until(scheduler->deadline);
+        } else {
+                // Ticks that were due before the current one
+                unsigned long behind = monotonic_difference(now, scheduler->deadline) / scheduler->period_ns;
+                unsigned long allowed = 0;
+                if (scheduler->policy == TICK_POLICY_CATCH_UP) {
+                        allowed = TICK_SCHEDULER_MAX_CATCH_UP;
+                }
+
+                if (behind > allowed) {
+                        dropped = behind;
+                        scheduler->skipped += dropped;
+                        scheduler->deadline = timespec_add(scheduler->deadline,
+                                                           behind * scheduler->period_ns);
+                }
+        }
+
+        scheduler->deadline = timespec_add(scheduler->deadline, scheduler->period_ns);
+        scheduler->tick++;
+        return dropped;
+}
@@ -2,6 +2,7 @@
 
 #include <timeutil.h>
 #include <stdio.h>
+#include <errno.h>
 
 struct timespec monotonic(void) {
         struct timespec tp = {0};
@@ -30,3 +31,28 @@ unsigned long monotonic_difference(const struct timespec a, const struct timespe
         }
         return (unsigned long)nsec;
 }
+
+struct timespec timespec_add(struct timespec t, const unsigned long ns) {
+        t.tv_sec += (time_t)(ns / 1000000000UL);
+        t.tv_nsec += (long)(ns % 1000000000UL);
+        if (t.tv_nsec >= 1000000000L) {
+                t.tv_sec += 1;
+                t.tv_nsec -= 1000000000L;
+        }
+        return t;
+}
+
+bool timespec_before(const struct timespec a, const struct timespec b) {
+        return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+void monotonic_sleep_until(const struct timespec t) {
+        int err;
+        do {
+                err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+        } while (err == EINTR);
+        if (err != 0) {
+                errno = err;
+                perror("clock_nanosleep");
+        }
+}
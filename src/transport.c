@@ -0,0 +1,262 @@
+#include <transport.h>
+#include <udpHost.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct transport {
+        enum transportBackend backend;
+        void (*release)(void *data);
+        union {
+                ENetHost *enet;
+                struct udpHost *udp;
+        };
+        // destroyed once the host is serviced again
+        ENetPacket *received;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+static ENetPeer *peer_get(const struct transport *const transport,
+                          const struct transportPeer peer) {
+        if (peer.idx >= transport->enet->peerCount) {
+                return NULL;
+        }
+        ENetPeer *enetPeer = &transport->enet->peers[peer.idx];
+        if (enetPeer->connectID != peer.connectID) {
+                return NULL;
+        }
+        return enetPeer;
+}
+
+static void packet_sent(ENetPacket *const packet) {
+        const struct transport *transport = packet->userData;
+        transport->release(packet->data);
+}
+
+static bool send_packet(struct transport *const transport, const struct transportPeer peer,
+                        const uint8_t channel, ENetPacket *const packet) {
+        ENetPeer *enetPeer = peer_get(transport, peer);
+        if (enetPeer == NULL || enetPeer->state != ENET_PEER_STATE_CONNECTED ||
+            enet_peer_send(enetPeer, channel, packet) < 0) {
+                enet_packet_destroy(packet);
+                return false;
+        }
+        return true;
+}
+
+static int service_enet(struct transport *const transport, struct transportEvent *const event) {
+        ENetEvent enetEvent;
+        const int r = enet_host_service(transport->enet, &enetEvent, 0);
+        if (r <= 0) {
+                return r;
+        }
+
+        event->peer.idx = (size_t)(enetEvent.peer - transport->enet->peers);
+        event->peer.connectID = enetEvent.peer->connectID;
+        event->roundTripTime = enetEvent.peer->roundTripTime;
+        event->roundTripTimeVariance = enetEvent.peer->roundTripTimeVariance;
+        event->address = enetEvent.peer->address;
+        event->data = 0;
+        event->channel = 0;
+        event->payload = NULL;
+        event->size = 0;
+        switch (enetEvent.type) {
+        case ENET_EVENT_TYPE_CONNECT:
+                event->type = TRANSPORT_EVENT_CONNECT;
+                event->data = enetEvent.data;
+                break;
+        case ENET_EVENT_TYPE_DISCONNECT:
+                event->type = TRANSPORT_EVENT_DISCONNECT;
+                break;
+        case ENET_EVENT_TYPE_RECEIVE:
+                event->type = TRANSPORT_EVENT_RECEIVE;
+                event->channel = enetEvent.channelID;
+                event->payload = enetEvent.packet->data;
+                event->size = enetEvent.packet->dataLength;
+                transport->received = enetEvent.packet;
+                break;
+        case ENET_EVENT_TYPE_NONE:
+        default:
+                event->type = TRANSPORT_EVENT_NONE;
+                break;
+        }
+        return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct transport *transport_create(const enum transportBackend backend,
+                                   const ENetAddress *const address, const size_t peerCount,
+                                   const size_t channels, void (*const release)(void *data)) {
+        struct transport *transport = malloc(sizeof(*transport));
+        if (transport == NULL) {
+                fprintf(stderr, "could not allocate memory\n");
+                exit(EXIT_FAILURE);
+        }
+        transport->backend = backend;
+        transport->release = release;
+        transport->received = NULL;
+
+        bool created;
+        switch (backend) {
+        case TRANSPORT_BACKEND_UDP:
+                transport->udp = udpHost_create(address, peerCount, channels, release);
+                created = transport->udp != NULL;
+                break;
+        case TRANSPORT_BACKEND_ENET:
+        default:
+                transport->enet = enet_host_create(address, peerCount, channels, 0, 0);
+                created = transport->enet != NULL;
+                break;
+        }
+        if (!created) {
+                free(transport);
+                return NULL;
+        }
+        return transport;
+}
+
+void transport_destroy(struct transport *const transport) {
+        switch (transport->backend) {
+        case TRANSPORT_BACKEND_UDP:
+                udpHost_destroy(transport->udp);
+                break;
+        case TRANSPORT_BACKEND_ENET:
+        default:
+                if (transport->received != NULL) {
+                        enet_packet_destroy(transport->received);
+                }
+                // gives back the buffers of the packets still queued
+                enet_host_destroy(transport->enet);
+                break;
+        }
+        free(transport);
+}
+
+int transport_socket(const struct transport *const transport) {
+        switch (transport->backend) {
+        case TRANSPORT_BACKEND_UDP:
+                return udpHost_socket(transport->udp);
+        case TRANSPORT_BACKEND_ENET:
+        default:
+                return transport->enet->socket;
+        }
+}
+
+int transport_service(struct transport *const transport, struct transportEvent *const event) {
+        switch (transport->backend) {
+        case TRANSPORT_BACKEND_UDP:
+                return udpHost_service(transport->udp, event);
+        case TRANSPORT_BACKEND_ENET:
+        default:
+                if (transport->received != NULL) {
+                        enet_packet_destroy(transport->received);
+                        transport->received = NULL;
+                }
+                return service_enet(transport, event);
+        }
+}
+
+void transport_flush(struct transport *const transport) {
+        switch (transport->backend) {
+        case TRANSPORT_BACKEND_UDP:
+                udpHost_flush(transport->udp);
+                break;
+        case TRANSPORT_BACKEND_ENET:
+        default:
+                enet_host_flush(transport->enet);
+                break;
+        }
+}
+
+bool transport_connect(struct transport *const transport, const ENetAddress *const address,
+                       const size_t channels, const uint32_t data,
+                       struct transportPeer *const peer) {
+        switch (transport->backend) {
+        case TRANSPORT_BACKEND_UDP:
+                return udpHost_connect(transport->udp, address, data, peer);
+        case TRANSPORT_BACKEND_ENET:
+        default: {
+                ENetPeer *enetPeer = enet_host_connect(transport->enet, address, channels, data);
+                if (enetPeer == NULL) {
+                        return false;
+                }
+                peer->idx = (size_t)(enetPeer - transport->enet->peers);
+                peer->connectID = enetPeer->connectID;
+                return true;
+        }
+        }
+}
+
+void transport_disconnect(struct transport *const transport, const struct transportPeer peer) {
+        switch (transport->backend) {
+        case TRANSPORT_BACKEND_UDP:
+                udpHost_disconnect(transport->udp, peer);
+                break;
+        case TRANSPORT_BACKEND_ENET:
+        default: {
+                ENetPeer *enetPeer = peer_get(transport, peer);
+                if (enetPeer != NULL) {
+                        enet_peer_disconnect_now(enetPeer, 0);
+                }
+                break;
+        }
+        }
+}
+
+bool transport_send(struct transport *const transport, const struct transportPeer peer,
+                    const uint8_t channel, const void *const data, const size_t size,
+                    const uint32_t flags) {
+        switch (transport->backend) {
+        case TRANSPORT_BACKEND_UDP:
+                return udpHost_send(transport->udp, peer, channel, data, size, flags);
+        case TRANSPORT_BACKEND_ENET:
+        default: {
+                ENetPacket *packet = enet_packet_create(data, size, flags);
+                if (packet == NULL) {
+                        fprintf(stderr, "could not create packet\n");
+                        return false;
+                }
+                return send_packet(transport, peer, channel, packet);
+        }
+        }
+}
+
+bool transport_sendOwned(struct transport *const transport, const struct transportPeer peer,
+                         const uint8_t channel, void *const data, const size_t size,
+                         const uint32_t flags) {
+        switch (transport->backend) {
+        case TRANSPORT_BACKEND_UDP:
+                return udpHost_sendOwned(transport->udp, peer, channel, data, size, flags);
+        case TRANSPORT_BACKEND_ENET:
+        default: {
+                // Send the buffer itself rather than a copy of it
+                ENetPacket *packet = enet_packet_create(data, size,
+                                                        flags | ENET_PACKET_FLAG_NO_ALLOCATE);
+                if (packet == NULL) {
+                        fprintf(stderr, "could not create packet\n");
+                        transport->release(data);
+                        return false;
+                }
+                packet->freeCallback = packet_sent;
+                packet->userData = transport;
+                return send_packet(transport, peer, channel, packet);
+        }
+        }
+}
+
+void transport_traffic(struct transport *const transport, size_t *const sent,
+                       size_t *const received) {
+        switch (transport->backend) {
+        case TRANSPORT_BACKEND_UDP:
+                udpHost_traffic(transport->udp, sent, received);
+                break;
+        case TRANSPORT_BACKEND_ENET:
+        default:
+                *sent = transport->enet->totalSentData;
+                *received = transport->enet->totalReceivedData;
+                transport->enet->totalSentData = 0;
+                transport->enet->totalReceivedData = 0;
+                break;
+        }
+}
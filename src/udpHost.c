@@ -0,0 +1,1149 @@
+#define _GNU_SOURCE
+
+#include <udpHost.h>
+#include <timeutil.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Datagrams moved per system call
+#define UDP_BATCH 64
+// Largest datagram sent. Bigger packets are split in fragments sent reliably.
+#define UDP_MTU 1400
+// Reliable datagrams in flight per channel, as many as receivers keep out of
+// order
+#define UDP_WINDOW 256
+// Largest packet put back together from fragments
+#define UDP_PACKET_MAX (1 << 20)
+// Acknowledgements per datagram
+#define UDP_ACKS_MAX 64
+#define UDP_SOCKET_BUFFER (4 << 20)
+
+#define UDP_CONNECT_RETRY_MS 250
+#define UDP_CONNECT_TIMEOUT_MS 5000
+#define UDP_PING_MS 500
+#define UDP_TIMEOUT_MS 10000
+#define UDP_RESEND_MIN_MS 20
+#define UDP_RESEND_MAX_MS 500
+#define UDP_ROUND_TRIP_DEFAULT_MS 500
+// Timers are checked at most this often
+#define UDP_TIMER_MS 5
+
+#define UDP_PEER_NONE UINT16_MAX
+// Channel of the acknowledgements of pings
+#define UDP_CHANNEL_PING UINT8_MAX
+// Fragment followed by more of the same packet
+#define UDP_FLAG_MORE 0x1
+
+enum udpType {
+        UDP_TYPE_CONNECT,
+        UDP_TYPE_ACCEPT,
+        UDP_TYPE_DISCONNECT,
+        UDP_TYPE_RELIABLE,
+        UDP_TYPE_UNRELIABLE,
+        UDP_TYPE_ACK,
+        UDP_TYPE_PING,
+};
+
+struct __attribute__((packed)) udpHeader {
+        uint8_t type;
+        uint8_t channel;
+        uint8_t flags;
+        // index of the peer at the receiver, UDP_PEER_NONE while connecting
+        uint16_t peer;
+        uint16_t sequence;
+        uint32_t connectID;
+        // milliseconds of the sender, sent back in acknowledgements
+        uint32_t time;
+};
+
+#define UDP_PAYLOAD_MAX (UDP_MTU - sizeof(struct udpHeader))
+
+struct __attribute__((packed)) udpConnect {
+        // index of the peer at the sender
+        uint16_t peer;
+        uint32_t data;
+};
+
+struct __attribute__((packed)) udpAccept {
+        uint16_t peer;
+};
+
+struct __attribute__((packed)) udpAck {
+        uint8_t channel;
+        uint16_t sequence;
+        uint32_t time;
+};
+
+// Packet being sent, shared by the datagrams carrying it
+struct udpMessage {
+        uint8_t *data;
+        size_t size;
+        bool owned;
+        size_t refs;
+        // next free one, once sent
+        struct udpMessage *next;
+};
+
+// Reliable datagram waiting to be acknowledged
+struct udpInflight {
+        struct udpMessage *message;
+        size_t offset;
+        size_t size;
+        uint8_t channel;
+        uint8_t flags;
+        uint16_t sequence;
+        // 0 until the window lets it go
+        unsigned sends;
+        uint32_t firstSend;
+        uint32_t resendTime;
+};
+
+// Reliable datagram received ahead of a missing one
+struct udpBuffered {
+        bool present;
+        uint8_t flags;
+        size_t size;
+        uint8_t *data;
+};
+
+struct udpChannel {
+        uint16_t nextReliable;
+        uint16_t nextUnreliable;
+        // next reliable datagram to deliver, those past it are kept in the
+        // window by sequence
+        uint16_t expected;
+        struct udpBuffered *window;
+        bool receivedUnreliable;
+        uint16_t lastUnreliable;
+        // fragments of the packet being put back together
+        uint8_t *assembly;
+        size_t assemblySize;
+        size_t assemblyCapacity;
+
+        // reliable datagrams sent and not yet acknowledged, kept by sequence
+        // from the oldest one up to the next to send, empty once acknowledged
+        struct udpInflight *inflight;
+        uint16_t oldest;
+        uint16_t nextSend;
+        // and those the window holds back, in order
+        struct udpInflight *pending;
+        size_t pendingHead;
+        size_t pendingCount;
+        size_t pendingCapacity;
+};
+
+enum udpPeerState {
+        UDP_PEER_FREE,
+        UDP_PEER_CONNECTING,
+        UDP_PEER_CONNECTED,
+};
+
+struct udpPeer {
+        enum udpPeerState state;
+        struct sockaddr_in address;
+        uint32_t connectID;
+        // index of this peer at the other side
+        uint16_t remote;
+        uint32_t data;
+        struct udpChannel *channels;
+
+        struct udpAck acks[UDP_ACKS_MAX];
+        size_t ackCount;
+        bool ackListed;
+
+        uint32_t connectTime;
+        uint32_t lastSend;
+        uint32_t lastReceive;
+        bool measured;
+        uint32_t roundTripTime;
+        uint32_t roundTripTimeVariance;
+};
+
+// Datagram queued to be sent, with either part of a packet or a payload of its
+// own
+struct udpDatagram {
+        struct sockaddr_in address;
+        struct udpHeader header;
+        struct udpMessage *message;
+        size_t offset;
+        size_t size;
+        uint8_t control[UDP_ACKS_MAX * sizeof(struct udpAck)];
+};
+
+struct udpEvent {
+        struct transportEvent event;
+        // payload to free once the event is handled
+        uint8_t *owned;
+};
+
+struct udpHost {
+        int socket;
+        bool listening;
+        size_t channelCount;
+        void (*release)(void *data);
+        struct timespec epoch;
+        uint32_t lastTimers;
+        uint32_t nextConnectID;
+
+        struct udpPeer *peers;
+        size_t peerCount;
+        uint16_t *freePeers;
+        size_t freeCount;
+        // peers with acknowledgements to send, each listed once
+        uint16_t *ackPeers;
+        size_t ackPeerCount;
+
+        struct udpDatagram *queue;
+        size_t queueCount;
+        size_t queueCapacity;
+
+        struct udpEvent *events;
+        size_t eventsHead;
+        size_t eventsCount;
+        size_t eventsCapacity;
+        uint8_t *handled;
+
+        // messages sent and done with, taken again rather than allocated so
+        // that sending pooled packets allocates nothing once warmed up
+        struct udpMessage *freeMessages;
+
+        uint8_t (*buffers)[UDP_MTU];
+        struct sockaddr_in from[UDP_BATCH];
+        struct iovec iov[UDP_BATCH];
+        struct mmsghdr msgs[UDP_BATCH];
+
+        size_t sent;
+        size_t received;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void *allocate(const size_t count, const size_t size) {
+        void *ptr = calloc(count, size);
+        if (ptr == NULL) {
+                fprintf(stderr, "could not allocate memory\n");
+                exit(EXIT_FAILURE);
+        }
+        return ptr;
+}
+
+// Make room for one more element at the end of an array
+static void *reserve(void *const array, const size_t count, size_t *const capacity,
+                     const size_t size) {
+        if (count < *capacity) {
+                return array;
+        }
+        *capacity = *capacity == 0 ? 16 : *capacity * 2;
+        void *grown = realloc(array, *capacity * size);
+        if (grown == NULL) {
+                fprintf(stderr, "could not allocate memory\n");
+                exit(EXIT_FAILURE);
+        }
+        return grown;
+}
+
+static uint32_t host_now(const struct udpHost *const host) {
+        return (uint32_t)(monotonic_difference(monotonic(), host->epoch) / 1000000);
+}
+
+static bool address_equal(const struct sockaddr_in *const a, const struct sockaddr_in *const b) {
+        return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+static ENetAddress address_to_enet(const struct sockaddr_in *const address) {
+        ENetAddress result;
+        result.host = address->sin_addr.s_addr;
+        result.port = ntohs(address->sin_port);
+        return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static struct udpMessage *message_create(struct udpHost *const host, void *const data,
+                                         const size_t size, const bool owned) {
+        struct udpMessage *message = host->freeMessages;
+        if (message != NULL) {
+                host->freeMessages = message->next;
+        } else {
+                message = allocate(1, sizeof(*message));
+        }
+        message->data = data;
+        message->size = size;
+        message->owned = owned;
+        message->refs = 1;
+        return message;
+}
+
+static void message_unref(struct udpHost *const host, struct udpMessage *const message) {
+        if (--message->refs > 0) {
+                return;
+        }
+        if (message->owned) {
+                host->release(message->data);
+        } else {
+                free(message->data);
+        }
+        message->next = host->freeMessages;
+        host->freeMessages = message;
+}
+
+static struct udpDatagram *queue_datagram(struct udpHost *const host, struct udpPeer *const peer,
+                                          const enum udpType type, const uint32_t now) {
+        host->queue = reserve(host->queue, host->queueCount, &host->queueCapacity,
+                              sizeof(*host->queue));
+        struct udpDatagram *datagram = &host->queue[host->queueCount++];
+        datagram->address = peer->address;
+        datagram->header.type = (uint8_t)type;
+        datagram->header.channel = 0;
+        datagram->header.flags = 0;
+        datagram->header.peer = peer->remote;
+        datagram->header.sequence = 0;
+        datagram->header.connectID = peer->connectID;
+        datagram->header.time = now;
+        datagram->message = NULL;
+        datagram->offset = 0;
+        datagram->size = 0;
+        peer->lastSend = now;
+        return datagram;
+}
+
+static void queue_control(struct udpHost *const host, struct udpPeer *const peer,
+                          const enum udpType type, const void *const payload, const size_t size,
+                          const uint32_t now) {
+        struct udpDatagram *datagram = queue_datagram(host, peer, type, now);
+        memcpy(datagram->control, payload, size);
+        datagram->size = size;
+}
+
+static void queue_acks(struct udpHost *const host, struct udpPeer *const peer, const uint32_t now) {
+        if (peer->ackCount == 0) {
+                return;
+        }
+        queue_control(host, peer, UDP_TYPE_ACK, peer->acks, peer->ackCount * sizeof(*peer->acks), now);
+        peer->ackCount = 0;
+}
+
+static void push_event(struct udpHost *const host, const struct udpPeer *const peer,
+                       const enum transportEventType type, const uint8_t *const payload,
+                       const size_t size, uint8_t *const owned) {
+        host->events = reserve(host->events, host->eventsCount, &host->eventsCapacity,
+                               sizeof(*host->events));
+        struct udpEvent *e = &host->events[host->eventsCount++];
+        memset(&e->event, 0, sizeof(e->event));
+        e->event.type = type;
+        e->event.peer.idx = (size_t)(peer - host->peers);
+        e->event.peer.connectID = peer->connectID;
+        e->event.roundTripTime = peer->roundTripTime;
+        e->event.roundTripTimeVariance = peer->roundTripTimeVariance;
+        e->event.address = address_to_enet(&peer->address);
+        e->event.data = peer->data;
+        e->event.payload = payload;
+        e->event.size = size;
+        e->owned = owned;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static struct udpPeer *peer_take(struct udpHost *const host, const uint32_t now) {
+        if (host->freeCount == 0) {
+                return NULL;
+        }
+        struct udpPeer *peer = &host->peers[host->freePeers[--host->freeCount]];
+        peer->remote = UDP_PEER_NONE;
+        peer->data = 0;
+        peer->ackCount = 0;
+        peer->connectTime = now;
+        peer->lastSend = now;
+        peer->lastReceive = now;
+        peer->measured = false;
+        peer->roundTripTime = UDP_ROUND_TRIP_DEFAULT_MS;
+        peer->roundTripTimeVariance = 0;
+        for (size_t c=0; c<host->channelCount; c++) {
+                struct udpChannel *channel = &peer->channels[c];
+                channel->nextReliable = 0;
+                channel->oldest = 0;
+                channel->nextSend = 0;
+                channel->nextUnreliable = 0;
+                channel->expected = 0;
+                channel->receivedUnreliable = false;
+                channel->assemblySize = 0;
+        }
+        return peer;
+}
+
+// Forget everything about a peer and give back its index
+static void peer_free(struct udpHost *const host, struct udpPeer *const peer) {
+        for (size_t c=0; c<host->channelCount; c++) {
+                struct udpChannel *channel = &peer->channels[c];
+                for (uint16_t s=channel->oldest; s!=channel->nextSend; s++) {
+                        struct udpInflight *entry = &channel->inflight[s % UDP_WINDOW];
+                        if (entry->message != NULL) {
+                                message_unref(host, entry->message);
+                                entry->message = NULL;
+                        }
+                }
+                channel->oldest = channel->nextSend;
+                for (size_t i=channel->pendingHead; i<channel->pendingCount; i++) {
+                        message_unref(host, channel->pending[i].message);
+                }
+                channel->pendingHead = 0;
+                channel->pendingCount = 0;
+                if (channel->window != NULL) {
+                        for (size_t w=0; w<UDP_WINDOW; w++) {
+                                free(channel->window[w].data);
+                        }
+                        free(channel->window);
+                        channel->window = NULL;
+                }
+                free(channel->assembly);
+                channel->assembly = NULL;
+                channel->assemblySize = 0;
+                channel->assemblyCapacity = 0;
+        }
+        peer->ackCount = 0;
+        peer->state = UDP_PEER_FREE;
+        host->freePeers[host->freeCount++] = (uint16_t)(peer - host->peers);
+}
+
+static void peer_timeout(struct udpHost *const host, struct udpPeer *const peer) {
+        push_event(host, peer, TRANSPORT_EVENT_DISCONNECT, NULL, 0, NULL);
+        peer_free(host, peer);
+}
+
+// Peer of an index and connection, if still connected
+static struct udpPeer *peer_get(struct udpHost *const host, const struct transportPeer handle) {
+        if (handle.idx >= host->peerCount) {
+                return NULL;
+        }
+        struct udpPeer *peer = &host->peers[handle.idx];
+        if (peer->state == UDP_PEER_FREE || peer->connectID != handle.connectID) {
+                return NULL;
+        }
+        return peer;
+}
+
+static void peer_measure(struct udpPeer *const peer, const uint32_t sample) {
+        if (!peer->measured) {
+                peer->measured = true;
+                peer->roundTripTime = sample;
+                peer->roundTripTimeVariance = sample / 2;
+                return;
+        }
+        const uint32_t difference = sample > peer->roundTripTime ?
+                sample - peer->roundTripTime : peer->roundTripTime - sample;
+        peer->roundTripTimeVariance = peer->roundTripTimeVariance - peer->roundTripTimeVariance / 4 +
+                difference / 4;
+        peer->roundTripTime = peer->roundTripTime - peer->roundTripTime / 8 + sample / 8;
+}
+
+static void peer_ack(struct udpHost *const host, struct udpPeer *const peer, const uint8_t channel,
+                     const uint16_t sequence, const uint32_t time, const uint32_t now) {
+        if (peer->ackCount == UDP_ACKS_MAX) {
+                queue_acks(host, peer, now);
+        }
+        struct udpAck *ack = &peer->acks[peer->ackCount++];
+        ack->channel = channel;
+        ack->sequence = sequence;
+        ack->time = time;
+        if (!peer->ackListed) {
+                peer->ackListed = true;
+                host->ackPeers[host->ackPeerCount++] = (uint16_t)(peer - host->peers);
+        }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void inflight_transmit(struct udpHost *const host, struct udpPeer *const peer,
+                              struct udpInflight *const entry, const uint32_t now) {
+        struct udpDatagram *datagram = queue_datagram(host, peer, UDP_TYPE_RELIABLE, now);
+        datagram->header.channel = entry->channel;
+        datagram->header.flags = entry->flags;
+        datagram->header.sequence = entry->sequence;
+        datagram->message = entry->message;
+        datagram->offset = entry->offset;
+        datagram->size = entry->size;
+        entry->message->refs++;
+        if (entry->sends == 0) {
+                entry->firstSend = now;
+        }
+
+        // back off exponentially while nothing comes back
+        uint32_t timeout = peer->roundTripTime + 4 * peer->roundTripTimeVariance;
+        if (timeout < UDP_RESEND_MIN_MS) {
+                timeout = UDP_RESEND_MIN_MS;
+        }
+        timeout <<= entry->sends < 4 ? entry->sends : 4;
+        if (timeout > UDP_RESEND_MAX_MS) {
+                timeout = UDP_RESEND_MAX_MS;
+        }
+        entry->sends++;
+        entry->resendTime = now + timeout;
+}
+
+// Room for one more reliable datagram held back by the window of a channel.
+// Those left are moved to the front once at least half of the array was sent.
+static struct udpInflight *inflight_hold(struct udpChannel *const channel) {
+        if (channel->pendingCount == channel->pendingCapacity && channel->pendingHead > 0 &&
+            channel->pendingHead >= channel->pendingCount / 2) {
+                channel->pendingCount -= channel->pendingHead;
+                memmove(channel->pending, channel->pending + channel->pendingHead,
+                        channel->pendingCount * sizeof(*channel->pending));
+                channel->pendingHead = 0;
+        }
+        channel->pending = reserve(channel->pending, channel->pendingCount,
+                                   &channel->pendingCapacity, sizeof(*channel->pending));
+        return &channel->pending[channel->pendingCount++];
+}
+
+// Send what the window of a channel lets go of those held back, the window
+// starting at the oldest datagram not yet acknowledged
+static void inflight_advance(struct udpHost *const host, struct udpPeer *const peer,
+                             struct udpChannel *const channel, const uint32_t now) {
+        while (channel->pendingHead < channel->pendingCount &&
+               (uint16_t)(channel->nextSend - channel->oldest) < UDP_WINDOW) {
+                if (channel->inflight == NULL) {
+                        channel->inflight = allocate(UDP_WINDOW, sizeof(*channel->inflight));
+                }
+                struct udpInflight *entry = &channel->inflight[channel->nextSend++ % UDP_WINDOW];
+                *entry = channel->pending[channel->pendingHead++];
+                inflight_transmit(host, peer, entry, now);
+        }
+        if (channel->pendingHead == channel->pendingCount) {
+                channel->pendingHead = 0;
+                channel->pendingCount = 0;
+        }
+}
+
+static void inflight_acked(struct udpHost *const host, struct udpPeer *const peer,
+                           const struct udpAck *const ack, const uint32_t now) {
+        peer_measure(peer, now - ack->time);
+        // pings included
+        if (ack->channel >= host->channelCount) {
+                return;
+        }
+        struct udpChannel *channel = &peer->channels[ack->channel];
+        if ((uint16_t)(ack->sequence - channel->oldest) >=
+            (uint16_t)(channel->nextSend - channel->oldest)) {
+                return;
+        }
+        struct udpInflight *entry = &channel->inflight[ack->sequence % UDP_WINDOW];
+        if (entry->message == NULL) {
+                return;
+        }
+        message_unref(host, entry->message);
+        entry->message = NULL;
+        while (channel->oldest != channel->nextSend &&
+               channel->inflight[channel->oldest % UDP_WINDOW].message == NULL) {
+                channel->oldest++;
+        }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Hand a reliable datagram over in order, putting fragments back together. A
+// copy of the payload made to keep it is taken over.
+static bool deliver_reliable(struct udpHost *const host, struct udpPeer *const peer,
+                             const uint8_t c, const uint8_t *const payload, const size_t size,
+                             const uint8_t flags, uint8_t *const copy) {
+        struct udpChannel *channel = &peer->channels[c];
+        if (channel->assembly == NULL && !(flags & UDP_FLAG_MORE)) {
+                push_event(host, peer, TRANSPORT_EVENT_RECEIVE, payload, size, copy);
+                host->events[host->eventsCount - 1].event.channel = c;
+                return true;
+        }
+
+        if (channel->assemblySize + size > UDP_PACKET_MAX) {
+                free(copy);
+                return false;
+        }
+        if (channel->assemblySize + size > channel->assemblyCapacity) {
+                size_t capacity = channel->assemblyCapacity == 0 ? UDP_MTU : channel->assemblyCapacity;
+                while (capacity < channel->assemblySize + size) {
+                        capacity *= 2;
+                }
+                uint8_t *assembly = realloc(channel->assembly, capacity);
+                if (assembly == NULL) {
+                        fprintf(stderr, "could not allocate memory\n");
+                        exit(EXIT_FAILURE);
+                }
+                channel->assembly = assembly;
+                channel->assemblyCapacity = capacity;
+        }
+        memcpy(channel->assembly + channel->assemblySize, payload, size);
+        channel->assemblySize += size;
+        free(copy);
+
+        if (!(flags & UDP_FLAG_MORE)) {
+                push_event(host, peer, TRANSPORT_EVENT_RECEIVE, channel->assembly,
+                           channel->assemblySize, channel->assembly);
+                host->events[host->eventsCount - 1].event.channel = c;
+                channel->assembly = NULL;
+                channel->assemblySize = 0;
+                channel->assemblyCapacity = 0;
+        }
+        return true;
+}
+
+static void onReliable(struct udpHost *const host, struct udpPeer *const peer,
+                       const struct udpHeader *const header, const uint8_t *const payload,
+                       const size_t size, const uint32_t now) {
+        struct udpChannel *channel = &peer->channels[header->channel];
+        const uint16_t distance = (uint16_t)(header->sequence - channel->expected);
+        if (distance >= UDP_WINDOW && distance < UINT16_MAX / 2) {
+                // too far ahead to keep, it comes again
+                return;
+        }
+        peer_ack(host, peer, header->channel, header->sequence, header->time, now);
+        if (distance >= UDP_WINDOW) {
+                // already delivered
+                return;
+        }
+
+        if (distance > 0) {
+                if (channel->window == NULL) {
+                        channel->window = allocate(UDP_WINDOW, sizeof(*channel->window));
+                }
+                struct udpBuffered *buffered = &channel->window[header->sequence % UDP_WINDOW];
+                if (!buffered->present) {
+                        buffered->present = true;
+                        buffered->flags = header->flags;
+                        buffered->size = size;
+                        buffered->data = malloc(size > 0 ? size : 1);
+                        if (buffered->data == NULL) {
+                                fprintf(stderr, "could not allocate memory\n");
+                                exit(EXIT_FAILURE);
+                        }
+                        memcpy(buffered->data, payload, size);
+                }
+                return;
+        }
+
+        bool ok = deliver_reliable(host, peer, header->channel, payload, size, header->flags, NULL);
+        channel->expected++;
+        while (ok && channel->window != NULL) {
+                struct udpBuffered *buffered = &channel->window[channel->expected % UDP_WINDOW];
+                if (!buffered->present) {
+                        break;
+                }
+                buffered->present = false;
+                ok = deliver_reliable(host, peer, header->channel, buffered->data, buffered->size,
+                                      buffered->flags, buffered->data);
+                buffered->data = NULL;
+                channel->expected++;
+        }
+        if (!ok) {
+                fprintf(stderr, "dropping peer sending a packet over %d bytes\n", UDP_PACKET_MAX);
+                peer_timeout(host, peer);
+        }
+}
+
+static void onUnreliable(struct udpHost *const host, struct udpPeer *const peer,
+                         const struct udpHeader *const header, const uint8_t *const payload,
+                         const size_t size) {
+        struct udpChannel *channel = &peer->channels[header->channel];
+        if (channel->receivedUnreliable &&
+            (int16_t)(header->sequence - channel->lastUnreliable) <= 0) {
+                return;
+        }
+        channel->receivedUnreliable = true;
+        channel->lastUnreliable = header->sequence;
+        push_event(host, peer, TRANSPORT_EVENT_RECEIVE, payload, size, NULL);
+        host->events[host->eventsCount - 1].event.channel = header->channel;
+}
+
+static void onConnect(struct udpHost *const host, const struct sockaddr_in *const from,
+                      const struct udpHeader *const header, const uint8_t *const payload,
+                      const size_t size, const uint32_t now) {
+        struct udpConnect connect;
+        if (!host->listening || size < sizeof(connect)) {
+                return;
+        }
+        memcpy(&connect, payload, sizeof(connect));
+
+        // the accept may have been lost
+        struct udpPeer *peer = NULL;
+        for (size_t i=0; i<host->peerCount && peer == NULL; i++) {
+                struct udpPeer *other = &host->peers[i];
+                if (other->state != UDP_PEER_FREE && other->connectID == header->connectID &&
+                    address_equal(&other->address, from)) {
+                        peer = other;
+                }
+        }
+        if (peer == NULL) {
+                peer = peer_take(host, now);
+                if (peer == NULL) {
+                        return;
+                }
+                peer->state = UDP_PEER_CONNECTED;
+                peer->address = *from;
+                peer->connectID = header->connectID;
+                peer->remote = connect.peer;
+                peer->data = connect.data;
+                push_event(host, peer, TRANSPORT_EVENT_CONNECT, NULL, 0, NULL);
+        }
+
+        struct udpAccept accept;
+        accept.peer = (uint16_t)(peer - host->peers);
+        queue_control(host, peer, UDP_TYPE_ACCEPT, &accept, sizeof(accept), now);
+}
+
+static void onDatagram(struct udpHost *const host, const struct sockaddr_in *const from,
+                       const uint8_t *const data, const size_t size, const uint32_t now) {
+        struct udpHeader header;
+        if (size < sizeof(header)) {
+                return;
+        }
+        memcpy(&header, data, sizeof(header));
+        const uint8_t *payload = data + sizeof(header);
+        const size_t payloadSize = size - sizeof(header);
+
+        if (header.type == UDP_TYPE_CONNECT) {
+                onConnect(host, from, &header, payload, payloadSize, now);
+                return;
+        }
+        if (header.peer >= host->peerCount) {
+                return;
+        }
+        struct udpPeer *peer = &host->peers[header.peer];
+        if (peer->state == UDP_PEER_FREE || peer->connectID != header.connectID ||
+            !address_equal(&peer->address, from)) {
+                return;
+        }
+        peer->lastReceive = now;
+
+        if (peer->state == UDP_PEER_CONNECTING) {
+                struct udpAccept accept;
+                if (header.type != UDP_TYPE_ACCEPT || payloadSize < sizeof(accept)) {
+                        return;
+                }
+                memcpy(&accept, payload, sizeof(accept));
+                peer->remote = accept.peer;
+                peer->state = UDP_PEER_CONNECTED;
+                peer_measure(peer, now - peer->connectTime);
+                push_event(host, peer, TRANSPORT_EVENT_CONNECT, NULL, 0, NULL);
+                return;
+        }
+
+        switch ((enum udpType)header.type) {
+        case UDP_TYPE_DISCONNECT:
+                peer_timeout(host, peer);
+                break;
+        case UDP_TYPE_RELIABLE:
+                if (header.channel < host->channelCount) {
+                        onReliable(host, peer, &header, payload, payloadSize, now);
+                }
+                break;
+        case UDP_TYPE_UNRELIABLE:
+                if (header.channel < host->channelCount) {
+                        onUnreliable(host, peer, &header, payload, payloadSize);
+                }
+                break;
+        case UDP_TYPE_ACK:
+                for (size_t i=0; i+sizeof(struct udpAck)<=payloadSize; i+=sizeof(struct udpAck)) {
+                        struct udpAck ack;
+                        memcpy(&ack, payload + i, sizeof(ack));
+                        inflight_acked(host, peer, &ack, now);
+                }
+                for (size_t c=0; c<host->channelCount; c++) {
+                        inflight_advance(host, peer, &peer->channels[c], now);
+                }
+                break;
+        case UDP_TYPE_PING:
+                peer_ack(host, peer, UDP_CHANNEL_PING, header.sequence, header.time, now);
+                break;
+        case UDP_TYPE_CONNECT:
+        case UDP_TYPE_ACCEPT:
+        default:
+                break;
+        }
+}
+
+// Receive batches until something happened or there is nothing left
+static int receive(struct udpHost *const host, const uint32_t now) {
+        for (;;) {
+                for (size_t i=0; i<UDP_BATCH; i++) {
+                        host->iov[i].iov_base = host->buffers[i];
+                        host->iov[i].iov_len = UDP_MTU;
+                        memset(&host->msgs[i].msg_hdr, 0, sizeof(host->msgs[i].msg_hdr));
+                        host->msgs[i].msg_hdr.msg_name = &host->from[i];
+                        host->msgs[i].msg_hdr.msg_namelen = sizeof(host->from[i]);
+                        host->msgs[i].msg_hdr.msg_iov = &host->iov[i];
+                        host->msgs[i].msg_hdr.msg_iovlen = 1;
+                }
+                const int r = recvmmsg(host->socket, host->msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+                if (r < 0) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+                            errno == ECONNREFUSED) {
+                                return 0;
+                        }
+                        perror("recvmmsg");
+                        return -1;
+                }
+
+                for (int i=0; i<r; i++) {
+                        host->received += host->msgs[i].msg_len;
+                        if (host->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                                continue;
+                        }
+                        onDatagram(host, &host->from[i], host->buffers[i], host->msgs[i].msg_len, now);
+                }
+                // payloads point into the buffers until handled
+                if (r < UDP_BATCH || host->eventsCount > 0) {
+                        return 0;
+                }
+        }
+}
+
+static void timers(struct udpHost *const host, const uint32_t now) {
+        for (size_t i=0; i<host->peerCount; i++) {
+                struct udpPeer *peer = &host->peers[i];
+                switch (peer->state) {
+                case UDP_PEER_CONNECTING:
+                        if (now - peer->connectTime >= UDP_CONNECT_TIMEOUT_MS) {
+                                peer_timeout(host, peer);
+                        } else if (now - peer->lastSend >= UDP_CONNECT_RETRY_MS) {
+                                struct udpConnect connect;
+                                connect.peer = (uint16_t)i;
+                                connect.data = peer->data;
+                                queue_control(host, peer, UDP_TYPE_CONNECT, &connect, sizeof(connect), now);
+                        }
+                        break;
+                case UDP_PEER_CONNECTED: {
+                        if (now - peer->lastReceive >= UDP_TIMEOUT_MS) {
+                                peer_timeout(host, peer);
+                                break;
+                        }
+                        bool lost = false;
+                        for (size_t c=0; c<host->channelCount && !lost; c++) {
+                                struct udpChannel *channel = &peer->channels[c];
+                                for (uint16_t s=channel->oldest; s!=channel->nextSend && !lost; s++) {
+                                        struct udpInflight *entry = &channel->inflight[s % UDP_WINDOW];
+                                        if (entry->message == NULL ||
+                                            (int32_t)(now - entry->resendTime) < 0) {
+                                                continue;
+                                        }
+                                        if (now - entry->firstSend >= UDP_TIMEOUT_MS) {
+                                                lost = true;
+                                        } else {
+                                                inflight_transmit(host, peer, entry, now);
+                                        }
+                                }
+                        }
+                        if (lost) {
+                                peer_timeout(host, peer);
+                                break;
+                        }
+                        if (now - peer->lastSend >= UDP_PING_MS) {
+                                queue_datagram(host, peer, UDP_TYPE_PING, now);
+                        }
+                        break;
+                }
+                case UDP_PEER_FREE:
+                default:
+                        break;
+                }
+        }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct udpHost *udpHost_create(const ENetAddress *const address, const size_t peerCount,
+                               const size_t channels, void (*const release)(void *data)) {
+        if (peerCount >= UDP_PEER_NONE || channels >= UDP_CHANNEL_PING) {
+                return NULL;
+        }
+
+        const int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+                perror("socket");
+                return NULL;
+        }
+        const int buffer = UDP_SOCKET_BUFFER;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+        if (address != NULL) {
+                struct sockaddr_in local;
+                memset(&local, 0, sizeof(local));
+                local.sin_family = AF_INET;
+                local.sin_addr.s_addr = address->host;
+                local.sin_port = htons(address->port);
+                if (bind(fd, (const struct sockaddr*)&local, sizeof(local)) < 0) {
+                        perror("bind");
+                        close(fd);
+                        return NULL;
+                }
+        }
+
+        struct udpHost *host = allocate(1, sizeof(*host));
+        host->socket = fd;
+        host->listening = address != NULL;
+        host->channelCount = channels;
+        host->release = release;
+        host->epoch = monotonic();
+        host->nextConnectID = (uint32_t)host->epoch.tv_nsec ^ (uint32_t)fd ^ 0x9e3779b9U;
+
+        host->peerCount = peerCount;
+        host->peers = allocate(peerCount, sizeof(*host->peers));
+        host->freePeers = allocate(peerCount, sizeof(*host->freePeers));
+        host->ackPeers = allocate(peerCount, sizeof(*host->ackPeers));
+        for (size_t i=0; i<peerCount; i++) {
+                host->peers[i].state = UDP_PEER_FREE;
+                host->peers[i].channels = allocate(channels, sizeof(*host->peers[i].channels));
+                // lowest indices first
+                host->freePeers[i] = (uint16_t)(peerCount - 1 - i);
+        }
+        host->freeCount = peerCount;
+
+        host->buffers = allocate(UDP_BATCH, sizeof(*host->buffers));
+        return host;
+}
+
+void udpHost_destroy(struct udpHost *const host) {
+        const uint32_t now = host_now(host);
+        for (size_t i=0; i<host->peerCount; i++) {
+                struct udpPeer *peer = &host->peers[i];
+                if (peer->state == UDP_PEER_CONNECTED) {
+                        queue_datagram(host, peer, UDP_TYPE_DISCONNECT, now);
+                }
+        }
+        udpHost_flush(host);
+        for (size_t i=0; i<host->peerCount; i++) {
+                struct udpPeer *peer = &host->peers[i];
+                if (peer->state != UDP_PEER_FREE) {
+                        peer_free(host, peer);
+                }
+                for (size_t c=0; c<host->channelCount; c++) {
+                        free(peer->channels[c].inflight);
+                        free(peer->channels[c].pending);
+                }
+                free(peer->channels);
+        }
+        for (size_t i=host->eventsHead; i<host->eventsCount; i++) {
+                free(host->events[i].owned);
+        }
+        free(host->handled);
+        while (host->freeMessages != NULL) {
+                struct udpMessage *next = host->freeMessages->next;
+                free(host->freeMessages);
+                host->freeMessages = next;
+        }
+        close(host->socket);
+        free(host->peers);
+        free(host->freePeers);
+        free(host->ackPeers);
+        free(host->queue);
+        free(host->events);
+        free(host->buffers);
+        free(host);
+}
+
+int udpHost_socket(const struct udpHost *const host) {
+        return host->socket;
+}
+
+int udpHost_service(struct udpHost *const host, struct transportEvent *const event) {
+        free(host->handled);
+        host->handled = NULL;
+
+        if (host->eventsHead == host->eventsCount) {
+                host->eventsHead = 0;
+                host->eventsCount = 0;
+
+                udpHost_flush(host);
+                const uint32_t now = host_now(host);
+                if (receive(host, now) < 0) {
+                        return -1;
+                }
+                if (now - host->lastTimers >= UDP_TIMER_MS) {
+                        host->lastTimers = now;
+                        timers(host, now);
+                }
+                // acknowledgements and resends go right away
+                udpHost_flush(host);
+        }
+
+        if (host->eventsHead == host->eventsCount) {
+                return 0;
+        }
+        const struct udpEvent *e = &host->events[host->eventsHead++];
+        *event = e->event;
+        host->handled = e->owned;
+        return 1;
+}
+
+void udpHost_flush(struct udpHost *const host) {
+        const uint32_t now = host_now(host);
+        for (size_t i=0; i<host->ackPeerCount; i++) {
+                struct udpPeer *peer = &host->peers[host->ackPeers[i]];
+                peer->ackListed = false;
+                if (peer->state == UDP_PEER_CONNECTED) {
+                        queue_acks(host, peer, now);
+                }
+        }
+        host->ackPeerCount = 0;
+
+        struct iovec iov[UDP_BATCH][2];
+        struct mmsghdr msgs[UDP_BATCH];
+        size_t done = 0;
+        while (done < host->queueCount) {
+                size_t count = host->queueCount - done;
+                if (count > UDP_BATCH) {
+                        count = UDP_BATCH;
+                }
+                for (size_t i=0; i<count; i++) {
+                        struct udpDatagram *datagram = &host->queue[done + i];
+                        iov[i][0].iov_base = &datagram->header;
+                        iov[i][0].iov_len = sizeof(datagram->header);
+                        iov[i][1].iov_base = datagram->message != NULL ?
+                                datagram->message->data + datagram->offset : datagram->control;
+                        iov[i][1].iov_len = datagram->size;
+                        memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+                        msgs[i].msg_hdr.msg_name = &datagram->address;
+                        msgs[i].msg_hdr.msg_namelen = sizeof(datagram->address);
+                        msgs[i].msg_hdr.msg_iov = iov[i];
+                        msgs[i].msg_hdr.msg_iovlen = 2;
+                }
+
+                const int r = sendmmsg(host->socket, msgs, (unsigned)count, 0);
+                if (r < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                                // what is reliable goes again later
+                                break;
+                        }
+                        // this one cannot be sent, the next ones may
+                        done++;
+                        continue;
+                }
+                for (int i=0; i<r; i++) {
+                        host->sent += msgs[i].msg_len;
+                }
+                done += (size_t)r;
+        }
+
+        for (size_t i=0; i<host->queueCount; i++) {
+                if (host->queue[i].message != NULL) {
+                        message_unref(host, host->queue[i].message);
+                }
+        }
+        host->queueCount = 0;
+}
+
+bool udpHost_connect(struct udpHost *const host, const ENetAddress *const address,
+                     const uint32_t data, struct transportPeer *const handle) {
+        const uint32_t now = host_now(host);
+        struct udpPeer *peer = peer_take(host, now);
+        if (peer == NULL) {
+                return false;
+        }
+
+        // xorshift32, never 0
+        uint32_t id = host->nextConnectID;
+        id ^= id << 13;
+        id ^= id >> 17;
+        id ^= id << 5;
+        host->nextConnectID = id;
+
+        peer->state = UDP_PEER_CONNECTING;
+        memset(&peer->address, 0, sizeof(peer->address));
+        peer->address.sin_family = AF_INET;
+        peer->address.sin_addr.s_addr = address->host;
+        peer->address.sin_port = htons(address->port);
+        peer->connectID = id;
+        peer->data = data;
+
+        struct udpConnect connect;
+        connect.peer = (uint16_t)(peer - host->peers);
+        connect.data = data;
+        queue_control(host, peer, UDP_TYPE_CONNECT, &connect, sizeof(connect), now);
+
+        handle->idx = connect.peer;
+        handle->connectID = id;
+        return true;
+}
+
+void udpHost_disconnect(struct udpHost *const host, const struct transportPeer handle) {
+        struct udpPeer *peer = peer_get(host, handle);
+        if (peer == NULL) {
+                return;
+        }
+        if (peer->state == UDP_PEER_CONNECTED) {
+                queue_datagram(host, peer, UDP_TYPE_DISCONNECT, host_now(host));
+        }
+        peer_free(host, peer);
+}
+
+static bool send_message(struct udpHost *const host, const struct transportPeer handle,
+                         const uint8_t c, struct udpMessage *const message, const uint32_t flags) {
+        struct udpPeer *peer = peer_get(host, handle);
+        if (peer == NULL || peer->state != UDP_PEER_CONNECTED || c >= host->channelCount) {
+                message_unref(host, message);
+                return false;
+        }
+        struct udpChannel *channel = &peer->channels[c];
+        const uint32_t now = host_now(host);
+
+        if (!(flags & ENET_PACKET_FLAG_RELIABLE) && message->size <= UDP_PAYLOAD_MAX) {
+                struct udpDatagram *datagram = queue_datagram(host, peer, UDP_TYPE_UNRELIABLE, now);
+                datagram->header.channel = c;
+                datagram->header.sequence = channel->nextUnreliable++;
+                datagram->message = message;
+                datagram->size = message->size;
+                return true;
+        }
+
+        size_t offset = 0;
+        do {
+                size_t size = message->size - offset;
+                if (size > UDP_PAYLOAD_MAX) {
+                        size = UDP_PAYLOAD_MAX;
+                }
+                struct udpInflight *entry = inflight_hold(channel);
+                entry->message = message;
+                entry->offset = offset;
+                entry->size = size;
+                entry->channel = c;
+                entry->flags = offset + size < message->size ? UDP_FLAG_MORE : 0;
+                entry->sequence = channel->nextReliable++;
+                entry->sends = 0;
+                entry->resendTime = now;
+                message->refs++;
+                offset += size;
+        } while (offset < message->size);
+        message_unref(host, message);
+
+        inflight_advance(host, peer, channel, now);
+        return true;
+}
+
+bool udpHost_send(struct udpHost *const host, const struct transportPeer peer, const uint8_t channel,
+                  const void *const data, const size_t size, const uint32_t flags) {
+        uint8_t *copy = malloc(size > 0 ? size : 1);
+        if (copy == NULL) {
+                fprintf(stderr, "could not allocate memory\n");
+                exit(EXIT_FAILURE);
+        }
+        memcpy(copy, data, size);
+        return send_message(host, peer, channel, message_create(host, copy, size, false), flags);
+}
+
+bool udpHost_sendOwned(struct udpHost *const host, const struct transportPeer peer,
+                       const uint8_t channel, void *const data, const size_t size,
+                       const uint32_t flags) {
+        return send_message(host, peer, channel, message_create(host, data, size, true), flags);
+}
+
+void udpHost_traffic(struct udpHost *const host, size_t *const sent, size_t *const received) {
+        *sent = host->sent;
+        *received = host->received;
+        host->sent = 0;
+        host->received = 0;
+}
@@ -15,6 +15,9 @@
 #define UI_LOADING_STATUS_WINDOW_WIDTH 400.0f
 #define UI_LOADING_STATUS_WINDOW_HEIGHT 90.0f
 
+#define UI_JOINING_STATUS_WINDOW_WIDTH 250.0f
+#define UI_JOINING_STATUS_WINDOW_HEIGHT 60.0f
+
 static void updateFps(struct uiControllerStatusData *data, float delta) {
         data->fpsChanged = false;
         data->deltas += delta;
@@ -231,6 +234,27 @@ static void updateUI_serverSelectWidget(struct game *game, struct nk_context *ct
         }
 }
 
+static void updateUI_joiningWidget(struct uiControllerStatusData *data, struct nk_context *ctx,
+                                  int width, int height) {
+        struct nk_rect bounds = nk_rect(
+                (float)width/2-UI_JOINING_STATUS_WINDOW_WIDTH/2,
+                (float)height-UI_JOINING_STATUS_WINDOW_HEIGHT*2,
+                UI_JOINING_STATUS_WINDOW_WIDTH,
+                UI_JOINING_STATUS_WINDOW_HEIGHT);
+
+        if (nk_begin(ctx, "joiningWindow", bounds, NK_WINDOW_NO_SCROLLBAR | NK_WINDOW_NO_INPUT)) {
+                nk_layout_row_begin(ctx, NK_DYNAMIC, 0, 1);
+                nk_layout_row_push(ctx, 1.0f);
+                nk_label(ctx, "Receiving world...", NK_TEXT_CENTERED);
+
+                nk_layout_row_begin(ctx, NK_DYNAMIC, 0, 1);
+                nk_layout_row_push(ctx, 1.0f);
+                nk_progress(ctx, &data->joinProgressCurrent,
+                            data->joinProgressTotal, NK_FIXED);
+        }
+        nk_end(ctx);
+}
+
 static void updateUI_statusWidget(struct uiControllerStatusData *data, struct nk_context *ctx, struct game *game) {
 
         if (nk_begin(ctx, "status", nk_rect(0, 0, UI_STATUS_WINDOW_WIDTH, UI_STATUS_WINDOW_HEIGHT), NK_WINDOW_NO_SCROLLBAR | NK_WINDOW_BACKGROUND | NK_WINDOW_NO_INPUT)) {
@@ -303,6 +327,10 @@ static void updateUI(void *registerArgs, void *fireArgs) {
         if (controller->game->inScene) {
                 updateUI_statusWidget(&controller->statusWidgetData, args->ctx,
                                       controller->game);
+                if (controller->statusWidgetData.joining) {
+                        updateUI_joiningWidget(&controller->statusWidgetData, args->ctx,
+                                               args->winWidth, args->winHeight);
+                }
         } else {
                 updateUI_serverSelectWidget(
                         controller->game, args->ctx, args->winWidth, args->winHeight,
@@ -334,7 +362,12 @@ static void onConnect(void *registerArgs, void *fireArgs) {
         struct eventBrokerNetworkConnected *args = fireArgs;
         (void)args;
 
+        redirectState_connected(&controller->redirect);
         controller->serverSelectWidgetData.connectionStatus = UI_SERVER_SELECT_STATUS_CONNECTED;
+
+        controller->statusWidgetData.joining = true;
+        controller->statusWidgetData.joinProgressCurrent = 0;
+        controller->statusWidgetData.joinProgressTotal = 1;
 }
 
 static void onDisconnect(void *registerArgs, void *fireArgs) {
@@ -342,6 +375,11 @@ static void onDisconnect(void *registerArgs, void *fireArgs) {
         struct eventBrokerNetworkDisconnected *args = fireArgs;
         (void)args;
 
+        controller->statusWidgetData.joining = false;
+        if (redirectState_disconnected(&controller->redirect)) {
+                return;
+        }
+
         switch (controller->serverSelectWidgetData.connectionStatus) {
         case UI_SERVER_SELECT_STATUS_INPUT:
         case UI_SERVER_SELECT_STATUS_CONNECTED:
@@ -357,6 +395,22 @@ static void onDisconnect(void *registerArgs, void *fireArgs) {
         }
 }
 
+static void onJoinProgress(void *registerArgs, void *fireArgs) {
+        struct uiController *controller = registerArgs;
+        struct eventNetworkJoinProgress *args = fireArgs;
+
+        controller->statusWidgetData.joinProgressCurrent = args->current;
+        controller->statusWidgetData.joinProgressTotal = args->total;
+        controller->statusWidgetData.joining = args->current < args->total;
+}
+
+static void onRedirect(void *registerArgs, void *fireArgs) {
+        struct uiController *controller = registerArgs;
+        (void)fireArgs;
+
+        controller->redirect = REDIRECT_DISCONNECTING;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void uiController_setup(struct uiController *controller, struct game *game, struct networkController *networkController) {
@@ -379,11 +433,15 @@ void uiController_setup(struct uiController *controller, struct game *game, stru
         
         controller->serverSelectWidgetData.connectionStatus = UI_SERVER_SELECT_STATUS_INPUT;
         controller->serverSelectWidgetData.errorMsg = "";
+        controller->redirect = REDIRECT_NONE;
 
         controller->statusWidgetData.fps = 60;
         controller->statusWidgetData.prevFps = 60;
         controller->statusWidgetData.fpsChanged = false;
         strcpy(controller->statusWidgetData.fpsBuffer, "60");
+        controller->statusWidgetData.joining = false;
+        controller->statusWidgetData.joinProgressCurrent = 0;
+        controller->statusWidgetData.joinProgressTotal = 1;
 
         controller->statusWidgetData.ping = 500;
         controller->statusWidgetData.prevPing = 500;
@@ -399,4 +457,6 @@ void uiController_setup(struct uiController *controller, struct game *game, stru
         eventBroker_register(sceneLoadProgress, EVENT_BROKER_PRIORITY_HIGH, EVENT_BROKER_SCENE_LOAD_PROGRESS, controller);
         eventBroker_register(onConnect, EVENT_BROKER_PRIORITY_HIGH, EVENT_BROKER_NETWORK_CONNECTED, controller);
         eventBroker_register(onDisconnect, EVENT_BROKER_PRIORITY_HIGH, EVENT_BROKER_NETWORK_DISCONNECTED, controller);
+        eventBroker_register(onRedirect, EVENT_BROKER_PRIORITY_HIGH, (enum eventBrokerEvent)EVENT_NETWORK_REDIRECT, controller);
+        eventBroker_register(onJoinProgress, EVENT_BROKER_PRIORITY_HIGH, (enum eventBrokerEvent)EVENT_NETWORK_JOIN_PROGRESS, controller);
 }
@@ -0,0 +1,131 @@
+#include <networkCodec.h>
+#include <timeutil.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Throughput of snapshot records through the codec, written and read back as
+// the server and clients do: the gap to the previous entity index, the mask
+// of fields sent, then those fields
+
+// Records in a snapshot, and snapshots timed
+#define RECORDS 1024
+#define SNAPSHOTS 2000
+// Room for a record with every field and the largest index gap
+#define RECORD_BYTES 32
+
+static uint32_t rng_state = 0x12345678;
+
+// xorshift32, so that runs are reproducible
+static uint32_t rng(void) {
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 17;
+        rng_state ^= rng_state << 5;
+        return rng_state;
+}
+
+static float rng_float(const float min, const float max) {
+        return min + (max - min) * ((float)(rng() >> 8) / (float)(1 << 24));
+}
+
+struct record {
+        size_t idx;
+        unsigned mask;
+        struct networkSnapshotEntity entity;
+};
+
+// Entities spread over the index space, half of them sent whole and the rest
+// with some of their fields
+static void make_records(const struct networkCodec *const codec, struct record *const records) {
+        size_t idx = 0;
+        for (size_t i=0; i<RECORDS; i++) {
+                idx += rng() % 8;
+                records[i].idx = idx++;
+                records[i].mask = i % 2 == 0 ? SNAPSHOT_FIELDS_ALL : 1 + rng() % SNAPSHOT_FIELDS_ALL;
+                records[i].entity.position.x = rng_float(-codec->params.extent, codec->params.extent);
+                records[i].entity.position.y = rng_float(-codec->params.extent, codec->params.extent);
+                records[i].entity.position.z = rng_float(codec->params.heightMin, codec->params.heightMax);
+                records[i].entity.rotation = rng_float(-3.14f, 3.14f);
+        }
+}
+
+static size_t encode(const struct networkCodec *const codec, const struct record *const records,
+                     uint8_t *const buffer, const size_t size) {
+        struct bitWriter writer;
+        bitWriter_init(&writer, buffer, size);
+        size_t next_idx = 0;
+        for (size_t i=0; i<RECORDS; i++) {
+                uint32_t fields[SNAPSHOT_FIELDS_TOTAL];
+                networkCodec_encodeEntity(codec, &records[i].entity, fields);
+                bitWriter_writeVarUint(&writer, (uint32_t)(records[i].idx - next_idx));
+                bitWriter_write(&writer, records[i].mask, SNAPSHOT_FIELDS_TOTAL);
+                networkCodec_writeFields(codec, &writer, fields, records[i].mask);
+                next_idx = records[i].idx + 1;
+        }
+        return bitWriter_finish(&writer);
+}
+
+// Sum of what was read, so that none of it can be left out
+static float decode(const struct networkCodec *const codec, const uint8_t *const buffer,
+                    const size_t size) {
+        struct bitReader reader;
+        bitReader_init(&reader, buffer, size);
+        struct networkSnapshotEntity entity = {0};
+        float sum = 0;
+        size_t idx = 0;
+        for (size_t i=0; i<RECORDS; i++) {
+                idx += bitReader_readVarUint(&reader);
+                const unsigned mask = bitReader_read(&reader, SNAPSHOT_FIELDS_TOTAL);
+                networkCodec_readFields(codec, &reader, &entity, mask);
+                sum += entity.position.x + entity.position.y + entity.position.z + entity.rotation;
+                idx++;
+        }
+        if (!bitReader_ok(&reader)) {
+                fprintf(stderr, "snapshot read back truncated\n");
+                exit(EXIT_FAILURE);
+        }
+        return sum + (float)idx;
+}
+
+static void report(const char *const what, const unsigned long elapsed, const size_t bytes) {
+        const double seconds = (double)elapsed / 1e9;
+        printf("%-8s %10.1f MB/s %12.0f records/s %8.1f ns/record\n", what,
+               (double)bytes / seconds / 1e6, (double)RECORDS * SNAPSHOTS / seconds,
+               (double)elapsed / ((double)RECORDS * SNAPSHOTS));
+}
+
+int main(void) {
+        const struct networkCodecParams params = networkCodec_defaultParams();
+        struct networkCodec codec;
+        if (!networkCodec_init(&codec, &params)) {
+                fprintf(stderr, "default codec parameters refused\n");
+                return EXIT_FAILURE;
+        }
+
+        static struct record records[RECORDS];
+        static uint8_t buffer[RECORDS * RECORD_BYTES];
+        make_records(&codec, records);
+
+        size_t size = 0;
+        const struct timespec encodeStart = monotonic();
+        for (size_t i=0; i<SNAPSHOTS; i++) {
+                size = encode(&codec, records, buffer, sizeof(buffer));
+        }
+        const unsigned long encodeElapsed = monotonic_difference(monotonic(), encodeStart);
+        if (size == 0) {
+                fprintf(stderr, "snapshot did not fit\n");
+                return EXIT_FAILURE;
+        }
+
+        float sum = 0;
+        const struct timespec decodeStart = monotonic();
+        for (size_t i=0; i<SNAPSHOTS; i++) {
+                sum += decode(&codec, buffer, size);
+        }
+        const unsigned long decodeElapsed = monotonic_difference(monotonic(), decodeStart);
+
+        printf("%d records in %zu bytes, %.2f bytes each (checksum %g)\n", RECORDS, size,
+               (double)size / RECORDS, (double)sum);
+        report("encode", encodeElapsed, size * SNAPSHOTS);
+        report("decode", decodeElapsed, size * SNAPSHOTS);
+        return EXIT_SUCCESS;
+}
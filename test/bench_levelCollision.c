@@ -0,0 +1,141 @@
+#include <levelCollision.h>
+#include <timeutil.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Time taken by sweeps and moves against a level, through its hierarchy and
+// testing every triangle, as `make bench` runs it on the exported level
+
+#define SWEEPS 100000
+// testing every triangle takes a lot longer
+#define BRUTE_FORCE_SWEEPS 1000
+#define PLAYERS 4096
+#define TICKS 64
+
+static uint32_t rng_state = 0x2545f491;
+
+// xorshift32, so that runs are reproducible
+static uint32_t rng(void) {
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 17;
+        rng_state ^= rng_state << 5;
+        return rng_state;
+}
+
+static float rng_float(const float min, const float max) {
+        return min + (max - min) * ((float)(rng() >> 8) / (float)(1 << 24));
+}
+
+static vec3s random_point(const struct levelCollision *const level) {
+        vec3s p;
+        p.x = rng_float(level->minX[0], level->maxX[0]);
+        p.y = rng_float(level->minY[0], level->maxY[0]);
+        p.z = rng_float(level->minZ[0], level->maxZ[0]);
+        return p;
+}
+
+static vec3s random_move(const vec3s from, const float length) {
+        vec3s d;
+        do {
+                d.x = rng_float(-1, 1);
+                d.y = rng_float(-1, 1);
+                d.z = rng_float(-1, 1);
+        } while (glms_vec3_dot(d, d) > 1 || glms_vec3_dot(d, d) < 1e-4f);
+        return glms_vec3_add(from, glms_vec3_scale(glms_vec3_normalize(d), length));
+}
+
+// see test_levelCollision.c
+static struct levelCollision brute_force(const struct levelCollision *const level) {
+        static uint32_t first = 0;
+        static uint32_t count;
+        count = (uint32_t)level->numTriangles;
+
+        struct levelCollision brute = *level;
+        brute.numNodes = 1;
+        brute.first = &first;
+        brute.count = &count;
+        return brute;
+}
+
+// Nanoseconds per sweep of count random ones with the given length and radius
+static double bench_sweeps(const struct levelCollision *const level, const size_t count,
+                           const float length, const float radius, size_t *const hits) {
+        vec3s *from = malloc(count * sizeof(*from));
+        vec3s *to = malloc(count * sizeof(*to));
+        if (from == NULL || to == NULL) {
+                fprintf(stderr, "could not allocate memory\n");
+                exit(EXIT_FAILURE);
+        }
+        for (size_t i=0; i<count; i++) {
+                from[i] = random_point(level);
+                to[i] = random_move(from[i], length);
+        }
+
+        *hits = 0;
+        const struct timespec start = monotonic();
+        for (size_t i=0; i<count; i++) {
+                *hits += levelCollision_sweepSphere(level, from[i], to[i], radius, NULL);
+        }
+        const unsigned long elapsed = monotonic_difference(monotonic(), start);
+
+        free(from);
+        free(to);
+        return (double)elapsed / (double)count;
+}
+
+static void bench_sweep_kind(const struct levelCollision *const level, const char *const kind,
+                             const float length, const float radius) {
+        const struct levelCollision brute = brute_force(level);
+        size_t hits, bruteHits;
+        const double ns = bench_sweeps(level, SWEEPS, length, radius, &hits);
+        const double bruteNs = bench_sweeps(&brute, BRUTE_FORCE_SWEEPS, length, radius, &bruteHits);
+        printf("%-16s %12.1f %12.1f %9.1fx %7.1f%%\n", kind, ns, bruteNs, bruteNs / ns,
+               100.0 * (double)hits / SWEEPS);
+}
+
+// Players walking around for a few ticks, all moved at once every tick
+static void bench_moves(const struct levelCollision *const level) {
+        static vec3s from[PLAYERS];
+        static vec3s to[PLAYERS];
+        for (size_t i=0; i<PLAYERS; i++) {
+                from[i] = random_point(level);
+        }
+
+        unsigned long elapsed = 0;
+        for (size_t tick=0; tick<TICKS; tick++) {
+                for (size_t i=0; i<PLAYERS; i++) {
+                        to[i] = random_move(from[i], 0.1f);
+                }
+                const struct timespec start = monotonic();
+                levelCollision_moveSpheres(level, PLAYERS, from, to, 0.4f);
+                elapsed += monotonic_difference(monotonic(), start);
+                for (size_t i=0; i<PLAYERS; i++) {
+                        from[i] = to[i];
+                }
+        }
+        printf("%d players moved in %.1f us a tick, %.1f ns each\n", PLAYERS,
+               (double)elapsed / TICKS / 1000.0, (double)elapsed / (TICKS * PLAYERS));
+}
+
+int main(int argc, char *argv[]) {
+        if (argc != 2) {
+                fprintf(stderr, "usage: %s level.obj\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+        struct levelCollision level;
+        if (!levelCollision_load(&level, argv[1])) {
+                return EXIT_FAILURE;
+        }
+        printf("%s: %zu triangles with padding, %zu nodes\n", argv[1], level.numTriangles,
+               level.numNodes);
+
+        printf("%-16s %12s %12s %10s %8s\n", "ns per sweep", "hierarchy", "every one", "speedup",
+               "hits");
+        bench_sweep_kind(&level, "player moves", 0.1f, 0.4f);
+        bench_sweep_kind(&level, "line of sight", 32, 0);
+        bench_sweep_kind(&level, "large spheres", 4, 2);
+        bench_moves(&level);
+
+        levelCollision_free(&level);
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,239 @@
+#include <bitstream.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Round trips of the bit level writer and reader and of the quantizers
+
+#define VALUES 4096
+
+static unsigned failures;
+
+#define CHECK(condition, ...) do {                                      \
+                if (!(condition)) {                                     \
+                        fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+                        fprintf(stderr, __VA_ARGS__);                   \
+                        fprintf(stderr, "\n");                          \
+                        failures++;                                     \
+                }                                                       \
+        } while (0)
+
+static uint32_t rng_state = 0x12345678;
+
+// xorshift32, so that runs are reproducible
+static uint32_t rng(void) {
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 17;
+        rng_state ^= rng_state << 5;
+        return rng_state;
+}
+
+static float rng_float(const float min, const float max) {
+        return min + (max - min) * ((float)(rng() >> 8) / (float)(1 << 24));
+}
+
+static uint32_t low_bits(const unsigned bits) {
+        return (uint32_t)(((uint64_t)1 << bits) - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Every width from 1 to 32 bits, mixed in one stream
+static void test_widths(void) {
+        static uint8_t buffer[VALUES * 4];
+        static uint32_t values[VALUES];
+        static unsigned widths[VALUES];
+
+        struct bitWriter writer;
+        bitWriter_init(&writer, buffer, sizeof(buffer));
+        size_t bits = 0;
+        for (size_t i=0; i<VALUES; i++) {
+                widths[i] = 1 + (unsigned)(i % 32);
+                // the extremes of every width, then random values
+                if (i < 32) {
+                        values[i] = 0;
+                } else if (i < 64) {
+                        values[i] = low_bits(widths[i]);
+                } else {
+                        values[i] = rng() & low_bits(widths[i]);
+                }
+                bitWriter_write(&writer, values[i], widths[i]);
+                bits += widths[i];
+        }
+        const size_t size = bitWriter_finish(&writer);
+        CHECK(size == (bits + 7) / 8, "wrote %zu bytes for %zu bits", size, bits);
+
+        struct bitReader reader;
+        bitReader_init(&reader, buffer, size);
+        for (size_t i=0; i<VALUES; i++) {
+                const uint32_t value = bitReader_read(&reader, widths[i]);
+                CHECK(value == values[i], "value %zu of %u bits: wrote %u, read %u",
+                      i, widths[i], values[i], value);
+        }
+        CHECK(bitReader_ok(&reader), "reading back overflowed");
+}
+
+// Bits above the width are not written
+static void test_masking(void) {
+        uint8_t buffer[8];
+        struct bitWriter writer;
+        bitWriter_init(&writer, buffer, sizeof(buffer));
+        bitWriter_write(&writer, UINT32_MAX, 3);
+        bitWriter_write(&writer, 0, 5);
+        const size_t size = bitWriter_finish(&writer);
+        CHECK(size == 1 && buffer[0] == 0x07, "wrote %zu bytes, first is %#x", size, buffer[0]);
+}
+
+static void test_varuint(void) {
+        uint32_t values[2 * 32 + 2];
+        size_t count = 0;
+        values[count++] = 0;
+        values[count++] = UINT32_MAX;
+        for (unsigned bit=0; bit<32; bit++) {
+                values[count++] = (uint32_t)1 << bit;
+                values[count++] = low_bits(bit + 1);
+        }
+
+        for (size_t i=0; i<count; i++) {
+                uint8_t buffer[8];
+                struct bitWriter writer;
+                bitWriter_init(&writer, buffer, sizeof(buffer));
+                bitWriter_writeVarUint(&writer, values[i]);
+                const size_t size = bitWriter_finish(&writer);
+
+                // one group per BITSTREAM_VARUINT_GROUP_BITS significant bits
+                unsigned groups = 1;
+                while (groups * BITSTREAM_VARUINT_GROUP_BITS < 32 &&
+                       values[i] >> (groups * BITSTREAM_VARUINT_GROUP_BITS) != 0) {
+                        groups++;
+                }
+                const size_t expected = (groups * (BITSTREAM_VARUINT_GROUP_BITS + 1) + 7) / 8;
+                CHECK(size == expected, "%u took %zu bytes rather than %zu", values[i], size, expected);
+
+                struct bitReader reader;
+                bitReader_init(&reader, buffer, size);
+                const uint32_t value = bitReader_readVarUint(&reader);
+                CHECK(bitReader_ok(&reader) && value == values[i], "wrote %u, read %u", values[i], value);
+        }
+
+        // more groups than any value written has
+        uint8_t ones[16];
+        for (size_t i=0; i<sizeof(ones); i++) {
+                ones[i] = 0xff;
+        }
+        struct bitReader reader;
+        bitReader_init(&reader, ones, sizeof(ones));
+        const uint32_t value = bitReader_readVarUint(&reader);
+        CHECK(!bitReader_ok(&reader) && value == 0, "endless varuint read as %u", value);
+}
+
+static void test_truncated(void) {
+        uint8_t buffer[64];
+        struct bitWriter writer;
+        bitWriter_init(&writer, buffer, sizeof(buffer));
+        for (unsigned i=0; i<16; i++) {
+                bitWriter_write(&writer, i, 13);
+        }
+        bitWriter_writeVarUint(&writer, UINT32_MAX);
+        const size_t size = bitWriter_finish(&writer);
+        CHECK(size > 0, "nothing written");
+
+        for (size_t cut=0; cut<size; cut++) {
+                struct bitReader reader;
+                bitReader_init(&reader, buffer, cut);
+                for (unsigned i=0; i<16; i++) {
+                        bitReader_read(&reader, 13);
+                }
+                bitReader_readVarUint(&reader);
+                CHECK(!bitReader_ok(&reader), "%zu of %zu bytes read as whole", cut, size);
+                CHECK(bitReader_read(&reader, 32) == 0, "read past the end gave data");
+        }
+
+        // and the same writing
+        for (size_t cut=0; cut<size; cut++) {
+                struct bitWriter small;
+                bitWriter_init(&small, buffer, cut);
+                for (unsigned i=0; i<16; i++) {
+                        bitWriter_write(&small, i, 13);
+                }
+                bitWriter_writeVarUint(&small, UINT32_MAX);
+                CHECK(bitWriter_finish(&small) == 0, "%zu of %zu bytes written as whole", cut, size);
+        }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void test_quantization_range(const float min, const float max, const float precision) {
+        struct quantization quantization;
+        quantization_init(&quantization, min, max, precision);
+        CHECK(quantization.maxValue % 2 == 0, "no middle value in [%g, %g]", min, max);
+        CHECK(quantization.maxValue <= low_bits(quantization.bits), "values past %u bits",
+              quantization.bits);
+
+        // rounding to the nearest value, and the rounding of floats themselves
+        const float tolerance = precision / 2 + fmaxf(fabsf(min), fabsf(max)) * FLT_EPSILON;
+        for (size_t i=0; i<VALUES; i++) {
+                const float value = rng_float(min, max);
+                const float decoded = quantization_decode(&quantization,
+                                                          quantization_encode(&quantization, value));
+                CHECK(fabsf(decoded - value) <= tolerance, "%g decoded as %g in [%g, %g]",
+                      value, decoded, min, max);
+        }
+
+        // decoding then encoding again is lossless
+        for (size_t i=0; i<VALUES; i++) {
+                uint32_t value = rng() % (quantization.maxValue + 1);
+                if (i == 0) {
+                        value = 0;
+                } else if (i == 1) {
+                        value = quantization.maxValue;
+                }
+                const uint32_t encoded = quantization_encode(&quantization,
+                                                             quantization_decode(&quantization, value));
+                CHECK(encoded == value, "%u encoded again as %u in [%g, %g]", value, encoded, min, max);
+        }
+
+        CHECK(quantization_encode(&quantization, min - 1) == 0, "below the range not clamped");
+        CHECK(quantization_encode(&quantization, max + 1) == quantization.maxValue,
+              "above the range not clamped");
+        CHECK(quantization_encode(&quantization, NAN) == 0, "NaN not clamped");
+
+        // the center is exact, 0 in a range centered on it
+        const float center = quantization_decode(&quantization,
+                                                 quantization_encode(&quantization, quantization.center));
+        CHECK(fabsf(center - quantization.center) <= 0, "center %g decoded as %g",
+              quantization.center, center);
+}
+
+static void test_quantization(void) {
+        // positions, heights and velocities as the codec has them by default
+        test_quantization_range(-4096, 4096, 1.0f / 128.0f);
+        test_quantization_range(-16, 64, 1.0f / 128.0f);
+        test_quantization_range(-10, 10, 1.0f / 32.0f);
+        // and the fewest and most bits there can be
+        test_quantization_range(-1, 1, 4);
+        test_quantization_range(-64, 64, 1.0f / 4096.0f);
+
+        struct quantization velocity;
+        quantization_init(&velocity, -10, 10, 1.0f / 32.0f);
+        const float still = quantization_decode(&velocity, quantization_encode(&velocity, 0));
+        CHECK(fabsf(still) <= 0, "zero velocity decoded as %g", still);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int main(void) {
+        test_widths();
+        test_masking();
+        test_varuint();
+        test_truncated();
+        test_quantization();
+
+        if (failures > 0) {
+                fprintf(stderr, "test_bitstream: %u failures\n", failures);
+                return EXIT_FAILURE;
+        }
+        printf("test_bitstream: ok\n");
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,230 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <levelCollision.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Sweeps through the hierarchy of a level give what testing every one of its
+// triangles does. Levels are a generated one, then any OBJ file given, such as
+// the one `make collision` exports.
+
+#define SWEEPS 20000
+#define MOVES (SWEEPS / 10)
+// Triangles tested one by one per level at most, so that large levels do not
+// take minutes. Levels that have more get fewer sweeps.
+#define BRUTE_FORCE_TESTS 5000000UL
+
+static unsigned failures;
+
+#define CHECK(condition, ...) do {                                      \
+                if (!(condition)) {                                     \
+                        fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+                        fprintf(stderr, __VA_ARGS__);                   \
+                        fprintf(stderr, "\n");                          \
+                        failures++;                                     \
+                }                                                       \
+        } while (0)
+
+static uint32_t rng_state = 0x2545f491;
+
+// xorshift32, so that runs are reproducible
+static uint32_t rng(void) {
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 17;
+        rng_state ^= rng_state << 5;
+        return rng_state;
+}
+
+static float rng_float(const float min, const float max) {
+        return min + (max - min) * ((float)(rng() >> 8) / (float)(1 << 24));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Bumpy ground of quads, boxes standing on it and triangles floating around,
+// as an OBJ file
+static void write_level(FILE *const file) {
+        const int side = 32;
+        for (int y=0; y<=side; y++) {
+                for (int x=0; x<=side; x++) {
+                        fprintf(file, "v %d %d %f\n", x - side / 2, y - side / 2,
+                                (double)rng_float(0, 0.5f));
+                }
+        }
+        for (int y=0; y<side; y++) {
+                for (int x=0; x<side; x++) {
+                        const int corner = y * (side + 1) + x + 1;
+                        fprintf(file, "f %d %d %d %d\n", corner, corner + 1,
+                                corner + side + 2, corner + side + 1);
+                }
+        }
+
+        // with indices counting back from the last vertex
+        for (int i=0; i<40; i++) {
+                const float x = rng_float(-14, 14);
+                const float y = rng_float(-14, 14);
+                const float w = rng_float(0.2f, 3);
+                const float d = rng_float(0.2f, 3);
+                const float h = rng_float(0.5f, 6);
+                for (int corner=0; corner<8; corner++) {
+                        fprintf(file, "v %f %f %f\n", (double)(x + (corner & 1 ? w : 0)),
+                                (double)(y + (corner & 2 ? d : 0)), (double)(corner & 4 ? h : 0));
+                }
+                fprintf(file, "f -8 -7 -5 -6\nf -4 -3 -1 -2\nf -8 -7 -3 -4\n"
+                        "f -6 -5 -1 -2\nf -8 -6 -2 -4\nf -7 -5 -1 -3\n");
+        }
+
+        for (int i=0; i<300; i++) {
+                const float x = rng_float(-16, 16);
+                const float y = rng_float(-16, 16);
+                const float z = rng_float(0, 8);
+                for (int corner=0; corner<3; corner++) {
+                        fprintf(file, "v %f %f %f\n", (double)(x + rng_float(-1, 1)),
+                                (double)(y + rng_float(-1, 1)), (double)(z + rng_float(-1, 1)));
+                }
+                fprintf(file, "f -3/1/1 -2/2/1 -1/3/1\n");
+        }
+}
+
+// The same level as a single leaf holding all of its triangles, which every
+// sweep tests one by one
+static struct levelCollision brute_force(const struct levelCollision *const level) {
+        static uint32_t first = 0;
+        static uint32_t count;
+        count = (uint32_t)level->numTriangles;
+
+        struct levelCollision brute = *level;
+        brute.numNodes = 1;
+        brute.first = &first;
+        brute.count = &count;
+        return brute;
+}
+
+// Sweeps to compare on a level, moves make several each
+static size_t sweeps(const struct levelCollision *const level) {
+        const size_t count = BRUTE_FORCE_TESTS / level->numTriangles;
+        return count < 200 ? 200 : count > SWEEPS ? SWEEPS : count;
+}
+
+static vec3s random_point(const struct levelCollision *const level, const float margin) {
+        vec3s p;
+        p.x = rng_float(level->minX[0] - margin, level->maxX[0] + margin);
+        p.y = rng_float(level->minY[0] - margin, level->maxY[0] + margin);
+        p.z = rng_float(level->minZ[0] - margin, level->maxZ[0] + margin);
+        return p;
+}
+
+static vec3s random_direction(void) {
+        vec3s d;
+        do {
+                d.x = rng_float(-1, 1);
+                d.y = rng_float(-1, 1);
+                d.z = rng_float(-1, 1);
+        } while (glms_vec3_dot(d, d) > 1 || glms_vec3_dot(d, d) < 1e-4f);
+        return glms_vec3_normalize(d);
+}
+
+// Radius of rays, bullets, players and anything larger
+static float random_radius(void) {
+        static const float radii[] = {0, 0.05f, 0.4f, 2};
+        return radii[rng() % (sizeof(radii) / sizeof(*radii))];
+}
+
+static void test_sweeps(const struct levelCollision *const level, const char *const name) {
+        const struct levelCollision brute = brute_force(level);
+        const size_t count = sweeps(level);
+        size_t hits = 0;
+        for (size_t i=0; i<count; i++) {
+                const vec3s from = random_point(level, 2);
+                // short moves as players make and long ones across the level
+                const float length = i % 2 == 0 ? rng_float(0.01f, 1) : rng_float(1, 64);
+                const vec3s to = glms_vec3_add(from, glms_vec3_scale(random_direction(), length));
+                const float radius = random_radius();
+
+                struct levelCollisionHit hit, expected;
+                const bool found = levelCollision_sweepSphere(level, from, to, radius, &hit);
+                const bool expectedFound = levelCollision_sweepSphere(&brute, from, to, radius,
+                                                                      &expected);
+                CHECK(found == expectedFound, "%s: sweep %zu %s, but not testing every triangle",
+                      name, i, found ? "hit" : "missed");
+                if (!found || !expectedFound) {
+                        continue;
+                }
+                hits++;
+
+                CHECK(fabsf(hit.fraction - expected.fraction) <= 1e-6f,
+                      "%s: sweep %zu hit at %g rather than %g", name, i, (double)hit.fraction,
+                      (double)expected.fraction);
+                CHECK(hit.fraction >= 0 && hit.fraction < 1, "%s: sweep %zu hit at %g", name, i,
+                      (double)hit.fraction);
+                CHECK(fabsf(glms_vec3_norm(hit.normal) - 1) <= 1e-4f,
+                      "%s: sweep %zu normal of length %g", name, i,
+                      (double)glms_vec3_norm(hit.normal));
+                CHECK(glms_vec3_dot(hit.normal, glms_vec3_sub(to, from)) <= 1e-3f * length,
+                      "%s: sweep %zu normal along the move", name, i);
+        }
+        // or random sweeps compare next to nothing
+        CHECK(hits > count / 10, "%s: %zu of %zu sweeps hit", name, hits, count);
+}
+
+static void test_moves(const struct levelCollision *const level, const char *const name) {
+        static vec3s from[MOVES];
+        static vec3s to[MOVES];
+        static vec3s expected[MOVES];
+        const struct levelCollision brute = brute_force(level);
+        const size_t count = sweeps(level) / 10;
+        const float radius = 0.4f;
+
+        for (size_t i=0; i<count; i++) {
+                from[i] = random_point(level, 0);
+                to[i] = glms_vec3_add(from[i], glms_vec3_scale(random_direction(),
+                                                               rng_float(0.01f, 2)));
+                expected[i] = levelCollision_moveSphere(&brute, from[i], to[i], radius);
+        }
+        levelCollision_moveSpheres(level, count, from, to, radius);
+        for (size_t i=0; i<count; i++) {
+                const float error = glms_vec3_norm(glms_vec3_sub(to[i], expected[i]));
+                CHECK(error <= 1e-4f, "%s: move %zu ends %g away from testing every triangle", name,
+                      i, (double)error);
+        }
+}
+
+static void test_level(const char *const path, const char *const name) {
+        struct levelCollision level;
+        if (!levelCollision_load(&level, path)) {
+                CHECK(false, "%s: could not be loaded", name);
+                return;
+        }
+        test_sweeps(&level, name);
+        test_moves(&level, name);
+        levelCollision_free(&level);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[]) {
+        char path[] = "/tmp/test_levelCollisionXXXXXX";
+        const int fd = mkstemp(path);
+        FILE *file = fd == -1 ? NULL : fdopen(fd, "w");
+        if (file == NULL) {
+                perror(path);
+                return EXIT_FAILURE;
+        }
+        write_level(file);
+        fclose(file);
+        test_level(path, "generated level");
+        unlink(path);
+
+        for (int i=1; i<argc; i++) {
+                test_level(argv[i], argv[i]);
+        }
+
+        if (failures > 0) {
+                fprintf(stderr, "test_levelCollision: %u failures\n", failures);
+                return EXIT_FAILURE;
+        }
+        printf("test_levelCollision: ok\n");
+        return EXIT_SUCCESS;
+}
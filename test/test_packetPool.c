@@ -0,0 +1,127 @@
+#include <packetPool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Steady traffic through a packet pool allocates nothing once warmed up, and
+// whatever does allocate is counted as a miss
+
+// Packets encoded per tick, and ticks they stay with the network thread
+#define PACKETS_PER_TICK 256
+#define TICKS_IN_FLIGHT 4
+#define WARMUP_TICKS (2 * TICKS_IN_FLIGHT)
+#define STEADY_TICKS 1000
+
+static unsigned failures;
+
+#define CHECK(condition, ...) do {                                      \
+                if (!(condition)) {                                     \
+                        fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+                        fprintf(stderr, __VA_ARGS__);                   \
+                        fprintf(stderr, "\n");                          \
+                        failures++;                                     \
+                }                                                       \
+        } while (0)
+
+static uint32_t rng_state = 0x9e3779b9;
+
+// xorshift32, so that runs are reproducible
+static uint32_t rng(void) {
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 17;
+        rng_state ^= rng_state << 5;
+        return rng_state;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Size of the i-th packet of a tick: its size class is the same every tick,
+// as with a steady number of clients, but not its exact size
+static size_t packet_size(const size_t i) {
+        const size_t size = (size_t)PACKET_POOL_MIN_SIZE << (i % 6);
+        return size / 2 + 1 + rng() % (size / 2);
+}
+
+static void test_steady(void) {
+        static void *in_flight[TICKS_IN_FLIGHT][PACKETS_PER_TICK];
+        struct packetPool pool;
+        packetPool_init(&pool);
+
+        size_t warm = 0;
+        for (size_t tick=0; tick<WARMUP_TICKS + STEADY_TICKS; tick++) {
+                if (tick == WARMUP_TICKS) {
+                        warm = packetPool_misses(&pool);
+                        CHECK(warm > 0, "no buffer allocated while warming up");
+                }
+
+                // the network thread is done with the packets of a few ticks
+                // ago
+                void **slot = in_flight[tick % TICKS_IN_FLIGHT];
+                if (tick >= TICKS_IN_FLIGHT) {
+                        for (size_t i=0; i<PACKETS_PER_TICK; i++) {
+                                packetPool_return(&pool, slot[i]);
+                        }
+                }
+
+                for (size_t i=0; i<PACKETS_PER_TICK; i++) {
+                        const size_t size = packet_size(i);
+                        slot[i] = packetPool_get(&pool, size);
+                        memset(slot[i], (int)i, size);
+                }
+                // some packets turn out empty and are not sent
+                packetPool_release(&pool, packetPool_get(&pool, 1));
+        }
+        CHECK(packetPool_misses(&pool) == warm, "%zu buffers allocated once warmed up",
+              packetPool_misses(&pool) - warm);
+
+        for (size_t tick=0; tick<TICKS_IN_FLIGHT; tick++) {
+                for (size_t i=0; i<PACKETS_PER_TICK; i++) {
+                        packetPool_return(&pool, in_flight[tick][i]);
+                }
+        }
+        packetPool_free(&pool);
+}
+
+// Buffers given back while the return queue is full are freed, which counts
+// as a miss too
+static void test_lost(void) {
+        const size_t count = PACKET_POOL_RETURN_QUEUE_SIZE + 16;
+        void **buffers = malloc(count * sizeof(*buffers));
+        if (buffers == NULL) {
+                fprintf(stderr, "could not allocate memory\n");
+                exit(EXIT_FAILURE);
+        }
+
+        struct packetPool pool;
+        packetPool_init(&pool);
+        for (size_t i=0; i<count; i++) {
+                buffers[i] = packetPool_get(&pool, 1);
+        }
+        CHECK(packetPool_misses(&pool) == count, "%zu misses for %zu allocations",
+              packetPool_misses(&pool), count);
+
+        // the owner does not drain the queue in between
+        for (size_t i=0; i<count; i++) {
+                packetPool_return(&pool, buffers[i]);
+        }
+        CHECK(packetPool_misses(&pool) == count + 16, "%zu buffers lost rather than 16",
+              packetPool_misses(&pool) - count);
+
+        packetPool_free(&pool);
+        free(buffers);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int main(void) {
+        test_steady();
+        test_lost();
+
+        if (failures > 0) {
+                fprintf(stderr, "test_packetPool: %u failures\n", failures);
+                return EXIT_FAILURE;
+        }
+        printf("test_packetPool: ok\n");
+        return EXIT_SUCCESS;
+}